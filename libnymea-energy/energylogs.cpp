@@ -154,3 +154,75 @@ void ThingPowerLogEntries::put(const QVariant &variant)
 {
     append(variant.value<ThingPowerLogEntry>());
 }
+
+ThingEnergyDelta::ThingEnergyDelta()
+{
+
+}
+
+ThingEnergyDelta::ThingEnergyDelta(const ThingId &thingId, double totalConsumption, double totalProduction):
+    m_thingId(thingId),
+    m_totalConsumption(totalConsumption),
+    m_totalProduction(totalProduction)
+{
+
+}
+
+ThingId ThingEnergyDelta::thingId() const
+{
+    return m_thingId;
+}
+
+double ThingEnergyDelta::totalConsumption() const
+{
+    return m_totalConsumption;
+}
+
+double ThingEnergyDelta::totalProduction() const
+{
+    return m_totalProduction;
+}
+
+QVariant ThingEnergyDeltas::get(int index) const
+{
+    return QVariant::fromValue(at(index));
+}
+
+void ThingEnergyDeltas::put(const QVariant &variant)
+{
+    append(variant.value<ThingEnergyDelta>());
+}
+
+PowerBalanceEnergyDelta::PowerBalanceEnergyDelta()
+{
+
+}
+
+PowerBalanceEnergyDelta::PowerBalanceEnergyDelta(double totalConsumption, double totalProduction, double totalAcquisition, double totalReturn):
+    m_totalConsumption(totalConsumption),
+    m_totalProduction(totalProduction),
+    m_totalAcquisition(totalAcquisition),
+    m_totalReturn(totalReturn)
+{
+
+}
+
+double PowerBalanceEnergyDelta::totalConsumption() const
+{
+    return m_totalConsumption;
+}
+
+double PowerBalanceEnergyDelta::totalProduction() const
+{
+    return m_totalProduction;
+}
+
+double PowerBalanceEnergyDelta::totalAcquisition() const
+{
+    return m_totalAcquisition;
+}
+
+double PowerBalanceEnergyDelta::totalReturn() const
+{
+    return m_totalReturn;
+}
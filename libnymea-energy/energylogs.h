@@ -35,6 +35,9 @@ class PowerBalanceLogEntry;
 class PowerBalanceLogEntries;
 class ThingPowerLogEntry;
 class ThingPowerLogEntries;
+class ThingEnergyDelta;
+class ThingEnergyDeltas;
+class PowerBalanceEnergyDelta;
 
 class EnergyLogs: public QObject
 {
@@ -43,7 +46,12 @@ public:
     EnergyLogs(QObject *parent = nullptr);
     virtual ~EnergyLogs() = default;
 
+    /*! Sample rates are given in minutes. The sub-minute sample rates have negative values, in seconds. Their samples
+     *  are not persisted but held in memory for a limited time only, and they are not included in the entry added signals.
+     */
     enum SampleRate {
+        SampleRate1Sec = -1,
+        SampleRate10Secs = -10,
         SampleRateAny = 0,
         SampleRate1Min = 1,
         SampleRate15Mins = 15,
@@ -56,6 +64,30 @@ public:
     };
     Q_ENUM(SampleRate)
 
+    /*! Additional options for log queries.
+     *  limit: The maximum number of entries to return. 0 returns all entries.
+     *  cursor: An opaque continuation cursor as returned in nextCursor by a previous query with the same parameters.
+     *          The query continues right after the last entry of the previous page.
+     *  maxPoints: Downsample the result to about maxPoints entries per series (the power balance or each thing) for
+     *             displaying it in a chart. Power values keep their minimum and maximum within each bucket, totals
+     *             stay exact at the bucket boundaries. 0 disables downsampling. Downsampled results are not paged.
+     *  fields: Only read the given value fields (e.g. "consumption", "totalConsumption"). The timestamp, and for things
+     *          the thingId, are always read. Fields which are not requested will be 0 in the result. Empty reads all fields.
+     *  sinceRevision: Only return entries written after the log had the given revision, see powerBalanceLogsRevision()
+     *                 and thingPowerLogsRevision(). This includes entries for past timestamps written later on, e.g. when
+     *                 missing samples are filled in. 0 returns all entries. Not applied to downsampled results.
+     *                 Deletions are not synced: Entries trimmed at the end of the retention of the sample rate are just
+     *                 gone. If other entries have been deleted since the given revision, e.g. the logs of a removed
+     *                 thing, the option is ignored and all entries are returned.
+     */
+    struct QueryOptions {
+        int limit = 0;
+        QString cursor;
+        int maxPoints = 0;
+        QStringList fields;
+        qint64 sinceRevision = 0;
+    };
+
     /*! Returns logs for the given sample rate for total household consumption, production, acquisition and storage balance.
      *  From and to may be given to limit results to a time span.
     */
@@ -67,6 +99,38 @@ public:
      */
     virtual ThingPowerLogEntries thingPowerLogs(SampleRate sampleRate, const QList<ThingId> &thingIds, const QDateTime &from = QDateTime(), const QDateTime &to = QDateTime()) const = 0;
 
+    // New virtual methods are appended below to keep the vtable layout of already built plugins.
+
+    /*! Returns a page of power balance logs. If there are more entries available, nextCursor will be set to the cursor
+     *  for the next page, otherwise it will be cleared.
+    */
+    virtual PowerBalanceLogEntries powerBalanceLogs(SampleRate sampleRate, const QDateTime &from, const QDateTime &to, const QueryOptions &options, QString *nextCursor = nullptr) const = 0;
+
+    /*! Returns a page of thing power logs, ordered by timestamp and thingId. If there are more entries available,
+     *  nextCursor will be set to the cursor for the next page, otherwise it will be cleared.
+     */
+    virtual ThingPowerLogEntries thingPowerLogs(SampleRate sampleRate, const QList<ThingId> &thingIds, const QDateTime &from, const QDateTime &to, const QueryOptions &options, QString *nextCursor = nullptr) const = 0;
+
+    /*! Returns the current revision of the power balance log. Every entry written to the log increases it. */
+    virtual qint64 powerBalanceLogsRevision() const = 0;
+
+    /*! Returns the current revision of the thing power log. Every entry written to the log increases it. */
+    virtual qint64 thingPowerLogsRevision() const = 0;
+
+    /*! Returns the energy consumed and produced by the given things between from and to, that is, the difference of
+     *  their totals at the newest samples at or before each of the two timestamps. If thingIds is empty, all things
+     *  will be returned.
+     */
+    virtual ThingEnergyDeltas energyBetween(const QList<ThingId> &thingIds, const QDateTime &from, const QDateTime &to) const = 0;
+
+    /*! Returns the count things which consumed the most energy between from and to, sorted by their consumption. */
+    virtual ThingEnergyDeltas topConsumers(const QDateTime &from, const QDateTime &to, int count) const = 0;
+
+    /*! Returns the energy consumed, produced, acquired and returned by the household between from and to, that is,
+     *  the difference of the power balance totals, looked up like in energyBetween().
+     */
+    virtual PowerBalanceEnergyDelta powerBalanceEnergyBetween(const QDateTime &from, const QDateTime &to) const = 0;
+
 signals:
     void powerBalanceEntryAdded(SampleRate sampleRate, const PowerBalanceLogEntry &entry);
     void thingPowerEntryAdded(SampleRate sampleRate, const ThingPowerLogEntry &entry);
@@ -78,14 +142,14 @@ class PowerBalanceLogEntry
 {
     Q_GADGET
     Q_PROPERTY(QDateTime timestamp READ timestamp)
-    Q_PROPERTY(double consumption READ consumption)
-    Q_PROPERTY(double production READ production)
-    Q_PROPERTY(double acquisition READ acquisition)
-    Q_PROPERTY(double storage READ storage)
-    Q_PROPERTY(double totalConsumption READ totalConsumption)
-    Q_PROPERTY(double totalProduction READ totalProduction)
-    Q_PROPERTY(double totalAcquisition READ totalAcquisition)
-    Q_PROPERTY(double totalReturn READ totalReturn)
+    Q_PROPERTY(double consumption READ consumption USER true)
+    Q_PROPERTY(double production READ production USER true)
+    Q_PROPERTY(double acquisition READ acquisition USER true)
+    Q_PROPERTY(double storage READ storage USER true)
+    Q_PROPERTY(double totalConsumption READ totalConsumption USER true)
+    Q_PROPERTY(double totalProduction READ totalProduction USER true)
+    Q_PROPERTY(double totalAcquisition READ totalAcquisition USER true)
+    Q_PROPERTY(double totalReturn READ totalReturn USER true)
 public:
     PowerBalanceLogEntry();
     PowerBalanceLogEntry(const QDateTime &timestamp, double consumption, double production, double acquisition, double storage, double totalConsumption, double totalProduction, double totalAcquisition, double totalReturn);
@@ -128,9 +192,9 @@ class ThingPowerLogEntry {
     Q_GADGET
     Q_PROPERTY(QDateTime timestamp READ timestamp)
     Q_PROPERTY(QUuid thingId READ thingId)
-    Q_PROPERTY(double currentPower READ currentPower)
-    Q_PROPERTY(double totalConsumption READ totalConsumption)
-    Q_PROPERTY(double totalProduction READ totalProduction)
+    Q_PROPERTY(double currentPower READ currentPower USER true)
+    Q_PROPERTY(double totalConsumption READ totalConsumption USER true)
+    Q_PROPERTY(double totalProduction READ totalProduction USER true)
 public:
     ThingPowerLogEntry();
     ThingPowerLogEntry(const QDateTime &timestamp, const ThingId &thingId, double currentPower, double totalConsumption, double totalProuction);
@@ -160,4 +224,55 @@ public:
 };
 Q_DECLARE_METATYPE(ThingPowerLogEntries)
 
+class ThingEnergyDelta {
+    Q_GADGET
+    Q_PROPERTY(QUuid thingId READ thingId)
+    Q_PROPERTY(double totalConsumption READ totalConsumption)
+    Q_PROPERTY(double totalProduction READ totalProduction)
+public:
+    ThingEnergyDelta();
+    ThingEnergyDelta(const ThingId &thingId, double totalConsumption, double totalProduction);
+    ThingId thingId() const;
+    double totalConsumption() const;
+    double totalProduction() const;
+private:
+    ThingId m_thingId;
+    double m_totalConsumption = 0;
+    double m_totalProduction = 0;
+};
+Q_DECLARE_METATYPE(ThingEnergyDelta)
+
+class ThingEnergyDeltas: public QList<ThingEnergyDelta>
+{
+    Q_GADGET
+    Q_PROPERTY(int count READ count)
+public:
+    ThingEnergyDeltas() = default;
+    ThingEnergyDeltas(const QList<ThingEnergyDelta> &other): QList<ThingEnergyDelta>(other) {}
+    Q_INVOKABLE QVariant get(int index) const;
+    Q_INVOKABLE void put(const QVariant &variant);
+};
+Q_DECLARE_METATYPE(ThingEnergyDeltas)
+
+class PowerBalanceEnergyDelta {
+    Q_GADGET
+    Q_PROPERTY(double totalConsumption READ totalConsumption)
+    Q_PROPERTY(double totalProduction READ totalProduction)
+    Q_PROPERTY(double totalAcquisition READ totalAcquisition)
+    Q_PROPERTY(double totalReturn READ totalReturn)
+public:
+    PowerBalanceEnergyDelta();
+    PowerBalanceEnergyDelta(double totalConsumption, double totalProduction, double totalAcquisition, double totalReturn);
+    double totalConsumption() const;
+    double totalProduction() const;
+    double totalAcquisition() const;
+    double totalReturn() const;
+private:
+    double m_totalConsumption = 0;
+    double m_totalProduction = 0;
+    double m_totalAcquisition = 0;
+    double m_totalReturn = 0;
+};
+Q_DECLARE_METATYPE(PowerBalanceEnergyDelta)
+
 #endif // ENERGYLOGS_H
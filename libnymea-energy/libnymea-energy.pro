@@ -2,7 +2,9 @@ TEMPLATE = lib
 TARGET = $$qtLibraryTarget(nymea-energy)
 
 include(../config.pri)
-NYMEA_ENERGY_VERSION_STRING = "0.0.1"
+NYMEA_ENERGY_VERSION_STRING = "0.0.2"
+# The soname major version, to be increased on incompatible changes of the EnergyLogs/EnergyManager interfaces
+VERSION = 2.0.0
 
 CONFIG += link_pkgconfig
 PKGCONFIG += nymea
@@ -1,7 +1,13 @@
 TEMPLATE = subdirs
 
-SUBDIRS += libnymea-energy plugin
+SUBDIRS += libnymea-energy plugin tools
 
 plugin.depends = libnymea-energy
+tools.depends = libnymea-energy
+
+!disabletests {
+    SUBDIRS += tests
+    tests.depends = libnymea-energy
+}
 
 
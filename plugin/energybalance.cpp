@@ -0,0 +1,194 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-experience-plugin-energy.
+*
+* nymea-experience-plugin-energy is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-experience-plugin-energy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-experience-plugin-energy. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "energybalance.h"
+
+#include <QLoggingCategory>
+Q_DECLARE_LOGGING_CATEGORY(dcEnergyExperience)
+
+void EnergyBalance::setTotals(double totalConsumption, double totalProduction, double totalAcquisition, double totalReturn)
+{
+    m_powerBalance.totalConsumption = totalConsumption;
+    m_powerBalance.totalProduction = totalProduction;
+    m_powerBalance.totalAcquisition = totalAcquisition;
+    m_powerBalance.totalReturn = totalReturn;
+}
+
+void EnergyBalance::addThing(const ThingId &thingId, double stateConsumption, double stateProduction, double totalConsumption, double totalProduction)
+{
+    m_powerBalanceTotalEnergyConsumedCache[thingId] = stateConsumption;
+    m_powerBalanceTotalEnergyProducedCache[thingId] = stateProduction;
+
+    m_thingsTotalEnergyConsumedCache[thingId] = QPair<double, double>(stateConsumption, totalConsumption);
+    m_thingsTotalEnergyProducedCache[thingId] = QPair<double, double>(stateProduction, totalProduction);
+}
+
+void EnergyBalance::removeThing(const ThingId &thingId)
+{
+    m_powerBalanceTotalEnergyConsumedCache.remove(thingId);
+    m_powerBalanceTotalEnergyProducedCache.remove(thingId);
+    m_thingsTotalEnergyConsumedCache.remove(thingId);
+    m_thingsTotalEnergyProducedCache.remove(thingId);
+}
+
+bool EnergyBalance::updatePowerBalance(const ThingValues *rootMeter, const QList<ThingValues> &producers, const QList<ThingValues> &storages)
+{
+    double currentPowerAcquisition = 0;
+    if (rootMeter) {
+        currentPowerAcquisition = rootMeter->currentPower;
+
+        double oldAcquisition = m_powerBalanceTotalEnergyConsumedCache.value(rootMeter->thingId);
+        double newAcquisition = rootMeter->totalEnergyConsumed;
+        // For the very first cycle (oldAcquisition is 0) we'll sync up on the meter values without actually adding them to our balance.
+        if (oldAcquisition == 0) {
+            oldAcquisition = newAcquisition;
+        }
+        // If the root meter has been reset in the meantime (newConsumption < oldConsumption) we'll sync down, taking the whole diff from 0 to new value
+        if (newAcquisition < oldAcquisition) {
+            qCInfo(dcEnergyExperience()) << "Root meter seems to have been reset. Re-synching internal consumption counter.";
+            oldAcquisition = newAcquisition;
+        }
+        qCDebug(dcEnergyExperience()) << "Root meter total consumption: Previous value:" << oldAcquisition << "New value:" << newAcquisition << "Diff:" << (newAcquisition -oldAcquisition);
+        m_powerBalance.totalAcquisition += newAcquisition - oldAcquisition;
+        m_powerBalanceTotalEnergyConsumedCache[rootMeter->thingId] = newAcquisition;
+
+        double oldReturn = m_powerBalanceTotalEnergyProducedCache.value(rootMeter->thingId);
+        double newReturn = rootMeter->totalEnergyProduced;
+        // For the very first cycle (oldReturn is 0) we'll sync up on the meter values without actually adding them to our balance.
+        if (oldReturn == 0) {
+            oldReturn = newReturn;
+        }
+        if (newReturn < oldReturn) {
+            qCInfo(dcEnergyExperience()) << "Root meter seems to have been reset. Re-synching internal production counter.";
+            oldReturn = newReturn;
+        }
+        qCDebug(dcEnergyExperience()) << "Root meter total production: Previous value:" << oldReturn << "New value:" << newReturn << "Diff:" << (newReturn - oldReturn);
+        m_powerBalance.totalReturn += newReturn - oldReturn;
+        m_powerBalanceTotalEnergyProducedCache[rootMeter->thingId] = newReturn;
+    }
+
+    double currentPowerProduction = 0;
+    foreach (const ThingValues &producer, producers) {
+        currentPowerProduction += producer.currentPower;
+        double oldProduction = m_powerBalanceTotalEnergyProducedCache.value(producer.thingId);
+        double newProduction = producer.totalEnergyProduced;
+        // For the very first cycle (oldProduction is 0) we'll sync up on the producer values without actually adding them to our balance.
+        if (oldProduction == 0) {
+            oldProduction = newProduction;
+        }
+        if (newProduction < oldProduction) {
+            oldProduction = newProduction;
+        }
+        qCDebug(dcEnergyExperience()) << "Producer" << producer.name << "total production: Previous value:" << oldProduction << "New value:" << newProduction << "Diff:" << (newProduction - oldProduction);
+        m_powerBalance.totalProduction += newProduction - oldProduction;
+        m_powerBalanceTotalEnergyProducedCache[producer.thingId] = newProduction;
+    }
+
+    double currentPowerStorage = 0;
+    double totalFromStorage = 0;
+    foreach (const ThingValues &storage, storages) {
+        currentPowerStorage += storage.currentPower;
+        double oldProduction = m_powerBalanceTotalEnergyProducedCache.value(storage.thingId);
+        double newProduction = storage.totalEnergyProduced;
+        // For the very first cycle (oldProdction is 0) we'll sync up on the meter values without actually adding them to our balance.
+        if (oldProduction == 0) {
+            oldProduction = newProduction;
+        }
+        if (newProduction < oldProduction) {
+            oldProduction = newProduction;
+        }
+        qCDebug(dcEnergyExperience()) << "Storage" << storage.name << "total storage: Previous value:" << oldProduction << "New value:" << newProduction << "Diff:" << (newProduction - oldProduction);
+        totalFromStorage += newProduction - oldProduction;
+        m_powerBalanceTotalEnergyProducedCache[storage.thingId] = newProduction;
+    }
+
+    double currentPowerConsumption = currentPowerAcquisition + qAbs(qMin(0.0, currentPowerProduction)) - currentPowerStorage;
+    m_powerBalance.totalConsumption = m_powerBalance.totalAcquisition + m_powerBalance.totalProduction + totalFromStorage - m_powerBalance.totalReturn;
+
+    qCDebug(dcEnergyExperience()).noquote().nospace() << "Power balance: " << "🔥: " << currentPowerConsumption << " W, 🌞: " << currentPowerProduction << " W, 💵: " << currentPowerAcquisition << " W, 🔋: " << currentPowerStorage << " W. Totals: 🔥: " << m_powerBalance.totalConsumption << " kWh, 🌞: " << m_powerBalance.totalProduction << " kWh, 💵↓: " << m_powerBalance.totalAcquisition << " kWh, 💵↑: " << m_powerBalance.totalReturn << " kWh";
+    if (currentPowerAcquisition == m_powerBalance.acquisition
+            && currentPowerConsumption == m_powerBalance.consumption
+            && currentPowerProduction == m_powerBalance.production
+            && currentPowerStorage == m_powerBalance.storage) {
+        return false;
+    }
+    m_powerBalance.acquisition = currentPowerAcquisition;
+    m_powerBalance.production = currentPowerProduction;
+    m_powerBalance.consumption = currentPowerConsumption;
+    m_powerBalance.storage = currentPowerStorage;
+    return true;
+}
+
+EnergyBalance::PowerBalance EnergyBalance::powerBalance() const
+{
+    return m_powerBalance;
+}
+
+QPair<double, double> EnergyBalance::updateThingTotals(const ThingValues &values)
+{
+    // We'll be keeping our own counters, starting from 0 at the time they're added to nymea and increasing with the things counters.
+    // This way we'll have proper logs even if the thing counter is reset (some things may reset their counter on power loss, factory reset etc)
+    // and also won't start with huge values if the thing has been counting for a while and only added to nymea later on
+
+
+    // Consumption
+    double oldThingConsumptionState = m_thingsTotalEnergyConsumedCache.value(values.thingId).first;
+    double oldThingConsumptionInternal = m_thingsTotalEnergyConsumedCache.value(values.thingId).second;
+    double newThingConsumptionState = values.totalEnergyConsumed;
+    // For the very first cycle (oldConsumption is 0) we'll sync up on the meter, without actually adding it to our diff
+    if (oldThingConsumptionState == 0 && newThingConsumptionState != 0) {
+        qCInfo(dcEnergyExperience()) << "Don't have a consumption counter for" << values.name << "Synching internal counters to initial value:" << newThingConsumptionState;
+        oldThingConsumptionState = newThingConsumptionState;
+    }
+    // If the thing's meter has been reset in the meantime (newConsumption < oldConsumption) we'll sync down, taking the whole diff from 0 to new value
+    if (newThingConsumptionState < oldThingConsumptionState) {
+        qCInfo(dcEnergyExperience()).nospace() << "Thing meter for " << values.name << " seems to have been reset. Old value: " << oldThingConsumptionState << " New value: " << newThingConsumptionState << ". Re-synching internal consumption counter.";
+        oldThingConsumptionState = newThingConsumptionState;
+    }
+    double consumptionDiff = newThingConsumptionState - oldThingConsumptionState;
+    double newThingConsumptionInternal = oldThingConsumptionInternal + consumptionDiff;
+    m_thingsTotalEnergyConsumedCache[values.thingId] = QPair<double, double>(newThingConsumptionState, newThingConsumptionInternal);
+
+
+    // Production
+    double oldThingProductionState = m_thingsTotalEnergyProducedCache.value(values.thingId).first;
+    double oldThingProductionInternal = m_thingsTotalEnergyProducedCache.value(values.thingId).second;
+    double newThingProductionState = values.totalEnergyProduced;
+    // For the very first cycle (oldProductino is 0) we'll sync up on the meter, without actually adding it to our diff
+    if (oldThingProductionState == 0 && newThingProductionState != 0) {
+        qCInfo(dcEnergyExperience()) << "Don't have a production counter for" << values.name << "Synching internal counter to initial value:" << newThingProductionState;
+        oldThingProductionState = newThingProductionState;
+    }
+    // If the thing's meter has been reset in the meantime (newProduction < oldProduction) we'll sync down, taking the whole diff from 0 to new value
+    if (newThingProductionState < oldThingProductionState) {
+        qCInfo(dcEnergyExperience()) << "Thing meter for" << values.name << "seems to have been reset. Re-synching internal production counter.";
+        oldThingProductionState = newThingProductionState;
+    }
+    double productionDiff = newThingProductionState - oldThingProductionState;
+    double newThingProductionInternal = oldThingProductionInternal + productionDiff;
+    m_thingsTotalEnergyProducedCache[values.thingId] = QPair<double, double>(newThingProductionState, newThingProductionInternal);
+
+    return QPair<double, double>(newThingConsumptionInternal, newThingProductionInternal);
+}
@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-experience-plugin-energy.
+*
+* nymea-experience-plugin-energy is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-experience-plugin-energy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-experience-plugin-energy. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#ifndef ENERGYBALANCE_H
+#define ENERGYBALANCE_H
+
+#include <typeutils.h>
+
+#include <QHash>
+#include <QList>
+#include <QPair>
+
+// The arithmetic of the energy manager: Sums up the power balance and counts the totals of the balance and of
+// each thing in internal counters which survive meters being reset or added later on. It works on plain state
+// values instead of Things, so tools/energytracereplay can drive it with the state changes of a recorded trace.
+class EnergyBalance
+{
+public:
+    // The energy related state values of a thing
+    struct ThingValues {
+        ThingId thingId;
+        QString name;
+        double currentPower = 0;
+        double totalEnergyConsumed = 0;
+        double totalEnergyProduced = 0;
+    };
+
+    struct PowerBalance {
+        double consumption = 0;
+        double production = 0;
+        double acquisition = 0;
+        double storage = 0;
+        double totalConsumption = 0;
+        double totalProduction = 0;
+        double totalAcquisition = 0;
+        double totalReturn = 0;
+    };
+
+    // Continues the power balance totals, e.g. from the latest log entry
+    void setTotals(double totalConsumption, double totalProduction, double totalAcquisition, double totalReturn);
+    // Starts counting for a thing. The state values are the ones processed last, the totals the ones logged last.
+    void addThing(const ThingId &thingId, double stateConsumption, double stateProduction, double totalConsumption, double totalProduction);
+    void removeThing(const ThingId &thingId);
+
+    // Returns true if any of the current power values has changed
+    bool updatePowerBalance(const ThingValues *rootMeter, const QList<ThingValues> &producers, const QList<ThingValues> &storages);
+    PowerBalance powerBalance() const;
+
+    // Advances the internal counters of the thing to the given state values and returns them
+    QPair<double, double> updateThingTotals(const ThingValues &values);
+
+private:
+    PowerBalance m_powerBalance;
+
+    // We use different caches for power balance and thing logs because they are calculated independently
+    // and one must not update the others cache for the diffs to be correct
+
+    // For the power balance: The last thing state values we've processed
+    QHash<ThingId, double> m_powerBalanceTotalEnergyConsumedCache;
+    QHash<ThingId, double> m_powerBalanceTotalEnergyProducedCache;
+
+    // For things totals we need to cache 2 values:
+    // - The last thing state value we've read and processed
+    // - The last entry in our internal counters we've processed and logged
+    // QHash<ThingId, Pair<thingStateValue, internalValue>>
+    QHash<ThingId, QPair<double, double>> m_thingsTotalEnergyConsumedCache;
+    QHash<ThingId, QPair<double, double>> m_thingsTotalEnergyProducedCache;
+};
+
+#endif // ENERGYBALANCE_H
@@ -0,0 +1,127 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-experience-plugin-energy.
+*
+* nymea-experience-plugin-energy is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-experience-plugin-energy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-experience-plugin-energy. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "energyclock.h"
+
+#include <QCoreApplication>
+
+#include <QLoggingCategory>
+Q_DECLARE_LOGGING_CATEGORY(dcEnergyExperience)
+
+// Upper bound for a single timer interval, so a jump of the system time is noticed within a minute
+static const qint64 maxTimerInterval = 60 * 1000;
+// Divergence of wall and monotonic time considered a clock jump rather than timer jitter
+static const qint64 clockJumpThreshold = 1000;
+
+EnergyClock::EnergyClock(QObject *parent):
+    QObject(parent)
+{
+
+}
+
+SystemEnergyClock::SystemEnergyClock(QObject *parent):
+    EnergyClock(parent)
+{
+    m_timer.setSingleShot(true);
+    m_timer.setTimerType(Qt::PreciseTimer);
+    connect(&m_timer, &QTimer::timeout, this, &SystemEnergyClock::onTimeout);
+}
+
+QDateTime SystemEnergyClock::now() const
+{
+    return QDateTime::currentDateTime();
+}
+
+void SystemEnergyClock::scheduleWakeup(const QDateTime &dateTime)
+{
+    m_wakeupTime = dateTime;
+    arm();
+}
+
+void SystemEnergyClock::arm()
+{
+    m_armedWallTime = QDateTime::currentMSecsSinceEpoch();
+    m_armedMonotonicTime.start();
+    qint64 interval = qBound<qint64>(0, m_wakeupTime.toMSecsSinceEpoch() - m_armedWallTime, maxTimerInterval);
+    m_timer.start(static_cast<int>(interval));
+}
+
+void SystemEnergyClock::onTimeout()
+{
+    qint64 wallElapsed = QDateTime::currentMSecsSinceEpoch() - m_armedWallTime;
+    qint64 monotonicElapsed = m_armedMonotonicTime.elapsed();
+    if (qAbs(wallElapsed - monotonicElapsed) > clockJumpThreshold) {
+        qCInfo(dcEnergyExperience()) << "System time jumped by" << (wallElapsed - monotonicElapsed) / 1000 << "s. Rescheduling sampling.";
+        emit timeJumped(wallElapsed - monotonicElapsed);
+        return;
+    }
+
+    // Capped intervals and early timeouts wait for the rest
+    if (QDateTime::currentMSecsSinceEpoch() < m_wakeupTime.toMSecsSinceEpoch()) {
+        arm();
+        return;
+    }
+    emit wakeup();
+}
+
+VirtualEnergyClock::VirtualEnergyClock(const QDateTime &start, QObject *parent):
+    EnergyClock(parent),
+    m_now(start)
+{
+
+}
+
+QDateTime VirtualEnergyClock::now() const
+{
+    return m_now;
+}
+
+void VirtualEnergyClock::scheduleWakeup(const QDateTime &dateTime)
+{
+    m_wakeupTime = dateTime;
+}
+
+void VirtualEnergyClock::advanceTo(const QDateTime &dateTime)
+{
+    while (m_wakeupTime.isValid() && m_wakeupTime <= dateTime) {
+        m_now = qMax(m_now, m_wakeupTime);
+        m_wakeupTime = QDateTime();
+        emit wakeup();
+        QCoreApplication::processEvents();
+    }
+    m_now = qMax(m_now, dateTime);
+}
+
+void VirtualEnergyClock::advance(qint64 msecs)
+{
+    advanceTo(m_now.addMSecs(msecs));
+}
+
+void VirtualEnergyClock::setNow(const QDateTime &dateTime)
+{
+    qint64 msecs = m_now.msecsTo(dateTime);
+    m_now = dateTime;
+    emit timeJumped(msecs);
+}
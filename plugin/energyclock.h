@@ -0,0 +1,99 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-experience-plugin-energy.
+*
+* nymea-experience-plugin-energy is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-experience-plugin-energy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-experience-plugin-energy. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#ifndef ENERGYCLOCK_H
+#define ENERGYCLOCK_H
+
+#include <QObject>
+#include <QDateTime>
+#include <QTimer>
+#include <QElapsedTimer>
+
+// The time source of the energy logger. The logger asks for a wakeup at its next due sample boundary
+// and the clock emits wakeup() once that time is reached. If the time jumps, timeJumped() is emitted
+// instead and the logger reschedules from the new time.
+class EnergyClock : public QObject
+{
+    Q_OBJECT
+public:
+    explicit EnergyClock(QObject *parent = nullptr);
+
+    virtual QDateTime now() const = 0;
+
+    // Replaces any previously scheduled wakeup. Times in the past wake up right away.
+    virtual void scheduleWakeup(const QDateTime &dateTime) = 0;
+
+signals:
+    void wakeup();
+    void timeJumped(qint64 msecs);
+};
+
+// Follows the system time using a single shot precise timer. The timer runs on the monotonic clock, so
+// the wall time is compared against it on every timeout. If they diverged (the system time was set or the
+// system resumed from suspend), the clock reports the jump early for the logger to re-arm from the new time.
+class SystemEnergyClock : public EnergyClock
+{
+    Q_OBJECT
+public:
+    explicit SystemEnergyClock(QObject *parent = nullptr);
+
+    QDateTime now() const override;
+    void scheduleWakeup(const QDateTime &dateTime) override;
+
+private:
+    void arm();
+    void onTimeout();
+
+    QTimer m_timer;
+    QDateTime m_wakeupTime;
+    qint64 m_armedWallTime = 0;
+    QElapsedTimer m_armedMonotonicTime;
+};
+
+// Only moves when advanced, waking up at every scheduled wakeup on the way. Allows simulating months of
+// logging, including DST changes and month ends, in a few seconds.
+class VirtualEnergyClock : public EnergyClock
+{
+    Q_OBJECT
+public:
+    explicit VirtualEnergyClock(const QDateTime &start, QObject *parent = nullptr);
+
+    QDateTime now() const override;
+    void scheduleWakeup(const QDateTime &dateTime) override;
+
+    // Steps to each scheduled wakeup up to and including dateTime. Queued events are processed after each
+    // wakeup, so work the logger hands to the event loop keeps pace with the time.
+    void advanceTo(const QDateTime &dateTime);
+    void advance(qint64 msecs);
+
+    // Jumps without waking up, like a system clock being set or resuming from suspend, and reports the jump
+    void setNow(const QDateTime &dateTime);
+
+private:
+    QDateTime m_now;
+    QDateTime m_wakeupTime;
+};
+
+#endif // ENERGYCLOCK_H
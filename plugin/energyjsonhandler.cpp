@@ -23,19 +23,78 @@
 * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
 #include "energyjsonhandler.h"
+#include "energylogger.h"
 #include "energymanagerimpl.h"
+#include "energyprofiler.h"
+
+#include <nymeasettings.h>
+
+#include <QSettings>
+
+#include <algorithm>
 
 Q_DECLARE_LOGGING_CATEGORY(dcEnergyExperience)
 
 EnergyJsonHandler::EnergyJsonHandler(EnergyManager *energyManager, QObject *parent):
     JsonHandler(parent),
-    m_energyManager(energyManager)
+    m_energyManager(energyManager),
+    m_logger(qobject_cast<EnergyLogger*>(energyManager->logs()))
 {
     registerEnum<EnergyManager::EnergyError>();
     registerEnum<EnergyLogs::SampleRate>();
 
     registerObject<PowerBalanceLogEntry, PowerBalanceLogEntries>();
     registerObject<ThingPowerLogEntry, ThingPowerLogEntries>();
+    registerObject<ThingEnergyDelta, ThingEnergyDeltas>();
+    registerObject<PowerBalanceEnergyDelta>();
+
+    QVariantMap logEntriesBatch;
+    logEntriesBatch.insert("sampleRate", enumRef<EnergyLogs::SampleRate>());
+    logEntriesBatch.insert("powerBalanceLogEntries", objectRef<PowerBalanceLogEntries>());
+    logEntriesBatch.insert("thingPowerLogEntries", objectRef<ThingPowerLogEntries>());
+    registerObject("LogEntriesBatch", logEntriesBatch);
+
+    // Compact columnar representation of log entries, see the columnar parameter of GetPowerBalanceLogs/GetThingPowerLogs
+    QVariantMap powerBalanceLogColumns;
+    powerBalanceLogColumns.insert("timestamps", QVariantList() << enumValueName(Uint));
+    foreach (const QString &field, QStringList({"consumption", "production", "acquisition", "storage", "totalConsumption", "totalProduction", "totalAcquisition", "totalReturn"})) {
+        powerBalanceLogColumns.insert("o:" + field, QVariantList() << enumValueName(Double));
+    }
+    registerObject("PowerBalanceLogColumns", powerBalanceLogColumns);
+
+    QVariantMap thingPowerLogColumns;
+    thingPowerLogColumns.insert("thingId", enumValueName(Uuid));
+    thingPowerLogColumns.insert("timestamps", QVariantList() << enumValueName(Uint));
+    foreach (const QString &field, QStringList({"currentPower", "totalConsumption", "totalProduction"})) {
+        thingPowerLogColumns.insert("o:" + field, QVariantList() << enumValueName(Double));
+    }
+    registerObject("ThingPowerLogColumns", thingPowerLogColumns);
+
+    QVariantMap powerStats;
+    powerStats.insert("field", enumValueName(String));
+    powerStats.insert("min", enumValueName(Double));
+    powerStats.insert("max", enumValueName(Double));
+    powerStats.insert("peak15", enumValueName(Double));
+    registerObject("PowerStats", powerStats);
+
+    QVariantMap powerStatsEntry;
+    powerStatsEntry.insert("timestamp", enumValueName(Uint));
+    powerStatsEntry.insert("sampleCount", enumValueName(Uint));
+    powerStatsEntry.insert("stats", QVariantList() << objectRef("PowerStats"));
+    registerObject("PowerStatsEntry", powerStatsEntry);
+
+    QVariantMap operationStatistics;
+    operationStatistics.insert("operation", enumValueName(String));
+    operationStatistics.insert("count", enumValueName(Uint));
+    operationStatistics.insert("totalTime", enumValueName(Double));
+    operationStatistics.insert("maxTime", enumValueName(Double));
+    operationStatistics.insert("histogram", QVariantList() << enumValueName(Uint));
+    registerObject("OperationStatistics", operationStatistics);
+
+    QVariantMap notificationStatistics;
+    notificationStatistics.insert("notification", enumValueName(String));
+    notificationStatistics.insert("count", enumValueName(Uint));
+    registerObject("NotificationStatistics", notificationStatistics);
 
     QVariantMap params, returns;
     QString description;
@@ -65,30 +124,228 @@ EnergyJsonHandler::EnergyJsonHandler(EnergyManager *energyManager, QObject *pare
 
     params.clear(); returns.clear();
     description = "Get logs for the power balance. If from is not give, the log will start at the beginning of "
-                  "recording. If to is not given, the logs will and at the last sample for this sample rate before now.";
+                  "recording. If to is not given, the logs will and at the last sample for this sample rate before now. "
+                  "If limit is given, at most limit entries will be returned. If there are more entries available, "
+                  "nextCursor will be returned which can be passed as cursor along with the otherwise unchanged "
+                  "parameters to fetch the next page. If maxPoints is given, the result will be downsampled to about "
+                  "maxPoints entries, keeping the minimum and maximum power values within each time bucket. Downsampled "
+                  "results are not paged. If fields is given, only those value fields (e.g. \"consumption\") will be read "
+                  "and returned, along with the timestamp. If columnar is set to true, the result will be returned in "
+                  "powerBalanceLogColumns instead of powerBalanceLogEntries, containing one array of timestamps and one "
+                  "array per field. If deltaTimestamps is set to true in addition, only the first timestamp is absolute "
+                  "and each following one is the difference to the previous one. The returned revision can be passed as "
+                  "sinceRevision in later calls to only fetch entries which have been written since, including entries "
+                  "for past timestamps filled in later on. sinceRevision is ignored for downsampled results. Deleted entries "
+                  "are not synced: Entries older than the retention of the sample rate are removed without notice. If "
+                  "entries have been deleted otherwise since sinceRevision, e.g. after a change of the log configuration, "
+                  "all entries are returned and resync is set to true, in which case the client needs to replace the "
+                  "entries it has synced so far. If includeCurrent is set to true, currentEntry will contain the current "
+                  "values, which may be used to display the live value until the current sample is completed. The "
+                  "sub-minute sample rates are optional and held in memory for a limited time only. For them, maxPoints "
+                  "and sinceRevision are not supported and energyError will be set to EnergyErrorInvalidParameter if "
+                  "either is given. If a sub-minute sample rate is not enabled, no entries are returned.";
     params.insert("sampleRate", enumRef<EnergyLogs::SampleRate>());
     params.insert("o:from", enumValueName(Uint));
     params.insert("o:to", enumValueName(Uint));
-    returns.insert("powerBalanceLogEntries", objectRef<PowerBalanceLogEntries>());
+    params.insert("o:includeCurrent", enumValueName(Bool));
+    params.insert("o:limit", enumValueName(Uint));
+    params.insert("o:cursor", enumValueName(String));
+    params.insert("o:maxPoints", enumValueName(Uint));
+    params.insert("o:fields", enumValueName(StringList));
+    params.insert("o:columnar", enumValueName(Bool));
+    params.insert("o:deltaTimestamps", enumValueName(Bool));
+    params.insert("o:sinceRevision", enumValueName(Uint));
+    returns.insert("o:currentEntry", objectRef<PowerBalanceLogEntry>());
+    returns.insert("o:powerBalanceLogEntries", objectRef<PowerBalanceLogEntries>());
+    returns.insert("o:powerBalanceLogColumns", objectRef("PowerBalanceLogColumns"));
+    returns.insert("o:nextCursor", enumValueName(String));
+    returns.insert("revision", enumValueName(Uint));
+    returns.insert("o:resync", enumValueName(Bool));
+    returns.insert("o:energyError", enumRef<EnergyManager::EnergyError>());
     registerMethod("GetPowerBalanceLogs", description, params, returns, Types::PermissionScopeNone);
 
     params.clear(); returns.clear();
     description = "Get logs for one or more things power values. If thingIds is not given, logs for all energy related "
                   "things will be returned. If from is not given, the log will start at the beginning of recording. If "
                   "to is not given, the logs will and at the last sample for this sample rate before now. If the parameter "
-                  "\"includeCurrent\" is set to true, the result will contain the newest log entries available, regardless "
-                  "of the sample rate (that is, 1 minute). This may be useful to calculate the difference to the newest "
+                  "\"includeCurrent\" is set to true, the result will contain the current values of the things, regardless "
+                  "of the sample rate. This may be useful to calculate the difference to the newest "
                   "entry of the fetched sample rate and the current values to display the live value until the current sample "
-                  "is completed.";
+                  "is completed. If limit is given, at most limit entries will be returned, ordered by timestamp and thing. "
+                  "If there are more entries available, nextCursor will be returned which can be passed as cursor along "
+                  "with the otherwise unchanged parameters to fetch the next page. If maxPoints is given, the log of each "
+                  "thing will be downsampled to about maxPoints entries, keeping the minimum and maximum power values within "
+                  "each time bucket. Downsampled results are not paged. If fields is given, only those value fields "
+                  "(e.g. \"currentPower\") will be read and returned, along with the timestamp and thingId. If columnar "
+                  "is set to true, the result will be returned in thingPowerLogColumns instead of thingPowerLogEntries, "
+                  "containing one array of timestamps and one array per field for each thing. If deltaTimestamps is set "
+                  "to true in addition, only the first timestamp of each thing is absolute and each following one is the "
+                  "difference to the previous one. The returned revision can be passed as sinceRevision in later calls to "
+                  "only fetch entries which have been written since, including entries for past timestamps filled in "
+                  "later on. sinceRevision is ignored for downsampled results. Deleted entries are not synced: Entries older "
+                  "than the retention of the sample rate are removed without notice. If entries have been deleted otherwise "
+                  "since sinceRevision, e.g. the logs of a removed thing, all entries are returned and resync is set to "
+                  "true, in which case the client needs to replace the entries it has synced so far. The sub-minute "
+                  "sample rates are optional and held in memory for a limited time only. For them, maxPoints and "
+                  "sinceRevision are not supported and energyError will be set to EnergyErrorInvalidParameter if either "
+                  "is given. If a sub-minute sample rate is not enabled, no entries are returned.";
     params.insert("sampleRate", enumRef<EnergyLogs::SampleRate>());
     params.insert("o:thingIds", QVariantList() << enumValueName(Uuid));
     params.insert("o:from", enumValueName(Uint));
     params.insert("o:to", enumValueName(Uint));
     params.insert("o:includeCurrent", enumValueName(Bool));
+    params.insert("o:limit", enumValueName(Uint));
+    params.insert("o:cursor", enumValueName(String));
+    params.insert("o:maxPoints", enumValueName(Uint));
+    params.insert("o:fields", enumValueName(StringList));
+    params.insert("o:columnar", enumValueName(Bool));
+    params.insert("o:deltaTimestamps", enumValueName(Bool));
+    params.insert("o:sinceRevision", enumValueName(Uint));
     returns.insert("o:currentEntries", objectRef<ThingPowerLogEntries>());
-    returns.insert("thingPowerLogEntries", objectRef<ThingPowerLogEntries>());
+    returns.insert("o:thingPowerLogEntries", objectRef<ThingPowerLogEntries>());
+    returns.insert("o:thingPowerLogColumns", QVariantList() << objectRef("ThingPowerLogColumns"));
+    returns.insert("o:nextCursor", enumValueName(String));
+    returns.insert("revision", enumValueName(Uint));
+    returns.insert("o:resync", enumValueName(Bool));
+    returns.insert("o:energyError", enumRef<EnergyManager::EnergyError>());
     registerMethod("GetThingPowerLogs", description, params, returns, Types::PermissionScopeNone);
 
+    params.clear(); returns.clear();
+    description = "Get the energy consumed and produced by things between from and to. That is, the difference of the "
+                  "totalConsumption and totalProduction values of the newest samples at or before from and to. If "
+                  "thingIds is not given, all energy related things will be returned. If to is not given, it defaults "
+                  "to now. powerBalanceEnergyDelta holds the differences of the household totals in the same way, e.g. "
+                  "the energy consumed this week.";
+    params.insert("o:thingIds", QVariantList() << enumValueName(Uuid));
+    params.insert("from", enumValueName(Uint));
+    params.insert("o:to", enumValueName(Uint));
+    returns.insert("powerBalanceEnergyDelta", objectRef<PowerBalanceEnergyDelta>());
+    returns.insert("thingEnergyDeltas", objectRef<ThingEnergyDeltas>());
+    registerMethod("GetEnergyDelta", description, params, returns, Types::PermissionScopeNone);
+
+    params.clear(); returns.clear();
+    description = "Get the things which consumed the most energy between from and to, sorted by their consumption. "
+                  "The consumption and production of each thing is calculated like in GetEnergyDelta. At most limit "
+                  "things (default 10) will be returned. If to is not given, it defaults to now. If from is after to "
+                  "or limit is 0, EnergyErrorInvalidParameter will be returned.";
+    params.insert("from", enumValueName(Uint));
+    params.insert("o:to", enumValueName(Uint));
+    params.insert("o:limit", enumValueName(Uint));
+    returns.insert("energyError", enumRef<EnergyManager::EnergyError>());
+    returns.insert("o:thingEnergyDeltas", objectRef<ThingEnergyDeltas>());
+    registerMethod("GetTopConsumers", description, params, returns, Types::PermissionScopeNone);
+
+    params.clear(); returns.clear();
+    description = "Get the recent power balance and power of things at a sub-minute sample rate, SampleRate1Sec if not "
+                  "given. Those samples are only held in memory for a limited time, which can be configured in the "
+                  "energy configuration. If from is given, only samples from then on will be returned. If thingIds "
+                  "is not given, all energy related things will be returned. If the sample rate is not a sub-minute "
+                  "sample rate or is disabled, EnergyErrorInvalidParameter will be returned.";
+    params.insert("o:sampleRate", enumRef<EnergyLogs::SampleRate>());
+    params.insert("o:from", enumValueName(Uint));
+    params.insert("o:thingIds", QVariantList() << enumValueName(Uuid));
+    returns.insert("energyError", enumRef<EnergyManager::EnergyError>());
+    returns.insert("o:powerBalanceLogEntries", objectRef<PowerBalanceLogEntries>());
+    returns.insert("o:thingPowerLogEntries", objectRef<ThingPowerLogEntries>());
+    registerMethod("GetLivePower", description, params, returns, Types::PermissionScopeNone);
+
+    params.clear(); returns.clear();
+    description = "Get the power statistics of the power balance, or of the thing with thingId if given, for each sample "
+                  "of a sample rate from SampleRate15Mins on. For each power value (e.g. \"consumption\" or "
+                  "\"currentPower\") stats holds its minimum, maximum and the highest average over a 15 minute window, "
+                  "aligned to local time, within the sample. sampleCount is the number of minute samples they are "
+                  "calculated from. From and to work like in GetPowerBalanceLogs. Samples written before the statistics "
+                  "were recorded are left out. For other sample rates, EnergyErrorInvalidParameter will be returned.";
+    params.insert("sampleRate", enumRef<EnergyLogs::SampleRate>());
+    params.insert("o:thingId", enumValueName(Uuid));
+    params.insert("o:from", enumValueName(Uint));
+    params.insert("o:to", enumValueName(Uint));
+    returns.insert("energyError", enumRef<EnergyManager::EnergyError>());
+    returns.insert("o:powerStatsEntries", QVariantList() << objectRef("PowerStatsEntry"));
+    registerMethod("GetPowerStats", description, params, returns, Types::PermissionScopeNone);
+
+    params.clear(); returns.clear();
+    description = "Get the timing statistics of the energy logging since the start or the last reset. For each operation "
+                  "(the SQL statement classes insert, rangeRead, latestLookup, trim, delete and cacheWrite as well as "
+                  "sampleTick and updatePowerBalance) the number of executions, the total and maximum time in ms and a "
+                  "latency histogram is returned. histogram holds the number of executions per bucket, the buckets end "
+                  "at the histogramBounds in µs, the last bucket holds all slower ones. notifications holds the number "
+                  "of notifications sent per notification, notifications to a single client count once per client. If "
+                  "reset is true, the statistics are reset after returning them. The statements of the background maintenance "
+                  "are included, log streams are not covered.";
+    params.insert("o:reset", enumValueName(Bool));
+    returns.insert("since", enumValueName(Uint));
+    returns.insert("histogramBounds", QVariantList() << enumValueName(Uint));
+    returns.insert("operations", QVariantList() << objectRef("OperationStatistics"));
+    returns.insert("notifications", QVariantList() << objectRef("NotificationStatistics"));
+    registerMethod("GetStatistics", description, params, returns, Types::PermissionScopeNone);
+
+    params.clear(); returns.clear();
+    description = "Subscribe to thing power log entries. Once subscribed, the calling client will receive "
+                  "SubscribedThingPowerLogEntryAdded notifications for entries matching the given things and sample "
+                  "rates only. If thingIds or sampleRates is not given, entries for all things or sample rates will "
+                  "match. If batched is set to true, all matching entries of one sample tick, including the power "
+                  "balance entries for the subscribed sample rates, will be delivered in a single LogEntriesAdded "
+                  "notification instead. Calling this again replaces the previous subscription of this client. Note "
+                  "that the PowerBalanceLogEntryAdded and ThingPowerLogEntryAdded notifications are still broadcasted "
+                  "to all clients unless disabled in the energy configuration. Only the persisted sample rates from "
+                  "SampleRate1Min on can be subscribed, for others EnergyErrorInvalidParameter will be returned.";
+    params.insert("o:thingIds", QVariantList() << enumValueName(Uuid));
+    params.insert("o:sampleRates", QVariantList() << enumRef<EnergyLogs::SampleRate>());
+    params.insert("o:batched", enumValueName(Bool));
+    returns.insert("energyError", enumRef<EnergyManager::EnergyError>());
+    registerMethod("SubscribeThingPowerLogs", description, params, returns, Types::PermissionScopeNone);
+
+    params.clear(); returns.clear();
+    description = "Remove the thing power log subscription of the calling client.";
+    registerMethod("UnsubscribeThingPowerLogs", description, params, returns, Types::PermissionScopeNone);
+
+    params.clear(); returns.clear();
+    description = "Stream power balance logs for bulk exports. Returns a streamId immediately and delivers the logs "
+                  "in LogStreamChunk notifications of at most chunkSize entries (default 1000) to the calling client. "
+                  "Chunks are numbered by sequence, starting at 0. At most windowSize chunks (default 4) are sent ahead of "
+                  "the last chunk acknowledged with AcknowledgeLogStream. The last chunk has last set to true. If the client "
+                  "does not acknowledge any chunk for 60 seconds, or the query fails, LogStreamAborted is sent instead. "
+                  "From, to and fields work like in GetPowerBalanceLogs. Only the persisted sample rates from SampleRate1Min "
+                  "on can be streamed, for others EnergyErrorInvalidParameter will be returned.";
+    params.insert("sampleRate", enumRef<EnergyLogs::SampleRate>());
+    params.insert("o:from", enumValueName(Uint));
+    params.insert("o:to", enumValueName(Uint));
+    params.insert("o:fields", enumValueName(StringList));
+    params.insert("o:chunkSize", enumValueName(Uint));
+    params.insert("o:windowSize", enumValueName(Uint));
+    returns.insert("energyError", enumRef<EnergyManager::EnergyError>());
+    returns.insert("o:streamId", enumValueName(Uuid));
+    registerMethod("StreamPowerBalanceLogs", description, params, returns, Types::PermissionScopeNone);
+
+    params.clear(); returns.clear();
+    description = "Stream thing power logs for bulk exports, ordered by timestamp and thing. See StreamPowerBalanceLogs "
+                  "for the flow control. ThingIds, from, to and fields work like in GetThingPowerLogs. Only the persisted "
+                  "sample rates from SampleRate1Min on can be streamed.";
+    params.insert("sampleRate", enumRef<EnergyLogs::SampleRate>());
+    params.insert("o:thingIds", QVariantList() << enumValueName(Uuid));
+    params.insert("o:from", enumValueName(Uint));
+    params.insert("o:to", enumValueName(Uint));
+    params.insert("o:fields", enumValueName(StringList));
+    params.insert("o:chunkSize", enumValueName(Uint));
+    params.insert("o:windowSize", enumValueName(Uint));
+    returns.insert("energyError", enumRef<EnergyManager::EnergyError>());
+    returns.insert("o:streamId", enumValueName(Uuid));
+    registerMethod("StreamThingPowerLogs", description, params, returns, Types::PermissionScopeNone);
+
+    params.clear(); returns.clear();
+    description = "Acknowledge all chunks of a log stream up to and including the given sequence.";
+    params.insert("streamId", enumValueName(Uuid));
+    params.insert("sequence", enumValueName(Uint));
+    returns.insert("energyError", enumRef<EnergyManager::EnergyError>());
+    registerMethod("AcknowledgeLogStream", description, params, returns, Types::PermissionScopeNone);
+
+    params.clear(); returns.clear();
+    description = "Cancel a log stream. No more chunks will be sent for it.";
+    params.insert("streamId", enumValueName(Uuid));
+    returns.insert("energyError", enumRef<EnergyManager::EnergyError>());
+    registerMethod("CancelLogStream", description, params, returns, Types::PermissionScopeNone);
+
     params.clear();
     description = "Emitted whenever the root meter id changes. If the root meter has been unset, the params will be empty.";
     params.insert("o:rootMeterThingId", enumValueName(Uuid));
@@ -119,40 +376,76 @@ EnergyJsonHandler::EnergyJsonHandler(EnergyManager *energyManager, QObject *pare
     params.insert("thingPowerLogEntry", objectRef<ThingPowerLogEntry>());
     registerNotification("ThingPowerLogEntryAdded", description, params);
 
+    params.clear();
+    description = "Emitted whenever an entry is added to the thing power log which matches the subscription "
+                  "of the client. See SubscribeThingPowerLogs.";
+    params.insert("sampleRate", enumRef<EnergyLogs::SampleRate>());
+    params.insert("thingPowerLogEntry", objectRef<ThingPowerLogEntry>());
+    registerNotification("SubscribedThingPowerLogEntryAdded", description, params);
+
+    params.clear();
+    description = "Emitted once per sample tick to clients which subscribed with batched set to true. Contains all log "
+                  "entries added in that tick which match the subscription of the client, grouped by sample rate.";
+    params.insert("batches", QVariantList() << objectRef("LogEntriesBatch"));
+    registerNotification("LogEntriesAdded", description, params);
+
+    params.clear();
+    description = "Emitted to the client which started a log stream for every chunk of the log. Depending on the stream, "
+                  "either powerBalanceLogEntries or thingPowerLogEntries is set. See StreamPowerBalanceLogs.";
+    params.insert("streamId", enumValueName(Uuid));
+    params.insert("sequence", enumValueName(Uint));
+    params.insert("o:powerBalanceLogEntries", objectRef<PowerBalanceLogEntries>());
+    params.insert("o:thingPowerLogEntries", objectRef<ThingPowerLogEntries>());
+    params.insert("last", enumValueName(Bool));
+    registerNotification("LogStreamChunk", description, params);
+
+    params.clear();
+    description = "Emitted to the client which started a log stream if the stream ended before the last chunk has been sent.";
+    params.insert("streamId", enumValueName(Uuid));
+    registerNotification("LogStreamAborted", description, params);
+
     connect(m_energyManager, &EnergyManager::rootMeterChanged, this, [=](){
         QVariantMap params;
         if (m_energyManager->rootMeter()) {
             params.insert("rootMeterThingId", m_energyManager->rootMeter()->id());
         }
+        countNotification("RootMeterChanged");
         emit RootMeterChanged(params);
     });
 
-    connect(m_energyManager, &EnergyManager::powerBalanceChanged, this, [=](){
-        QVariantMap params;
-        params.insert("currentPowerConsumption", m_energyManager->currentPowerConsumption());
-        params.insert("currentPowerProduction", m_energyManager->currentPowerProduction());
-        params.insert("currentPowerAcquisition", m_energyManager->currentPowerAcquisition());
-        params.insert("currentPowerStorage", m_energyManager->currentPowerStorage());
-        params.insert("totalConsumption", m_energyManager->totalConsumption());
-        params.insert("totalProduction", m_energyManager->totalProduction());
-        params.insert("totalAcquisition", m_energyManager->totalAcquisition());
-        params.insert("totalReturn", m_energyManager->totalReturn());
-        emit PowerBalanceChanged(params);
-    });
+    loadPowerBalanceNotificationPolicy();
 
-    connect(m_energyManager->logs(), &EnergyLogs::powerBalanceEntryAdded, this, [=](EnergyLogs::SampleRate sampleRate, const PowerBalanceLogEntry &entry){
-        QVariantMap params;
-        params.insert("sampleRate", enumValueName(sampleRate));
-        params.insert("powerBalanceLogEntry", pack(entry));
-        emit PowerBalanceLogEntryAdded(params);
-    });
+    m_powerBalanceHoldOffTimer.setSingleShot(true);
+    connect(&m_powerBalanceHoldOffTimer, &QTimer::timeout, this, &EnergyJsonHandler::onPowerBalanceChanged);
 
-    connect(m_energyManager->logs(), &EnergyLogs::thingPowerEntryAdded, this, [=](EnergyLogs::SampleRate sampleRate, const ThingPowerLogEntry &entry){
-        QVariantMap params;
-        params.insert("sampleRate", enumValueName(sampleRate));
-        params.insert("thingPowerLogEntry", pack(entry));
-        emit ThingPowerLogEntryAdded(params);
+    // Only running while a change is held back by the deadband, so an idle installation doesn't wake up for nothing
+    m_powerBalanceMaxIntervalTimer.setSingleShot(true);
+    connect(&m_powerBalanceMaxIntervalTimer, &QTimer::timeout, this, [this](){
+        // Flush changes which have been held back by the deadband so clients never lag behind longer than maxInterval
+        QVariantMap params = powerBalanceParams();
+        if (params != m_lastPowerBalanceParams) {
+            sendPowerBalanceChanged(params);
+        }
     });
+
+    connect(m_energyManager, &EnergyManager::powerBalanceChanged, this, &EnergyJsonHandler::onPowerBalanceChanged);
+
+    // Installations where all clients use SubscribeThingPowerLogs can disable the broadcasts in energy.conf:
+    // [Notifications]
+    // broadcastPowerBalanceLogEntries=false
+    // broadcastThingPowerLogEntries=false
+    QSettings settings(NymeaSettings::settingsPath() + "/energy.conf", QSettings::IniFormat);
+    m_broadcastPowerBalanceLogEntries = settings.value("Notifications/broadcastPowerBalanceLogEntries", true).toBool();
+    m_broadcastThingPowerLogEntries = settings.value("Notifications/broadcastThingPowerLogEntries", true).toBool();
+
+    // The logger adds all entries of a sample tick in one go. Collect them until the event loop pass
+    // finishes and send them to batched subscribers as one notification.
+    m_logEntriesBatchTimer.setInterval(0);
+    m_logEntriesBatchTimer.setSingleShot(true);
+    connect(&m_logEntriesBatchTimer, &QTimer::timeout, this, &EnergyJsonHandler::sendLogEntriesBatches);
+
+    connect(m_energyManager->logs(), &EnergyLogs::powerBalanceEntryAdded, this, &EnergyJsonHandler::onPowerBalanceEntryAdded);
+    connect(m_energyManager->logs(), &EnergyLogs::thingPowerEntryAdded, this, &EnergyJsonHandler::onThingPowerEntryAdded);
 }
 
 QString EnergyJsonHandler::name() const
@@ -186,30 +479,57 @@ JsonReply *EnergyJsonHandler::SetRootMeter(const QVariantMap &params)
 JsonReply *EnergyJsonHandler::GetPowerBalance(const QVariantMap &params)
 {
     Q_UNUSED(params)
-    QVariantMap ret;
-    ret.insert("currentPowerConsumption", m_energyManager->currentPowerConsumption());
-    ret.insert("currentPowerProduction", m_energyManager->currentPowerProduction());
-    ret.insert("currentPowerAcquisition", m_energyManager->currentPowerAcquisition());
-    ret.insert("currentPowerStorage", m_energyManager->currentPowerStorage());
-    ret.insert("totalConsumption", m_energyManager->totalConsumption());
-    ret.insert("totalProduction", m_energyManager->totalProduction());
-    ret.insert("totalAcquisition", m_energyManager->totalAcquisition());
-    ret.insert("totalReturn", m_energyManager->totalReturn());
-    return createReply(ret);
+    return createReply(powerBalanceParams());
 }
 
 JsonReply *EnergyJsonHandler::GetPowerBalanceLogs(const QVariantMap &params)
 {
+    EnergyProfiler::Span span("GetPowerBalanceLogs", "jsonrpc");
+    span.setArg("params", params);
     EnergyLogs::SampleRate sampleRate = enumNameToValue<EnergyLogs::SampleRate>(params.value("sampleRate").toString());
     QDateTime from = params.contains("from") ? QDateTime::fromMSecsSinceEpoch(params.value("from").toLongLong() * 1000) : QDateTime();
     QDateTime to = params.contains("to") ? QDateTime::fromMSecsSinceEpoch(params.value("to").toLongLong() * 1000) : QDateTime();
+    EnergyLogs::QueryOptions options;
+    options.limit = params.value("limit", 0).toInt();
+    options.cursor = params.value("cursor").toString();
+    options.maxPoints = params.value("maxPoints", 0).toInt();
+    options.fields = params.value("fields").toStringList();
+    options.sinceRevision = params.value("sinceRevision", 0).toLongLong();
+    QString nextCursor;
     QVariantMap returns;
-    returns.insert("powerBalanceLogEntries", pack(m_energyManager->logs()->powerBalanceLogs(sampleRate, from, to)));
+    if (sampleRate < EnergyLogs::SampleRateAny && (options.maxPoints > 0 || options.sinceRevision > 0)) {
+        returns.insert("revision", 0);
+        returns.insert("energyError", enumValueName(EnergyManager::EnergyErrorInvalidParameter));
+        return createReply(returns);
+    }
+    // Read the revision first, entries written in the meantime will be returned again with the next sync
+    returns.insert("revision", m_energyManager->logs()->powerBalanceLogsRevision());
+    if (sampleRate > 0 && options.sinceRevision > 0 && options.maxPoints == 0 && m_logger && options.sinceRevision < m_logger->powerBalanceLogsResyncRevision()) {
+        returns.insert("resync", true);
+    }
+    PowerBalanceLogEntries entries = m_energyManager->logs()->powerBalanceLogs(sampleRate, from, to, options, &nextCursor);
+    if (params.value("columnar", false).toBool()) {
+        returns.insert("powerBalanceLogColumns", packColumns(entries, options.fields, params.value("deltaTimestamps", false).toBool()));
+    } else {
+        returns.insert("powerBalanceLogEntries", projected(pack(entries), options.fields, {"timestamp"}));
+    }
+    if (!nextCursor.isEmpty()) {
+        returns.insert("nextCursor", nextCursor);
+    }
+
+    if (params.value("includeCurrent", false).toBool()) {
+        PowerBalanceLogEntry currentEntry = m_logger ? m_logger->currentPowerBalanceEntry() : PowerBalanceLogEntry();
+        if (currentEntry.timestamp().isValid()) {
+            returns.insert("currentEntry", projected(QVariantList() << pack(currentEntry), options.fields, {"timestamp"}).first());
+        }
+    }
     return createReply(returns);
 }
 
 JsonReply *EnergyJsonHandler::GetThingPowerLogs(const QVariantMap &params)
 {
+    EnergyProfiler::Span span("GetThingPowerLogs", "jsonrpc");
+    span.setArg("params", params);
     EnergyLogs::SampleRate sampleRate = enumNameToValue<EnergyLogs::SampleRate>(params.value("sampleRate").toString());
     QList<ThingId> thingIds;
     foreach (const QVariant &thingId, params.value("thingIds").toList()) {
@@ -217,12 +537,748 @@ JsonReply *EnergyJsonHandler::GetThingPowerLogs(const QVariantMap &params)
     }
     QDateTime from = params.contains("from") ? QDateTime::fromMSecsSinceEpoch(params.value("from").toLongLong() * 1000) : QDateTime();
     QDateTime to = params.contains("to") ? QDateTime::fromMSecsSinceEpoch(params.value("to").toLongLong() * 1000) : QDateTime();
+    EnergyLogs::QueryOptions options;
+    options.limit = params.value("limit", 0).toInt();
+    options.cursor = params.value("cursor").toString();
+    options.maxPoints = params.value("maxPoints", 0).toInt();
+    options.fields = params.value("fields").toStringList();
+    options.sinceRevision = params.value("sinceRevision", 0).toLongLong();
+    QString nextCursor;
     QVariantMap returns;
-    returns.insert("thingPowerLogEntries", pack(m_energyManager->logs()->thingPowerLogs(sampleRate, thingIds, from, to)));
+    if (sampleRate < EnergyLogs::SampleRateAny && (options.maxPoints > 0 || options.sinceRevision > 0)) {
+        returns.insert("revision", 0);
+        returns.insert("energyError", enumValueName(EnergyManager::EnergyErrorInvalidParameter));
+        return createReply(returns);
+    }
+    // Read the revision first, entries written in the meantime will be returned again with the next sync
+    returns.insert("revision", m_energyManager->logs()->thingPowerLogsRevision());
+    if (sampleRate > 0 && options.sinceRevision > 0 && options.maxPoints == 0 && m_logger && options.sinceRevision < m_logger->thingPowerLogsResyncRevision()) {
+        returns.insert("resync", true);
+    }
+    ThingPowerLogEntries entries = m_energyManager->logs()->thingPowerLogs(sampleRate, thingIds, from, to, options, &nextCursor);
+    if (params.value("columnar", false).toBool()) {
+        returns.insert("thingPowerLogColumns", packColumns(entries, options.fields, params.value("deltaTimestamps", false).toBool()));
+    } else {
+        returns.insert("thingPowerLogEntries", projected(pack(entries), options.fields, {"timestamp", "thingId"}));
+    }
+    if (!nextCursor.isEmpty()) {
+        returns.insert("nextCursor", nextCursor);
+    }
 
     if (params.contains("includeCurrent") && params.value("includeCurrent").toBool()) {
-        returns.insert("currentEntries", pack(m_energyManager->logs()->thingPowerLogs(EnergyLogs::SampleRate1Min, thingIds, QDateTime::currentDateTime().addSecs(-60))));
+        ThingPowerLogEntries currentEntries;
+        if (m_logger) {
+            currentEntries = m_logger->currentThingPowerEntries(thingIds);
+        } else {
+            currentEntries = m_energyManager->logs()->thingPowerLogs(EnergyLogs::SampleRate1Min, thingIds, QDateTime::currentDateTime().addSecs(-60), QDateTime());
+        }
+        returns.insert("currentEntries", projected(pack(currentEntries), options.fields, {"timestamp", "thingId"}));
+    }
+
+    return createReply(returns);
+}
+
+JsonReply *EnergyJsonHandler::GetEnergyDelta(const QVariantMap &params)
+{
+    EnergyProfiler::Span span("GetEnergyDelta", "jsonrpc");
+    span.setArg("params", params);
+    QList<ThingId> thingIds;
+    foreach (const QVariant &thingId, params.value("thingIds").toList()) {
+        thingIds.append(thingId.toUuid());
+    }
+    QDateTime from = QDateTime::fromMSecsSinceEpoch(params.value("from").toLongLong() * 1000);
+    QDateTime to = params.contains("to") ? QDateTime::fromMSecsSinceEpoch(params.value("to").toLongLong() * 1000) : QDateTime::currentDateTime();
+    QVariantMap returns;
+    returns.insert("powerBalanceEnergyDelta", pack(m_energyManager->logs()->powerBalanceEnergyBetween(from, to)));
+    returns.insert("thingEnergyDeltas", pack(m_energyManager->logs()->energyBetween(thingIds, from, to)));
+    return createReply(returns);
+}
+
+JsonReply *EnergyJsonHandler::GetTopConsumers(const QVariantMap &params)
+{
+    EnergyProfiler::Span span("GetTopConsumers", "jsonrpc");
+    span.setArg("params", params);
+    QDateTime from = QDateTime::fromMSecsSinceEpoch(params.value("from").toLongLong() * 1000);
+    QDateTime to = params.contains("to") ? QDateTime::fromMSecsSinceEpoch(params.value("to").toLongLong() * 1000) : QDateTime::currentDateTime();
+    int limit = params.value("limit", 10).toInt();
+    QVariantMap returns;
+    if (from > to || limit == 0) {
+        returns.insert("energyError", enumValueName(EnergyManager::EnergyErrorInvalidParameter));
+        return createReply(returns);
     }
+    returns.insert("energyError", enumValueName(EnergyManager::EnergyErrorNoError));
+    returns.insert("thingEnergyDeltas", pack(m_energyManager->logs()->topConsumers(from, to, limit)));
+    return createReply(returns);
+}
 
+JsonReply *EnergyJsonHandler::GetLivePower(const QVariantMap &params)
+{
+    QVariantMap returns;
+    EnergyLogs::SampleRate sampleRate = EnergyLogs::SampleRate1Sec;
+    if (params.contains("sampleRate")) {
+        sampleRate = enumNameToValue<EnergyLogs::SampleRate>(params.value("sampleRate").toString());
+    }
+    if (!m_logger || !m_logger->hasLiveSampleRate(sampleRate)) {
+        returns.insert("energyError", enumValueName(EnergyManager::EnergyErrorInvalidParameter));
+        return createReply(returns);
+    }
+    QList<ThingId> thingIds;
+    foreach (const QVariant &thingId, params.value("thingIds").toList()) {
+        thingIds.append(thingId.toUuid());
+    }
+    QDateTime from = params.contains("from") ? QDateTime::fromMSecsSinceEpoch(params.value("from").toLongLong() * 1000) : QDateTime();
+    returns.insert("energyError", enumValueName(EnergyManager::EnergyErrorNoError));
+    returns.insert("powerBalanceLogEntries", pack(m_logger->powerBalanceLogs(sampleRate, from)));
+    returns.insert("thingPowerLogEntries", pack(m_logger->thingPowerLogs(sampleRate, thingIds, from)));
     return createReply(returns);
 }
+
+JsonReply *EnergyJsonHandler::GetPowerStats(const QVariantMap &params)
+{
+    EnergyProfiler::Span span("GetPowerStats", "jsonrpc");
+    span.setArg("params", params);
+    QVariantMap returns;
+    EnergyLogs::SampleRate sampleRate = enumNameToValue<EnergyLogs::SampleRate>(params.value("sampleRate").toString());
+    if (!m_logger || sampleRate < EnergyLogs::SampleRate15Mins) {
+        returns.insert("energyError", enumValueName(EnergyManager::EnergyErrorInvalidParameter));
+        return createReply(returns);
+    }
+    ThingId thingId = params.value("thingId").toUuid();
+    QDateTime from = params.contains("from") ? QDateTime::fromMSecsSinceEpoch(params.value("from").toLongLong() * 1000) : QDateTime();
+    QDateTime to = params.contains("to") ? QDateTime::fromMSecsSinceEpoch(params.value("to").toLongLong() * 1000) : QDateTime();
+
+    QVariantList entries;
+    foreach (const EnergyLogger::StatsEntry &entry, m_logger->powerStats(sampleRate, thingId, from, to)) {
+        QVariantList stats;
+        for (auto it = entry.stats.constBegin(); it != entry.stats.constEnd(); ++it) {
+            QVariantMap fieldStats;
+            fieldStats.insert("field", it.key());
+            fieldStats.insert("min", it.value().min);
+            fieldStats.insert("max", it.value().max);
+            fieldStats.insert("peak15", it.value().peak15);
+            stats.append(fieldStats);
+        }
+        QVariantMap map;
+        map.insert("timestamp", entry.timestamp.toMSecsSinceEpoch() / 1000);
+        map.insert("sampleCount", entry.sampleCount);
+        map.insert("stats", stats);
+        entries.append(map);
+    }
+    returns.insert("energyError", enumValueName(EnergyManager::EnergyErrorNoError));
+    returns.insert("powerStatsEntries", entries);
+    return createReply(returns);
+}
+
+JsonReply *EnergyJsonHandler::GetStatistics(const QVariantMap &params)
+{
+    QVariantMap returns;
+    QVariantList histogramBounds;
+    foreach (qint64 bound, EnergyStatistics::bucketBounds()) {
+        histogramBounds.append(bound);
+    }
+    returns.insert("histogramBounds", histogramBounds);
+    if (!m_logger) {
+        returns.insert("since", QDateTime::currentMSecsSinceEpoch() / 1000);
+        returns.insert("operations", QVariantList());
+        returns.insert("notifications", QVariantList());
+        return createReply(returns);
+    }
+
+    EnergyStatistics *statistics = m_logger->statistics();
+    returns.insert("since", statistics->since().toMSecsSinceEpoch() / 1000);
+
+    QVariantList operations;
+    QHash<EnergyStatistics::Operation, EnergyStatistics::OperationStatistics> operationStatistics = statistics->operations();
+    for (auto it = operationStatistics.constBegin(); it != operationStatistics.constEnd(); ++it) {
+        QVariantMap operation;
+        operation.insert("operation", EnergyStatistics::operationName(it.key()));
+        operation.insert("count", it.value().count);
+        operation.insert("totalTime", it.value().totalUsecs / 1000.0);
+        operation.insert("maxTime", it.value().maxUsecs / 1000.0);
+        QVariantList histogram;
+        foreach (quint64 count, it.value().buckets) {
+            histogram.append(count);
+        }
+        operation.insert("histogram", histogram);
+        operations.append(operation);
+    }
+    returns.insert("operations", operations);
+
+    QVariantList notifications;
+    QHash<QString, quint64> notificationCounts = statistics->notifications();
+    for (auto it = notificationCounts.constBegin(); it != notificationCounts.constEnd(); ++it) {
+        QVariantMap notification;
+        notification.insert("notification", it.key());
+        notification.insert("count", it.value());
+        notifications.append(notification);
+    }
+    returns.insert("notifications", notifications);
+
+    if (params.value("reset").toBool()) {
+        statistics->reset();
+    }
+    return createReply(returns);
+}
+
+JsonReply *EnergyJsonHandler::SubscribeThingPowerLogs(const QVariantMap &params, const JsonContext &context)
+{
+    QVariantMap returns;
+    ThingPowerLogSubscription subscription;
+    foreach (const QVariant &thingId, params.value("thingIds").toList()) {
+        subscription.thingIds.insert(thingId.toUuid());
+    }
+    foreach (const QVariant &sampleRateName, params.value("sampleRates").toList()) {
+        // Entries are only added to the persisted sample rates, the sub-minute ones would never match
+        EnergyLogs::SampleRate sampleRate = enumNameToValue<EnergyLogs::SampleRate>(sampleRateName.toString());
+        if (sampleRate < EnergyLogs::SampleRate1Min) {
+            returns.insert("energyError", enumValueName(EnergyManager::EnergyErrorInvalidParameter));
+            return createReply(returns);
+        }
+        subscription.sampleRates.insert(sampleRate);
+    }
+    subscription.batched = params.value("batched", false).toBool();
+    m_thingPowerLogSubscriptions.insert(context.clientId(), subscription);
+    qCDebug(dcEnergyExperience()) << "Client" << context.clientId() << "subscribed to thing power logs for" << subscription.thingIds.count() << "things and" << subscription.sampleRates.count() << "sample rates";
+    returns.insert("energyError", enumValueName(EnergyManager::EnergyErrorNoError));
+    return createReply(returns);
+}
+
+JsonReply *EnergyJsonHandler::UnsubscribeThingPowerLogs(const QVariantMap &params, const JsonContext &context)
+{
+    Q_UNUSED(params)
+    m_thingPowerLogSubscriptions.remove(context.clientId());
+    return createReply(QVariantMap());
+}
+
+void EnergyJsonHandler::removeClient(const QUuid &clientId)
+{
+    if (m_thingPowerLogSubscriptions.remove(clientId) > 0) {
+        qCDebug(dcEnergyExperience()) << "Removed thing power log subscription of disconnected client" << clientId;
+    }
+
+    foreach (const QUuid &streamId, m_logStreams.keys()) {
+        if (m_logStreams.value(streamId).clientId == clientId) {
+            qCDebug(dcEnergyExperience()) << "Stopping log stream" << streamId << "of disconnected client" << clientId;
+            stopLogStream(streamId);
+        }
+    }
+}
+
+JsonReply *EnergyJsonHandler::StreamPowerBalanceLogs(const QVariantMap &params, const JsonContext &context)
+{
+    EnergyLogs::SampleRate sampleRate = enumNameToValue<EnergyLogs::SampleRate>(params.value("sampleRate").toString());
+    QDateTime from = params.contains("from") ? QDateTime::fromMSecsSinceEpoch(params.value("from").toLongLong() * 1000) : QDateTime();
+    QDateTime to = params.contains("to") ? QDateTime::fromMSecsSinceEpoch(params.value("to").toLongLong() * 1000) : QDateTime();
+    EnergyLogs::QueryOptions options;
+    options.fields = params.value("fields").toStringList();
+    int chunkSize = params.value("chunkSize", 1000).toInt();
+    int windowSize = params.value("windowSize", 4).toInt();
+
+    EnergyLogStream *stream = m_logger ? m_logger->createPowerBalanceLogStream(sampleRate, from, to, options, chunkSize, windowSize, this) : nullptr;
+    return createReply(startLogStream(stream, context.clientId(), options.fields));
+}
+
+JsonReply *EnergyJsonHandler::StreamThingPowerLogs(const QVariantMap &params, const JsonContext &context)
+{
+    EnergyLogs::SampleRate sampleRate = enumNameToValue<EnergyLogs::SampleRate>(params.value("sampleRate").toString());
+    QList<ThingId> thingIds;
+    foreach (const QVariant &thingId, params.value("thingIds").toList()) {
+        thingIds.append(thingId.toUuid());
+    }
+    QDateTime from = params.contains("from") ? QDateTime::fromMSecsSinceEpoch(params.value("from").toLongLong() * 1000) : QDateTime();
+    QDateTime to = params.contains("to") ? QDateTime::fromMSecsSinceEpoch(params.value("to").toLongLong() * 1000) : QDateTime();
+    EnergyLogs::QueryOptions options;
+    options.fields = params.value("fields").toStringList();
+    int chunkSize = params.value("chunkSize", 1000).toInt();
+    int windowSize = params.value("windowSize", 4).toInt();
+
+    EnergyLogStream *stream = m_logger ? m_logger->createThingPowerLogStream(sampleRate, thingIds, from, to, options, chunkSize, windowSize, this) : nullptr;
+    return createReply(startLogStream(stream, context.clientId(), options.fields));
+}
+
+JsonReply *EnergyJsonHandler::AcknowledgeLogStream(const QVariantMap &params, const JsonContext &context)
+{
+    QVariantMap returns;
+    QUuid streamId = params.value("streamId").toUuid();
+    if (!m_logStreams.contains(streamId) || m_logStreams.value(streamId).clientId != context.clientId()) {
+        returns.insert("energyError", enumValueName(EnergyManager::EnergyErrorInvalidParameter));
+        return createReply(returns);
+    }
+    m_logStreams.value(streamId).stream->acknowledge(params.value("sequence").toInt());
+    returns.insert("energyError", enumValueName(EnergyManager::EnergyErrorNoError));
+    return createReply(returns);
+}
+
+JsonReply *EnergyJsonHandler::CancelLogStream(const QVariantMap &params, const JsonContext &context)
+{
+    QVariantMap returns;
+    QUuid streamId = params.value("streamId").toUuid();
+    if (!m_logStreams.contains(streamId) || m_logStreams.value(streamId).clientId != context.clientId()) {
+        returns.insert("energyError", enumValueName(EnergyManager::EnergyErrorInvalidParameter));
+        return createReply(returns);
+    }
+    stopLogStream(streamId);
+    returns.insert("energyError", enumValueName(EnergyManager::EnergyErrorNoError));
+    return createReply(returns);
+}
+
+QVariantMap EnergyJsonHandler::startLogStream(EnergyLogStream *stream, const QUuid &clientId, const QStringList &fields)
+{
+    QVariantMap returns;
+    if (!stream) {
+        returns.insert("energyError", enumValueName(EnergyManager::EnergyErrorInvalidParameter));
+        return returns;
+    }
+
+    LogStream logStream;
+    logStream.clientId = clientId;
+    logStream.fields = fields;
+    logStream.stream = stream;
+    const QUuid streamId = stream->id();
+    m_logStreams.insert(streamId, logStream);
+
+    connect(stream, &EnergyLogStream::powerBalanceChunkAvailable, this, [this, streamId](int sequence, const PowerBalanceLogEntries &entries, bool last){
+        sendLogStreamChunk(streamId, sequence, pack(entries), last);
+    });
+    connect(stream, &EnergyLogStream::thingPowerChunkAvailable, this, [this, streamId](int sequence, const ThingPowerLogEntries &entries, bool last){
+        sendLogStreamChunk(streamId, sequence, pack(entries), last);
+    });
+    connect(stream, &EnergyLogStream::aborted, this, [this, streamId](){
+        QVariantMap params;
+        params.insert("streamId", streamId);
+        countNotification("LogStreamAborted");
+        emit LogStreamAborted(m_logStreams.value(streamId).clientId, params);
+        stopLogStream(streamId);
+    });
+    connect(stream, &EnergyLogStream::finished, this, [this, streamId](){
+        LogStream logStream = m_logStreams.take(streamId);
+        if (logStream.stream) {
+            logStream.stream->deleteLater();
+        }
+    });
+
+    qCDebug(dcEnergyExperience()) << "Starting log stream" << streamId << "for client" << clientId;
+    stream->start();
+
+    returns.insert("energyError", enumValueName(EnergyManager::EnergyErrorNoError));
+    returns.insert("streamId", streamId);
+    return returns;
+}
+
+void EnergyJsonHandler::stopLogStream(const QUuid &streamId)
+{
+    LogStream logStream = m_logStreams.take(streamId);
+    if (!logStream.stream) {
+        return;
+    }
+    // Drops chunks which are still queued for delivery, the destructor stops the worker and closes its read transaction
+    logStream.stream->disconnect(this);
+    logStream.stream->deleteLater();
+}
+
+void EnergyJsonHandler::sendLogStreamChunk(const QUuid &streamId, int sequence, const QVariant &packedEntries, bool last)
+{
+    const LogStream logStream = m_logStreams.value(streamId);
+    QVariantMap params;
+    params.insert("streamId", streamId);
+    params.insert("sequence", sequence);
+    if (logStream.stream->type() == EnergyLogStream::TypePowerBalance) {
+        params.insert("powerBalanceLogEntries", projected(packedEntries, logStream.fields, {"timestamp"}));
+    } else {
+        params.insert("thingPowerLogEntries", projected(packedEntries, logStream.fields, {"timestamp", "thingId"}));
+    }
+    params.insert("last", last);
+    countNotification("LogStreamChunk");
+    emit LogStreamChunk(logStream.clientId, params);
+}
+
+QVariantList EnergyJsonHandler::projected(const QVariant &packedEntries, const QStringList &fields, const QStringList &keyFields)
+{
+    QVariantList entries = packedEntries.toList();
+    if (fields.isEmpty()) {
+        return entries;
+    }
+
+    for (int i = 0; i < entries.count(); i++) {
+        QVariantMap entry = entries.at(i).toMap();
+        QVariantMap projectedEntry;
+        for (auto it = entry.constBegin(); it != entry.constEnd(); ++it) {
+            if (keyFields.contains(it.key()) || fields.contains(it.key())) {
+                projectedEntry.insert(it.key(), it.value());
+            }
+        }
+        entries[i] = projectedEntry;
+    }
+    return entries;
+}
+
+QVariantMap EnergyJsonHandler::packColumns(const PowerBalanceLogEntries &entries, const QStringList &fields, bool deltaTimestamps)
+{
+    auto wanted = [&fields](const QString &field) {
+        return fields.isEmpty() || fields.contains(field);
+    };
+
+    QVariantList timestamps, consumption, production, acquisition, storage, totalConsumption, totalProduction, totalAcquisition, totalReturn;
+    qint64 previousTimestamp = 0;
+    foreach (const PowerBalanceLogEntry &entry, entries) {
+        qint64 timestamp = entry.timestamp().toSecsSinceEpoch();
+        timestamps.append(deltaTimestamps ? timestamp - previousTimestamp : timestamp);
+        previousTimestamp = timestamp;
+        if (wanted("consumption")) {
+            consumption.append(entry.consumption());
+        }
+        if (wanted("production")) {
+            production.append(entry.production());
+        }
+        if (wanted("acquisition")) {
+            acquisition.append(entry.acquisition());
+        }
+        if (wanted("storage")) {
+            storage.append(entry.storage());
+        }
+        if (wanted("totalConsumption")) {
+            totalConsumption.append(entry.totalConsumption());
+        }
+        if (wanted("totalProduction")) {
+            totalProduction.append(entry.totalProduction());
+        }
+        if (wanted("totalAcquisition")) {
+            totalAcquisition.append(entry.totalAcquisition());
+        }
+        if (wanted("totalReturn")) {
+            totalReturn.append(entry.totalReturn());
+        }
+    }
+
+    QVariantMap columns;
+    columns.insert("timestamps", timestamps);
+    if (wanted("consumption")) {
+        columns.insert("consumption", consumption);
+    }
+    if (wanted("production")) {
+        columns.insert("production", production);
+    }
+    if (wanted("acquisition")) {
+        columns.insert("acquisition", acquisition);
+    }
+    if (wanted("storage")) {
+        columns.insert("storage", storage);
+    }
+    if (wanted("totalConsumption")) {
+        columns.insert("totalConsumption", totalConsumption);
+    }
+    if (wanted("totalProduction")) {
+        columns.insert("totalProduction", totalProduction);
+    }
+    if (wanted("totalAcquisition")) {
+        columns.insert("totalAcquisition", totalAcquisition);
+    }
+    if (wanted("totalReturn")) {
+        columns.insert("totalReturn", totalReturn);
+    }
+    return columns;
+}
+
+QVariantList EnergyJsonHandler::packColumns(const ThingPowerLogEntries &entries, const QStringList &fields, bool deltaTimestamps)
+{
+    auto wanted = [&fields](const QString &field) {
+        return fields.isEmpty() || fields.contains(field);
+    };
+
+    struct ThingColumns {
+        QVariantList timestamps, currentPower, totalConsumption, totalProduction;
+        qint64 previousTimestamp = 0;
+    };
+    QList<ThingId> thingIds;
+    QHash<ThingId, ThingColumns> things;
+    foreach (const ThingPowerLogEntry &entry, entries) {
+        if (!things.contains(entry.thingId())) {
+            thingIds.append(entry.thingId());
+        }
+        ThingColumns &columns = things[entry.thingId()];
+        qint64 timestamp = entry.timestamp().toSecsSinceEpoch();
+        columns.timestamps.append(deltaTimestamps ? timestamp - columns.previousTimestamp : timestamp);
+        columns.previousTimestamp = timestamp;
+        if (wanted("currentPower")) {
+            columns.currentPower.append(entry.currentPower());
+        }
+        if (wanted("totalConsumption")) {
+            columns.totalConsumption.append(entry.totalConsumption());
+        }
+        if (wanted("totalProduction")) {
+            columns.totalProduction.append(entry.totalProduction());
+        }
+    }
+
+    QVariantList ret;
+    foreach (const ThingId &thingId, thingIds) {
+        const ThingColumns &columns = things.value(thingId);
+        QVariantMap map;
+        map.insert("thingId", thingId);
+        map.insert("timestamps", columns.timestamps);
+        if (wanted("currentPower")) {
+            map.insert("currentPower", columns.currentPower);
+        }
+        if (wanted("totalConsumption")) {
+            map.insert("totalConsumption", columns.totalConsumption);
+        }
+        if (wanted("totalProduction")) {
+            map.insert("totalProduction", columns.totalProduction);
+        }
+        ret.append(map);
+    }
+    return ret;
+}
+
+bool EnergyJsonHandler::matchesSubscription(const ThingPowerLogSubscription &subscription, EnergyLogs::SampleRate sampleRate, const ThingId &thingId) const
+{
+    if (!subscription.sampleRates.isEmpty() && !subscription.sampleRates.contains(sampleRate)) {
+        return false;
+    }
+    if (!thingId.isNull() && !subscription.thingIds.isEmpty() && !subscription.thingIds.contains(thingId)) {
+        return false;
+    }
+    return true;
+}
+
+bool EnergyJsonHandler::hasBatchedSubscriptions() const
+{
+    foreach (const ThingPowerLogSubscription &subscription, m_thingPowerLogSubscriptions) {
+        if (subscription.batched) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void EnergyJsonHandler::onPowerBalanceEntryAdded(EnergyLogs::SampleRate sampleRate, const PowerBalanceLogEntry &entry)
+{
+    if (m_broadcastPowerBalanceLogEntries) {
+        QVariantMap params;
+        params.insert("sampleRate", enumValueName(sampleRate));
+        params.insert("powerBalanceLogEntry", pack(entry));
+        countNotification("PowerBalanceLogEntryAdded");
+        emit PowerBalanceLogEntryAdded(params);
+    }
+
+    if (hasBatchedSubscriptions()) {
+        m_pendingPowerBalanceLogEntries[sampleRate].append(entry);
+        m_logEntriesBatchTimer.start();
+    }
+}
+
+void EnergyJsonHandler::onThingPowerEntryAdded(EnergyLogs::SampleRate sampleRate, const ThingPowerLogEntry &entry)
+{
+    if (!m_broadcastThingPowerLogEntries && m_thingPowerLogSubscriptions.isEmpty()) {
+        return;
+    }
+
+    QVariantMap params;
+    params.insert("sampleRate", enumValueName(sampleRate));
+    params.insert("thingPowerLogEntry", pack(entry));
+
+    if (m_broadcastThingPowerLogEntries) {
+        countNotification("ThingPowerLogEntryAdded");
+        emit ThingPowerLogEntryAdded(params);
+    }
+
+    bool batch = false;
+    for (auto it = m_thingPowerLogSubscriptions.constBegin(); it != m_thingPowerLogSubscriptions.constEnd(); ++it) {
+        if (it.value().batched) {
+            batch = true;
+            continue;
+        }
+        if (matchesSubscription(it.value(), sampleRate, entry.thingId())) {
+            countNotification("SubscribedThingPowerLogEntryAdded");
+            emit SubscribedThingPowerLogEntryAdded(it.key(), params);
+        }
+    }
+
+    if (batch) {
+        m_pendingThingPowerLogEntries[sampleRate].append(entry);
+        m_logEntriesBatchTimer.start();
+    }
+}
+
+void EnergyJsonHandler::sendLogEntriesBatches()
+{
+    QMap<EnergyLogs::SampleRate, PowerBalanceLogEntries> powerBalanceLogEntries = m_pendingPowerBalanceLogEntries;
+    QMap<EnergyLogs::SampleRate, ThingPowerLogEntries> thingPowerLogEntries = m_pendingThingPowerLogEntries;
+    m_pendingPowerBalanceLogEntries.clear();
+    m_pendingThingPowerLogEntries.clear();
+
+    // Pack every entry only once, no matter how many clients will receive it
+    QMap<EnergyLogs::SampleRate, QVariantList> packedPowerBalanceLogEntries;
+    for (auto it = powerBalanceLogEntries.constBegin(); it != powerBalanceLogEntries.constEnd(); ++it) {
+        packedPowerBalanceLogEntries.insert(it.key(), pack(it.value()).toList());
+    }
+    QMap<EnergyLogs::SampleRate, QVariantList> packedThingPowerLogEntries;
+    for (auto it = thingPowerLogEntries.constBegin(); it != thingPowerLogEntries.constEnd(); ++it) {
+        packedThingPowerLogEntries.insert(it.key(), pack(it.value()).toList());
+    }
+
+    QList<EnergyLogs::SampleRate> sampleRates = powerBalanceLogEntries.keys();
+    foreach (EnergyLogs::SampleRate sampleRate, thingPowerLogEntries.keys()) {
+        if (!sampleRates.contains(sampleRate)) {
+            sampleRates.append(sampleRate);
+        }
+    }
+    std::sort(sampleRates.begin(), sampleRates.end());
+
+    for (auto it = m_thingPowerLogSubscriptions.constBegin(); it != m_thingPowerLogSubscriptions.constEnd(); ++it) {
+        const ThingPowerLogSubscription &subscription = it.value();
+        if (!subscription.batched) {
+            continue;
+        }
+
+        QVariantList batches;
+        foreach (EnergyLogs::SampleRate sampleRate, sampleRates) {
+            if (!matchesSubscription(subscription, sampleRate)) {
+                continue;
+            }
+
+            QVariantList thingEntries;
+            if (subscription.thingIds.isEmpty()) {
+                thingEntries = packedThingPowerLogEntries.value(sampleRate);
+            } else {
+                const ThingPowerLogEntries entries = thingPowerLogEntries.value(sampleRate);
+                const QVariantList packedEntries = packedThingPowerLogEntries.value(sampleRate);
+                for (int i = 0; i < entries.count(); i++) {
+                    if (subscription.thingIds.contains(entries.at(i).thingId())) {
+                        thingEntries.append(packedEntries.at(i));
+                    }
+                }
+            }
+
+            const QVariantList balanceEntries = packedPowerBalanceLogEntries.value(sampleRate);
+            if (balanceEntries.isEmpty() && thingEntries.isEmpty()) {
+                continue;
+            }
+
+            QVariantMap batch;
+            batch.insert("sampleRate", enumValueName(sampleRate));
+            batch.insert("powerBalanceLogEntries", balanceEntries);
+            batch.insert("thingPowerLogEntries", thingEntries);
+            batches.append(batch);
+        }
+
+        if (!batches.isEmpty()) {
+            QVariantMap params;
+            params.insert("batches", batches);
+            countNotification("LogEntriesAdded");
+            emit LogEntriesAdded(it.key(), params);
+        }
+    }
+}
+
+void EnergyJsonHandler::loadPowerBalanceNotificationPolicy()
+{
+    // The PowerBalanceChanged notification can be rate limited in energy.conf, e.g.:
+    //
+    // [PowerBalanceNotifications]
+    // minInterval=1000                         ; ms, notifications are held back and coalesced if they come in faster
+    // maxInterval=30000                        ; ms, changes held back by the deadband are sent at the latest after this
+    // absoluteDeadband=5                       ; default for all fields, in the unit of the field (W or kWh)
+    // relativeDeadband=0.01                    ; default for all fields, relative to the last notified value
+    // totalConsumption\absoluteDeadband=0.01   ; per field overrides
+    //
+    // All values default to 0, which sends a notification on every change.
+    QSettings settings(NymeaSettings::settingsPath() + "/energy.conf", QSettings::IniFormat);
+    settings.beginGroup("PowerBalanceNotifications");
+    m_powerBalanceMinInterval = qMax(0, settings.value("minInterval", 0).toInt());
+    m_powerBalanceMaxInterval = qMax(0, settings.value("maxInterval", 0).toInt());
+
+    Deadband defaultDeadband;
+    defaultDeadband.absolute = qAbs(settings.value("absoluteDeadband", 0).toDouble());
+    defaultDeadband.relative = qAbs(settings.value("relativeDeadband", 0).toDouble());
+
+    m_powerBalanceDeadbands.clear();
+    foreach (const QString &field, powerBalanceParams().keys()) {
+        Deadband deadband;
+        deadband.absolute = qAbs(settings.value(field + "/absoluteDeadband", defaultDeadband.absolute).toDouble());
+        deadband.relative = qAbs(settings.value(field + "/relativeDeadband", defaultDeadband.relative).toDouble());
+        m_powerBalanceDeadbands.insert(field, deadband);
+    }
+    settings.endGroup();
+
+    m_powerBalanceMaxIntervalTimer.setInterval(m_powerBalanceMaxInterval);
+
+    qCDebug(dcEnergyExperience()) << "PowerBalanceChanged notification policy: min interval:" << m_powerBalanceMinInterval << "ms, max interval:" << m_powerBalanceMaxInterval << "ms, default deadband:" << defaultDeadband.absolute << "absolute," << defaultDeadband.relative << "relative";
+}
+
+QVariantMap EnergyJsonHandler::powerBalanceParams() const
+{
+    QVariantMap params;
+    params.insert("currentPowerConsumption", m_energyManager->currentPowerConsumption());
+    params.insert("currentPowerProduction", m_energyManager->currentPowerProduction());
+    params.insert("currentPowerAcquisition", m_energyManager->currentPowerAcquisition());
+    params.insert("currentPowerStorage", m_energyManager->currentPowerStorage());
+    params.insert("totalConsumption", m_energyManager->totalConsumption());
+    params.insert("totalProduction", m_energyManager->totalProduction());
+    params.insert("totalAcquisition", m_energyManager->totalAcquisition());
+    params.insert("totalReturn", m_energyManager->totalReturn());
+    return params;
+}
+
+bool EnergyJsonHandler::exceedsPowerBalanceDeadband(const QVariantMap &params) const
+{
+    if (m_lastPowerBalanceParams.isEmpty()) {
+        return true;
+    }
+
+    for (auto it = params.constBegin(); it != params.constEnd(); ++it) {
+        double oldValue = m_lastPowerBalanceParams.value(it.key()).toDouble();
+        double newValue = it.value().toDouble();
+        double diff = qAbs(newValue - oldValue);
+        if (diff == 0) {
+            continue;
+        }
+        const Deadband deadband = m_powerBalanceDeadbands.value(it.key());
+        double threshold = qMax(deadband.absolute, deadband.relative * qAbs(oldValue));
+        if (diff > threshold || threshold == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void EnergyJsonHandler::onPowerBalanceChanged()
+{
+    QVariantMap params = powerBalanceParams();
+    if (!exceedsPowerBalanceDeadband(params)) {
+        if (m_powerBalanceMaxInterval > 0 && !m_powerBalanceMaxIntervalTimer.isActive() && params != m_lastPowerBalanceParams) {
+            m_powerBalanceMaxIntervalTimer.start();
+        }
+        return;
+    }
+
+    if (m_powerBalanceMinInterval > 0 && m_lastPowerBalanceNotification.isValid()) {
+        qint64 elapsed = m_lastPowerBalanceNotification.elapsed();
+        if (elapsed < m_powerBalanceMinInterval) {
+            // Coalesce, the hold off timer will send the then current values
+            if (!m_powerBalanceHoldOffTimer.isActive()) {
+                m_powerBalanceHoldOffTimer.start(m_powerBalanceMinInterval - elapsed);
+            }
+            return;
+        }
+    }
+
+    sendPowerBalanceChanged(params);
+}
+
+void EnergyJsonHandler::sendPowerBalanceChanged(const QVariantMap &params)
+{
+    m_powerBalanceHoldOffTimer.stop();
+    m_powerBalanceMaxIntervalTimer.stop();
+    m_lastPowerBalanceParams = params;
+    m_lastPowerBalanceNotification.start();
+    countNotification("PowerBalanceChanged");
+    emit PowerBalanceChanged(params);
+}
+
+void EnergyJsonHandler::countNotification(const QString &notification)
+{
+    if (m_logger) {
+        m_logger->statistics()->countNotification(notification);
+    }
+}
@@ -26,9 +26,19 @@
 #define ENERGYJSONHANDLER_H
 
 #include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSet>
+#include <QMap>
+
 #include <jsonrpc/jsonhandler.h>
 
+#include "energylogs.h"
+
 class EnergyManager;
+class EnergyLogger;
+class EnergyLogStream;
 
 class EnergyJsonHandler : public JsonHandler
 {
@@ -43,15 +53,93 @@ public:
     Q_INVOKABLE JsonReply *GetPowerBalance(const QVariantMap &params);
     Q_INVOKABLE JsonReply *GetPowerBalanceLogs(const QVariantMap &params);
     Q_INVOKABLE JsonReply *GetThingPowerLogs(const QVariantMap &params);
+    Q_INVOKABLE JsonReply *GetEnergyDelta(const QVariantMap &params);
+    Q_INVOKABLE JsonReply *GetTopConsumers(const QVariantMap &params);
+    Q_INVOKABLE JsonReply *GetLivePower(const QVariantMap &params);
+    Q_INVOKABLE JsonReply *GetPowerStats(const QVariantMap &params);
+    Q_INVOKABLE JsonReply *GetStatistics(const QVariantMap &params);
+    Q_INVOKABLE JsonReply *SubscribeThingPowerLogs(const QVariantMap &params, const JsonContext &context);
+    Q_INVOKABLE JsonReply *UnsubscribeThingPowerLogs(const QVariantMap &params, const JsonContext &context);
+    Q_INVOKABLE JsonReply *StreamPowerBalanceLogs(const QVariantMap &params, const JsonContext &context);
+    Q_INVOKABLE JsonReply *StreamThingPowerLogs(const QVariantMap &params, const JsonContext &context);
+    Q_INVOKABLE JsonReply *AcknowledgeLogStream(const QVariantMap &params, const JsonContext &context);
+    Q_INVOKABLE JsonReply *CancelLogStream(const QVariantMap &params, const JsonContext &context);
+
+public slots:
+    // Drops everything held for a client, to be called when it disconnects
+    void removeClient(const QUuid &clientId);
 
 signals:
     void RootMeterChanged(const QVariantMap &params);
     void PowerBalanceChanged(const QVariantMap &params);
     void PowerBalanceLogEntryAdded(const QVariantMap &params);
     void ThingPowerLogEntryAdded(const QVariantMap &params);
+    void SubscribedThingPowerLogEntryAdded(const QUuid &clientId, const QVariantMap &params);
+    void LogEntriesAdded(const QUuid &clientId, const QVariantMap &params);
+    void LogStreamChunk(const QUuid &clientId, const QVariantMap &params);
+    void LogStreamAborted(const QUuid &clientId, const QVariantMap &params);
 
 private:
+    struct Deadband {
+        double absolute = 0;
+        double relative = 0;
+    };
+
+    void loadPowerBalanceNotificationPolicy();
+    QVariantMap powerBalanceParams() const;
+    bool exceedsPowerBalanceDeadband(const QVariantMap &params) const;
+    void onPowerBalanceChanged();
+    void sendPowerBalanceChanged(const QVariantMap &params);
+
+    static QVariantList projected(const QVariant &packedEntries, const QStringList &fields, const QStringList &keyFields);
+    static QVariantMap packColumns(const PowerBalanceLogEntries &entries, const QStringList &fields, bool deltaTimestamps);
+    static QVariantList packColumns(const ThingPowerLogEntries &entries, const QStringList &fields, bool deltaTimestamps);
+
+    struct ThingPowerLogSubscription {
+        // Empty sets match everything
+        QSet<ThingId> thingIds;
+        QSet<EnergyLogs::SampleRate> sampleRates;
+        bool batched = false;
+    };
+    bool matchesSubscription(const ThingPowerLogSubscription &subscription, EnergyLogs::SampleRate sampleRate, const ThingId &thingId = ThingId()) const;
+    bool hasBatchedSubscriptions() const;
+    void onPowerBalanceEntryAdded(EnergyLogs::SampleRate sampleRate, const PowerBalanceLogEntry &entry);
+    void onThingPowerEntryAdded(EnergyLogs::SampleRate sampleRate, const ThingPowerLogEntry &entry);
+    void sendLogEntriesBatches();
+
+    struct LogStream {
+        QUuid clientId;
+        QStringList fields;
+        EnergyLogStream *stream = nullptr;
+    };
+    QVariantMap startLogStream(EnergyLogStream *stream, const QUuid &clientId, const QStringList &fields);
+    void stopLogStream(const QUuid &streamId);
+    void sendLogStreamChunk(const QUuid &streamId, int sequence, const QVariant &packedEntries, bool last);
+
+    void countNotification(const QString &notification);
+
     EnergyManager *m_energyManager = nullptr;
+    EnergyLogger *m_logger = nullptr;
+
+    // PowerBalanceChanged notification policy, see loadPowerBalanceNotificationPolicy()
+    int m_powerBalanceMinInterval = 0;
+    int m_powerBalanceMaxInterval = 0;
+    QHash<QString, Deadband> m_powerBalanceDeadbands;
+    QVariantMap m_lastPowerBalanceParams;
+    QElapsedTimer m_lastPowerBalanceNotification;
+    QTimer m_powerBalanceHoldOffTimer;
+    QTimer m_powerBalanceMaxIntervalTimer;
+
+    bool m_broadcastPowerBalanceLogEntries = true;
+    bool m_broadcastThingPowerLogEntries = true;
+    QHash<QUuid, ThingPowerLogSubscription> m_thingPowerLogSubscriptions;
+
+    // Log entries added within the current event loop pass, sent as one LogEntriesAdded to batched subscribers
+    QTimer m_logEntriesBatchTimer;
+    QMap<EnergyLogs::SampleRate, PowerBalanceLogEntries> m_pendingPowerBalanceLogEntries;
+    QMap<EnergyLogs::SampleRate, ThingPowerLogEntries> m_pendingThingPowerLogEntries;
+
+    QHash<QUuid, LogStream> m_logStreams;
 };
 
 #endif // ENERGYJSONHANDLER_H
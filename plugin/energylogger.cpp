@@ -23,6 +23,8 @@
 * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
 #include "energylogger.h"
+#include "energyclock.h"
+#include "energyprofiler.h"
 
 #include <nymeasettings.h>
 
@@ -34,8 +36,14 @@
 #include <QSqlIndex>
 #include <QSettings>
 #include <QElapsedTimer>
-#include <QPointer>
 #include <QUuid>
+#include <QMetaEnum>
+#include <QFile>
+#include <QContiguousCache>
+#include <QScopeGuard>
+
+#include <algorithm>
+#include <functional>
 
 #include <QLoggingCategory>
 Q_DECLARE_LOGGING_CATEGORY(dcEnergyExperience)
@@ -43,11 +51,44 @@ Q_DECLARE_LOGGING_CATEGORY(dcEnergyExperience)
 namespace {
 
 struct MaintenanceConfig {
+    MaintenanceConfig() = default;
+    MaintenanceConfig(EnergyLogs::SampleRate sampleRate, EnergyLogs::SampleRate baseSampleRate, uint maxSamples):
+        sampleRate(sampleRate), baseSampleRate(baseSampleRate), maxSamples(maxSamples) {}
+
     EnergyLogs::SampleRate sampleRate = EnergyLogs::SampleRateAny;
     EnergyLogs::SampleRate baseSampleRate = EnergyLogs::SampleRateAny;
     uint maxSamples = 0;
 };
 
+// Default logging configuration, can be overridden in the [Logs] group of energy.conf
+// Note: SampleRate1Min is always sampled as it is the base series for others
+// Make sure your base series always has enough samples to build a full sample
+// of all series building on it.
+
+// Disk space considerations;
+// Each entry takes approx 50 bytes for powerBalance + 60 bytes for thingCurrentPower per thing of disk space
+// SQLite adds metadata and overhead of about 5%
+// The resulting database size can be estimated with (count being the sum of all numbers below):
+// (count * 50 bytes) + (count * things * 60 bytes) + 5%
+// ~40000 entries, with 5 energy things => ~15MB
+// Note: use sqlite3_analyzer to see the approx. size per entry in each table.
+
+// One day 1440 min, let's keep one week
+const int defaultMaxMinuteSamples = 10080;
+
+QList<MaintenanceConfig> defaultTierConfigs()
+{
+    return {
+        {EnergyLogs::SampleRate15Mins, EnergyLogs::SampleRate1Min, 16128}, // 6 months
+        {EnergyLogs::SampleRate1Hour, EnergyLogs::SampleRate15Mins, 8760}, // 1 year
+        {EnergyLogs::SampleRate3Hours, EnergyLogs::SampleRate15Mins, 2920}, // 1 year
+        {EnergyLogs::SampleRate1Day, EnergyLogs::SampleRate1Hour, 1095}, // 3 years
+        {EnergyLogs::SampleRate1Week, EnergyLogs::SampleRate1Day, 168}, // 3 years
+        {EnergyLogs::SampleRate1Month, EnergyLogs::SampleRate1Day, 240}, // 20 years
+        {EnergyLogs::SampleRate1Year, EnergyLogs::SampleRate1Month, 20} // 20 years
+    };
+}
+
 struct BalanceTotals {
     double totalConsumption = 0;
     double totalProduction = 0;
@@ -60,70 +101,177 @@ struct ThingTotals {
     double totalProduction = 0;
 };
 
-QDateTime maintenanceNextSampleTimestamp(EnergyLogs::SampleRate sampleRate, const QDateTime &dateTime)
+// The writer's connection for the maintenance functions below. exec runs a statement like
+// EnergyLogger::execWriteQuery(), recording its timing and logging it if slow.
+struct MaintenanceContext {
+    QSqlDatabase db;
+    std::function<bool(QSqlQuery &query, EnergyStatistics::Operation operation)> exec;
+};
+
+// The power values which get PowerStats in the tier samples
+const QStringList powerBalanceStatsFields = {"consumption", "production", "acquisition", "storage"};
+const QStringList thingPowerStatsFields = {"currentPower"};
+
+// Accumulates the PowerStats of one power value over the base samples of a tier sample, in timestamp order
+class PowerStatsAccumulator
 {
-    QTime time = dateTime.time();
-    QDate date = dateTime.date();
-    QDateTime next;
-    switch (sampleRate) {
-    case EnergyLogs::SampleRateAny:
-        return QDateTime();
-    case EnergyLogs::SampleRate1Min:
-        time.setHMS(time.hour(), time.minute(), 0);
-        next = QDateTime(date, time).addMSecs(60 * 1000);
-        break;
-    case EnergyLogs::SampleRate15Mins:
-        time.setHMS(time.hour(), time.minute() - (time.minute() % 15), 0);
-        next = QDateTime(date, time).addMSecs(15 * 60 * 1000);
-        break;
-    case EnergyLogs::SampleRate1Hour:
-        time.setHMS(time.hour(), 0, 0);
-        next = QDateTime(date, time).addMSecs(60 * 60 * 1000);
-        break;
-    case EnergyLogs::SampleRate3Hours:
-        time.setHMS(time.hour() - (time.hour() % 3), 0, 0);
-        next = QDateTime(date, time).addMSecs(3 * 60 * 60 * 1000);
-        if (next.time().hour() == 2) {
-            next = next.addMSecs(60 * 60 * 1000);
+public:
+    PowerStatsAccumulator(const QString &field, EnergyLogs::SampleRate baseSampleRate):
+        m_field(field),
+        m_baseSampleRate(baseSampleRate)
+    {
+    }
+
+    void add(const QSqlRecord &record)
+    {
+        // Minute samples don't carry stats, the value itself is min and max then
+        double value = record.value(m_field).toDouble();
+        QVariant min = record.value(m_field + "Min");
+        QVariant max = record.value(m_field + "Max");
+        QVariant peak15 = record.value(m_field + "Peak15");
+        double sampleMin = min.isNull() ? value : min.toDouble();
+        double sampleMax = max.isNull() ? value : max.toDouble();
+        m_stats.min = m_empty ? sampleMin : qMin(m_stats.min, sampleMin);
+        m_stats.max = m_empty ? sampleMax : qMax(m_stats.max, sampleMax);
+        m_empty = false;
+
+        if (m_baseSampleRate < EnergyLogs::SampleRate15Mins) {
+            // Average the base samples of each 15 minute window, aligned to local time like the 15 minute tier.
+            // The timestamp is the end of the sample period, the window is identified by its end.
+            QDateTime sampleTime = QDateTime::fromMSecsSinceEpoch(record.value("timestamp").toLongLong() - 1);
+            qint64 window = EnergyLogger::nextSampleTimestamp(EnergyLogs::SampleRate15Mins, sampleTime).toMSecsSinceEpoch();
+            if (window != m_window) {
+                finishWindow();
+                m_window = window;
+            }
+            m_windowSum += value;
+            m_windowCount++;
+        } else {
+            addPeak(peak15.isNull() ? value : peak15.toDouble());
         }
-        break;
-    case EnergyLogs::SampleRate1Day:
-        next = QDateTime(date, QTime()).addDays(1);
-        break;
-    case EnergyLogs::SampleRate1Week:
-        date = date.addDays(-date.dayOfWeek() + 1);
-        next = QDateTime(date, QTime()).addDays(7);
-        break;
-    case EnergyLogs::SampleRate1Month:
-        date = date.addDays(-date.day() + 1);
-        next = QDateTime(date, QTime()).addMonths(1);
-        break;
-    case EnergyLogs::SampleRate1Year:
-        date.setDate(date.year(), 1, 1);
-        next = QDateTime(date, QTime()).addYears(1);
-        break;
     }
 
-    return next;
+    EnergyLogger::PowerStats stats()
+    {
+        finishWindow();
+        return m_stats;
+    }
+
+private:
+    void finishWindow()
+    {
+        if (m_windowCount > 0) {
+            addPeak(m_windowSum / m_windowCount);
+        }
+        m_windowSum = 0;
+        m_windowCount = 0;
+    }
+
+    void addPeak(double peak)
+    {
+        m_stats.peak15 = m_hasPeak ? qMax(m_stats.peak15, peak) : peak;
+        m_hasPeak = true;
+    }
+
+    QString m_field;
+    EnergyLogs::SampleRate m_baseSampleRate;
+    EnergyLogger::PowerStats m_stats;
+    bool m_empty = true;
+    bool m_hasPeak = false;
+    qint64 m_window = -1;
+    double m_windowSum = 0;
+    int m_windowCount = 0;
+};
+
+// Collects the PowerStats of all stats fields and the number of raw samples aggregated into a tier sample
+class TierStats
+{
+public:
+    TierStats(const QStringList &fields, EnergyLogs::SampleRate baseSampleRate)
+    {
+        foreach (const QString &field, fields) {
+            m_accumulators.append(PowerStatsAccumulator(field, baseSampleRate));
+        }
+    }
+
+    void add(const QSqlRecord &record)
+    {
+        // Minute samples count as one, tier samples for periods without any samples don't count at all
+        QVariant sampleCount = record.value("sampleCount");
+        if (!sampleCount.isNull() && sampleCount.toInt() == 0) {
+            return;
+        }
+        for (int i = 0; i < m_accumulators.count(); i++) {
+            m_accumulators[i].add(record);
+        }
+        m_sampleCount += sampleCount.isNull() ? 1 : sampleCount.toInt();
+    }
+
+    QList<EnergyLogger::PowerStats> stats()
+    {
+        QList<EnergyLogger::PowerStats> ret;
+        for (int i = 0; i < m_accumulators.count(); i++) {
+            ret.append(m_accumulators[i].stats());
+        }
+        return ret;
+    }
+
+    int sampleCount() const
+    {
+        return m_sampleCount;
+    }
+
+private:
+    QList<PowerStatsAccumulator> m_accumulators;
+    int m_sampleCount = 0;
+};
+
+QString statsColumns(const QStringList &fields)
+{
+    QStringList columns;
+    foreach (const QString &field, fields) {
+        columns << field + "Min" << field + "Max" << field + "Peak15";
+    }
+    columns << "sampleCount";
+    return columns.join(", ");
 }
 
-QDateTime maintenanceCalculateSampleStart(const QDateTime &sampleEnd, EnergyLogs::SampleRate sampleRate, int sampleCount = 1)
+QString powerBalanceInsertQuery()
 {
-    if (sampleRate == EnergyLogs::SampleRate1Month) {
-        return sampleEnd.addMonths(-sampleCount);
-    } else if (sampleRate == EnergyLogs::SampleRate1Year) {
-        return sampleEnd.addYears(-sampleCount);
+    return QStringLiteral("INSERT INTO powerBalance (timestamp, sampleRate, consumption, production, acquisition, storage, totalConsumption, totalProduction, totalAcquisition, totalReturn, %1, revision) "
+                          "values (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, (SELECT MAX(IFNULL(MAX(revision), 0), (SELECT powerBalanceResyncRevision FROM metadata)) + 1 FROM powerBalance));").arg(statsColumns(powerBalanceStatsFields));
+}
+
+QString thingPowerInsertQuery()
+{
+    return QStringLiteral("INSERT INTO thingPower (timestamp, sampleRate, thingId, currentPower, totalConsumption, totalProduction, %1, revision) "
+                          "values (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, (SELECT MAX(IFNULL(MAX(revision), 0), (SELECT thingPowerResyncRevision FROM metadata)) + 1 FROM thingPower));").arg(statsColumns(thingPowerStatsFields));
+}
+
+// Binds the values for statsColumns(), NULL if there are no stats (minute samples)
+void bindStats(QSqlQuery &query, const QStringList &fields, const QList<EnergyLogger::PowerStats> &stats, int sampleCount)
+{
+    for (int i = 0; i < fields.count(); i++) {
+        if (i < stats.count()) {
+            query.addBindValue(stats.at(i).min);
+            query.addBindValue(stats.at(i).max);
+            query.addBindValue(stats.at(i).peak15);
+        } else {
+            query.addBindValue(QVariant());
+            query.addBindValue(QVariant());
+            query.addBindValue(QVariant());
+        }
     }
-    return sampleEnd.addMSecs(-(quint64)sampleCount * sampleRate * 60 * 1000);
+    query.addBindValue(stats.isEmpty() ? QVariant() : QVariant(sampleCount));
 }
 
-QList<ThingId> maintenanceLoggedThings(QSqlDatabase &db)
+QList<ThingId> maintenanceLoggedThings(MaintenanceContext &context)
 {
     QList<ThingId> ret;
 
-    QSqlQuery query(db);
+    QSqlQuery query(context.db);
     query.prepare(QStringLiteral("SELECT DISTINCT thingId FROM thingPower;"));
-    if (!query.exec()) {
+    if (!context.exec(query, EnergyStatistics::OperationRangeRead)) {
         qCWarning(dcEnergyExperience()) << "Failed to load existing things from logs:" << query.lastError();
         return ret;
     }
@@ -133,12 +281,12 @@ QList<ThingId> maintenanceLoggedThings(QSqlDatabase &db)
     return ret;
 }
 
-QDateTime maintenanceGetOldestPowerBalanceSampleTimestamp(QSqlDatabase &db, EnergyLogs::SampleRate sampleRate)
+QDateTime maintenanceGetOldestPowerBalanceSampleTimestamp(MaintenanceContext &context, EnergyLogs::SampleRate sampleRate)
 {
-    QSqlQuery query(db);
+    QSqlQuery query(context.db);
     query.prepare(QStringLiteral("SELECT MIN(timestamp) AS oldestTimestamp FROM powerBalance WHERE sampleRate = ?;"));
     query.addBindValue(sampleRate);
-    if (!query.exec()) {
+    if (!context.exec(query, EnergyStatistics::OperationLatestLookup)) {
         qCWarning(dcEnergyExperience()) << "Failed to query oldest powerBalance timestamp:" << query.lastError();
         return QDateTime();
     }
@@ -148,12 +296,12 @@ QDateTime maintenanceGetOldestPowerBalanceSampleTimestamp(QSqlDatabase &db, Ener
     return QDateTime();
 }
 
-QDateTime maintenanceGetNewestPowerBalanceSampleTimestamp(QSqlDatabase &db, EnergyLogs::SampleRate sampleRate)
+QDateTime maintenanceGetNewestPowerBalanceSampleTimestamp(MaintenanceContext &context, EnergyLogs::SampleRate sampleRate)
 {
-    QSqlQuery query(db);
+    QSqlQuery query(context.db);
     query.prepare(QStringLiteral("SELECT MAX(timestamp) AS newestTimestamp FROM powerBalance WHERE sampleRate = ?;"));
     query.addBindValue(sampleRate);
-    if (!query.exec()) {
+    if (!context.exec(query, EnergyStatistics::OperationLatestLookup)) {
         qCWarning(dcEnergyExperience()) << "Failed to query newest powerBalance timestamp:" << query.lastError();
         return QDateTime();
     }
@@ -163,13 +311,13 @@ QDateTime maintenanceGetNewestPowerBalanceSampleTimestamp(QSqlDatabase &db, Ener
     return QDateTime();
 }
 
-QDateTime maintenanceGetOldestThingPowerSampleTimestamp(QSqlDatabase &db, const ThingId &thingId, EnergyLogs::SampleRate sampleRate)
+QDateTime maintenanceGetOldestThingPowerSampleTimestamp(MaintenanceContext &context, const ThingId &thingId, EnergyLogs::SampleRate sampleRate)
 {
-    QSqlQuery query(db);
+    QSqlQuery query(context.db);
     query.prepare(QStringLiteral("SELECT MIN(timestamp) AS oldestTimestamp FROM thingPower WHERE thingId = ? AND sampleRate = ?;"));
     query.addBindValue(thingId);
     query.addBindValue(sampleRate);
-    if (!query.exec()) {
+    if (!context.exec(query, EnergyStatistics::OperationLatestLookup)) {
         qCWarning(dcEnergyExperience()) << "Failed to query oldest thingPower timestamp:" << thingId << query.lastError();
         return QDateTime();
     }
@@ -179,13 +327,13 @@ QDateTime maintenanceGetOldestThingPowerSampleTimestamp(QSqlDatabase &db, const
     return QDateTime();
 }
 
-QDateTime maintenanceGetNewestThingPowerSampleTimestamp(QSqlDatabase &db, const ThingId &thingId, EnergyLogs::SampleRate sampleRate)
+QDateTime maintenanceGetNewestThingPowerSampleTimestamp(MaintenanceContext &context, const ThingId &thingId, EnergyLogs::SampleRate sampleRate)
 {
-    QSqlQuery query(db);
+    QSqlQuery query(context.db);
     query.prepare(QStringLiteral("SELECT MAX(timestamp) AS newestTimestamp FROM thingPower WHERE thingId = ? AND sampleRate = ?;"));
     query.addBindValue(thingId);
     query.addBindValue(sampleRate);
-    if (!query.exec()) {
+    if (!context.exec(query, EnergyStatistics::OperationLatestLookup)) {
         qCWarning(dcEnergyExperience()) << "Failed to query newest thingPower timestamp:" << thingId << query.lastError();
         return QDateTime();
     }
@@ -195,13 +343,13 @@ QDateTime maintenanceGetNewestThingPowerSampleTimestamp(QSqlDatabase &db, const
     return QDateTime();
 }
 
-BalanceTotals maintenanceLatestPowerBalanceTotals(QSqlDatabase &db, EnergyLogs::SampleRate sampleRate)
+BalanceTotals maintenanceLatestPowerBalanceTotals(MaintenanceContext &context, EnergyLogs::SampleRate sampleRate)
 {
     BalanceTotals totals;
-    QSqlQuery query(db);
+    QSqlQuery query(context.db);
     query.prepare(QStringLiteral("SELECT totalConsumption, totalProduction, totalAcquisition, totalReturn FROM powerBalance WHERE sampleRate = ? ORDER BY timestamp DESC LIMIT 1;"));
     query.addBindValue(sampleRate);
-    if (!query.exec()) {
+    if (!context.exec(query, EnergyStatistics::OperationLatestLookup)) {
         qCWarning(dcEnergyExperience()) << "Failed to query latest powerBalance totals:" << sampleRate << query.lastError();
         return totals;
     }
@@ -215,14 +363,14 @@ BalanceTotals maintenanceLatestPowerBalanceTotals(QSqlDatabase &db, EnergyLogs::
     return totals;
 }
 
-ThingTotals maintenanceLatestThingTotals(QSqlDatabase &db, EnergyLogs::SampleRate sampleRate, const ThingId &thingId)
+ThingTotals maintenanceLatestThingTotals(MaintenanceContext &context, EnergyLogs::SampleRate sampleRate, const ThingId &thingId)
 {
     ThingTotals totals;
-    QSqlQuery query(db);
+    QSqlQuery query(context.db);
     query.prepare(QStringLiteral("SELECT totalConsumption, totalProduction FROM thingPower WHERE thingId = ? AND sampleRate = ? ORDER BY timestamp DESC LIMIT 1;"));
     query.addBindValue(thingId);
     query.addBindValue(sampleRate);
-    if (!query.exec()) {
+    if (!context.exec(query, EnergyStatistics::OperationLatestLookup)) {
         qCWarning(dcEnergyExperience()) << "Failed to query latest thingPower totals:" << sampleRate << thingId << query.lastError();
         return totals;
     }
@@ -234,12 +382,13 @@ ThingTotals maintenanceLatestThingTotals(QSqlDatabase &db, EnergyLogs::SampleRat
     return totals;
 }
 
-bool maintenanceInsertPowerBalance(QSqlDatabase &db, const QDateTime &timestamp, EnergyLogs::SampleRate sampleRate,
+bool maintenanceInsertPowerBalance(MaintenanceContext &context, const QDateTime &timestamp, EnergyLogs::SampleRate sampleRate,
                                   double consumption, double production, double acquisition, double storage,
-                                  double totalConsumption, double totalProduction, double totalAcquisition, double totalReturn)
+                                  double totalConsumption, double totalProduction, double totalAcquisition, double totalReturn,
+                                  const QList<EnergyLogger::PowerStats> &stats = QList<EnergyLogger::PowerStats>(), int sampleCount = 0)
 {
-    QSqlQuery query(db);
-    query.prepare(QStringLiteral("INSERT INTO powerBalance (timestamp, sampleRate, consumption, production, acquisition, storage, totalConsumption, totalProduction, totalAcquisition, totalReturn) values (?, ?, ?, ?, ?, ?, ?, ?, ?, ?);"));
+    QSqlQuery query(context.db);
+    query.prepare(powerBalanceInsertQuery());
     query.addBindValue(timestamp.toMSecsSinceEpoch());
     query.addBindValue(sampleRate);
     query.addBindValue(consumption);
@@ -250,34 +399,37 @@ bool maintenanceInsertPowerBalance(QSqlDatabase &db, const QDateTime &timestamp,
     query.addBindValue(totalProduction);
     query.addBindValue(totalAcquisition);
     query.addBindValue(totalReturn);
-    if (!query.exec()) {
+    bindStats(query, powerBalanceStatsFields, stats, sampleCount);
+    if (!context.exec(query, EnergyStatistics::OperationInsert)) {
         qCWarning(dcEnergyExperience()) << "Error logging power balance sample:" << query.lastError() << query.executedQuery();
         return false;
     }
     return true;
 }
 
-bool maintenanceInsertThingPower(QSqlDatabase &db, const QDateTime &timestamp, EnergyLogs::SampleRate sampleRate, const ThingId &thingId,
-                                 double currentPower, double totalConsumption, double totalProduction)
+bool maintenanceInsertThingPower(MaintenanceContext &context, const QDateTime &timestamp, EnergyLogs::SampleRate sampleRate, const ThingId &thingId,
+                                 double currentPower, double totalConsumption, double totalProduction,
+                                 const QList<EnergyLogger::PowerStats> &stats = QList<EnergyLogger::PowerStats>(), int sampleCount = 0)
 {
-    QSqlQuery query(db);
-    query.prepare(QStringLiteral("INSERT INTO thingPower (timestamp, sampleRate, thingId, currentPower, totalConsumption, totalProduction) values (?, ?, ?, ?, ?, ?);"));
+    QSqlQuery query(context.db);
+    query.prepare(thingPowerInsertQuery());
     query.addBindValue(timestamp.toMSecsSinceEpoch());
     query.addBindValue(sampleRate);
     query.addBindValue(thingId);
     query.addBindValue(currentPower);
     query.addBindValue(totalConsumption);
     query.addBindValue(totalProduction);
-    if (!query.exec()) {
+    bindStats(query, thingPowerStatsFields, stats, sampleCount);
+    if (!context.exec(query, EnergyStatistics::OperationInsert)) {
         qCWarning(dcEnergyExperience()) << "Error logging thing power sample:" << query.lastError() << query.executedQuery();
         return false;
     }
     return true;
 }
 
-bool maintenanceSamplePowerBalance(QSqlDatabase &db, EnergyLogs::SampleRate sampleRate, EnergyLogs::SampleRate baseSampleRate, const QDateTime &sampleEnd)
+bool maintenanceSamplePowerBalance(MaintenanceContext &context, EnergyLogs::SampleRate sampleRate, EnergyLogs::SampleRate baseSampleRate, const QDateTime &sampleEnd)
 {
-    QDateTime sampleStart = maintenanceCalculateSampleStart(sampleEnd, sampleRate);
+    QDateTime sampleStart = EnergyLogger::previousSampleTimestamp(sampleRate, sampleEnd);
 
     double medianConsumption = 0;
     double medianProduction = 0;
@@ -288,23 +440,25 @@ bool maintenanceSamplePowerBalance(QSqlDatabase &db, EnergyLogs::SampleRate samp
     double totalAcquisition = 0;
     double totalReturn = 0;
 
-    QSqlQuery query(db);
+    QSqlQuery query(context.db);
     query.prepare(QStringLiteral("SELECT * FROM powerBalance WHERE sampleRate = ? AND timestamp > ? AND timestamp <= ? ORDER BY timestamp ASC;"));
     query.addBindValue(baseSampleRate);
     query.addBindValue(sampleStart.toMSecsSinceEpoch());
     query.addBindValue(sampleEnd.toMSecsSinceEpoch());
-    if (!query.exec()) {
+    if (!context.exec(query, EnergyStatistics::OperationRangeRead)) {
         qCWarning(dcEnergyExperience()) << "Error fetching power balance samples for" << baseSampleRate << "from" << sampleStart.toString() << "to" << sampleEnd.toString();
         qCWarning(dcEnergyExperience()) << "SQL error was:" << query.lastError() << "executed query:" << query.executedQuery();
         return false;
     }
 
+    TierStats tierStats(powerBalanceStatsFields, baseSampleRate);
     int resultCount = 0;
     while (query.next()) {
         if (QThread::currentThread()->isInterruptionRequested()) {
             return false;
         }
         resultCount++;
+        tierStats.add(query.record());
         medianConsumption += query.value("consumption").toDouble();
         medianProduction += query.value("production").toDouble();
         medianAcquisition += query.value("acquisition").toDouble();
@@ -320,10 +474,11 @@ bool maintenanceSamplePowerBalance(QSqlDatabase &db, EnergyLogs::SampleRate samp
         medianAcquisition = medianAcquisition * baseSampleRate / sampleRate;
         medianStorage = medianStorage * baseSampleRate / sampleRate;
     } else {
-        query = QSqlQuery(db);
-        query.prepare(QStringLiteral("SELECT * FROM powerBalance WHERE sampleRate = ? ORDER BY timestamp DESC LIMIT 1;"));
+        query = QSqlQuery(context.db);
+        query.prepare(QStringLiteral("SELECT * FROM powerBalance WHERE sampleRate = ? AND timestamp <= ? ORDER BY timestamp DESC LIMIT 1;"));
         query.addBindValue(baseSampleRate);
-        if (!query.exec()) {
+        query.addBindValue(sampleEnd.toMSecsSinceEpoch());
+        if (!context.exec(query, EnergyStatistics::OperationLatestLookup)) {
             qCWarning(dcEnergyExperience()) << "Error fetching newest power balance sample for" << baseSampleRate;
             qCWarning(dcEnergyExperience()) << "SQL error was:" << query.lastError() << "executed query:" << query.executedQuery();
             return false;
@@ -336,35 +491,37 @@ bool maintenanceSamplePowerBalance(QSqlDatabase &db, EnergyLogs::SampleRate samp
         }
     }
 
-    return maintenanceInsertPowerBalance(db, sampleEnd, sampleRate, medianConsumption, medianProduction, medianAcquisition, medianStorage, totalConsumption, totalProduction, totalAcquisition, totalReturn);
+    return maintenanceInsertPowerBalance(context, sampleEnd, sampleRate, medianConsumption, medianProduction, medianAcquisition, medianStorage, totalConsumption, totalProduction, totalAcquisition, totalReturn, tierStats.stats(), tierStats.sampleCount());
 }
 
-bool maintenanceSampleThingPower(QSqlDatabase &db, const ThingId &thingId, EnergyLogs::SampleRate sampleRate, EnergyLogs::SampleRate baseSampleRate, const QDateTime &sampleEnd)
+bool maintenanceSampleThingPower(MaintenanceContext &context, const ThingId &thingId, EnergyLogs::SampleRate sampleRate, EnergyLogs::SampleRate baseSampleRate, const QDateTime &sampleEnd)
 {
-    QDateTime sampleStart = maintenanceCalculateSampleStart(sampleEnd, sampleRate);
+    QDateTime sampleStart = EnergyLogger::previousSampleTimestamp(sampleRate, sampleEnd);
 
     double medianCurrentPower = 0;
     double totalConsumption = 0;
     double totalProduction = 0;
 
-    QSqlQuery query(db);
+    QSqlQuery query(context.db);
     query.prepare(QStringLiteral("SELECT * FROM thingPower WHERE thingId = ? AND sampleRate = ? AND timestamp > ? AND timestamp <= ? ORDER BY timestamp ASC;"));
     query.addBindValue(thingId);
     query.addBindValue(baseSampleRate);
     query.addBindValue(sampleStart.toMSecsSinceEpoch());
     query.addBindValue(sampleEnd.toMSecsSinceEpoch());
-    if (!query.exec()) {
+    if (!context.exec(query, EnergyStatistics::OperationRangeRead)) {
         qCWarning(dcEnergyExperience()) << "Error fetching thing power samples for" << baseSampleRate << "from" << sampleStart.toString() << "to" << sampleEnd.toString();
         qCWarning(dcEnergyExperience()) << "SQL error was:" << query.lastError() << "executed query:" << query.executedQuery();
         return false;
     }
 
+    TierStats tierStats(thingPowerStatsFields, baseSampleRate);
     int resultCount = 0;
     while (query.next()) {
         if (QThread::currentThread()->isInterruptionRequested()) {
             return false;
         }
         resultCount++;
+        tierStats.add(query.record());
         medianCurrentPower += query.value("currentPower").toDouble();
         totalConsumption = query.value("totalConsumption").toDouble();
         totalProduction = query.value("totalProduction").toDouble();
@@ -372,11 +529,12 @@ bool maintenanceSampleThingPower(QSqlDatabase &db, const ThingId &thingId, Energ
     if (resultCount > 0) {
         medianCurrentPower = medianCurrentPower * baseSampleRate / sampleRate;
     } else {
-        query = QSqlQuery(db);
-        query.prepare(QStringLiteral("SELECT * FROM thingPower WHERE thingId = ? AND sampleRate = ? ORDER BY timestamp DESC LIMIT 1;"));
+        query = QSqlQuery(context.db);
+        query.prepare(QStringLiteral("SELECT * FROM thingPower WHERE thingId = ? AND sampleRate = ? AND timestamp <= ? ORDER BY timestamp DESC LIMIT 1;"));
         query.addBindValue(thingId);
         query.addBindValue(baseSampleRate);
-        if (!query.exec()) {
+        query.addBindValue(sampleEnd.toMSecsSinceEpoch());
+        if (!context.exec(query, EnergyStatistics::OperationLatestLookup)) {
             qCWarning(dcEnergyExperience()) << "Error fetching newest thing power sample for" << thingId.toString() << baseSampleRate;
             qCWarning(dcEnergyExperience()) << "SQL error was:" << query.lastError() << "executed query:" << query.executedQuery();
             return false;
@@ -387,14 +545,14 @@ bool maintenanceSampleThingPower(QSqlDatabase &db, const ThingId &thingId, Energ
         }
     }
 
-    return maintenanceInsertThingPower(db, sampleEnd, sampleRate, thingId, medianCurrentPower, totalConsumption, totalProduction);
+    return maintenanceInsertThingPower(context, sampleEnd, sampleRate, thingId, medianCurrentPower, totalConsumption, totalProduction, tierStats.stats(), tierStats.sampleCount());
 }
 
-void maintenanceRectifySamples(QSqlDatabase &db, EnergyLogs::SampleRate sampleRate, EnergyLogs::SampleRate baseSampleRate, uint maxSamples,
+void maintenanceRectifySamples(MaintenanceContext &context, EnergyLogs::SampleRate sampleRate, EnergyLogs::SampleRate baseSampleRate, uint maxSamples,
                                const QDateTime &nextScheduledSample, const QList<ThingId> &thingIds)
 {
-    QDateTime oldestBaseSample = maintenanceGetOldestPowerBalanceSampleTimestamp(db, baseSampleRate);
-    QDateTime newestSample = maintenanceGetNewestPowerBalanceSampleTimestamp(db, sampleRate);
+    QDateTime oldestBaseSample = maintenanceGetOldestPowerBalanceSampleTimestamp(context, baseSampleRate);
+    QDateTime newestSample = maintenanceGetNewestPowerBalanceSampleTimestamp(context, sampleRate);
 
     if (QThread::currentThread()->isInterruptionRequested()) {
         return;
@@ -404,37 +562,37 @@ void maintenanceRectifySamples(QSqlDatabase &db, EnergyLogs::SampleRate sampleRa
         newestSample = oldestBaseSample;
     }
 
-    if (!newestSample.isNull() && maintenanceNextSampleTimestamp(sampleRate, newestSample) < nextScheduledSample) {
-        QDateTime nextSample = maintenanceNextSampleTimestamp(sampleRate, newestSample.addMSecs(1000));
-        maintenanceSamplePowerBalance(db, sampleRate, baseSampleRate, nextSample);
+    if (!newestSample.isNull() && EnergyLogger::nextSampleTimestamp(sampleRate, newestSample) < nextScheduledSample) {
+        QDateTime nextSample = EnergyLogger::nextSampleTimestamp(sampleRate, newestSample.addMSecs(1000));
+        maintenanceSamplePowerBalance(context, sampleRate, baseSampleRate, nextSample);
         newestSample = nextSample;
     }
 
-    BalanceTotals latest = maintenanceLatestPowerBalanceTotals(db, sampleRate);
+    BalanceTotals latest = maintenanceLatestPowerBalanceTotals(context, sampleRate);
 
     if (!newestSample.isNull()) {
-        newestSample = qMax(newestSample, maintenanceCalculateSampleStart(nextScheduledSample, sampleRate, (int)maxSamples));
+        newestSample = qMax(newestSample, EnergyLogger::calculateSampleStart(nextScheduledSample, sampleRate, (int)maxSamples));
     }
 
-    db.transaction();
-    while (!newestSample.isNull() && maintenanceNextSampleTimestamp(sampleRate, newestSample) < nextScheduledSample) {
+    context.db.transaction();
+    while (!newestSample.isNull() && EnergyLogger::nextSampleTimestamp(sampleRate, newestSample) < nextScheduledSample) {
         if (QThread::currentThread()->isInterruptionRequested()) {
-            db.rollback();
+            context.db.rollback();
             return;
         }
-        QDateTime nextSample = maintenanceNextSampleTimestamp(sampleRate, newestSample.addMSecs(1000));
-        maintenanceInsertPowerBalance(db, nextSample, sampleRate, 0, 0, 0, 0, latest.totalConsumption, latest.totalProduction, latest.totalAcquisition, latest.totalReturn);
+        QDateTime nextSample = EnergyLogger::nextSampleTimestamp(sampleRate, newestSample.addMSecs(1000));
+        maintenanceInsertPowerBalance(context, nextSample, sampleRate, 0, 0, 0, 0, latest.totalConsumption, latest.totalProduction, latest.totalAcquisition, latest.totalReturn);
         newestSample = nextSample;
     }
-    db.commit();
+    context.db.commit();
 
     foreach (const ThingId &thingId, thingIds) {
         if (QThread::currentThread()->isInterruptionRequested()) {
             return;
         }
 
-        QDateTime oldestBaseSample = maintenanceGetOldestThingPowerSampleTimestamp(db, thingId, baseSampleRate);
-        QDateTime newestSample = maintenanceGetNewestThingPowerSampleTimestamp(db, thingId, sampleRate);
+        QDateTime oldestBaseSample = maintenanceGetOldestThingPowerSampleTimestamp(context, thingId, baseSampleRate);
+        QDateTime newestSample = maintenanceGetNewestThingPowerSampleTimestamp(context, thingId, sampleRate);
 
         if (newestSample.isNull()) {
             if (oldestBaseSample.isNull()) {
@@ -443,41 +601,231 @@ void maintenanceRectifySamples(QSqlDatabase &db, EnergyLogs::SampleRate sampleRa
             newestSample = oldestBaseSample;
         }
 
-        if (!newestSample.isNull() && maintenanceNextSampleTimestamp(sampleRate, newestSample) < nextScheduledSample) {
-            QDateTime nextSample = maintenanceNextSampleTimestamp(sampleRate, newestSample.addMSecs(1000));
-            maintenanceSampleThingPower(db, thingId, sampleRate, baseSampleRate, nextSample);
+        if (!newestSample.isNull() && EnergyLogger::nextSampleTimestamp(sampleRate, newestSample) < nextScheduledSample) {
+            QDateTime nextSample = EnergyLogger::nextSampleTimestamp(sampleRate, newestSample.addMSecs(1000));
+            maintenanceSampleThingPower(context, thingId, sampleRate, baseSampleRate, nextSample);
             newestSample = nextSample;
         }
 
-        ThingTotals latest = maintenanceLatestThingTotals(db, sampleRate, thingId);
+        ThingTotals latest = maintenanceLatestThingTotals(context, sampleRate, thingId);
 
-        newestSample = qMax(newestSample, maintenanceCalculateSampleStart(nextScheduledSample, sampleRate, (int)maxSamples));
+        newestSample = qMax(newestSample, EnergyLogger::calculateSampleStart(nextScheduledSample, sampleRate, (int)maxSamples));
 
-        db.transaction();
-        while (!newestSample.isNull() && maintenanceNextSampleTimestamp(sampleRate, newestSample) < nextScheduledSample) {
+        context.db.transaction();
+        while (!newestSample.isNull() && EnergyLogger::nextSampleTimestamp(sampleRate, newestSample) < nextScheduledSample) {
             if (QThread::currentThread()->isInterruptionRequested()) {
-                db.rollback();
+                context.db.rollback();
                 return;
             }
-            QDateTime nextSample = maintenanceNextSampleTimestamp(sampleRate, newestSample.addMSecs(1000));
-            maintenanceInsertThingPower(db, nextSample, sampleRate, thingId, 0, latest.totalConsumption, latest.totalProduction);
+            QDateTime nextSample = EnergyLogger::nextSampleTimestamp(sampleRate, newestSample.addMSecs(1000));
+            maintenanceInsertThingPower(context, nextSample, sampleRate, thingId, 0, latest.totalConsumption, latest.totalProduction);
             newestSample = nextSample;
         }
-        db.commit();
+        context.db.commit();
+    }
+}
+
+// Samples the part of the base series the tier doesn't cover yet, that is everything older than the oldest tier
+// sample and within the retention of the tier. Needed when a tier gets added, rebased or its retention extended.
+void maintenanceBackfillSamples(MaintenanceContext &context, EnergyLogs::SampleRate sampleRate, EnergyLogs::SampleRate baseSampleRate, uint maxSamples,
+                                const QDateTime &nextScheduledSample, const QList<ThingId> &thingIds)
+{
+    const QDateTime retentionStart = EnergyLogger::calculateSampleStart(nextScheduledSample, sampleRate, (int)maxSamples);
+
+    QDateTime oldestBaseSample = maintenanceGetOldestPowerBalanceSampleTimestamp(context, baseSampleRate);
+    QDateTime oldestSample = maintenanceGetOldestPowerBalanceSampleTimestamp(context, sampleRate);
+    QDateTime until = oldestSample.isValid() ? oldestSample : nextScheduledSample;
+    if (oldestBaseSample.isValid()) {
+        int count = 0;
+        context.db.transaction();
+        QDateTime sampleEnd = EnergyLogger::nextSampleTimestamp(sampleRate, qMax(oldestBaseSample, retentionStart));
+        while (sampleEnd < until) {
+            if (QThread::currentThread()->isInterruptionRequested()) {
+                context.db.rollback();
+                return;
+            }
+            maintenanceSamplePowerBalance(context, sampleRate, baseSampleRate, sampleEnd);
+            sampleEnd = EnergyLogger::nextSampleTimestamp(sampleRate, sampleEnd);
+            count++;
+        }
+        context.db.commit();
+        qCDebug(dcEnergyExperience()) << "Backfilled" << count << "power balance samples for" << sampleRate << "from" << baseSampleRate;
+    }
+
+    foreach (const ThingId &thingId, thingIds) {
+        oldestBaseSample = maintenanceGetOldestThingPowerSampleTimestamp(context, thingId, baseSampleRate);
+        if (oldestBaseSample.isNull()) {
+            continue;
+        }
+        oldestSample = maintenanceGetOldestThingPowerSampleTimestamp(context, thingId, sampleRate);
+        until = oldestSample.isValid() ? oldestSample : nextScheduledSample;
+
+        context.db.transaction();
+        QDateTime sampleEnd = EnergyLogger::nextSampleTimestamp(sampleRate, qMax(oldestBaseSample, retentionStart));
+        while (sampleEnd < until) {
+            if (QThread::currentThread()->isInterruptionRequested()) {
+                context.db.rollback();
+                return;
+            }
+            maintenanceSampleThingPower(context, thingId, sampleRate, baseSampleRate, sampleEnd);
+            sampleEnd = EnergyLogger::nextSampleTimestamp(sampleRate, sampleEnd);
+        }
+        context.db.commit();
+    }
+}
+
+// Makes clients which synced the table up to now fetch it again, see EnergyLogger::powerBalanceLogsResyncRevision().
+// Consumes a revision, so it must be called before deleting rows which might hold the newest one.
+void maintenanceRequireResync(MaintenanceContext &context, const QString &table, EnergyStatistics::Operation operation)
+{
+    QSqlQuery query(context.db);
+    query.prepare(QString("UPDATE metadata SET %1ResyncRevision = MAX(IFNULL((SELECT MAX(revision) FROM %1), 0), %1ResyncRevision) + 1;").arg(table));
+    if (!context.exec(query, operation)) {
+        qCWarning(dcEnergyExperience()) << "Error advancing the resync revision of" << table << query.lastError() << query.executedQuery();
+    }
+}
+
+// Removes the samples of a series older than beforeTime, or all of them if beforeTime is invalid
+void maintenanceTrimSamples(MaintenanceContext &context, EnergyLogs::SampleRate sampleRate, const QDateTime &beforeTime = QDateTime())
+{
+    foreach (const QString &table, QStringList({"powerBalance", "thingPower"})) {
+        // Unlike the trims at the end of the retention, clients can't tell which rows are gone
+        maintenanceRequireResync(context, table, EnergyStatistics::OperationTrim);
+
+        QSqlQuery query(context.db);
+        if (beforeTime.isValid()) {
+            query.prepare(QString("DELETE FROM %1 WHERE sampleRate = ? AND timestamp < ?;").arg(table));
+            query.addBindValue(sampleRate);
+            query.addBindValue(beforeTime.toMSecsSinceEpoch());
+        } else {
+            query.prepare(QString("DELETE FROM %1 WHERE sampleRate = ?;").arg(table));
+            query.addBindValue(sampleRate);
+        }
+        if (!context.exec(query, EnergyStatistics::OperationTrim)) {
+            qCWarning(dcEnergyExperience()) << "Error trimming" << table << "series" << sampleRate << query.lastError() << query.executedQuery();
+            continue;
+        }
+        qCDebug(dcEnergyExperience()).nospace() << "Trimmed " << query.numRowsAffected() << " from " << table << " series " << sampleRate << " (Older than: " << beforeTime.toString() << ")";
+    }
+}
+
+// The tier layout the DB has been sampled with, as stored by maintenanceStoreSampleConfigs(). The minute series is
+// included with SampleRateAny as base. DBs from before the layout became configurable have the default layout.
+QList<MaintenanceConfig> maintenanceStoredSampleConfigs(MaintenanceContext &context)
+{
+    QList<MaintenanceConfig> configs;
+    QSqlQuery query(context.db);
+    query.prepare(QStringLiteral("SELECT sampleRate, baseSampleRate, maxSamples FROM sampleConfigs ORDER BY sampleRate ASC;"));
+    if (!context.exec(query, EnergyStatistics::OperationRangeRead)) {
+        qCWarning(dcEnergyExperience()) << "Failed to load the stored energy log tier configuration:" << query.lastError();
+    }
+    while (query.next()) {
+        MaintenanceConfig cfg;
+        cfg.sampleRate = static_cast<EnergyLogs::SampleRate>(query.value("sampleRate").toInt());
+        cfg.baseSampleRate = static_cast<EnergyLogs::SampleRate>(query.value("baseSampleRate").toInt());
+        cfg.maxSamples = query.value("maxSamples").toUInt();
+        configs.append(cfg);
+    }
+    if (configs.isEmpty()) {
+        configs.append(MaintenanceConfig(EnergyLogs::SampleRate1Min, EnergyLogs::SampleRateAny, defaultMaxMinuteSamples));
+        configs.append(defaultTierConfigs());
+    }
+    return configs;
+}
+
+bool maintenanceStoreSampleConfigs(MaintenanceContext &context, const QList<MaintenanceConfig> &configs)
+{
+    context.db.transaction();
+    QSqlQuery query(context.db);
+    query.prepare(QStringLiteral("DELETE FROM sampleConfigs;"));
+    if (!context.exec(query, EnergyStatistics::OperationDelete)) {
+        qCWarning(dcEnergyExperience()) << "Failed to store the energy log tier configuration:" << query.lastError();
+        context.db.rollback();
+        return false;
+    }
+    foreach (const MaintenanceConfig &cfg, configs) {
+        query = QSqlQuery(context.db);
+        query.prepare(QStringLiteral("INSERT INTO sampleConfigs (sampleRate, baseSampleRate, maxSamples) VALUES (?, ?, ?);"));
+        query.addBindValue(cfg.sampleRate);
+        query.addBindValue(cfg.baseSampleRate);
+        query.addBindValue(cfg.maxSamples);
+        if (!context.exec(query, EnergyStatistics::OperationInsert)) {
+            qCWarning(dcEnergyExperience()) << "Failed to store the energy log tier configuration:" << query.lastError();
+            context.db.rollback();
+            return false;
+        }
+    }
+    return context.db.commit();
+}
+
+// Brings the DB from the stored tier layout to the configured one: Drops removed tiers, trims tiers with a shorter
+// retention and backfills added or rebased tiers and those with a longer retention. Regular gaps are left to
+// maintenanceRectifySamples().
+bool maintenanceApplySampleConfigs(MaintenanceContext &context, const QList<MaintenanceConfig> &configs, int maxMinuteSamples,
+                                   const QHash<EnergyLogs::SampleRate, QDateTime> &nextSamples, const QList<ThingId> &thingIds)
+{
+    QHash<EnergyLogs::SampleRate, MaintenanceConfig> stored;
+    foreach (const MaintenanceConfig &cfg, maintenanceStoredSampleConfigs(context)) {
+        stored.insert(cfg.sampleRate, cfg);
+    }
+
+    QList<MaintenanceConfig> newConfigs = {MaintenanceConfig(EnergyLogs::SampleRate1Min, EnergyLogs::SampleRateAny, maxMinuteSamples)};
+    newConfigs.append(configs);
+
+    bool changed = false;
+    foreach (const MaintenanceConfig &cfg, stored) {
+        if (!std::any_of(newConfigs.constBegin(), newConfigs.constEnd(), [&cfg](const MaintenanceConfig &c) { return c.sampleRate == cfg.sampleRate; })) {
+            qCInfo(dcEnergyExperience()) << "Energy log tier" << cfg.sampleRate << "has been removed. Dropping its samples.";
+            maintenanceTrimSamples(context, cfg.sampleRate);
+            changed = true;
+        }
+    }
+
+    foreach (const MaintenanceConfig &cfg, newConfigs) {
+        if (QThread::currentThread()->isInterruptionRequested()) {
+            return false;
+        }
+        const QDateTime nextScheduledSample = nextSamples.value(cfg.sampleRate);
+
+        const MaintenanceConfig previous = stored.value(cfg.sampleRate);
+        if (stored.contains(cfg.sampleRate) && cfg.maxSamples < previous.maxSamples) {
+            qCInfo(dcEnergyExperience()) << "Retention of energy log tier" << cfg.sampleRate << "reduced from" << previous.maxSamples << "to" << cfg.maxSamples << "samples. Trimming.";
+            maintenanceTrimSamples(context, cfg.sampleRate, EnergyLogger::calculateSampleStart(nextScheduledSample, cfg.sampleRate, (int)cfg.maxSamples));
+            changed = true;
+        }
+
+        // The minute series can't be rebuilt, a longer retention only takes effect for new samples.
+        if (cfg.sampleRate == EnergyLogs::SampleRate1Min) {
+            changed |= cfg.maxSamples != previous.maxSamples;
+            continue;
+        }
+        if (!stored.contains(cfg.sampleRate) || cfg.baseSampleRate != previous.baseSampleRate || cfg.maxSamples > previous.maxSamples) {
+            qCInfo(dcEnergyExperience()) << "Energy log tier" << cfg.sampleRate << "has been added or changed. Sampling it from" << cfg.baseSampleRate;
+            maintenanceBackfillSamples(context, cfg.sampleRate, cfg.baseSampleRate, cfg.maxSamples, nextScheduledSample, thingIds);
+            changed = true;
+        }
+    }
+
+    if (QThread::currentThread()->isInterruptionRequested()) {
+        return false;
+    }
+    if (changed || stored.count() != newConfigs.count()) {
+        return maintenanceStoreSampleConfigs(context, newConfigs);
     }
+    return true;
 }
 
-void maintenanceFillMissingMinuteSamples(QSqlDatabase &db, int maxMinuteSamples, const QDateTime &fillUntil)
+void maintenanceFillMissingMinuteSamples(MaintenanceContext &context, int maxMinuteSamples, const QDateTime &fillUntil)
 {
     if (!fillUntil.isValid()) {
         return;
     }
 
     // Power balance
-    QSqlQuery newestBalanceQuery(db);
+    QSqlQuery newestBalanceQuery(context.db);
     newestBalanceQuery.prepare(QStringLiteral("SELECT timestamp, totalConsumption, totalProduction, totalAcquisition, totalReturn FROM powerBalance WHERE sampleRate = ? ORDER BY timestamp DESC LIMIT 1;"));
     newestBalanceQuery.addBindValue(EnergyLogs::SampleRate1Min);
-    if (!newestBalanceQuery.exec()) {
+    if (!context.exec(newestBalanceQuery, EnergyStatistics::OperationLatestLookup)) {
         qCWarning(dcEnergyExperience()) << "Failed to query newest power balance 1-min sample:" << newestBalanceQuery.lastError();
         return;
     }
@@ -497,31 +845,31 @@ void maintenanceFillMissingMinuteSamples(QSqlDatabase &db, int maxMinuteSamples,
             totals.totalAcquisition = newestBalanceQuery.value("totalAcquisition").toDouble();
             totals.totalReturn = newestBalanceQuery.value("totalReturn").toDouble();
 
-            db.transaction();
+            context.db.transaction();
             while (timestamp < fillUntil) {
                 if (QThread::currentThread()->isInterruptionRequested()) {
-                    db.rollback();
+                    context.db.rollback();
                     return;
                 }
                 timestamp = timestamp.addMSecs(60000);
-                maintenanceInsertPowerBalance(db, timestamp, EnergyLogs::SampleRate1Min, 0, 0, 0, 0, totals.totalConsumption, totals.totalProduction, totals.totalAcquisition, totals.totalReturn);
+                maintenanceInsertPowerBalance(context, timestamp, EnergyLogs::SampleRate1Min, 0, 0, 0, 0, totals.totalConsumption, totals.totalProduction, totals.totalAcquisition, totals.totalReturn);
             }
-            db.commit();
+            context.db.commit();
         }
     }
 
     // Things
-    const QList<ThingId> thingIds = maintenanceLoggedThings(db);
+    const QList<ThingId> thingIds = maintenanceLoggedThings(context);
     foreach (const ThingId &thingId, thingIds) {
         if (QThread::currentThread()->isInterruptionRequested()) {
             return;
         }
 
-        QSqlQuery newestThingQuery(db);
+        QSqlQuery newestThingQuery(context.db);
         newestThingQuery.prepare(QStringLiteral("SELECT timestamp, totalConsumption, totalProduction FROM thingPower WHERE thingId = ? AND sampleRate = ? ORDER BY timestamp DESC LIMIT 1;"));
         newestThingQuery.addBindValue(thingId);
         newestThingQuery.addBindValue(EnergyLogs::SampleRate1Min);
-        if (!newestThingQuery.exec()) {
+        if (!context.exec(newestThingQuery, EnergyStatistics::OperationLatestLookup)) {
             qCWarning(dcEnergyExperience()) << "Failed to query newest thing power 1-min sample:" << thingId << newestThingQuery.lastError();
             continue;
         }
@@ -545,52 +893,247 @@ void maintenanceFillMissingMinuteSamples(QSqlDatabase &db, int maxMinuteSamples,
         totals.totalConsumption = newestThingQuery.value("totalConsumption").toDouble();
         totals.totalProduction = newestThingQuery.value("totalProduction").toDouble();
 
-        db.transaction();
+        context.db.transaction();
         while (timestamp < fillUntil) {
             if (QThread::currentThread()->isInterruptionRequested()) {
-                db.rollback();
+                context.db.rollback();
                 return;
             }
             timestamp = timestamp.addMSecs(60000);
-            maintenanceInsertThingPower(db, timestamp, EnergyLogs::SampleRate1Min, thingId, 0, totals.totalConsumption, totals.totalProduction);
+            maintenanceInsertThingPower(context, timestamp, EnergyLogs::SampleRate1Min, thingId, 0, totals.totalConsumption, totals.totalProduction);
         }
-        db.commit();
+        context.db.commit();
+    }
+}
+
+// Min/max bucketing for chart queries. Rows are streamed in timestamp order and split into fixed width time buckets.
+// Each bucket is reduced to at most two rows, at the first and last timestamp of the bucket. For every power value
+// the extremum occurring earlier goes to the first, the other to the second row, so peaks and valleys survive.
+// Totals are counters, they are taken from the first and last row in the bucket which keeps any energy diff exact.
+struct DownsampledRow {
+    qint64 timestamp = 0;
+    QVector<double> values;
+};
+
+class MinMaxBucketer
+{
+public:
+    MinMaxBucketer(int powerValueCount, qint64 origin, qint64 bucketWidth):
+        m_powerValueCount(powerValueCount),
+        m_origin(origin),
+        m_bucketWidth(qMax<qint64>(1, bucketWidth))
+    {
+    }
+
+    void add(qint64 timestamp, const QVector<double> &values, QList<DownsampledRow> *output)
+    {
+        qint64 index = (timestamp - m_origin) / m_bucketWidth;
+        if (m_count > 0 && index != m_index) {
+            finish(output);
+        }
+        if (m_count == 0) {
+            m_index = index;
+            m_first.timestamp = timestamp;
+            m_first.values = values;
+            m_min = values;
+            m_max = values;
+            m_minTimestamps.fill(timestamp, m_powerValueCount);
+            m_maxTimestamps.fill(timestamp, m_powerValueCount);
+        }
+        for (int i = 0; i < m_powerValueCount; i++) {
+            if (values.at(i) < m_min.at(i)) {
+                m_min[i] = values.at(i);
+                m_minTimestamps[i] = timestamp;
+            }
+            if (values.at(i) > m_max.at(i)) {
+                m_max[i] = values.at(i);
+                m_maxTimestamps[i] = timestamp;
+            }
+        }
+        m_last.timestamp = timestamp;
+        m_last.values = values;
+        m_count++;
+    }
+
+    void finish(QList<DownsampledRow> *output)
+    {
+        if (m_count == 0) {
+            return;
+        }
+        if (m_count == 1) {
+            output->append(m_first);
+            m_count = 0;
+            return;
+        }
+        DownsampledRow first = m_first;
+        DownsampledRow last = m_last;
+        for (int i = 0; i < m_powerValueCount; i++) {
+            bool minFirst = m_minTimestamps.at(i) <= m_maxTimestamps.at(i);
+            first.values[i] = minFirst ? m_min.at(i) : m_max.at(i);
+            last.values[i] = minFirst ? m_max.at(i) : m_min.at(i);
+        }
+        output->append(first);
+        output->append(last);
+        m_count = 0;
+    }
+
+private:
+    int m_powerValueCount = 0;
+    qint64 m_origin = 0;
+    qint64 m_bucketWidth = 1;
+
+    qint64 m_index = 0;
+    int m_count = 0;
+    DownsampledRow m_first;
+    DownsampledRow m_last;
+    QVector<double> m_min;
+    QVector<double> m_max;
+    QVector<qint64> m_minTimestamps;
+    QVector<qint64> m_maxTimestamps;
+};
+
+// Restricts the given value columns to the requested fields. No fields requested means all columns.
+QStringList projectedColumns(const QStringList &columns, const QStringList &fields)
+{
+    if (fields.isEmpty()) {
+        return columns;
+    }
+    QStringList ret;
+    foreach (const QString &column, columns) {
+        if (fields.contains(column)) {
+            ret.append(column);
+        }
+    }
+    return ret;
+}
+
+double downsampledValue(const DownsampledRow &row, const QStringList &columns, const QString &column)
+{
+    int index = columns.indexOf(column);
+    return index >= 0 ? row.values.at(index) : 0;
+}
+
+bool downsampledLogs(const QSqlDatabase &db, const QString &table, const QString &whereString, const QVariantList &bindValues, const QDateTime &from, const QDateTime &to, int maxPoints, const QStringList &powerColumns, const QStringList &totalColumns, QList<DownsampledRow> *rows)
+{
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+
+    // Every bucket yields up to 2 rows
+    int bucketCount = qMax(1, maxPoints / 2);
+
+    qint64 start = from.isNull() ? 0 : from.toMSecsSinceEpoch();
+    qint64 end = to.isNull() ? 0 : to.toMSecsSinceEpoch();
+    if (from.isNull() || to.isNull()) {
+        query.prepare("SELECT MIN(timestamp) AS oldestTimestamp, MAX(timestamp) AS newestTimestamp FROM " + table + whereString + ";");
+        foreach (const QVariant &bindValue, bindValues) {
+            query.addBindValue(bindValue);
+        }
+        if (!query.exec()) {
+            qCWarning(dcEnergyExperience()) << "Error fetching time range for downsampling:" << query.lastError() << query.executedQuery();
+            return false;
+        }
+        if (!query.next() || query.value("oldestTimestamp").isNull()) {
+            return true;
+        }
+        if (from.isNull()) {
+            start = query.value("oldestTimestamp").toLongLong();
+        }
+        if (to.isNull()) {
+            end = query.value("newestTimestamp").toLongLong();
+        }
+        query.finish();
+    }
+
+    qint64 bucketWidth = (end - start + bucketCount) / bucketCount;
+    MinMaxBucketer bucketer(powerColumns.count(), start, bucketWidth);
+
+    QStringList columns = QStringList() << "timestamp" << powerColumns << totalColumns;
+    query.prepare("SELECT " + columns.join(", ") + " FROM " + table + whereString + " ORDER BY timestamp ASC;");
+    foreach (const QVariant &bindValue, bindValues) {
+        query.addBindValue(bindValue);
     }
+    if (!query.exec()) {
+        qCWarning(dcEnergyExperience()) << "Error fetching logs for downsampling:" << query.lastError() << query.executedQuery();
+        return false;
+    }
+
+    int valueCount = powerColumns.count() + totalColumns.count();
+    QVector<double> values(valueCount);
+    while (query.next()) {
+        for (int i = 0; i < valueCount; i++) {
+            values[i] = query.value(i + 1).toDouble();
+        }
+        bucketer.add(query.value(0).toLongLong(), values, rows);
+    }
+    bucketer.finish(rows);
+
+    qCDebug(dcEnergyExperience()) << "Downsampled" << table << "to" << rows->count() << "rows using" << bucketCount << "buckets of" << bucketWidth << "ms";
+    return true;
 }
 
 } // namespace
 
 EnergyLogger::EnergyLogger(QObject *parent)
-    : EnergyLogs(parent)
+    : EnergyLogger(nullptr, parent)
+{
+
+}
+
+EnergyLogger::EnergyLogger(EnergyClock *clock, QObject *parent)
+    : EnergyLogs(parent),
+    m_clock(clock ? clock : new SystemEnergyClock(this)),
+    m_writeQueue(4096)
 {
     if (!initDB()) {
         qCCritical(dcEnergyExperience()) << "Unable to open energy log. Energy logs will not be available.";
         return;
     }
 
-    // Logging configuration
-    // Note: SampleRate1Min is always sampled as it is the base series for others
-    // Make sure your base series always has enough samples to build a full sample
-    // of all series building on it.
-
-    // Disk space considerations;
-    // Each entry takes approx 50 bytes for powerBalance + 60 bytes for thingCurrentPower per thing of disk space
-    // SQLite adds metadata and overhead of about 5%
-    // The resulting database size can be estimated with (count being the sum of all numbers below):
-    // (count * 50 bytes) + (count * things * 60 bytes) + 5%
-    // ~40000 entries, with 5 energy things => ~15MB
-    // Note: use sqlite3_analyzer to see the approx. size per entry in each table.
-
-    // One day 1440 min, let's keep one week
-    m_maxMinuteSamples = 10080;
+    // The main thread only reads from m_db, all writes go through the writer thread
+    m_writerThread = QThread::create([this]() {
+        runWriter();
+    });
+    m_writerThread->setObjectName("EnergyLogWriter");
+    m_writerThread->start();
+
+    // Logging configuration, see defaultTierConfigs() for the defaults
+    const QString settingsFile = NymeaSettings::settingsPath() + "/energy.conf";
+    QSettings settings(settingsFile, QSettings::IniFormat);
+    QMap<SampleRate, int> liveConfigs;
+    loadSampleConfigs(settings, &m_maxMinuteSamples, &m_configs, &liveConfigs);
+    applyLiveConfigs(liveConfigs);
+    loadSlowLogConfig(settings);
+
+    // Opt-in profiling, see EnergyProfiler. The environment variable takes precedence.
+    QString profileFile = qEnvironmentVariable("NYMEA_ENERGY_PROFILE_FILE");
+    settings.beginGroup("Profiling");
+    if (profileFile.isEmpty() && settings.value("enabled", false).toBool()) {
+        profileFile = settings.value("file", QDir(NymeaSettings::storagePath()).filePath("energyprofile.json")).toString();
+    }
+    if (!profileFile.isEmpty()) {
+        EnergyProfiler::instance()->start(profileFile, settings.value("maxEvents", 100000).toInt());
+        connect(&m_profileWriteTimer, &QTimer::timeout, this, [this](){
+            if (!EnergyProfiler::instance()->hasChanges()) {
+                return;
+            }
+            // Serializing up to maxEvents spans takes a while, leave it to the writer thread
+            if (!m_writerThread) {
+                EnergyProfiler::instance()->writeFile();
+                return;
+            }
+            WriteRecord record;
+            record.type = WriteRecord::TypeWriteProfile;
+            enqueueWrites({record});
+        });
+        m_profileWriteTimer.start(settings.value("writeInterval", 60).toInt() * 1000);
+    }
+    settings.endGroup();
 
-    addConfig(SampleRate15Mins, SampleRate1Min, 16128); // 6 months
-    addConfig(SampleRate1Hour, SampleRate15Mins, 8760); // 1 year
-    addConfig(SampleRate3Hours, SampleRate15Mins, 2920); // 1 year
-    addConfig(SampleRate1Day, SampleRate1Hour, 1095); // 3 years
-    addConfig(SampleRate1Week, SampleRate1Day, 168); // 3 years
-    addConfig(SampleRate1Month, SampleRate1Day, 240); // 20 years
-    addConfig(SampleRate1Year, SampleRate1Month, 20); // 20 years
+    // Tier changes in energy.conf are applied at runtime
+    if (QFile::exists(settingsFile)) {
+        m_settingsWatcher.addPath(settingsFile);
+    }
+    connect(&m_settingsWatcher, &QFileSystemWatcher::fileChanged, this, &EnergyLogger::onSettingsFileChanged);
 
     // Load last values from thingsPower logs so we have at least one base sample available for sampling, even if a thing might not produce any logs for a while.
     foreach (const ThingId &thingId, loggedThings()) {
@@ -608,185 +1151,386 @@ EnergyLogger::EnergyLogger(QObject *parent)
     // This can take a long time (especially when filling long gaps) so run it in the background.
     startDbMaintenance("startup resampling", calculateSampleStart(m_nextSamples.value(SampleRate1Min), SampleRate1Min));
 
-    // And start the sampler timer
-    connect(&m_sampleTimer, &QTimer::timeout, this, &EnergyLogger::sample);
-    m_sampleTimer.start(1000);
+    // And start sampling along the clock
+    connect(m_clock, &EnergyClock::wakeup, this, &EnergyLogger::onClockWakeup);
+    connect(m_clock, &EnergyClock::timeJumped, this, &EnergyLogger::onClockJumped);
+    scheduleWakeup();
 }
 
 EnergyLogger::~EnergyLogger()
 {
-    QThread *thread = m_dbMaintenanceThread;
-    m_dbMaintenanceThread = nullptr;
-    if (!thread) {
+    if (!m_writerThread) {
+        if (m_profileWriteTimer.isActive()) {
+            EnergyProfiler::instance()->writeFile();
+        }
         return;
     }
 
-    thread->requestInterruption();
-    thread->wait();
-    delete thread;
-}
-
-void EnergyLogger::startDbMaintenance(const QString &reason, const QDateTime &fillMinuteSamplesUntil)
-{
-    if (m_dbMaintenanceThread && m_dbMaintenanceThread->isRunning()) {
-        qCDebug(dcEnergyExperience()) << "Energy log DB maintenance thread already running. Skipping request:" << reason;
-        return;
+    // Abort a running maintenance, but write everything else which has been handed over so far,
+    // followed by the stop record. What doesn't fit into the queue is handed over as a whole.
+    m_writerThread->requestInterruption();
+    WriteRecord stopRecord;
+    stopRecord.type = WriteRecord::TypeStop;
+    if (!flushWriteBacklog() || !m_writeQueue.push(stopRecord)) {
+        m_writeBacklog.append(stopRecord);
+        QMutexLocker locker(&m_shutdownWritesMutex);
+        m_shutdownWrites = m_writeBacklog;
+        m_writeBacklog.clear();
     }
-    if (m_dbMaintenanceThread) {
-        delete m_dbMaintenanceThread;
-        m_dbMaintenanceThread = nullptr;
+    m_writeWakeups.release();
+    m_writerThread->wait();
+    delete m_writerThread;
+
+    // The writer is gone, nothing else writes the profile anymore
+    if (m_profileWriteTimer.isActive()) {
+        EnergyProfiler::instance()->writeFile();
     }
+}
 
+void EnergyLogger::startDbMaintenance(const QString &reason, const QDateTime &fillMinuteSamplesUntil)
+{
     if (m_dbMaintenanceRunning) {
         qCDebug(dcEnergyExperience()) << "Energy log DB maintenance already running. Skipping request:" << reason;
         return;
     }
-    if (m_dbFilePath.isEmpty()) {
-        qCWarning(dcEnergyExperience()) << "Cannot start energy log DB maintenance without a database path.";
+    if (!m_writerThread) {
+        qCWarning(dcEnergyExperience()) << "Cannot start energy log DB maintenance without a database.";
         return;
     }
 
     m_dbMaintenanceRunning = true;
+    m_sampleConfigsChanged = false;
     qCInfo(dcEnergyExperience()) << "Starting energy log DB maintenance in background:" << reason;
 
-    QList<MaintenanceConfig> configs;
-    for (auto it = m_configs.constBegin(); it != m_configs.constEnd(); ++it) {
-        MaintenanceConfig cfg;
-        cfg.sampleRate = it.key();
-        cfg.baseSampleRate = it.value().baseSampleRate;
-        cfg.maxSamples = it.value().maxSamples;
-        configs.append(cfg);
+    WriteRecord record;
+    record.type = WriteRecord::TypeMaintenance;
+    record.reason = reason;
+    record.timestamp = fillMinuteSamplesUntil;
+    record.maxMinuteSamples = m_maxMinuteSamples;
+    record.configs = m_configs;
+
+    // The maintenance works up to the schedule of the logger's clock
+    record.nextSamples = m_nextSamples;
+    const QDateTime now = m_clock->now();
+    if (!record.nextSamples.contains(SampleRate1Min)) {
+        record.nextSamples.insert(SampleRate1Min, nextSampleTimestamp(SampleRate1Min, now));
     }
-    const int maxMinuteSamples = m_maxMinuteSamples;
-    const QString dbFilePath = m_dbFilePath;
-    const QHash<SampleRate, QDateTime> nextSamples = m_nextSamples;
+    foreach (SampleRate sampleRate, m_configs.keys()) {
+        if (!record.nextSamples.contains(sampleRate)) {
+            record.nextSamples.insert(sampleRate, nextSampleTimestamp(sampleRate, now));
+        }
+    }
+    enqueueWrites({record});
+}
 
-    QPointer<EnergyLogger> self(this);
-    QThread *thread = QThread::create([self, reason, dbFilePath, configs, maxMinuteSamples, fillMinuteSamplesUntil, nextSamples]() {
-        if (!self) {
+void EnergyLogger::enqueueWrites(const QList<WriteRecord> &records)
+{
+    if (!m_writerThread || records.isEmpty()) {
+        return;
+    }
+
+    if (m_writeBacklog.isEmpty()) {
+        int pushed = 0;
+        while (pushed < records.count() && m_writeQueue.push(records.at(pushed))) {
+            pushed++;
+        }
+        m_writesSubmitted += pushed;
+        m_writeWakeups.release();
+        if (pushed == records.count()) {
             return;
         }
+        // Usually a long maintenance run holding up the writer
+        qCInfo(dcEnergyExperience()) << "Energy log write queue full. Holding back writes until the writer catches up.";
+        m_writeBacklog = records.mid(pushed);
+        return;
+    }
+    m_writeBacklog.append(records);
+    flushWriteBacklog();
+}
+
+bool EnergyLogger::flushWriteBacklog()
+{
+    int pushed = 0;
+    while (!m_writeBacklog.isEmpty() && m_writeQueue.push(m_writeBacklog.first())) {
+        m_writeBacklog.removeFirst();
+        pushed++;
+    }
+    if (pushed > 0) {
+        m_writesSubmitted += pushed;
+        m_writeWakeups.release();
+    }
+    return m_writeBacklog.isEmpty();
+}
 
-        QElapsedTimer timer;
-        timer.start();
+bool EnergyLogger::writesPending() const
+{
+    return !m_writeBacklog.isEmpty() || m_writesCompleted < m_writesSubmitted;
+}
 
-        const QString connectionName = QStringLiteral("energylogs_maintenance_%1").arg(QUuid::createUuid().toString(QUuid::WithoutBraces));
-        {
-            QSqlDatabase db = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), connectionName);
-            db.setConnectOptions(QStringLiteral("QSQLITE_BUSY_TIMEOUT=5000"));
-            db.setDatabaseName(dbFilePath);
-            if (!db.open()) {
-                qCWarning(dcEnergyExperience()) << "Cannot open energy log DB for maintenance at" << dbFilePath << db.lastError();
-            } else {
-                QSqlQuery pragmaQuery(db);
-                pragmaQuery.exec(QStringLiteral("PRAGMA journal_mode=WAL;"));
-                pragmaQuery.exec(QStringLiteral("PRAGMA synchronous=NORMAL;"));
+void EnergyLogger::onWritesDone(const WriteResult &result)
+{
+    m_writesCompleted += result.records;
+    for (int i = 0; i < result.timings.count(); i++) {
+        m_statistics.record(result.timings.at(i).first, result.timings.at(i).second);
+    }
 
-                if (fillMinuteSamplesUntil.isValid()) {
-                    maintenanceFillMissingMinuteSamples(db, maxMinuteSamples, fillMinuteSamplesUntil);
-                }
+    for (int i = 0; i < result.powerBalanceEntries.count(); i++) {
+        emit powerBalanceEntryAdded(result.powerBalanceEntries.at(i).first, result.powerBalanceEntries.at(i).second);
+    }
+    for (int i = 0; i < result.thingPowerEntries.count(); i++) {
+        emit thingPowerEntryAdded(result.thingPowerEntries.at(i).first, result.thingPowerEntries.at(i).second);
+    }
 
-                const QList<ThingId> thingIds = maintenanceLoggedThings(db);
-                foreach (const MaintenanceConfig &cfg, configs) {
-                    if (QThread::currentThread()->isInterruptionRequested()) {
-                        break;
-                    }
-                    QDateTime nextScheduledSample = nextSamples.value(cfg.sampleRate);
-                    if (!nextScheduledSample.isValid()) {
-                        nextScheduledSample = maintenanceNextSampleTimestamp(cfg.sampleRate, QDateTime::currentDateTime());
-                    }
-                    maintenanceRectifySamples(db, cfg.sampleRate, cfg.baseSampleRate, cfg.maxSamples, nextScheduledSample, thingIds);
-                }
-            }
-            db.close();
+    if (!result.maintenanceReason.isEmpty()) {
+        qCInfo(dcEnergyExperience()) << "Energy log DB maintenance finished:" << result.maintenanceReason << "in" << result.maintenanceDuration << "ms.";
+        m_dbMaintenanceRunning = false;
+
+        // The tier configuration changed while the maintenance was busy
+        if (m_sampleConfigsChanged) {
+            startDbMaintenance("re-tiering");
         }
-        QSqlDatabase::removeDatabase(connectionName);
+    }
 
-        if (!self) {
-            return;
+    if (result.gapDetected) {
+        qCWarning(dcEnergyExperience()).nospace() << "Clock skew detected. Scheduling background recovery job.";
+        startDbMaintenance("clock skew recovery");
+    }
+
+    flushWriteBacklog();
+}
+
+void EnergyLogger::runWriter()
+{
+    const QString connectionName = QStringLiteral("energylogs_writer");
+    {
+        WriteContext context;
+        context.db = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), connectionName);
+        context.db.setConnectOptions(QStringLiteral("QSQLITE_BUSY_TIMEOUT=5000"));
+        context.db.setDatabaseName(m_dbFilePath);
+        if (!context.db.open()) {
+            qCWarning(dcEnergyExperience()) << "Cannot open energy log DB for writing at" << m_dbFilePath << context.db.lastError();
+        } else {
+            QSqlQuery pragmaQuery(context.db);
+            pragmaQuery.exec(QStringLiteral("PRAGMA journal_mode=WAL;"));
+            pragmaQuery.exec(QStringLiteral("PRAGMA synchronous=NORMAL;"));
         }
-        const qint64 durationMs = timer.elapsed();
-        QMetaObject::invokeMethod(self, [self, reason, durationMs]() {
-            if (!self) {
-                return;
+
+        forever {
+            m_writeWakeups.acquire();
+
+            // Everything queued until now goes into one transaction. Maintenance runs manage their own.
+            WriteRecord record;
+            bool stop = false;
+            while (!stop && takeWrite(&record)) {
+                if (record.type == WriteRecord::TypeStop) {
+                    stop = true;
+                    continue;
+                }
+                if (record.type == WriteRecord::TypeMaintenance) {
+                    postWriteResult(&context);
+                    runMaintenance(&context, record);
+                    context.result.records++;
+                    postWriteResult(&context);
+                    continue;
+                }
+                if (record.type == WriteRecord::TypeWriteProfile) {
+                    // Don't hold the transaction open while serializing
+                    postWriteResult(&context);
+                    executeWrite(&context, record);
+                    context.result.records++;
+                    continue;
+                }
+                if (!context.batchOpen) {
+                    context.batchOpen = context.db.transaction();
+                }
+                executeWrite(&context, record);
+                context.result.records++;
             }
-            qCInfo(dcEnergyExperience()) << "Energy log DB maintenance finished:" << reason << "in" << durationMs << "ms.";
-            self->m_dbMaintenanceRunning = false;
-            self->flushPendingDbWrites();
-        }, Qt::QueuedConnection);
-    });
+            postWriteResult(&context);
 
-    m_dbMaintenanceThread = thread;
-    connect(thread, &QThread::finished, this, [this, thread]() {
-        if (m_dbMaintenanceThread == thread) {
-            m_dbMaintenanceThread = nullptr;
+            if (stop) {
+                break;
+            }
         }
-        delete thread;
-    });
-    thread->start();
+        context.db.close();
+    }
+    QSqlDatabase::removeDatabase(connectionName);
 }
 
-void EnergyLogger::flushPendingDbWrites()
+bool EnergyLogger::takeWrite(WriteRecord *record)
 {
-    if (m_dbMaintenanceRunning) {
-        return;
+    if (m_writeQueue.pop(record)) {
+        return true;
     }
+    // Only filled at shutdown, once nothing is pushed to the queue anymore
+    QMutexLocker locker(&m_shutdownWritesMutex);
+    if (m_shutdownWrites.isEmpty()) {
+        return false;
+    }
+    *record = m_shutdownWrites.takeFirst();
+    return true;
+}
 
-    // Remove queued thing logs first to avoid re-inserting data for removed things.
-    foreach (const ThingId &thingId, m_pendingThingLogRemovals) {
-        QSqlQuery query(m_db);
-        query.prepare(QStringLiteral("DELETE FROM thingPower WHERE thingId = ?;"));
-        query.addBindValue(thingId);
-        if (!query.exec()) {
-            qCWarning(dcEnergyExperience()) << "Error removing thing energy logs for thing id" << thingId << query.lastError() << query.executedQuery();
+void EnergyLogger::postWriteResult(WriteContext *context)
+{
+    if (context->batchOpen) {
+        EnergyProfiler::Span span("commit", "db");
+        span.setArg("records", context->result.records);
+        if (!context->db.commit()) {
+            qCWarning(dcEnergyExperience()) << "Error committing energy log writes:" << context->db.lastError();
         }
+        context->batchOpen = false;
+    }
+    if (context->result.records == 0) {
+        return;
+    }
 
-        query = QSqlQuery(m_db);
-        query.prepare(QStringLiteral("DELETE FROM thingCache WHERE thingId = ?;"));
-        query.addBindValue(thingId);
-        if (!query.exec()) {
-            qCWarning(dcEnergyExperience()) << "Error removing thing cache entry for thing id" << thingId << query.lastError() << query.executedQuery();
+    const WriteResult result = context->result;
+    context->result = WriteResult();
+    QMetaObject::invokeMethod(this, [this, result]() {
+        onWritesDone(result);
+    }, Qt::QueuedConnection);
+}
+
+void EnergyLogger::executeWrite(WriteContext *context, const WriteRecord &record) const
+{
+    MaintenanceContext maintenance = {context->db, [this, context](QSqlQuery &query, EnergyStatistics::Operation operation) {
+        return execWriteQuery(context, query, operation);
+    }};
+
+    switch (record.type) {
+    case WriteRecord::TypePowerBalance: {
+        // The DB must continue where the live sampling is, anything else means the clock jumped or samples got lost
+        if (record.sampleRate == SampleRate1Min) {
+            QDateTime sampleStart = record.timestamp.addMSecs(-60 * 1000);
+            QDateTime newestInDB = maintenanceGetNewestPowerBalanceSampleTimestamp(maintenance, SampleRate1Min);
+            if (newestInDB.isValid() && newestInDB < sampleStart) {
+                qCWarning(dcEnergyExperience()) << "Filling gap in the minute samples from" << newestInDB.toString() << "to" << sampleStart.toString();
+                if (context->batchOpen) {
+                    context->db.commit();
+                    context->batchOpen = false;
+                }
+                maintenanceFillMissingMinuteSamples(maintenance, record.maxMinuteSamples, sampleStart);
+                context->batchOpen = context->db.transaction();
+                context->result.gapDetected = true;
+            }
         }
+        insertPowerBalance(context, record.timestamp, record.sampleRate, record.values.at(0), record.values.at(1), record.values.at(2), record.values.at(3),
+                           record.values.at(4), record.values.at(5), record.values.at(6), record.values.at(7), record.stats, record.sampleCount);
+        break;
     }
-    m_pendingThingLogRemovals.clear();
+    case WriteRecord::TypeThingPower:
+        insertThingPower(context, record.timestamp, record.sampleRate, record.thingId, record.values.at(0), record.values.at(1), record.values.at(2), record.stats, record.sampleCount);
+        break;
+    case WriteRecord::TypeSampleTier: {
+        // A tier can't be sampled over a gap, the maintenance rectifies it up to and including this sample
+        QDateTime newestInDB = maintenanceGetNewestPowerBalanceSampleTimestamp(maintenance, record.sampleRate);
+        if (newestInDB.isValid() && newestInDB < previousSampleTimestamp(record.sampleRate, record.timestamp)) {
+            context->result.gapDetected = true;
+            break;
+        }
+        EnergyProfiler::Span tierSpan("aggregate", "sampling");
+        tierSpan.setArg("sampleRate", record.sampleRate);
+        tierSpan.setArg("baseSampleRate", record.baseSampleRate);
+        samplePowerBalance(context, record.sampleRate, record.baseSampleRate, record.timestamp);
+        foreach (const ThingId &thingId, record.thingIds) {
+            sampleThingPower(context, thingId, record.sampleRate, record.baseSampleRate, record.timestamp);
+        }
+        break;
+    }
+    case WriteRecord::TypeTrim:
+        trimPowerBalance(context, record.sampleRate, record.timestamp);
+        foreach (const ThingId &thingId, record.thingIds) {
+            trimThingPower(context, thingId, record.sampleRate, record.timestamp);
+        }
+        break;
+    case WriteRecord::TypeRemoveThing: {
+        maintenanceRequireResync(maintenance, "thingPower", EnergyStatistics::OperationDelete);
+
+        QSqlQuery query(context->db);
+        query.prepare("DELETE FROM thingPower WHERE thingId = ?;");
+        query.addBindValue(record.thingId);
+        if (!execWriteQuery(context, query, EnergyStatistics::OperationDelete)) {
+            qCWarning(dcEnergyExperience()) << "Error removing thing energy logs for thing id" << record.thingId << query.lastError() << query.executedQuery();
+        }
 
-    // Flush cached thing state (deduplicated to latest value per thing).
-    for (auto it = m_pendingThingCacheEntries.constBegin(); it != m_pendingThingCacheEntries.constEnd(); ++it) {
-        const ThingId &thingId = it.key();
-        const QPair<double, double> &totals = it.value();
-        cacheThingEntry(thingId, totals.first, totals.second);
+        query = QSqlQuery(context->db);
+        query.prepare("DELETE FROM thingCache WHERE thingId = ?;");
+        query.addBindValue(record.thingId);
+        if (!execWriteQuery(context, query, EnergyStatistics::OperationDelete)) {
+            qCWarning(dcEnergyExperience()) << "Error removing thing cache entry for thing id" << record.thingId << query.lastError() << query.executedQuery();
+        }
+        break;
+    }
+    case WriteRecord::TypeCacheThing: {
+        QSqlQuery query(context->db);
+        query.prepare("INSERT OR REPLACE INTO thingCache (thingId, totalEnergyConsumed, totalEnergyProduced) VALUES (?, ?, ?);");
+        query.addBindValue(record.thingId);
+        query.addBindValue(record.values.at(0));
+        query.addBindValue(record.values.at(1));
+        if (!execWriteQuery(context, query, EnergyStatistics::OperationCacheWrite)) {
+            qCWarning(dcEnergyExperience()) << "Failed to store thing cache entry:" << query.lastError() << query.executedQuery();
+        }
+        break;
     }
-    m_pendingThingCacheEntries.clear();
+    case WriteRecord::TypeMaintenance:
+        runMaintenance(context, record);
+        break;
+    case WriteRecord::TypeWriteProfile:
+        EnergyProfiler::instance()->writeFile();
+        break;
+    case WriteRecord::TypeStop:
+        break;
+    }
+}
+
+void EnergyLogger::runMaintenance(WriteContext *context, const WriteRecord &record) const
+{
+    QElapsedTimer timer;
+    timer.start();
+    EnergyProfiler::Span maintenanceSpan("maintenance", "maintenance");
+    maintenanceSpan.setArg("reason", record.reason);
+    MaintenanceContext maintenance = {context->db, [this, context](QSqlQuery &query, EnergyStatistics::Operation operation) {
+        return execWriteQuery(context, query, operation);
+    }};
 
-    // Flush queued samples.
-    const int pendingPowerBalanceSamples = m_pendingPowerBalanceSamples.count();
-    const int pendingThingPowerSamples = m_pendingThingPowerSamples.count();
+    QList<MaintenanceConfig> configs;
+    for (auto it = record.configs.constBegin(); it != record.configs.constEnd(); ++it) {
+        configs.append(MaintenanceConfig(it.key(), it.value().baseSampleRate, it.value().maxSamples));
+    }
 
-    for (const PendingPowerBalanceSample &sample: m_pendingPowerBalanceSamples) {
-        insertPowerBalance(sample.timestamp, sample.sampleRate,
-                           sample.consumption, sample.production, sample.acquisition, sample.storage,
-                           sample.totalConsumption, sample.totalProduction, sample.totalAcquisition, sample.totalReturn);
+    if (record.timestamp.isValid()) {
+        EnergyProfiler::Span span("fillMissingMinuteSamples", "maintenance");
+        maintenanceFillMissingMinuteSamples(maintenance, record.maxMinuteSamples, record.timestamp);
     }
-    m_pendingPowerBalanceSamples.clear();
 
-    for (const PendingThingPowerSample &sample: m_pendingThingPowerSamples) {
-        insertThingPower(sample.timestamp, sample.sampleRate, sample.thingId,
-                         sample.currentPower, sample.totalConsumption, sample.totalProduction);
+    const QList<ThingId> thingIds = maintenanceLoggedThings(maintenance);
+    {
+        EnergyProfiler::Span span("applySampleConfigs", "maintenance");
+        maintenanceApplySampleConfigs(maintenance, configs, record.maxMinuteSamples, record.nextSamples, thingIds);
     }
-    m_pendingThingPowerSamples.clear();
 
-    if (pendingPowerBalanceSamples > 0 || pendingThingPowerSamples > 0) {
-        qCDebug(dcEnergyExperience()) << "Flushed queued samples after DB maintenance. Power balance:" << pendingPowerBalanceSamples << "Thing power:" << pendingThingPowerSamples;
+    foreach (const MaintenanceConfig &cfg, configs) {
+        if (QThread::currentThread()->isInterruptionRequested()) {
+            break;
+        }
+        EnergyProfiler::Span span("rectifySamples", "maintenance");
+        span.setArg("sampleRate", cfg.sampleRate);
+        maintenanceRectifySamples(maintenance, cfg.sampleRate, cfg.baseSampleRate, cfg.maxSamples, record.nextSamples.value(cfg.sampleRate), thingIds);
     }
+
+    context->result.maintenanceReason = record.reason;
+    context->result.maintenanceDuration = timer.elapsed();
 }
 
 void EnergyLogger::logPowerBalance(double consumption, double production, double acquisition, double storage, double totalConsumption, double totalProduction, double totalAcquisition, double totalReturn)
 {
-    PowerBalanceLogEntry entry(QDateTime::currentDateTime(), consumption, production, acquisition, storage, totalConsumption, totalProduction, totalAcquisition, totalReturn);
+    const QDateTime now = m_clock->now();
+    PowerBalanceLogEntry entry(now, consumption, production, acquisition, storage, totalConsumption, totalProduction, totalAcquisition, totalReturn);
 
     // Add everything to livelog, keep that for one day, in memory only
     m_balanceLiveLog.prepend(entry);
-    while (m_balanceLiveLog.count() > 1 && m_balanceLiveLog.last().timestamp().addDays(1) < QDateTime::currentDateTime()) {
+    while (m_balanceLiveLog.count() > 1 && m_balanceLiveLog.last().timestamp().addDays(1) < now) {
         qCDebug(dcEnergyExperience()) << "Discarding livelog entry from" << m_balanceLiveLog.last().timestamp().toString();
         m_balanceLiveLog.removeLast();
     }
@@ -794,72 +1538,260 @@ void EnergyLogger::logPowerBalance(double consumption, double production, double
 
 void EnergyLogger::logThingPower(const ThingId &thingId, double currentPower, double totalConsumption, double totalProduction)
 {
-    ThingPowerLogEntry entry(QDateTime::currentDateTime(), thingId, currentPower, totalConsumption, totalProduction);
+    const QDateTime now = m_clock->now();
+    ThingPowerLogEntry entry(now, thingId, currentPower, totalConsumption, totalProduction);
 
     m_thingsPowerLiveLogs[thingId].prepend(entry);
-    while (m_thingsPowerLiveLogs[thingId].count() > 1 && m_thingsPowerLiveLogs[thingId].last().timestamp().addDays(1) < QDateTime::currentDateTime()) {
+    while (m_thingsPowerLiveLogs[thingId].count() > 1 && m_thingsPowerLiveLogs[thingId].last().timestamp().addDays(1) < now) {
         qCDebug(dcEnergyExperience()) << "Discarding thing power livelog entry for thing" << thingId << "from" << m_thingsPowerLiveLogs[thingId].last().timestamp().toString();
         m_thingsPowerLiveLogs[thingId].removeLast();
     }
 }
 
 PowerBalanceLogEntries EnergyLogger::powerBalanceLogs(SampleRate sampleRate, const QDateTime &from, const QDateTime &to) const
+{
+    return powerBalanceLogs(sampleRate, from, to, QueryOptions());
+}
+
+PowerBalanceLogEntries EnergyLogger::powerBalanceLogs(SampleRate sampleRate, const QDateTime &from, const QDateTime &to, const QueryOptions &options, QString *nextCursor) const
 {
     PowerBalanceLogEntries result;
+    if (nextCursor) {
+        nextCursor->clear();
+    }
 
-    QSqlQuery query(m_db);
-    QString queryString = "SELECT * FROM powerBalance WHERE sampleRate = ?";
+    if (sampleRate < SampleRateAny) {
+        return livePowerBalanceLogs(sampleRate, from, to, options, nextCursor);
+    }
+
+    QStringList powerColumns = projectedColumns({"consumption", "production", "acquisition", "storage"}, options.fields);
+    QStringList totalColumns = projectedColumns({"totalConsumption", "totalProduction", "totalAcquisition", "totalReturn"}, options.fields);
+
+    QString whereString = " WHERE sampleRate = ?";
     QVariantList bindValues;
     bindValues << sampleRate;
     qCDebug(dcEnergyExperience()) << "Fetching logs. Timestamp:" << from << from.isNull();
     if (!from.isNull()) {
-        queryString += " AND timestamp >= ?";
+        whereString += " AND timestamp >= ?";
         bindValues << from.toMSecsSinceEpoch();
     }
     if (!to.isNull()) {
-        queryString += " AND timestamp <= ?";
+        whereString += " AND timestamp <= ?";
         bindValues << to.toMSecsSinceEpoch();
     }
-    queryString += " ORDER BY timestamp ASC";
+
+    if (options.maxPoints > 0) {
+        QList<DownsampledRow> rows;
+        if (!downsampledLogs(m_db, "powerBalance", whereString, bindValues, from, to, options.maxPoints, powerColumns, totalColumns, &rows)) {
+            return result;
+        }
+        const QStringList columns = powerColumns + totalColumns;
+        foreach (const DownsampledRow &row, rows) {
+            result.append(PowerBalanceLogEntry(QDateTime::fromMSecsSinceEpoch(row.timestamp),
+                                               downsampledValue(row, columns, "consumption"),
+                                               downsampledValue(row, columns, "production"),
+                                               downsampledValue(row, columns, "acquisition"),
+                                               downsampledValue(row, columns, "storage"),
+                                               downsampledValue(row, columns, "totalConsumption"),
+                                               downsampledValue(row, columns, "totalProduction"),
+                                               downsampledValue(row, columns, "totalAcquisition"),
+                                               downsampledValue(row, columns, "totalReturn")));
+        }
+        return result;
+    }
+
+    if (!options.cursor.isEmpty()) {
+        qint64 cursorTimestamp = 0;
+        if (!decodeCursor(options.cursor, &cursorTimestamp)) {
+            qCWarning(dcEnergyExperience()) << "Invalid cursor for power balance logs:" << options.cursor;
+            return result;
+        }
+        whereString += " AND timestamp > ?";
+        bindValues << cursorTimestamp;
+    }
+    if (options.sinceRevision > 0 && options.sinceRevision >= powerBalanceLogsResyncRevision()) {
+        whereString += " AND revision > ?";
+        bindValues << options.sinceRevision;
+    }
+    QString queryString = "SELECT " + (QStringList() << "timestamp" << powerColumns << totalColumns).join(", ") + " FROM powerBalance" + whereString + " ORDER BY timestamp ASC";
+    if (options.limit > 0) {
+        // Fetch one more to know whether there is a next page
+        queryString += " LIMIT ?";
+        bindValues << options.limit + 1;
+    }
+
+    QSqlQuery query(m_db);
     query.prepare(queryString);
     foreach (const QVariant &bindValue, bindValues) {
         query.addBindValue(bindValue);
     }
 
     qCDebug(dcEnergyExperience()) << "Executing" << queryString << bindValues;
-    query.exec();
+    query.setForwardOnly(true);
+    execQuery(query, EnergyStatistics::OperationRangeRead);
     if (query.lastError().isValid()) {
         qCWarning(dcEnergyExperience()) << "Error fetching power balance logs:" << query.lastError() << query.executedQuery();
         return result;
     }
 
     while (query.next()) {
-        //        qCDebug(dcEnergyExperience()) << "Adding result";
+        if (options.limit > 0 && result.count() == options.limit) {
+            if (nextCursor) {
+                *nextCursor = encodeCursor(result.last().timestamp().toMSecsSinceEpoch());
+            }
+            break;
+        }
         result.append(queryResultToBalanceLogEntry(query.record()));
     }
     return result;
 }
 
 ThingPowerLogEntries EnergyLogger::thingPowerLogs(SampleRate sampleRate, const QList<ThingId> &thingIds, const QDateTime &from, const QDateTime &to) const
+{
+    return thingPowerLogs(sampleRate, thingIds, from, to, QueryOptions());
+}
+
+ThingPowerLogEntries EnergyLogger::thingPowerLogs(SampleRate sampleRate, const QList<ThingId> &thingIds, const QDateTime &from, const QDateTime &to, const QueryOptions &options, QString *nextCursor) const
 {
     ThingPowerLogEntries result;
+    if (nextCursor) {
+        nextCursor->clear();
+    }
 
-    QSqlQuery query(m_db);
-    QString queryString = "SELECT * FROM thingPower WHERE sampleRate = ?";
-    QVariantList bindValues;
-    bindValues << sampleRate;
+    if (sampleRate < SampleRateAny) {
+        return liveThingPowerLogs(sampleRate, thingIds, from, to, options, nextCursor);
+    }
+
+    QStringList powerColumns = projectedColumns({"currentPower"}, options.fields);
+    QStringList totalColumns = projectedColumns({"totalConsumption", "totalProduction"}, options.fields);
 
     qCDebug(dcEnergyExperience()) << "Fetching thing power logs for" << thingIds;
 
-    QStringList thingsQuery;
-    foreach (const ThingId &thingId, thingIds) {
-        thingsQuery.append("thingId = ?");
-        bindValues << thingId;
+    // Every thing is read with a range scan of its own on idx_thingPower(thingId, sampleRate, timestamp). An OR list of
+    // thingIds can't always be turned into index probes by SQLite and runs into the host parameter limit.
+    QList<ThingId> things = thingIds;
+    if (things.isEmpty()) {
+        things = loggedThings();
+    }
+
+    QString whereString = " WHERE thingId = ? AND sampleRate = ?";
+    QVariantList bindValues;
+    if (!from.isNull()) {
+        whereString += " AND timestamp >= ?";
+        bindValues << from.toMSecsSinceEpoch();
+    }
+    if (!to.isNull()) {
+        whereString += " AND timestamp <= ?";
+        bindValues << to.toMSecsSinceEpoch();
+    }
+
+    if (options.maxPoints > 0) {
+        // Each thing is a series of its own and gets its own buckets.
+        QList<QPair<ThingId, DownsampledRow>> rows;
+        foreach (const ThingId &thingId, things) {
+            QList<DownsampledRow> thingRows;
+            if (!downsampledLogs(m_db, "thingPower", whereString, QVariantList() << thingId << sampleRate << bindValues, from, to, options.maxPoints, powerColumns, totalColumns, &thingRows)) {
+                return result;
+            }
+            foreach (const DownsampledRow &row, thingRows) {
+                rows.append(qMakePair(thingId, row));
+            }
+        }
+        std::stable_sort(rows.begin(), rows.end(), [](const QPair<ThingId, DownsampledRow> &a, const QPair<ThingId, DownsampledRow> &b){
+            return a.second.timestamp < b.second.timestamp;
+        });
+        const QStringList columns = powerColumns + totalColumns;
+        for (int i = 0; i < rows.count(); i++) {
+            const DownsampledRow &row = rows.at(i).second;
+            result.append(ThingPowerLogEntry(QDateTime::fromMSecsSinceEpoch(row.timestamp), rows.at(i).first,
+                                             downsampledValue(row, columns, "currentPower"),
+                                             downsampledValue(row, columns, "totalConsumption"),
+                                             downsampledValue(row, columns, "totalProduction")));
+        }
+        return result;
+    }
+
+    qint64 cursorTimestamp = 0;
+    ThingId cursorThingId;
+    if (!options.cursor.isEmpty() && !decodeCursor(options.cursor, &cursorTimestamp, &cursorThingId)) {
+        qCWarning(dcEnergyExperience()) << "Invalid cursor for thing power logs:" << options.cursor;
+        return result;
+    }
+    QueryOptions scanOptions = options;
+    if (scanOptions.sinceRevision > 0 && scanOptions.sinceRevision < thingPowerLogsResyncRevision()) {
+        // Deleted entries can't be expressed by revisions, the client gets everything to resync
+        scanOptions.sinceRevision = 0;
+    }
+
+    ThingPowerScanMerge merge;
+    foreach (const ThingId &thingId, things) {
+        QVariantList thingBindValues;
+        QString queryString = thingPowerScanQuery(sampleRate, thingId, from, to, powerColumns + totalColumns, scanOptions, &thingBindValues);
+
+        QSqlQuery query(m_db);
+        query.prepare(queryString);
+        foreach (const QVariant &bindValue, thingBindValues) {
+            query.addBindValue(bindValue);
+        }
+        query.setForwardOnly(true);
+        execQuery(query, EnergyStatistics::OperationRangeRead);
+        if (query.lastError().isValid()) {
+            qCWarning(dcEnergyExperience()) << "Error fetching thing power logs:" << query.lastError() << query.executedQuery();
+            return result;
+        }
+        merge.addScan(thingId.toString(), query);
     }
-    if (!thingsQuery.isEmpty()) {
-        queryString += " AND (" + thingsQuery.join(" OR ") + " )";
+
+    while (!merge.atEnd()) {
+        if (options.limit > 0 && result.count() == options.limit) {
+            if (nextCursor) {
+                *nextCursor = encodeCursor(result.last().timestamp().toMSecsSinceEpoch(), result.last().thingId());
+            }
+            break;
+        }
+        result.append(merge.takeNext());
     }
+    return result;
+}
+
+ThingEnergyDeltas EnergyLogger::energyBetween(const QList<ThingId> &thingIds, const QDateTime &from, const QDateTime &to) const
+{
+    ThingEnergyDeltas result;
+    QList<ThingId> things = thingIds;
+    if (things.isEmpty()) {
+        things = cachedThings();
+    }
+    foreach (const ThingId &thingId, things) {
+        ThingPowerLogEntry fromEntry = thingTotalsAt(thingId, from);
+        ThingPowerLogEntry toEntry = thingTotalsAt(thingId, to);
+        result.append(ThingEnergyDelta(thingId, toEntry.totalConsumption() - fromEntry.totalConsumption(), toEntry.totalProduction() - fromEntry.totalProduction()));
+    }
+    return result;
+}
+
+PowerBalanceEnergyDelta EnergyLogger::powerBalanceEnergyBetween(const QDateTime &from, const QDateTime &to) const
+{
+    PowerBalanceLogEntry fromEntry = powerBalanceTotalsAt(from);
+    PowerBalanceLogEntry toEntry = powerBalanceTotalsAt(to);
+    return PowerBalanceEnergyDelta(toEntry.totalConsumption() - fromEntry.totalConsumption(),
+                                   toEntry.totalProduction() - fromEntry.totalProduction(),
+                                   toEntry.totalAcquisition() - fromEntry.totalAcquisition(),
+                                   toEntry.totalReturn() - fromEntry.totalReturn());
+}
 
+QList<EnergyLogger::StatsEntry> EnergyLogger::powerStats(SampleRate sampleRate, const ThingId &thingId, const QDateTime &from, const QDateTime &to) const
+{
+    QList<StatsEntry> result;
+    const QStringList fields = thingId.isNull() ? powerBalanceStatsFields : thingPowerStatsFields;
+    QString queryString = QString("SELECT timestamp, %1 FROM %2 WHERE ").arg(statsColumns(fields), thingId.isNull() ? "powerBalance" : "thingPower");
+    QVariantList bindValues;
+    if (!thingId.isNull()) {
+        queryString += "thingId = ? AND ";
+        bindValues << thingId;
+    }
+    // Rows from before the stats were introduced have none
+    queryString += "sampleRate = ? AND sampleCount IS NOT NULL";
+    bindValues << sampleRate;
     if (!from.isNull()) {
         queryString += " AND timestamp >= ?";
         bindValues << from.toMSecsSinceEpoch();
@@ -868,27 +1800,221 @@ ThingPowerLogEntries EnergyLogger::thingPowerLogs(SampleRate sampleRate, const Q
         queryString += " AND timestamp <= ?";
         bindValues << to.toMSecsSinceEpoch();
     }
-    queryString += " ORDER BY timestamp ASC";
+    queryString += " ORDER BY timestamp ASC;";
+
+    QSqlQuery query(m_db);
+    query.setForwardOnly(true);
     query.prepare(queryString);
     foreach (const QVariant &bindValue, bindValues) {
         query.addBindValue(bindValue);
     }
-    query.exec();
-    if (query.lastError().isValid()) {
-        qCWarning(dcEnergyExperience()) << "Error fetching thing power logs:" << query.lastError() << query.executedQuery();
+    if (!execQuery(query, EnergyStatistics::OperationRangeRead)) {
+        qCWarning(dcEnergyExperience()) << "Error fetching power stats:" << query.lastError() << query.executedQuery();
         return result;
     }
+    while (query.next()) {
+        StatsEntry entry;
+        entry.timestamp = QDateTime::fromMSecsSinceEpoch(query.value("timestamp").toLongLong());
+        entry.sampleCount = query.value("sampleCount").toInt();
+        foreach (const QString &field, fields) {
+            PowerStats stats;
+            stats.min = query.value(field + "Min").toDouble();
+            stats.max = query.value(field + "Max").toDouble();
+            stats.peak15 = query.value(field + "Peak15").toDouble();
+            entry.stats.insert(field, stats);
+        }
+        result.append(entry);
+    }
+    return result;
+}
 
+ThingEnergyDeltas EnergyLogger::topConsumers(const QDateTime &from, const QDateTime &to, int count) const
+{
+    // Ranked in a single statement. The totals at from and to are picked by the same rules as in totalsAt(), so the
+    // deltas agree with energyBetween(). Like cachedThings(), every logged thing is listed in thingCache.
+    ThingEnergyDeltas result;
+    QVariantList bindValues;
+    QString fromRowQuery = totalsAtRowQuery("thingPower", "thingId = things.thingId AND ", from, &bindValues);
+    QString toRowQuery = totalsAtRowQuery("thingPower", "thingId = things.thingId AND ", to, &bindValues);
+    bindValues << count;
+
+    QSqlQuery query(m_db);
+    query.setForwardOnly(true);
+    query.prepare(QString("SELECT bounds.thingId AS thingId, "
+                          "COALESCE(toRow.totalConsumption, 0) - COALESCE(fromRow.totalConsumption, 0) AS consumptionDelta, "
+                          "COALESCE(toRow.totalProduction, 0) - COALESCE(fromRow.totalProduction, 0) AS productionDelta "
+                          "FROM (SELECT things.thingId AS thingId, (%1) AS fromRowId, (%2) AS toRowId FROM thingCache AS things) AS bounds "
+                          "LEFT JOIN thingPower AS fromRow ON fromRow.rowid = bounds.fromRowId "
+                          "LEFT JOIN thingPower AS toRow ON toRow.rowid = bounds.toRowId "
+                          "ORDER BY consumptionDelta DESC, bounds.thingId ASC LIMIT ?;").arg(fromRowQuery, toRowQuery));
+    foreach (const QVariant &bindValue, bindValues) {
+        query.addBindValue(bindValue);
+    }
+    if (!execQuery(query, EnergyStatistics::OperationRangeRead)) {
+        qCWarning(dcEnergyExperience()) << "Error ranking top consumers:" << query.lastError() << query.executedQuery();
+        return result;
+    }
     while (query.next()) {
-        result.append(ThingPowerLogEntry(
-            QDateTime::fromMSecsSinceEpoch(query.value("timestamp").toLongLong()),
-            query.value("thingId").toUuid(),
-            query.value("currentPower").toDouble(),
-            query.value("totalConsumption").toDouble(),
-            query.value("totalProduction").toDouble()));
+        result.append(ThingEnergyDelta(query.value("thingId").toUuid(), query.value("consumptionDelta").toDouble(), query.value("productionDelta").toDouble()));
     }
     return result;
+}
+
+ThingPowerLogEntry EnergyLogger::thingTotalsAt(const ThingId &thingId, const QDateTime &timestamp) const
+{
+    QSqlRecord record = totalsAt("thingPower", "thingId, totalConsumption, totalProduction", thingId, timestamp);
+    if (record.isEmpty()) {
+        return ThingPowerLogEntry();
+    }
+    return queryResultToThingPowerLogEntry(record);
+}
+
+PowerBalanceLogEntry EnergyLogger::powerBalanceTotalsAt(const QDateTime &timestamp) const
+{
+    QSqlRecord record = totalsAt("powerBalance", "totalConsumption, totalProduction, totalAcquisition, totalReturn", ThingId(), timestamp);
+    if (record.isEmpty()) {
+        return PowerBalanceLogEntry();
+    }
+    return queryResultToBalanceLogEntry(record);
+}
+
+QSqlRecord EnergyLogger::totalsAt(const QString &table, const QString &columns, const ThingId &thingId, const QDateTime &timestamp) const
+{
+    QVariantList bindValues;
+    QString thingFilter;
+    if (!thingId.isNull()) {
+        thingFilter = QStringLiteral("thingId = ? AND ");
+        bindValues << thingId;
+    }
+    QString rowQuery = totalsAtRowQuery(table, thingFilter, timestamp, &bindValues);
+
+    QSqlQuery query(m_db);
+    query.prepare(QString("SELECT timestamp, %1 FROM %2 WHERE rowid = (%3);").arg(columns, table, rowQuery));
+    foreach (const QVariant &bindValue, bindValues) {
+        query.addBindValue(bindValue);
+    }
+    if (!execQuery(query, EnergyStatistics::OperationLatestLookup)) {
+        qCWarning(dcEnergyExperience()) << "Error fetching" << table << "totals at" << timestamp << query.lastError();
+        return QSqlRecord();
+    }
+    // If nothing has been logged before, the totals were 0 back then
+    if (!query.next()) {
+        return QSqlRecord();
+    }
+    return query.record();
+}
+
+QString EnergyLogger::totalsAtRowQuery(const QString &table, const QString &thingFilter, const QDateTime &timestamp, QVariantList *bindValues) const
+{
+    // Each sample rate costs a single seek on the index of the table. The minute samples are only kept for a week, so prefer
+    // the coarsest sample rate which has a sample exactly at the timestamp (e.g. the start of a month). If not aligned or not
+    // logged at that rate, use the newest sample before, from the finest sample rate still holding samples within one sample
+    // period of the timestamp. If there is none, the newest sample before of any rate.
+    QList<SampleRate> sampleRates = m_configs.keys();
+    sampleRates.prepend(SampleRate1Min);
+    QStringList rates;
+    for (int i = 0; i < sampleRates.count(); i++) {
+        bool aligned = nextSampleTimestamp(sampleRates.at(i), timestamp.addMSecs(-1)) == timestamp;
+        rates.append(QString("SELECT %1 AS sampleRate, %2 AS rateIndex, %3 AS aligned").arg(static_cast<int>(sampleRates.at(i))).arg(i).arg(aligned ? 1 : 0));
+    }
+    *bindValues << timestamp.toMSecsSinceEpoch() << timestamp.toMSecsSinceEpoch() << timestamp.toMSecsSinceEpoch();
+    return QString("SELECT candidate.rowid FROM (%1) AS rates "
+                   "JOIN %2 AS candidate ON candidate.rowid = "
+                   "(SELECT rowid FROM %2 WHERE %3sampleRate = rates.sampleRate AND timestamp <= ? ORDER BY timestamp DESC LIMIT 1) "
+                   "ORDER BY CASE WHEN rates.aligned AND candidate.timestamp = ? THEN -rates.rateIndex "
+                   "WHEN candidate.timestamp > ? - rates.sampleRate * 60000 THEN 100 + rates.rateIndex "
+                   "ELSE 1000 END, candidate.timestamp DESC, rates.rateIndex LIMIT 1").arg(rates.join(" UNION ALL "), table, thingFilter);
+}
+
+QString EnergyLogger::thingPowerScanQuery(SampleRate sampleRate, const ThingId &thingId, const QDateTime &from, const QDateTime &to, const QStringList &columns, const QueryOptions &options, QVariantList *bindValues)
+{
+    QString queryString = "SELECT " + (QStringList() << "timestamp" << "thingId" << columns).join(", ") + " FROM thingPower WHERE thingId = ? AND sampleRate = ?";
+    *bindValues << thingId << sampleRate;
+    if (!from.isNull()) {
+        queryString += " AND timestamp >= ?";
+        *bindValues << from.toMSecsSinceEpoch();
+    }
+    if (!to.isNull()) {
+        queryString += " AND timestamp <= ?";
+        *bindValues << to.toMSecsSinceEpoch();
+    }
+    if (options.sinceRevision > 0) {
+        queryString += " AND revision > ?";
+        *bindValues << options.sinceRevision;
+    }
+    qint64 cursorTimestamp = 0;
+    ThingId cursorThingId;
+    if (!options.cursor.isEmpty() && decodeCursor(options.cursor, &cursorTimestamp, &cursorThingId)) {
+        // Within one thing, the cursor is a plain timestamp bound
+        queryString += thingId.toString() > cursorThingId.toString() ? " AND timestamp >= ?" : " AND timestamp > ?";
+        *bindValues << cursorTimestamp;
+    }
+    queryString += " ORDER BY timestamp ASC";
+    if (options.limit > 0) {
+        // Fetch one more to know whether there is a next page
+        queryString += " LIMIT ?";
+        *bindValues << options.limit + 1;
+    }
+    return queryString;
+}
+
+EnergyLogStream *EnergyLogger::createPowerBalanceLogStream(SampleRate sampleRate, const QDateTime &from, const QDateTime &to, const QueryOptions &options, int chunkSize, int windowSize, QObject *parent)
+{
+    if (m_dbFilePath.isEmpty()) {
+        qCWarning(dcEnergyExperience()) << "Cannot stream power balance logs without a database path.";
+        return nullptr;
+    }
+    if (sampleRate < SampleRate1Min) {
+        qCWarning(dcEnergyExperience()) << "Cannot stream power balance logs for sample rate" << sampleRate << "Only the persisted sample rates can be streamed.";
+        return nullptr;
+    }
+
+    QStringList columns = projectedColumns({"consumption", "production", "acquisition", "storage", "totalConsumption", "totalProduction", "totalAcquisition", "totalReturn"}, options.fields);
+    QString queryString = "SELECT " + (QStringList() << "timestamp" << columns).join(", ") + " FROM powerBalance WHERE sampleRate = ?";
+    QVariantList bindValues;
+    bindValues << sampleRate;
+    if (!from.isNull()) {
+        queryString += " AND timestamp >= ?";
+        bindValues << from.toMSecsSinceEpoch();
+    }
+    if (!to.isNull()) {
+        queryString += " AND timestamp <= ?";
+        bindValues << to.toMSecsSinceEpoch();
+    }
+    queryString += " ORDER BY timestamp ASC";
+
+    EnergyLogStream::Scan scan;
+    scan.queryString = queryString;
+    scan.bindValues = bindValues;
+    return new EnergyLogStream(EnergyLogStream::TypePowerBalance, m_dbFilePath, QList<EnergyLogStream::Scan>() << scan, chunkSize, windowSize, parent);
+}
+
+EnergyLogStream *EnergyLogger::createThingPowerLogStream(SampleRate sampleRate, const QList<ThingId> &thingIds, const QDateTime &from, const QDateTime &to, const QueryOptions &options, int chunkSize, int windowSize, QObject *parent)
+{
+    if (m_dbFilePath.isEmpty()) {
+        qCWarning(dcEnergyExperience()) << "Cannot stream thing power logs without a database path.";
+        return nullptr;
+    }
+    if (sampleRate < SampleRate1Min) {
+        qCWarning(dcEnergyExperience()) << "Cannot stream thing power logs for sample rate" << sampleRate << "Only the persisted sample rates can be streamed.";
+        return nullptr;
+    }
+
+    // Same per thing range scans as thingPowerLogs(), merged on the stream's worker thread
+    QList<ThingId> things = thingIds;
+    if (things.isEmpty()) {
+        things = loggedThings();
+    }
+    QStringList columns = projectedColumns({"currentPower", "totalConsumption", "totalProduction"}, options.fields);
+    QList<EnergyLogStream::Scan> scans;
+    foreach (const ThingId &thingId, things) {
+        EnergyLogStream::Scan scan;
+        scan.thingId = thingId.toString();
+        scan.queryString = thingPowerScanQuery(sampleRate, thingId, from, to, columns, QueryOptions(), &scan.bindValues);
+        scans.append(scan);
+    }
 
+    return new EnergyLogStream(EnergyLogStream::TypeThingPower, m_dbFilePath, scans, chunkSize, windowSize, parent);
 }
 
 PowerBalanceLogEntry EnergyLogger::latestLogEntry(SampleRate sampleRate)
@@ -915,7 +2041,7 @@ PowerBalanceLogEntry EnergyLogger::latestLogEntry(SampleRate sampleRate)
     foreach (const QVariant &value, bindValues) {
         query.addBindValue(value);
     }
-    if (!query.exec()) {
+    if (!execQuery(query, EnergyStatistics::OperationLatestLookup)) {
         qCWarning(dcEnergyExperience()) << "Error obtaining latest log entry from DB:" << query.lastError() << query.executedQuery();
         return PowerBalanceLogEntry();
     }
@@ -951,7 +2077,7 @@ ThingPowerLogEntry EnergyLogger::latestLogEntry(SampleRate sampleRate, const Thi
     foreach (const QVariant &bindValue, bindValues) {
         query.addBindValue(bindValue);
     }
-    if (!query.exec()) {
+    if (!execQuery(query, EnergyStatistics::OperationLatestLookup)) {
         qCWarning(dcEnergyExperience()) << "Error fetching latest thing log entry from DB:" << query.lastError() << query.executedQuery();
         return ThingPowerLogEntry();
     }
@@ -963,38 +2089,45 @@ ThingPowerLogEntry EnergyLogger::latestLogEntry(SampleRate sampleRate, const Thi
 
 }
 
-void EnergyLogger::removeThingLogs(const ThingId &thingId)
+PowerBalanceLogEntry EnergyLogger::currentPowerBalanceEntry() const
 {
-    m_thingsPowerLiveLogs.remove(thingId);
-
-    if (m_dbMaintenanceRunning) {
-        m_pendingThingLogRemovals.insert(thingId);
-        m_pendingThingCacheEntries.remove(thingId);
+    if (m_balanceLiveLog.isEmpty()) {
+        return PowerBalanceLogEntry();
+    }
+    return m_balanceLiveLog.first();
+}
 
-        // Drop any queued samples for this thing.
-        for (int i = m_pendingThingPowerSamples.count() - 1; i >= 0; i--) {
-            if (m_pendingThingPowerSamples.at(i).thingId == thingId) {
-                m_pendingThingPowerSamples.removeAt(i);
-            }
+ThingPowerLogEntries EnergyLogger::currentThingPowerEntries(const QList<ThingId> &thingIds) const
+{
+    ThingPowerLogEntries result;
+    QList<ThingId> things = thingIds.isEmpty() ? m_thingsPowerLiveLogs.keys() : thingIds;
+    foreach (const ThingId &thingId, things) {
+        const ThingPowerLogEntries &liveLog = m_thingsPowerLiveLogs.value(thingId);
+        if (!liveLog.isEmpty()) {
+            result.append(liveLog.first());
         }
-        return;
     }
+    return result;
+}
 
-    QSqlQuery query(m_db);
-    query.prepare("DELETE FROM thingPower WHERE thingId = ?;");
-    query.addBindValue(thingId);
-    query.exec();
-    if (query.lastError().isValid()) {
-        qCWarning(dcEnergyExperience()) << "Error removing thing energy logs for thing id" << thingId << query.lastError() << query.executedQuery();
+void EnergyLogger::removeThingLogs(const ThingId &thingId)
+{
+    m_thingsPowerLiveLogs.remove(thingId);
+    for (auto it = m_thingsPowerLiveSamples.begin(); it != m_thingsPowerLiveSamples.end(); ++it) {
+        it.value().remove(thingId);
     }
+    m_thingCacheEntries.remove(thingId);
 
-    query = QSqlQuery(m_db);
-    query.prepare("DELETE FROM thingCache WHERE thingId = ?;");
-    query.addBindValue(thingId);
-    query.exec();
-    if (query.lastError().isValid()) {
-        qCWarning(dcEnergyExperience()) << "Error removing thing cache entry for thing id" << thingId << query.lastError() << query.executedQuery();
-    }
+    // Samples of the thing queued before are written first and removed along with the rest
+    WriteRecord record;
+    record.type = WriteRecord::TypeRemoveThing;
+    record.thingId = thingId;
+    enqueueWrites({record});
+}
+
+EnergyStatistics *EnergyLogger::statistics() const
+{
+    return &m_statistics;
 }
 
 QList<ThingId> EnergyLogger::loggedThings() const
@@ -1003,7 +2136,7 @@ QList<ThingId> EnergyLogger::loggedThings() const
 
     QSqlQuery query(m_db);
     query.prepare("SELECT DISTINCT thingId FROM thingPower;");
-    query.exec();
+    execQuery(query, EnergyStatistics::OperationRangeRead);
     if (query.lastError().isValid()) {
         qCWarning(dcEnergyExperience()) << "Failed to load existing things from logs:" << query.lastError();
     } else {
@@ -1014,30 +2147,47 @@ QList<ThingId> EnergyLogger::loggedThings() const
     return ret;
 }
 
-void EnergyLogger::cacheThingEntry(const ThingId &thingId, double totalEnergyConsumed, double totalEnergyProduced)
+QList<ThingId> EnergyLogger::cachedThings() const
 {
-    if (m_dbMaintenanceRunning) {
-        m_pendingThingCacheEntries.insert(thingId, {totalEnergyConsumed, totalEnergyProduced});
-        return;
-    }
-
+    // Every logged thing has a cache entry. Reading those is much cheaper than collecting the thingIds from thingPower.
+    QList<ThingId> ret = m_thingCacheEntries.keys();
     QSqlQuery query(m_db);
-    query.prepare("INSERT OR REPLACE INTO thingCache (thingId, totalEnergyConsumed, totalEnergyProduced) VALUES (?, ?, ?);");
-    query.addBindValue(thingId);
-    query.addBindValue(totalEnergyConsumed);
-    query.addBindValue(totalEnergyProduced);
-    query.exec();
-    if (query.lastError().isValid()) {
-        qCWarning(dcEnergyExperience()) << "Failed to store thing cache entry:" << query.lastError() << query.executedQuery();
+    query.prepare("SELECT thingId FROM thingCache;");
+    if (!execQuery(query, EnergyStatistics::OperationRangeRead)) {
+        qCWarning(dcEnergyExperience()) << "Failed to load the cached things:" << query.lastError();
+        return ret;
+    }
+    while (query.next()) {
+        ThingId thingId = query.value("thingId").toUuid();
+        if (!ret.contains(thingId)) {
+            ret.append(thingId);
+        }
     }
+    return ret;
+}
+
+void EnergyLogger::cacheThingEntry(const ThingId &thingId, double totalEnergyConsumed, double totalEnergyProduced)
+{
+    m_thingCacheEntries.insert(thingId, qMakePair(totalEnergyConsumed, totalEnergyProduced));
+
+    WriteRecord record;
+    record.type = WriteRecord::TypeCacheThing;
+    record.thingId = thingId;
+    record.values = {totalEnergyConsumed, totalEnergyProduced};
+    enqueueWrites({record});
 }
 
 ThingPowerLogEntry EnergyLogger::cachedThingEntry(const ThingId &thingId)
 {
+    if (m_thingCacheEntries.contains(thingId)) {
+        const QPair<double, double> totals = m_thingCacheEntries.value(thingId);
+        return ThingPowerLogEntry(QDateTime(), thingId, 0, totals.first, totals.second);
+    }
+
     QSqlQuery query(m_db);
     query.prepare("SELECT * FROM thingCache WHERE thingId = ?;");
     query.addBindValue(thingId);
-    query.exec();
+    execQuery(query, EnergyStatistics::OperationLatestLookup);
     if (query.lastError().isValid()) {
         qCWarning(dcEnergyExperience()) << "Failed to retrieve thing cache entry:" << query.lastError() << query.executedQuery();
         return ThingPowerLogEntry();
@@ -1049,63 +2199,65 @@ ThingPowerLogEntry EnergyLogger::cachedThingEntry(const ThingId &thingId)
     return ThingPowerLogEntry(QDateTime(), thingId, 0, query.value("totalEnergyConsumed").toDouble(), query.value("totalEnergyProduced").toDouble());
 }
 
-void EnergyLogger::sample()
+void EnergyLogger::onClockWakeup()
 {
-    QDateTime now = QDateTime::currentDateTime();
-    bool deferDbWrites = m_dbMaintenanceRunning;
-
-    if (now >= m_nextSamples.value(SampleRate1Min)) {
-        QDateTime sampleEnd = m_nextSamples.value(SampleRate1Min);
-        QDateTime sampleStart = sampleEnd.addMSecs(-60 * 1000);
+    sample();
+    scheduleWakeup();
+}
 
-        if (!deferDbWrites) {
-            PowerBalanceLogEntry newestInDB = latestLogEntry(SampleRate1Min);
-            qCDebug(dcEnergyExperience()) << "Sampling power balance for 1 min from" << sampleStart.toString() << sampleEnd.toString() << "newest in DB:" << newestInDB.timestamp().toString();
+void EnergyLogger::onClockJumped(qint64 msecs)
+{
+    // The schedule is relative to the old time. After a jump back it would be hours ahead, after a jump
+    // forward it would catch up one sample per wakeup. Start over from now and let the maintenance fill in.
+    const QDateTime now = m_clock->now();
+    foreach (SampleRate sampleRate, m_nextSamples.keys()) {
+        m_nextSamples.insert(sampleRate, nextSampleTimestamp(sampleRate, now));
+    }
+    qCInfo(dcEnergyExperience()) << "Clock jumped by" << msecs / 1000 << "s. Next minute sample scheduled at" << m_nextSamples.value(SampleRate1Min).toString();
+    startDbMaintenance("clock jump recovery", calculateSampleStart(m_nextSamples.value(SampleRate1Min), SampleRate1Min));
+    scheduleWakeup();
+}
 
-            if (newestInDB.timestamp().isValid() && newestInDB.timestamp() < sampleStart) {
-                qCWarning(dcEnergyExperience()).nospace() << "Clock skew detected. Scheduling background recovery job.";
-                startDbMaintenance("clock skew recovery", sampleStart);
-                deferDbWrites = true;
-            }
+void EnergyLogger::sample()
+{
+    EnergyStatistics::Timer tickTimer(&m_statistics, EnergyStatistics::OperationSampleTick);
+    EnergyProfiler::Span span("sample", "sampling");
+    QDateTime now = m_clock->now();
+
+    QElapsedTimer slowTickTimer;
+    slowTickTimer.start();
+    QList<SampleRate> dueSampleRates;
+    for (auto it = m_nextSamples.constBegin(); it != m_nextSamples.constEnd(); ++it) {
+        if (it.key() >= SampleRate1Min && now >= it.value()) {
+            dueSampleRates.append(it.key());
         }
+    }
+    auto slowTickLog = qScopeGuard([this, &slowTickTimer, &dueSampleRates]() {
+        int threshold = m_slowOperationThreshold.loadAcquire();
+        if (threshold > 0 && slowTickTimer.elapsed() >= threshold) {
+            qCWarning(dcEnergyExperience()) << "Slow sampling tick took" << slowTickTimer.elapsed() << "ms. Sampled:" << dueSampleRates;
+        }
+    });
 
-        double medianConsumption = 0;
-        double medianProduction = 0;
-        double medianAcquisition = 0;
-        double medianStorage = 0;
-        for (int i = 0; i < m_balanceLiveLog.count(); i++) {
-            const PowerBalanceLogEntry &entry = m_balanceLiveLog.at(i);
-            QDateTime frameStart = entry.timestamp();
-            if (frameStart < sampleStart) {
-                frameStart = sampleStart;
-            } else if (frameStart > sampleEnd) {
-                frameStart = sampleEnd;
-            }
+    sampleLiveSeries(now);
 
-            QDateTime frameEnd = i == 0 ? sampleEnd : m_balanceLiveLog.at(i-1).timestamp();
-            if (frameEnd < sampleStart) {
-                frameEnd = sampleStart;
-            } else if (frameEnd > sampleEnd) {
-                frameEnd = sampleEnd;
-            }
-            qint64 frameDuration = frameStart.msecsTo(frameEnd);
-            if (frameDuration < 0) {
-                frameDuration = 0;
-            }
-            qCDebug(dcEnergyExperience()) << "Frame" << i << "duration:" << frameDuration << "value:" << entry.consumption() << "start" << frameStart.toString() << "end" << frameEnd.toString();
+    // The minute samples are averaged from the live logs here. Everything touching the DB goes to the
+    // writer thread, in one go and in this order, so each tier finds the base samples of this tick.
+    QList<WriteRecord> records;
+    const QList<ThingId> thingIds = m_thingsPowerLiveLogs.keys();
 
-            medianConsumption += entry.consumption() * frameDuration;
-            medianProduction += entry.production() * frameDuration;
-            medianAcquisition += entry.acquisition() * frameDuration;
-            medianStorage += entry.storage() * frameDuration;
-            if (entry.timestamp() < sampleStart) {
-                break;
-            }
-        }
-        medianConsumption /= sampleStart.msecsTo(sampleEnd);
-        medianProduction /= sampleStart.msecsTo(sampleEnd);
-        medianAcquisition /= sampleStart.msecsTo(sampleEnd);
-        medianStorage /= sampleStart.msecsTo(sampleEnd);
+    if (now >= m_nextSamples.value(SampleRate1Min)) {
+        EnergyProfiler::Span minuteSpan("aggregate", "sampling");
+        minuteSpan.setArg("sampleRate", SampleRate1Min);
+        QDateTime sampleEnd = m_nextSamples.value(SampleRate1Min);
+        QDateTime sampleStart = sampleEnd.addMSecs(-60 * 1000);
+        qCDebug(dcEnergyExperience()) << "Sampling power balance for 1 min from" << sampleStart.toString() << sampleEnd.toString();
+
+        PowerBalanceLogEntry average = averagePowerBalance(sampleStart, sampleEnd);
+        double medianConsumption = average.consumption();
+        double medianProduction = average.production();
+        double medianAcquisition = average.acquisition();
+        double medianStorage = average.storage();
 
         PowerBalanceLogEntry newest = latestLogEntry(SampleRateAny);
         double totalConsumption = newest.totalConsumption();
@@ -1114,126 +2266,301 @@ void EnergyLogger::sample()
         double totalReturn = newest.totalReturn();
 
         qCDebug(dcEnergyExperience()) << "Sampled power balance:" << SampleRate1Min << "🔥:" << medianConsumption << "🌞:" << medianProduction << "💵:" << medianAcquisition << "🔋:" << medianStorage << "Totals:" << "🔥:" << totalConsumption << "🌞:" << totalProduction << "💵↓:" << totalAcquisition << "💵↑:" << totalReturn;
-        insertPowerBalance(sampleEnd, SampleRate1Min, medianConsumption, medianProduction, medianAcquisition, medianStorage, totalConsumption, totalProduction, totalAcquisition, totalReturn);
+        WriteRecord record;
+        record.type = WriteRecord::TypePowerBalance;
+        record.timestamp = sampleEnd;
+        record.sampleRate = SampleRate1Min;
+        record.values = {medianConsumption, medianProduction, medianAcquisition, medianStorage, totalConsumption, totalProduction, totalAcquisition, totalReturn};
+        record.maxMinuteSamples = m_maxMinuteSamples;
+        records.append(record);
 
-        foreach (const ThingId &thingId, m_thingsPowerLiveLogs.keys()) {
+        foreach (const ThingId &thingId, thingIds) {
+            double medianPower = averageThingPower(thingId, sampleStart, sampleEnd).currentPower();
 
-            if (!deferDbWrites) {
-                ThingPowerLogEntry newestInDB = latestLogEntry(SampleRate1Min, thingId);
-                qCDebug(dcEnergyExperience()) << "Sampling thing power for" << thingId.toString() << SampleRate1Min << "from" << sampleStart.toString() << "to" <<  sampleEnd.toString() << "newest in DB" << newestInDB.timestamp().toString();
+            ThingPowerLogEntry newest = latestLogEntry(SampleRateAny, thingId);
+            double totalConsumption = newest.totalConsumption();
+            double totalProduction = newest.totalProduction();
 
-                if (newestInDB.timestamp().isValid() && newestInDB.timestamp() < sampleStart) {
-                    qCWarning(dcEnergyExperience()).nospace() << "Clock skew detected for thing power logs. Scheduling background recovery job.";
-                    startDbMaintenance("clock skew recovery", sampleStart);
-                    deferDbWrites = true;
-                }
-            }
+            qCDebug(dcEnergyExperience()) << "Sampled thing power for" << thingId << SampleRate1Min << "🔥/🌞:" << medianPower << "Totals:" << "🔥:" << totalConsumption << "🌞:" << totalProduction;
+            WriteRecord thingRecord;
+            thingRecord.type = WriteRecord::TypeThingPower;
+            thingRecord.timestamp = sampleEnd;
+            thingRecord.sampleRate = SampleRate1Min;
+            thingRecord.thingId = thingId;
+            thingRecord.values = {medianPower, totalConsumption, totalProduction};
+            records.append(thingRecord);
+        }
+    }
 
-            double medianPower = 0;
-            ThingPowerLogEntries entries = m_thingsPowerLiveLogs.value(thingId);
-            for (int i = 0; i < entries.count(); i++) {
-                const ThingPowerLogEntry &entry = entries.at(i);
-                QDateTime frameStart = entry.timestamp();
-                if (frameStart < sampleStart) {
-                    frameStart = sampleStart;
-                } else if (frameStart > sampleEnd) {
-                    frameStart = sampleEnd;
-                }
+    // Then sample all the configs from their base series
+    foreach (SampleRate sampleRate, m_configs.keys()) {
+        if (now >= m_nextSamples.value(sampleRate)) {
+            WriteRecord record;
+            record.type = WriteRecord::TypeSampleTier;
+            record.timestamp = m_nextSamples.value(sampleRate);
+            record.sampleRate = sampleRate;
+            record.baseSampleRate = m_configs.value(sampleRate).baseSampleRate;
+            record.thingIds = thingIds;
+            records.append(record);
+        }
+    }
 
-                QDateTime frameEnd = i == 0 ? sampleEnd : entries.at(i-1).timestamp();
-                if (frameEnd < sampleStart) {
-                    frameEnd = sampleStart;
-                } else if (frameEnd > sampleEnd) {
-                    frameEnd = sampleEnd;
-                }
-                qint64 frameDuration = frameStart.msecsTo(frameEnd);
-                if (frameDuration < 0) {
-                    frameDuration = 0;
+    // and then trim them
+    if (now >= m_nextSamples.value(SampleRate1Min)) {
+        WriteRecord record;
+        record.type = WriteRecord::TypeTrim;
+        record.sampleRate = SampleRate1Min;
+        record.timestamp = m_nextSamples.value(SampleRate1Min).addMSecs(-(qint64)m_maxMinuteSamples * 60 * 1000);
+        record.thingIds = thingIds;
+        records.append(record);
+    }
+    foreach (SampleRate sampleRate, m_configs.keys()) {
+        if (now >= m_nextSamples.value(sampleRate)) {
+            WriteRecord record;
+            record.type = WriteRecord::TypeTrim;
+            record.sampleRate = sampleRate;
+            record.timestamp = calculateSampleStart(m_nextSamples.value(sampleRate), sampleRate, m_configs.value(sampleRate).maxSamples);
+            record.thingIds = thingIds;
+            records.append(record);
+        }
+    }
+
+    // Lastly we reschedule the next sample for each config
+    // Note: keep this at the end as the previous stuff uses the schedule to work
+    if (now >= m_nextSamples.value(SampleRate1Min)) {
+        scheduleNextSample(SampleRate1Min);
+    }
+    foreach (SampleRate sampleRate, m_configs.keys()) {
+        if (now >= m_nextSamples.value(sampleRate)) {
+            scheduleNextSample(sampleRate);
+        }
+    }
+
+    enqueueWrites(records);
+}
+
+PowerBalanceLogEntry EnergyLogger::averagePowerBalance(const QDateTime &sampleStart, const QDateTime &sampleEnd) const
+{
+    double medianConsumption = 0;
+    double medianProduction = 0;
+    double medianAcquisition = 0;
+    double medianStorage = 0;
+    PowerBalanceLogEntry totals;
+    for (int i = 0; i < m_balanceLiveLog.count(); i++) {
+        const PowerBalanceLogEntry &entry = m_balanceLiveLog.at(i);
+        if (!totals.timestamp().isValid() && entry.timestamp() <= sampleEnd) {
+            totals = entry;
+        }
+        QDateTime frameStart = entry.timestamp();
+        if (frameStart < sampleStart) {
+            frameStart = sampleStart;
+        } else if (frameStart > sampleEnd) {
+            frameStart = sampleEnd;
+        }
+
+        QDateTime frameEnd = i == 0 ? sampleEnd : m_balanceLiveLog.at(i-1).timestamp();
+        if (frameEnd < sampleStart) {
+            frameEnd = sampleStart;
+        } else if (frameEnd > sampleEnd) {
+            frameEnd = sampleEnd;
+        }
+        qint64 frameDuration = frameStart.msecsTo(frameEnd);
+        if (frameDuration < 0) {
+            frameDuration = 0;
+        }
+        qCDebug(dcEnergyExperience()) << "Frame" << i << "duration:" << frameDuration << "value:" << entry.consumption() << "start" << frameStart.toString() << "end" << frameEnd.toString();
+
+        medianConsumption += entry.consumption() * frameDuration;
+        medianProduction += entry.production() * frameDuration;
+        medianAcquisition += entry.acquisition() * frameDuration;
+        medianStorage += entry.storage() * frameDuration;
+        if (entry.timestamp() < sampleStart) {
+            break;
+        }
+    }
+    medianConsumption /= sampleStart.msecsTo(sampleEnd);
+    medianProduction /= sampleStart.msecsTo(sampleEnd);
+    medianAcquisition /= sampleStart.msecsTo(sampleEnd);
+    medianStorage /= sampleStart.msecsTo(sampleEnd);
+
+    return PowerBalanceLogEntry(sampleEnd, medianConsumption, medianProduction, medianAcquisition, medianStorage,
+                                totals.totalConsumption(), totals.totalProduction(), totals.totalAcquisition(), totals.totalReturn());
+}
+
+ThingPowerLogEntry EnergyLogger::averageThingPower(const ThingId &thingId, const QDateTime &sampleStart, const QDateTime &sampleEnd) const
+{
+    double medianPower = 0;
+    ThingPowerLogEntry totals;
+    const ThingPowerLogEntries entries = m_thingsPowerLiveLogs.value(thingId);
+    for (int i = 0; i < entries.count(); i++) {
+        const ThingPowerLogEntry &entry = entries.at(i);
+        if (!totals.timestamp().isValid() && entry.timestamp() <= sampleEnd) {
+            totals = entry;
+        }
+        QDateTime frameStart = entry.timestamp();
+        if (frameStart < sampleStart) {
+            frameStart = sampleStart;
+        } else if (frameStart > sampleEnd) {
+            frameStart = sampleEnd;
+        }
+
+        QDateTime frameEnd = i == 0 ? sampleEnd : entries.at(i-1).timestamp();
+        if (frameEnd < sampleStart) {
+            frameEnd = sampleStart;
+        } else if (frameEnd > sampleEnd) {
+            frameEnd = sampleEnd;
+        }
+        qint64 frameDuration = frameStart.msecsTo(frameEnd);
+        if (frameDuration < 0) {
+            frameDuration = 0;
+        }
+        qCDebug(dcEnergyExperience()) << "Frame" << i << "duration:" << frameDuration << "value:" << entry.currentPower();
+        medianPower += entry.currentPower() * frameDuration;
+        if (entry.timestamp() < sampleStart) {
+            break;
+        }
+    }
+    medianPower /= sampleStart.msecsTo(sampleEnd);
+
+    return ThingPowerLogEntry(sampleEnd, thingId, medianPower, totals.totalConsumption(), totals.totalProduction());
+}
+
+void EnergyLogger::applyLiveConfigs(const QMap<SampleRate, int> &liveConfigs)
+{
+    foreach (SampleRate sampleRate, m_liveConfigs.keys()) {
+        if (!liveConfigs.contains(sampleRate)) {
+            m_balanceLiveSamples.remove(sampleRate);
+            m_thingsPowerLiveSamples.remove(sampleRate);
+            m_nextSamples.remove(sampleRate);
+        }
+    }
+    m_liveConfigs = liveConfigs;
+    for (auto it = m_liveConfigs.constBegin(); it != m_liveConfigs.constEnd(); ++it) {
+        // Shrinking the capacity keeps the newest samples
+        m_balanceLiveSamples[it.key()].setCapacity(it.value());
+        QHash<ThingId, QContiguousCache<ThingPowerLogEntry>> &thingsSamples = m_thingsPowerLiveSamples[it.key()];
+        for (auto thingIt = thingsSamples.begin(); thingIt != thingsSamples.end(); ++thingIt) {
+            thingIt.value().setCapacity(it.value());
+        }
+        if (!m_nextSamples.contains(it.key())) {
+            m_nextSamples.insert(it.key(), nextSampleTimestamp(it.key(), m_clock->now()));
+        }
+    }
+}
+
+void EnergyLogger::sampleLiveSeries(const QDateTime &now)
+{
+    for (auto it = m_liveConfigs.constBegin(); it != m_liveConfigs.constEnd(); ++it) {
+        SampleRate sampleRate = it.key();
+        const qint64 period = -sampleRate * 1000;
+        QDateTime sampleEnd = m_nextSamples.value(sampleRate);
+
+        // Catch up on missed ticks, but don't compute more samples than the buffer holds.
+        // If the clock went backwards, start over from now.
+        if (sampleEnd.msecsTo(now) > period * it.value()) {
+            sampleEnd = nextSampleTimestamp(sampleRate, now.addMSecs(-period * it.value()));
+        } else if (now.msecsTo(sampleEnd) > period) {
+            sampleEnd = nextSampleTimestamp(sampleRate, now);
+        }
+        while (now >= sampleEnd) {
+            QDateTime sampleStart = sampleEnd.addMSecs(-period);
+            if (!m_balanceLiveLog.isEmpty()) {
+                m_balanceLiveSamples[sampleRate].append(averagePowerBalance(sampleStart, sampleEnd));
+            }
+            QHash<ThingId, QContiguousCache<ThingPowerLogEntry>> &thingsSamples = m_thingsPowerLiveSamples[sampleRate];
+            for (auto thingIt = m_thingsPowerLiveLogs.constBegin(); thingIt != m_thingsPowerLiveLogs.constEnd(); ++thingIt) {
+                if (thingIt.value().isEmpty()) {
+                    continue;
                 }
-                qCDebug(dcEnergyExperience()) << "Frame" << i << "duration:" << frameDuration << "value:" << entry.currentPower();
-                medianPower += entry.currentPower() * frameDuration;
-                if (entry.timestamp() < sampleStart) {
-                    break;
+                QContiguousCache<ThingPowerLogEntry> &samples = thingsSamples[thingIt.key()];
+                if (samples.capacity() == 0) {
+                    samples.setCapacity(it.value());
                 }
+                samples.append(averageThingPower(thingIt.key(), sampleStart, sampleEnd));
             }
-            medianPower /= sampleStart.msecsTo(sampleEnd);
-
-            ThingPowerLogEntry newest = latestLogEntry(SampleRateAny, thingId);
-            double totalConsumption = newest.totalConsumption();
-            double totalProduction = newest.totalProduction();
-
-            qCDebug(dcEnergyExperience()) << "Sampled thing power for" << thingId << SampleRate1Min << "🔥/🌞:" << medianPower << "Totals:" << "🔥:" << totalConsumption << "🌞:" << totalProduction;
-            insertThingPower(sampleEnd, SampleRate1Min, thingId, medianPower, totalConsumption, totalProduction);
+            sampleEnd = sampleEnd.addMSecs(period);
         }
+        m_nextSamples.insert(sampleRate, sampleEnd);
     }
+}
 
-    // A background maintenance job (resampling / gap filling) is running.
-    // Keep 1-minute sampling going (in-memory) but do not touch the DB for lower sample rates or housekeeping.
-    if (deferDbWrites) {
-        if (now > m_nextSamples.value(SampleRate1Min)) {
-            scheduleNextSample(SampleRate1Min);
-        }
-        return;
+PowerBalanceLogEntries EnergyLogger::livePowerBalanceLogs(SampleRate sampleRate, const QDateTime &from, const QDateTime &to, const QueryOptions &options, QString *nextCursor) const
+{
+    PowerBalanceLogEntries result;
+    qint64 cursorTimestamp = 0;
+    if (!options.cursor.isEmpty() && !decodeCursor(options.cursor, &cursorTimestamp)) {
+        qCWarning(dcEnergyExperience()) << "Invalid cursor for power balance logs:" << options.cursor;
+        return result;
     }
 
-    // First sample all the configs.
-    foreach (SampleRate sampleRate, m_configs.keys()) {
-        if (now >= m_nextSamples.value(sampleRate)) {
-            QDateTime sampleTime = m_nextSamples.value(sampleRate);
-            SampleRate baseSampleRate = m_configs.value(sampleRate).baseSampleRate;
-            QDateTime sampleStart = calculateSampleStart(sampleTime, sampleRate);
-            QDateTime newestInDB = getNewestPowerBalanceSampleTimestamp(sampleRate);
-
-            if (newestInDB.isValid() && newestInDB < sampleStart) {
-                qCWarning(dcEnergyExperience()) << "Clock skew detected. Scheduling background recovery job.";
-                startDbMaintenance("clock skew recovery");
-                if (now >= m_nextSamples.value(SampleRate1Min)) {
-                    scheduleNextSample(SampleRate1Min);
-                }
-                foreach (SampleRate rate, m_configs.keys()) {
-                    if (now >= m_nextSamples.value(rate)) {
-                        scheduleNextSample(rate);
-                    }
-                }
-                return;
+    const QContiguousCache<PowerBalanceLogEntry> samples = m_balanceLiveSamples.value(sampleRate);
+    for (int i = samples.firstIndex(); i <= samples.lastIndex(); i++) {
+        const PowerBalanceLogEntry &entry = samples.at(i);
+        if ((!from.isNull() && entry.timestamp() < from) || (!options.cursor.isEmpty() && entry.timestamp().toMSecsSinceEpoch() <= cursorTimestamp)) {
+            continue;
+        }
+        if (!to.isNull() && entry.timestamp() > to) {
+            break;
+        }
+        if (options.limit > 0 && result.count() == options.limit) {
+            if (nextCursor) {
+                *nextCursor = encodeCursor(result.last().timestamp().toMSecsSinceEpoch());
             }
-
-            samplePowerBalance(sampleRate, baseSampleRate, sampleTime);
-            sampleThingsPower(sampleRate, baseSampleRate, sampleTime);
+            break;
         }
+        result.append(entry);
     }
+    return result;
+}
 
-    // and then trim them
-    if (now > m_nextSamples.value(SampleRate1Min)) {
-        QDateTime sampleTime = m_nextSamples.value(SampleRate1Min);
-        QDateTime oldestTimestamp = sampleTime.addMSecs(-(qint64)m_maxMinuteSamples * 60 * 1000);
-        trimPowerBalance(SampleRate1Min, oldestTimestamp);
-        foreach (const ThingId &thingId, m_thingsPowerLiveLogs.keys()) {
-            trimThingPower(thingId, SampleRate1Min, oldestTimestamp);
-        }
+ThingPowerLogEntries EnergyLogger::liveThingPowerLogs(SampleRate sampleRate, const QList<ThingId> &thingIds, const QDateTime &from, const QDateTime &to, const QueryOptions &options, QString *nextCursor) const
+{
+    ThingPowerLogEntries result;
+    qint64 cursorTimestamp = 0;
+    ThingId cursorThingId;
+    if (!options.cursor.isEmpty() && !decodeCursor(options.cursor, &cursorTimestamp, &cursorThingId)) {
+        qCWarning(dcEnergyExperience()) << "Invalid cursor for thing power logs:" << options.cursor;
+        return result;
     }
-    foreach (SampleRate sampleRate, m_configs.keys()) {
-        if (now >= m_nextSamples.value(sampleRate)) {
-            uint maxSamples = m_configs.value(sampleRate).maxSamples;
-            QDateTime sampleTime = m_nextSamples.value(sampleRate);
-            QDateTime oldestTimestamp = calculateSampleStart(sampleTime, sampleRate, maxSamples);
-            trimPowerBalance(sampleRate, oldestTimestamp);
-            foreach (const ThingId &thingId, m_thingsPowerLiveLogs.keys()) {
-                trimThingPower(thingId, sampleRate, oldestTimestamp);
+
+    // Same order as the DB logs: by timestamp, then by thing
+    const QHash<ThingId, QContiguousCache<ThingPowerLogEntry>> thingsSamples = m_thingsPowerLiveSamples.value(sampleRate);
+    QList<ThingId> things = thingIds.isEmpty() ? thingsSamples.keys() : thingIds;
+    std::sort(things.begin(), things.end(), [](const ThingId &a, const ThingId &b) { return a.toString() < b.toString(); });
+    QList<ThingPowerLogEntry> entries;
+    foreach (const ThingId &thingId, things) {
+        const QContiguousCache<ThingPowerLogEntry> samples = thingsSamples.value(thingId);
+        for (int i = samples.firstIndex(); i <= samples.lastIndex(); i++) {
+            const ThingPowerLogEntry &entry = samples.at(i);
+            if ((!from.isNull() && entry.timestamp() < from) || (!to.isNull() && entry.timestamp() > to)) {
+                continue;
+            }
+            if (!options.cursor.isEmpty()) {
+                qint64 timestamp = entry.timestamp().toMSecsSinceEpoch();
+                if (timestamp < cursorTimestamp || (timestamp == cursorTimestamp && thingId.toString() <= cursorThingId.toString())) {
+                    continue;
+                }
             }
+            entries.append(entry);
         }
     }
+    std::stable_sort(entries.begin(), entries.end(), [](const ThingPowerLogEntry &a, const ThingPowerLogEntry &b) { return a.timestamp() < b.timestamp(); });
 
-    // Lastly we reschedule the next sample for each config
-    // Note: keep this at the end as the previous stuff uses the schedule to work
-    if (now > m_nextSamples.value(SampleRate1Min)) {
-        scheduleNextSample(SampleRate1Min);
-    }
-    foreach (SampleRate sampleRate, m_configs.keys()) {
-        if (now >= m_nextSamples.value(sampleRate)) {
-            scheduleNextSample(sampleRate);
+    foreach (const ThingPowerLogEntry &entry, entries) {
+        if (options.limit > 0 && result.count() == options.limit) {
+            if (nextCursor) {
+                *nextCursor = encodeCursor(result.last().timestamp().toMSecsSinceEpoch(), result.last().thingId());
+            }
+            break;
         }
+        result.append(entry);
     }
+    return result;
+}
+
+bool EnergyLogger::hasLiveSampleRate(SampleRate sampleRate) const
+{
+    return m_liveConfigs.contains(sampleRate);
 }
 
 bool EnergyLogger::initDB()
@@ -1260,32 +2587,42 @@ bool EnergyLogger::initDB()
         return false;
     }
 
-    // Improve concurrency between readers (main thread) and the background maintenance job.
+    // Improve concurrency between readers (main thread) and the writer thread.
     // NOTE: journal_mode is persisted per database, running this is cheap.
     QSqlQuery pragmaQuery(m_db);
     pragmaQuery.exec(QStringLiteral("PRAGMA journal_mode=WAL;"));
     pragmaQuery.exec(QStringLiteral("PRAGMA synchronous=NORMAL;"));
 
-    if (!m_db.tables().contains("metadata")) {
+    if (!initSchema(m_db)) {
+        return false;
+    }
+
+    qCDebug(dcEnergyExperience()) << "Initialized logging DB successfully." << m_db.databaseName();
+    return true;
+}
+
+bool EnergyLogger::initSchema(QSqlDatabase &db)
+{
+    if (!db.tables().contains("metadata")) {
         qCDebug(dcEnergyExperience()) << "No \"metadata\" table in database. Creating it.";
 
         QString queryString = "CREATE TABLE IF NOT EXISTS metadata (version INT);";
-        QSqlQuery createTableMetadataVersionQuery(queryString, m_db);
+        QSqlQuery createTableMetadataVersionQuery(queryString, db);
 
         if (!createTableMetadataVersionQuery.exec()) {
-            qCWarning(dcEnergyExperience()) << "Error creating metadata table in energy log database. Query:" << queryString << createTableMetadataVersionQuery.lastError().text() << "Driver error:" << m_db.lastError().driverText() << "Database error:" << m_db.lastError().databaseText();
+            qCWarning(dcEnergyExperience()) << "Error creating metadata table in energy log database. Query:" << queryString << createTableMetadataVersionQuery.lastError().text() << "Driver error:" << db.lastError().driverText() << "Database error:" << db.lastError().databaseText();
             return false;
         }
 
         queryString = "INSERT INTO metadata (version) VALUES (1);";
-        QSqlQuery writeVersionQuery(queryString, m_db);
+        QSqlQuery writeVersionQuery(queryString, db);
         if (!writeVersionQuery.exec()) {
-            qCWarning(dcEnergyExperience()) << "Error writing metadata table in energy log database. Query:" << queryString << writeVersionQuery.lastError().text() << "Driver error:" << m_db.lastError().driverText() << "Database error:" << m_db.lastError().databaseText();
+            qCWarning(dcEnergyExperience()) << "Error writing metadata table in energy log database. Query:" << queryString << writeVersionQuery.lastError().text() << "Driver error:" << db.lastError().driverText() << "Database error:" << db.lastError().databaseText();
             return false;
         }
     }
 
-    if (!m_db.tables().contains("powerBalance")) {
+    if (!db.tables().contains("powerBalance")) {
         qCDebug(dcEnergyExperience()) << "No \"powerBalance\" table in database. Creating it.";
         QString query("CREATE TABLE IF NOT EXISTS powerBalance "
                       "("
@@ -1301,21 +2638,21 @@ bool EnergyLogger::initDB()
                       "totalReturn FLOAT"
                       ");");
 
-        QSqlQuery createTableQuery(query, m_db);
+        QSqlQuery createTableQuery(query, db);
         if (!createTableQuery.exec()) {
-            qCWarning(dcEnergyExperience()) << "Error creating powerBalance table in energy log database." << query << createTableQuery.lastError().text() << "Driver error:" << m_db.lastError().driverText() << "Database error:" << m_db.lastError().databaseText();
+            qCWarning(dcEnergyExperience()) << "Error creating powerBalance table in energy log database." << query << createTableQuery.lastError().text() << "Driver error:" << db.lastError().driverText() << "Database error:" << db.lastError().databaseText();
             return false;
         }
 
     }
 
-    QSqlQuery createPowerBalanceIndexQuery("CREATE INDEX IF NOT EXISTS idx_powerBalance ON powerBalance(sampleRate, timestamp);", m_db);
+    QSqlQuery createPowerBalanceIndexQuery("CREATE INDEX IF NOT EXISTS idx_powerBalance ON powerBalance(sampleRate, timestamp);", db);
     if (!createPowerBalanceIndexQuery.exec()) {
-        qCWarning(dcEnergyExperience()) << "Error creating powerBalance table index in energy log database. Query:" << createPowerBalanceIndexQuery.lastQuery() << createPowerBalanceIndexQuery.lastError().text() << "Driver error:" << m_db.lastError().driverText() << "Database error:" << m_db.lastError().databaseText();
+        qCWarning(dcEnergyExperience()) << "Error creating powerBalance table index in energy log database. Query:" << createPowerBalanceIndexQuery.lastQuery() << createPowerBalanceIndexQuery.lastError().text() << "Driver error:" << db.lastError().driverText() << "Database error:" << db.lastError().databaseText();
         return false;
     }
 
-    if (!m_db.tables().contains("thingPower")) {
+    if (!db.tables().contains("thingPower")) {
         qCDebug(dcEnergyExperience()) << "No \"thingPower\" table in database. Creating it.";
         QString query("CREATE TABLE IF NOT EXISTS thingPower "
                       "("
@@ -1327,20 +2664,20 @@ bool EnergyLogger::initDB()
                       "totalProduction FLOAT"
                       ");");
 
-        QSqlQuery createThingPowerTableQuery(query, m_db);
+        QSqlQuery createThingPowerTableQuery(query, db);
         if (!createThingPowerTableQuery.exec()) {
-            qCWarning(dcEnergyExperience()) << "Error creating thingPower table in energy log database. Query:" << query << createThingPowerTableQuery.lastError().text() << "Driver error:" << m_db.lastError().driverText() << "Database error:" << m_db.lastError().databaseText();
+            qCWarning(dcEnergyExperience()) << "Error creating thingPower table in energy log database. Query:" << query << createThingPowerTableQuery.lastError().text() << "Driver error:" << db.lastError().driverText() << "Database error:" << db.lastError().databaseText();
             return false;
         }
     }
 
-    QSqlQuery createThingPowerIndexQuery("CREATE INDEX IF NOT EXISTS idx_thingPower ON thingPower(thingId, sampleRate, timestamp);", m_db);
+    QSqlQuery createThingPowerIndexQuery("CREATE INDEX IF NOT EXISTS idx_thingPower ON thingPower(thingId, sampleRate, timestamp);", db);
     if (!createThingPowerIndexQuery.exec()) {
-        qCWarning(dcEnergyExperience()) << "Error creating thingPower table index in energy log database. Query:" << createThingPowerIndexQuery.lastQuery() << createThingPowerIndexQuery.lastError().text() << "Driver error:" << m_db.lastError().driverText() << "Database error:" << m_db.lastError().databaseText();
+        qCWarning(dcEnergyExperience()) << "Error creating thingPower table index in energy log database. Query:" << createThingPowerIndexQuery.lastQuery() << createThingPowerIndexQuery.lastError().text() << "Driver error:" << db.lastError().driverText() << "Database error:" << db.lastError().databaseText();
         return false;
     }
 
-    if (!m_db.tables().contains("thingCache")) {
+    if (!db.tables().contains("thingCache")) {
         qCDebug(dcEnergyExperience()) << "No \"thingCache\" table in database. Creating it.";
         QString query("CREATE TABLE IF NOT EXISTS thingCache "
                       "("
@@ -1349,23 +2686,287 @@ bool EnergyLogger::initDB()
                       "totalEnergyProduced FLOAT"
                       ");");
 
-        QSqlQuery createThingCacheTableQuery(query, m_db);
+        QSqlQuery createThingCacheTableQuery(query, db);
         if (!createThingCacheTableQuery.exec()) {
-            qCWarning(dcEnergyExperience()) << "Error creating thingCache table in energy log database. Query:" << query << createThingCacheTableQuery.lastError().text() << "Driver error:" << m_db.lastError().driverText() << "Database error:" << m_db.lastError().databaseText();
+            qCWarning(dcEnergyExperience()) << "Error creating thingCache table in energy log database. Query:" << query << createThingCacheTableQuery.lastError().text() << "Driver error:" << db.lastError().driverText() << "Database error:" << db.lastError().databaseText();
             return false;
         }
     }
 
-    qCDebug(dcEnergyExperience()) << "Initialized logging DB successfully." << m_db.databaseName();
+    if (!db.tables().contains("sampleConfigs")) {
+        qCDebug(dcEnergyExperience()) << "No \"sampleConfigs\" table in database. Creating it.";
+        QString query("CREATE TABLE IF NOT EXISTS sampleConfigs "
+                      "("
+                      "sampleRate INT PRIMARY KEY,"
+                      "baseSampleRate INT,"
+                      "maxSamples INT"
+                      ");");
+
+        QSqlQuery createSampleConfigsTableQuery(query, db);
+        if (!createSampleConfigsTableQuery.exec()) {
+            qCWarning(dcEnergyExperience()) << "Error creating sampleConfigs table in energy log database. Query:" << query << createSampleConfigsTableQuery.lastError().text() << "Driver error:" << db.lastError().driverText() << "Database error:" << db.lastError().databaseText();
+            return false;
+        }
+    }
+
+    return migrateDB(db);
+}
+
+bool EnergyLogger::migrateDB(QSqlDatabase &db)
+{
+    QSqlQuery versionQuery("SELECT version FROM metadata;", db);
+    if (!versionQuery.exec() || !versionQuery.next()) {
+        qCWarning(dcEnergyExperience()) << "Error reading energy log database version:" << versionQuery.lastError().text();
+        return false;
+    }
+    int version = versionQuery.value("version").toInt();
+
+    if (version < 2) {
+        // Version 2: Every written row gets a revision, increasing per table, so clients can fetch only rows
+        // added after their last sync. This includes rows written by the maintenance for past timestamps.
+        qCInfo(dcEnergyExperience()) << "Migrating energy log database from version" << version << "to 2";
+        QStringList queries = {
+            "ALTER TABLE powerBalance ADD COLUMN revision BIGINT NOT NULL DEFAULT 0;",
+            "ALTER TABLE thingPower ADD COLUMN revision BIGINT NOT NULL DEFAULT 0;",
+            "CREATE INDEX IF NOT EXISTS idx_powerBalance_revision ON powerBalance(revision);",
+            "CREATE INDEX IF NOT EXISTS idx_thingPower_revision ON thingPower(revision);",
+            "UPDATE metadata SET version = 2;"
+        };
+        db.transaction();
+        foreach (const QString &queryString, queries) {
+            QSqlQuery query(db);
+            if (!query.exec(queryString)) {
+                qCWarning(dcEnergyExperience()) << "Error migrating energy log database. Query:" << queryString << query.lastError().text() << "Driver error:" << db.lastError().driverText() << "Database error:" << db.lastError().databaseText();
+                db.rollback();
+                return false;
+            }
+        }
+        db.commit();
+        version = 2;
+    }
+
+    if (version < 3) {
+        // Version 3: Tier samples carry min, max and the highest 15 minute average of their power values, along with
+        // the number of raw samples they aggregate. See EnergyLogger::PowerStats.
+        qCInfo(dcEnergyExperience()) << "Migrating energy log database from version" << version << "to 3";
+        QStringList queries;
+        foreach (const QString &field, powerBalanceStatsFields) {
+            queries << QString("ALTER TABLE powerBalance ADD COLUMN %1Min FLOAT;").arg(field);
+            queries << QString("ALTER TABLE powerBalance ADD COLUMN %1Max FLOAT;").arg(field);
+            queries << QString("ALTER TABLE powerBalance ADD COLUMN %1Peak15 FLOAT;").arg(field);
+        }
+        queries << "ALTER TABLE powerBalance ADD COLUMN sampleCount INT;";
+        foreach (const QString &field, thingPowerStatsFields) {
+            queries << QString("ALTER TABLE thingPower ADD COLUMN %1Min FLOAT;").arg(field);
+            queries << QString("ALTER TABLE thingPower ADD COLUMN %1Max FLOAT;").arg(field);
+            queries << QString("ALTER TABLE thingPower ADD COLUMN %1Peak15 FLOAT;").arg(field);
+        }
+        queries << "ALTER TABLE thingPower ADD COLUMN sampleCount INT;";
+        queries << "UPDATE metadata SET version = 3;";
+        db.transaction();
+        foreach (const QString &queryString, queries) {
+            QSqlQuery query(db);
+            if (!query.exec(queryString)) {
+                qCWarning(dcEnergyExperience()) << "Error migrating energy log database. Query:" << queryString << query.lastError().text() << "Driver error:" << db.lastError().driverText() << "Database error:" << db.lastError().databaseText();
+                db.rollback();
+                return false;
+            }
+        }
+        db.commit();
+        version = 3;
+    }
+
+    if (version < 4) {
+        // Version 4: Deleting rows other than by the retention trims advances the resync revision of the table,
+        // clients which synced before it need to fetch the log again.
+        qCInfo(dcEnergyExperience()) << "Migrating energy log database from version" << version << "to 4";
+        QStringList queries = {
+            "ALTER TABLE metadata ADD COLUMN powerBalanceResyncRevision BIGINT NOT NULL DEFAULT 0;",
+            "ALTER TABLE metadata ADD COLUMN thingPowerResyncRevision BIGINT NOT NULL DEFAULT 0;",
+            "UPDATE metadata SET version = 4;"
+        };
+        db.transaction();
+        foreach (const QString &queryString, queries) {
+            QSqlQuery query(db);
+            if (!query.exec(queryString)) {
+                qCWarning(dcEnergyExperience()) << "Error migrating energy log database. Query:" << queryString << query.lastError().text() << "Driver error:" << db.lastError().driverText() << "Database error:" << db.lastError().databaseText();
+                db.rollback();
+                return false;
+            }
+        }
+        db.commit();
+        version = 4;
+    }
+
     return true;
 }
 
-void EnergyLogger::addConfig(SampleRate sampleRate, SampleRate baseSampleRate, int maxSamples)
+qint64 EnergyLogger::powerBalanceLogsRevision() const
+{
+    QSqlQuery query("SELECT MAX(IFNULL(MAX(revision), 0), (SELECT powerBalanceResyncRevision FROM metadata)) AS revision FROM powerBalance;", m_db);
+    if (!query.exec() || !query.next()) {
+        qCWarning(dcEnergyExperience()) << "Error fetching power balance logs revision:" << query.lastError();
+        return 0;
+    }
+    return query.value("revision").toLongLong();
+}
+
+qint64 EnergyLogger::thingPowerLogsRevision() const
+{
+    QSqlQuery query("SELECT MAX(IFNULL(MAX(revision), 0), (SELECT thingPowerResyncRevision FROM metadata)) AS revision FROM thingPower;", m_db);
+    if (!query.exec() || !query.next()) {
+        qCWarning(dcEnergyExperience()) << "Error fetching thing power logs revision:" << query.lastError();
+        return 0;
+    }
+    return query.value("revision").toLongLong();
+}
+
+qint64 EnergyLogger::powerBalanceLogsResyncRevision() const
+{
+    QSqlQuery query("SELECT powerBalanceResyncRevision FROM metadata;", m_db);
+    if (!query.exec() || !query.next()) {
+        qCWarning(dcEnergyExperience()) << "Error fetching power balance logs resync revision:" << query.lastError();
+        return 0;
+    }
+    return query.value("powerBalanceResyncRevision").toLongLong();
+}
+
+qint64 EnergyLogger::thingPowerLogsResyncRevision() const
+{
+    QSqlQuery query("SELECT thingPowerResyncRevision FROM metadata;", m_db);
+    if (!query.exec() || !query.next()) {
+        qCWarning(dcEnergyExperience()) << "Error fetching thing power logs resync revision:" << query.lastError();
+        return 0;
+    }
+    return query.value("thingPowerResyncRevision").toLongLong();
+}
+
+void EnergyLogger::loadSampleConfigs(QSettings &settings, int *maxMinuteSamples, QMap<SampleRate, SampleConfig> *configs, QMap<SampleRate, int> *liveConfigs)
+{
+    // The tier layout can be changed in energy.conf, e.g.:
+    //
+    // [Logs]
+    // SampleRate1Min\maxSamples=43200                  ; keep a month of minute samples
+    // SampleRate3Hours\enabled=false                   ; don't log this tier at all
+    // SampleRate1Week\baseSampleRate=SampleRate1Day    ; the series a tier is sampled from
+    // SampleRate1Week\maxSamples=520                   ; retention in samples of the tier
+    // SampleRate1Sec\enabled=true                      ; sub-minute tiers are off by default, they wake the logger every second
+    // SampleRate1Sec\maxSamples=3600                   ; sub-minute tiers are held in memory and have no base
+    //
+    // Changes are applied at runtime. Added tiers are sampled from the base series as far as it reaches back,
+    // tiers with a shorter retention are trimmed and removed tiers are dropped.
+    settings.beginGroup("Logs");
+
+    QMetaEnum metaEnum = QMetaEnum::fromType<SampleRate>();
+    *maxMinuteSamples = settings.value(QString(metaEnum.valueToKey(SampleRate1Min)) + "/maxSamples", defaultMaxMinuteSamples).toInt();
+    if (*maxMinuteSamples <= 0) {
+        qCWarning(dcEnergyExperience()) << "Invalid maxSamples for" << SampleRate1Min << "in energy.conf. Using the default.";
+        *maxMinuteSamples = defaultMaxMinuteSamples;
+    }
+
+    QHash<SampleRate, MaintenanceConfig> defaults;
+    foreach (const MaintenanceConfig &cfg, defaultTierConfigs()) {
+        defaults.insert(cfg.sampleRate, cfg);
+    }
+
+    liveConfigs->clear();
+    foreach (SampleRate sampleRate, QList<SampleRate>({SampleRate1Sec, SampleRate10Secs})) {
+        const QString key = metaEnum.valueToKey(sampleRate);
+        if (!settings.value(key + "/enabled", false).toBool()) {
+            continue;
+        }
+        // Once enabled, default to 15 minutes of 1 second samples and one hour of 10 second samples
+        int maxSamples = settings.value(key + "/maxSamples", sampleRate == SampleRate1Sec ? 900 : 360).toInt();
+        if (maxSamples <= 0) {
+            qCWarning(dcEnergyExperience()) << "No maxSamples for" << sampleRate << "in energy.conf. Disabling the tier.";
+            continue;
+        }
+        liveConfigs->insert(sampleRate, maxSamples);
+    }
+
+    configs->clear();
+    // Enum values are ordered, so base tiers are validated before the tiers building on them
+    for (int i = 0; i < metaEnum.keyCount(); i++) {
+        SampleRate sampleRate = static_cast<SampleRate>(metaEnum.value(i));
+        if (sampleRate <= SampleRate1Min) {
+            continue;
+        }
+        const QString key = metaEnum.key(i);
+        const MaintenanceConfig defaultConfig = defaults.value(sampleRate, MaintenanceConfig(sampleRate, SampleRate1Min, 0));
+        if (!settings.value(key + "/enabled", defaults.contains(sampleRate)).toBool()) {
+            continue;
+        }
+
+        SampleConfig config;
+        config.baseSampleRate = defaultConfig.baseSampleRate;
+        if (settings.contains(key + "/baseSampleRate")) {
+            bool ok = false;
+            config.baseSampleRate = static_cast<SampleRate>(metaEnum.keyToValue(settings.value(key + "/baseSampleRate").toByteArray(), &ok));
+            if (!ok) {
+                qCWarning(dcEnergyExperience()) << "Invalid baseSampleRate" << settings.value(key + "/baseSampleRate").toString() << "for" << sampleRate << "in energy.conf. Disabling the tier.";
+                continue;
+            }
+        }
+        config.maxSamples = settings.value(key + "/maxSamples", defaultConfig.maxSamples).toUInt();
+
+        // Weeks don't add up to months or years
+        if (config.baseSampleRate >= sampleRate || config.baseSampleRate == SampleRate1Week
+                || (config.baseSampleRate != SampleRate1Min && !configs->contains(config.baseSampleRate))) {
+            qCWarning(dcEnergyExperience()) << "Cannot sample" << sampleRate << "from" << config.baseSampleRate << "as configured in energy.conf. Disabling the tier.";
+            continue;
+        }
+        if (config.maxSamples == 0) {
+            qCWarning(dcEnergyExperience()) << "No maxSamples for" << sampleRate << "in energy.conf. Disabling the tier.";
+            continue;
+        }
+        quint64 baseRetention = config.baseSampleRate == SampleRate1Min ? *maxMinuteSamples : (quint64)configs->value(config.baseSampleRate).maxSamples * config.baseSampleRate;
+        if (baseRetention < (quint64)sampleRate) {
+            qCWarning(dcEnergyExperience()) << "The retention of" << config.baseSampleRate << "is too short to build full samples of" << sampleRate;
+        }
+        configs->insert(sampleRate, config);
+    }
+    settings.endGroup();
+}
+
+void EnergyLogger::onSettingsFileChanged(const QString &path)
 {
-    SampleConfig config;
-    config.baseSampleRate = baseSampleRate;
-    config.maxSamples = maxSamples;
-    m_configs.insert(sampleRate, config);
+    // QSettings replaces the file when writing it, which removes it from the watcher
+    if (!m_settingsWatcher.files().contains(path) && QFile::exists(path)) {
+        m_settingsWatcher.addPath(path);
+    }
+
+    int maxMinuteSamples = 0;
+    QMap<SampleRate, SampleConfig> configs;
+    QMap<SampleRate, int> liveConfigs;
+    QSettings settings(path, QSettings::IniFormat);
+    loadSampleConfigs(settings, &maxMinuteSamples, &configs, &liveConfigs);
+    loadSlowLogConfig(settings);
+    if (liveConfigs != m_liveConfigs) {
+        qCInfo(dcEnergyExperience()) << "Sub-minute energy log configuration changed.";
+        applyLiveConfigs(liveConfigs);
+        scheduleWakeup();
+    }
+    if (maxMinuteSamples == m_maxMinuteSamples && configs == m_configs) {
+        return;
+    }
+
+    qCInfo(dcEnergyExperience()) << "Energy log tier configuration changed. Applying it in the background.";
+    foreach (SampleRate sampleRate, m_configs.keys()) {
+        if (!configs.contains(sampleRate)) {
+            m_nextSamples.remove(sampleRate);
+        }
+    }
+    m_maxMinuteSamples = maxMinuteSamples;
+    m_configs = configs;
+    foreach (SampleRate sampleRate, m_configs.keys()) {
+        if (!m_nextSamples.contains(sampleRate)) {
+            scheduleNextSample(sampleRate);
+        }
+    }
+    scheduleWakeup();
+
+    m_sampleConfigsChanged = true;
+    startDbMaintenance("re-tiering");
 }
 
 QDateTime EnergyLogger::getOldestPowerBalanceSampleTimestamp(SampleRate sampleRate)
@@ -1373,7 +2974,7 @@ QDateTime EnergyLogger::getOldestPowerBalanceSampleTimestamp(SampleRate sampleRa
     QSqlQuery query(m_db);
     query.prepare("SELECT MIN(timestamp) AS oldestTimestamp FROM powerBalance WHERE sampleRate = ?;");
     query.addBindValue(sampleRate);
-    query.exec();
+    execQuery(query, EnergyStatistics::OperationLatestLookup);
     if (query.next() && !query.value("oldestTimestamp").isNull()) {
         return QDateTime::fromMSecsSinceEpoch(query.value("oldestTimestamp").toLongLong());
     }
@@ -1385,7 +2986,7 @@ QDateTime EnergyLogger::getNewestPowerBalanceSampleTimestamp(SampleRate sampleRa
     QSqlQuery query(m_db);
     query.prepare("SELECT MAX(timestamp) AS latestTimestamp FROM powerBalance WHERE sampleRate = ?;");
     query.addBindValue(sampleRate);
-    query.exec();
+    execQuery(query, EnergyStatistics::OperationLatestLookup);
     if (query.next() && !query.value("latestTimestamp").isNull()) {
         return QDateTime::fromMSecsSinceEpoch(query.value("latestTimestamp").toLongLong());
     }
@@ -1398,7 +2999,7 @@ QDateTime EnergyLogger::getOldestThingPowerSampleTimestamp(const ThingId &thingI
     query.prepare("SELECT MIN(timestamp) AS oldestTimestamp FROM thingPower WHERE thingId = ? AND sampleRate = ?;");
     query.addBindValue(thingId);
     query.addBindValue(sampleRate);
-    query.exec();
+    execQuery(query, EnergyStatistics::OperationLatestLookup);
     if (query.next() && !query.value("oldestTimestamp").isNull()) {
         return QDateTime::fromMSecsSinceEpoch(query.value("oldestTimestamp").toLongLong());
     }
@@ -1411,7 +3012,7 @@ QDateTime EnergyLogger::getNewestThingPowerSampleTimestamp(const ThingId &thingI
     query.prepare("SELECT MAX(timestamp) AS newestTimestamp FROM thingPower WHERE thingId = ? AND sampleRate = ?;");
     query.addBindValue(thingId);
     query.addBindValue(sampleRate);
-    query.exec();
+    execQuery(query, EnergyStatistics::OperationLatestLookup);
     if (query.next() && !query.value("newestTimestamp").isNull()) {
         return QDateTime::fromMSecsSinceEpoch(query.value("newestTimestamp").toLongLong());
     }
@@ -1424,7 +3025,7 @@ void EnergyLogger::scheduleNextSample(SampleRate sampleRate)
     // If we don't have a schedule yet, align based on "now".
     QDateTime base = m_nextSamples.value(sampleRate);
     if (!base.isValid()) {
-        base = QDateTime::currentDateTime();
+        base = m_clock->now();
     } else {
         base = base.addMSecs(1000);
     }
@@ -1434,6 +3035,22 @@ void EnergyLogger::scheduleNextSample(SampleRate sampleRate)
     qCDebug(dcEnergyExperience()) << "Next sample for" << sampleRate << "scheduled at" << next.toString();
 }
 
+void EnergyLogger::scheduleWakeup()
+{
+    // sample() has rescheduled everything that was due, only upcoming boundaries count
+    QDateTime now = m_clock->now();
+    QDateTime next;
+    for (auto it = m_nextSamples.constBegin(); it != m_nextSamples.constEnd(); ++it) {
+        if (it.value() > now && (next.isNull() || it.value() < next)) {
+            next = it.value();
+        }
+    }
+    if (next.isNull()) {
+        next = now.addMSecs(60 * 1000);
+    }
+    m_clock->scheduleWakeup(next);
+}
+
 QDateTime EnergyLogger::calculateSampleStart(const QDateTime &sampleEnd, SampleRate sampleRate, int sampleCount)
 {
     if (sampleRate == SampleRate1Month) {
@@ -1444,87 +3061,21 @@ QDateTime EnergyLogger::calculateSampleStart(const QDateTime &sampleEnd, SampleR
     return sampleEnd.addMSecs(-(quint64)sampleCount * sampleRate * 60 * 1000);
 }
 
-void EnergyLogger::rectifySamples(SampleRate sampleRate, SampleRate baseSampleRate)
+QDateTime EnergyLogger::previousSampleTimestamp(SampleRate sampleRate, const QDateTime &sampleEnd)
 {
-    // Normally we'd need to find the newest available sample of a series and catch up from there.
-    // However, it could happen a series does not have any samples at all yet. For example if we're logging since january,
-    // and at new years the system was off, we missed the new years yearly sample and don't have any earlier. For those cases
-    // we need to start resampling from the oldest timestamp we find in the DB for the base sampleRate.
-    QDateTime oldestBaseSample = getOldestPowerBalanceSampleTimestamp(baseSampleRate);
-    QDateTime newestSample = getNewestPowerBalanceSampleTimestamp(sampleRate);
-
-    QDateTime startTime = QDateTime::currentDateTime();
-    qCDebug(dcEnergyExperience()) << "Checking for missing power balance samples for" << sampleRate;
-    qCDebug(dcEnergyExperience()) << "Newest sample:" << newestSample.toString() << "Oldest base sample:" << oldestBaseSample.toString();
-    if (newestSample.isNull()) {
-        qCDebug(dcEnergyExperience()) << "No sample at all so far. Using base as starting point.";
-        newestSample = oldestBaseSample;
-    }
-
-    //    qCDebug(dcEnergyExperience()) << "next sample after last in series:" << nextSampleTimestamp(sampleRate, newestSample).toString();
-    //    qCDebug(dcEnergyExperience()) << "next scheduled sample:" << m_nextSamples.value(sampleRate).toString();
-    if (!newestSample.isNull() && nextSampleTimestamp(sampleRate, newestSample) < m_nextSamples[sampleRate]) {
-        // regularly sample one sample as there may be some valid samples in the base series
-        QDateTime nextSample = nextSampleTimestamp(sampleRate, newestSample.addMSecs(1000));
-        samplePowerBalance(sampleRate, baseSampleRate, nextSample);
-        newestSample = nextSample;
+    if (sampleRate < SampleRate15Mins || sampleRate == SampleRate1Month || sampleRate == SampleRate1Year) {
+        return calculateSampleStart(sampleEnd, sampleRate);
     }
-    // Now retrieve the last sample and just carry over totals
-    PowerBalanceLogEntry latest = latestLogEntry(sampleRate);
-    // We only need to rectify up to maxSamples, so don't bother with older ones
-    if (!newestSample.isNull()) {
-        newestSample = qMax(newestSample, calculateSampleStart(m_nextSamples[sampleRate], sampleRate, m_configs.value(sampleRate).maxSamples));
-    }
-
-    m_db.transaction();
-    int count = 0;
-    while (!newestSample.isNull() && nextSampleTimestamp(sampleRate, newestSample) < m_nextSamples[sampleRate]) {
-        QDateTime nextSample = nextSampleTimestamp(sampleRate, newestSample.addMSecs(1000));
-        insertPowerBalance(nextSample, sampleRate, 0, 0, 0, 0, latest.totalConsumption(), latest.totalProduction(), latest.totalAcquisition(), latest.totalReturn());
-        newestSample = nextSample;
-        count++;
-    }
-    m_db.commit();
-    qCDebug(dcEnergyExperience()) << "Done rectifying" << count << "power balance samples for" << sampleRate << "in" << startTime.msecsTo(QDateTime::currentDateTime()) << "ms";
-
-    foreach (const ThingId &thingId, m_thingsPowerLiveLogs.keys()) {
-        QDateTime oldestBaseSample = getOldestThingPowerSampleTimestamp(thingId, baseSampleRate);
-        QDateTime newestSample = getNewestThingPowerSampleTimestamp(thingId, sampleRate);
-
-        QDateTime startTime = QDateTime::currentDateTime();
-        qCDebug(dcEnergyExperience()) << "Checking for missing thing samples for" << sampleRate << "for thing" << thingId;
-        qCDebug(dcEnergyExperience()) << "Newest sample:" << newestSample.toString() << "Oldest base sample:" << oldestBaseSample.toString();
-        if (newestSample.isNull()) {
-            qCDebug(dcEnergyExperience()) << "No sample at all so far. Using base as starting point.";
-            if (oldestBaseSample.isNull()) {
-                qCDebug(dcEnergyExperience()) << "Base series doesn't have any samples either. Skipping resampling for" << sampleRate << "for" << thingId;
-                continue;
-            }
-            newestSample = oldestBaseSample;
-        }
-        //        qCDebug(dcEnergyExperience()) << "T next sample after last in series:" << nextSampleTimestamp(sampleRate, newestSample).toString();
-        //        qCDebug(dcEnergyExperience()) << "T next scheduled sample:" << m_nextSamples.value(sampleRate).toString();
-        if (!newestSample.isNull() && nextSampleTimestamp(sampleRate, newestSample) < m_nextSamples[sampleRate]) {
-            QDateTime nextSample = nextSampleTimestamp(sampleRate, newestSample.addMSecs(1000));
-            sampleThingPower(thingId, sampleRate, baseSampleRate, nextSample);
-            newestSample = nextSample;
-        }
-        // Now retrieve the last sample and just carry over totals
-        ThingPowerLogEntry latest = latestLogEntry(sampleRate, thingId);
-        // We only need to rectify up to maxSamples, so don't bother with older ones
-        newestSample = qMax(newestSample, calculateSampleStart(m_nextSamples[sampleRate], sampleRate, m_configs.value(sampleRate).maxSamples));
 
-        m_db.transaction();
-        int count = 0;
-        while (!newestSample.isNull() && nextSampleTimestamp(sampleRate, newestSample) < m_nextSamples[sampleRate]) {
-            QDateTime nextSample = nextSampleTimestamp(sampleRate, newestSample.addMSecs(1000));
-            insertThingPower(nextSample, sampleRate, thingId, 0, latest.totalConsumption(), latest.totalProduction());
-            newestSample = nextSample;
-            count++;
-        }
-        m_db.commit();
-        qCDebug(dcEnergyExperience()) << "Done rectifying" << count << "thing power samples for" << sampleRate << " for" << thingId << "in" << startTime.msecsTo(QDateTime::currentDateTime()) << "ms";
+    // Days, weeks and the 3 hour slots are an hour shorter or longer across DST changes. Walk the
+    // schedule from before the nominal start, which is off by at most that hour, up to sampleEnd.
+    QDateTime boundary = nextSampleTimestamp(sampleRate, calculateSampleStart(sampleEnd, sampleRate).addMSecs(-2 * 60 * 60 * 1000));
+    QDateTime previous = boundary;
+    while (boundary < sampleEnd) {
+        previous = boundary;
+        boundary = nextSampleTimestamp(sampleRate, boundary);
     }
+    return previous;
 }
 
 QDateTime EnergyLogger::nextSampleTimestamp(SampleRate sampleRate, const QDateTime &dateTime)
@@ -1536,6 +3087,14 @@ QDateTime EnergyLogger::nextSampleTimestamp(SampleRate sampleRate, const QDateTi
     case SampleRateAny:
         qCWarning(dcEnergyExperience()) << "Cannot calculate next sample timestamp without a sample rate";
         return QDateTime();
+    case SampleRate1Sec:
+        time.setHMS(time.hour(), time.minute(), time.second());
+        next = QDateTime(date, time).addMSecs(1000);
+        break;
+    case SampleRate10Secs:
+        time.setHMS(time.hour(), time.minute(), time.second() - (time.second() % 10));
+        next = QDateTime(date, time).addMSecs(10 * 1000);
+        break;
     case SampleRate1Min:
         time.setHMS(time.hour(), time.minute(), 0);
         next = QDateTime(date, time).addMSecs(60 * 1000);
@@ -1576,9 +3135,9 @@ QDateTime EnergyLogger::nextSampleTimestamp(SampleRate sampleRate, const QDateTi
     return next;
 }
 
-bool EnergyLogger::samplePowerBalance(SampleRate sampleRate, SampleRate baseSampleRate, const QDateTime &sampleEnd)
+bool EnergyLogger::samplePowerBalance(WriteContext *context, SampleRate sampleRate, SampleRate baseSampleRate, const QDateTime &sampleEnd) const
 {
-    QDateTime sampleStart = calculateSampleStart(sampleEnd, sampleRate);
+    QDateTime sampleStart = previousSampleTimestamp(sampleRate, sampleEnd);
 
     qCDebug(dcEnergyExperience()) << "Sampling power balance" << sampleRate << "from" << sampleStart << "to" << sampleEnd;
 
@@ -1591,12 +3150,12 @@ bool EnergyLogger::samplePowerBalance(SampleRate sampleRate, SampleRate baseSamp
     double totalAcquisition = 0;
     double totalReturn = 0;
 
-    QSqlQuery query(m_db);
+    QSqlQuery query(context->db);
     query.prepare("SELECT * FROM powerBalance WHERE sampleRate = ? AND timestamp > ? AND timestamp <= ? ORDER BY timestamp ASC;");
     query.addBindValue(baseSampleRate);
     query.addBindValue(sampleStart.toMSecsSinceEpoch());
     query.addBindValue(sampleEnd.toMSecsSinceEpoch());
-    query.exec();
+    execWriteQuery(context, query, EnergyStatistics::OperationRangeRead);
 
     if (query.lastError().isValid()) {
         qCWarning(dcEnergyExperience()) << "Error fetching power balance samples for" << baseSampleRate << "from" << sampleStart.toString() << "to" << sampleEnd.toString();
@@ -1604,9 +3163,11 @@ bool EnergyLogger::samplePowerBalance(SampleRate sampleRate, SampleRate baseSamp
         return false;
     }
 
+    TierStats tierStats(powerBalanceStatsFields, baseSampleRate);
     int resultCount = 0;
     while (query.next()) {
         resultCount++;
+        tierStats.add(query.record());
         qCDebug(dcEnergyExperience()) << "Frame:" << QDateTime::fromMSecsSinceEpoch(query.value("timestamp").toLongLong()).toString() << query.value("consumption").toDouble() << query.value("production").toDouble() << query.value("acquisition").toDouble() << query.value("storage").toDouble() << query.value("totalConsumption").toDouble() << query.value("totalProduction").toDouble() << query.value("totalAcquisition").toDouble() << query.value("totalReturn").toDouble();
         medianConsumption += query.value("consumption").toDouble();
         medianProduction += query.value("production").toDouble();
@@ -1627,10 +3188,10 @@ bool EnergyLogger::samplePowerBalance(SampleRate sampleRate, SampleRate baseSamp
         // If there are no base samples for the given time frame at all, let's try to find the last existing one in the base
         // to at least copy the totals from where we left off.
 
-        query = QSqlQuery(m_db);
+        query = QSqlQuery(context->db);
         query.prepare("SELECT * FROM powerBalance WHERE sampleRate = ? ORDER BY timestamp DESC LIMIT 1;");
         query.addBindValue(baseSampleRate);
-        query.exec();
+        execWriteQuery(context, query, EnergyStatistics::OperationLatestLookup);
         if (query.lastError().isValid()) {
             qCWarning(dcEnergyExperience()) << "Error fetching newest power balance sample for" << baseSampleRate;
             qCWarning(dcEnergyExperience()) << "SQL error was:" << query.lastError() << "executed query:" << query.executedQuery();
@@ -1647,29 +3208,13 @@ bool EnergyLogger::samplePowerBalance(SampleRate sampleRate, SampleRate baseSamp
 
 
     qCDebug(dcEnergyExperience()) << "Sampled:" << "🔥:" << medianConsumption << "🌞:" << medianProduction << "💵:" << medianAcquisition << "🔋:" << medianStorage << "Totals:" << "🔥:" << totalConsumption << "🌞:" << totalProduction << "💵↓:" << totalAcquisition << "💵↑:" << totalReturn;
-    return insertPowerBalance(sampleEnd, sampleRate, medianConsumption, medianProduction, medianAcquisition, medianStorage, totalConsumption, totalProduction, totalAcquisition, totalReturn);
+    return insertPowerBalance(context, sampleEnd, sampleRate, medianConsumption, medianProduction, medianAcquisition, medianStorage, totalConsumption, totalProduction, totalAcquisition, totalReturn, tierStats.stats(), tierStats.sampleCount());
 }
 
-bool EnergyLogger::insertPowerBalance(const QDateTime &timestamp, SampleRate sampleRate, double consumption, double production, double acquisition, double storage, double totalConsumption, double totalProduction, double totalAcquisition, double totalReturn)
+bool EnergyLogger::insertPowerBalance(WriteContext *context, const QDateTime &timestamp, SampleRate sampleRate, double consumption, double production, double acquisition, double storage, double totalConsumption, double totalProduction, double totalAcquisition, double totalReturn, const QList<PowerStats> &stats, int sampleCount) const
 {
-    if (m_dbMaintenanceRunning) {
-        PendingPowerBalanceSample pending;
-        pending.timestamp = timestamp;
-        pending.sampleRate = sampleRate;
-        pending.consumption = consumption;
-        pending.production = production;
-        pending.acquisition = acquisition;
-        pending.storage = storage;
-        pending.totalConsumption = totalConsumption;
-        pending.totalProduction = totalProduction;
-        pending.totalAcquisition = totalAcquisition;
-        pending.totalReturn = totalReturn;
-        m_pendingPowerBalanceSamples.append(pending);
-        return true;
-    }
-
-    QSqlQuery query = QSqlQuery(m_db);
-    query.prepare("INSERT INTO powerBalance (timestamp, sampleRate, consumption, production, acquisition, storage, totalConsumption, totalProduction, totalAcquisition, totalReturn) values (?, ?, ?, ?, ?, ?, ?, ?, ?, ?);");
+    QSqlQuery query = QSqlQuery(context->db);
+    query.prepare(powerBalanceInsertQuery());
     query.addBindValue(timestamp.toMSecsSinceEpoch());
     query.addBindValue(sampleRate);
     query.addBindValue(consumption);
@@ -1680,40 +3225,32 @@ bool EnergyLogger::insertPowerBalance(const QDateTime &timestamp, SampleRate sam
     query.addBindValue(totalProduction);
     query.addBindValue(totalAcquisition);
     query.addBindValue(totalReturn);
-    query.exec();
+    bindStats(query, powerBalanceStatsFields, stats, sampleCount);
+    execWriteQuery(context, query, EnergyStatistics::OperationInsert);
     if (query.lastError().isValid()) {
         qCWarning(dcEnergyExperience()) << "Error logging consumption sample:" << query.lastError() << query.executedQuery();
         return false;
     }
-    emit powerBalanceEntryAdded(sampleRate, PowerBalanceLogEntry(timestamp, consumption, production, acquisition, storage, totalConsumption, totalProduction, totalAcquisition, totalReturn));
+    context->result.powerBalanceEntries.append(qMakePair(sampleRate, PowerBalanceLogEntry(timestamp, consumption, production, acquisition, storage, totalConsumption, totalProduction, totalAcquisition, totalReturn)));
     return true;
 }
 
-bool EnergyLogger::sampleThingsPower(SampleRate sampleRate, SampleRate baseSampleRate, const QDateTime &sampleEnd)
-{
-    bool ret = true;
-    foreach (const ThingId &thingId, m_thingsPowerLiveLogs.keys()) {
-        ret &= sampleThingPower(thingId, sampleRate, baseSampleRate, sampleEnd);
-    }
-    return ret;
-}
-
-bool EnergyLogger::sampleThingPower(const ThingId &thingId, SampleRate sampleRate, SampleRate baseSampleRate, const QDateTime &sampleEnd)
+bool EnergyLogger::sampleThingPower(WriteContext *context, const ThingId &thingId, SampleRate sampleRate, SampleRate baseSampleRate, const QDateTime &sampleEnd) const
 {
-    QDateTime sampleStart = calculateSampleStart(sampleEnd, sampleRate);
+    QDateTime sampleStart = previousSampleTimestamp(sampleRate, sampleEnd);
     qCDebug(dcEnergyExperience()) << "Sampling thing power for" << thingId.toString() << sampleRate << "from" << sampleStart.toString() << "to" << sampleEnd.toString();
 
     double medianCurrentPower = 0;
     double totalConsumption = 0;
     double totalProduction = 0;
 
-    QSqlQuery query(m_db);
+    QSqlQuery query(context->db);
     query.prepare("SELECT * FROM thingPower WHERE thingId = ? AND sampleRate = ? AND timestamp > ? AND timestamp <= ? ORDER BY timestamp ASC;");
     query.addBindValue(thingId);
     query.addBindValue(baseSampleRate);
     query.addBindValue(sampleStart.toMSecsSinceEpoch());
     query.addBindValue(sampleEnd.toMSecsSinceEpoch());
-    query.exec();
+    execWriteQuery(context, query, EnergyStatistics::OperationRangeRead);
 
     if (query.lastError().isValid()) {
         qCWarning(dcEnergyExperience()) << "Error fetching thing power samples for" << baseSampleRate << "from" << sampleStart.toString() << "to" << sampleEnd.toString();
@@ -1724,9 +3261,11 @@ bool EnergyLogger::sampleThingPower(const ThingId &thingId, SampleRate sampleRat
     qCDebug(dcEnergyExperience()) << "Query:" << query.executedQuery();
     qCDebug(dcEnergyExperience()) << "Results:" << query.size();
 
+    TierStats tierStats(thingPowerStatsFields, baseSampleRate);
     int resultCount = 0;
     while (query.next()) {
         resultCount++;
+        tierStats.add(query.record());
         qCDebug(dcEnergyExperience()) << "Frame:" << query.value("currentPower").toDouble() << QDateTime::fromMSecsSinceEpoch(query.value("timestamp").toLongLong()).toString();
         medianCurrentPower += query.value("currentPower").toDouble();
         totalConsumption = query.value("totalConsumption").toDouble();
@@ -1739,11 +3278,11 @@ bool EnergyLogger::sampleThingPower(const ThingId &thingId, SampleRate sampleRat
         // If there are no base samples for the given time frame at all, let's try to find the last existing one in the base
         // to at least copy the totals from where we left off.
 
-        query = QSqlQuery(m_db);
+        query = QSqlQuery(context->db);
         query.prepare("SELECT * FROM thingPower WHERE thingId = ? AND sampleRate = ? ORDER BY timestamp DESC LIMIT 1;");
         query.addBindValue(thingId);
         query.addBindValue(baseSampleRate);
-        query.exec();
+        execWriteQuery(context, query, EnergyStatistics::OperationLatestLookup);
         if (query.lastError().isValid()) {
             qCWarning(dcEnergyExperience()) << "Error fetching newest thing power sample for" << thingId.toString() << baseSampleRate;
             qCWarning(dcEnergyExperience()) << "SQL error was:" << query.lastError() << "executed query:" << query.executedQuery();
@@ -1758,74 +3297,133 @@ bool EnergyLogger::sampleThingPower(const ThingId &thingId, SampleRate sampleRat
 
 
     qCDebug(dcEnergyExperience()) << "Sampled:" << thingId.toString() << sampleRate << "median currentPower:" << medianCurrentPower << "total consumption:" << totalConsumption << "total production:" << totalProduction;
-    return insertThingPower(sampleEnd, sampleRate, thingId, medianCurrentPower, totalConsumption, totalProduction);
+    return insertThingPower(context, sampleEnd, sampleRate, thingId, medianCurrentPower, totalConsumption, totalProduction, tierStats.stats(), tierStats.sampleCount());
 }
 
-bool EnergyLogger::insertThingPower(const QDateTime &timestamp, SampleRate sampleRate, const ThingId &thingId, double currentPower, double totalConsumption, double totalProduction)
+bool EnergyLogger::insertThingPower(WriteContext *context, const QDateTime &timestamp, SampleRate sampleRate, const ThingId &thingId, double currentPower, double totalConsumption, double totalProduction, const QList<PowerStats> &stats, int sampleCount) const
 {
-    if (m_dbMaintenanceRunning) {
-        PendingThingPowerSample pending;
-        pending.timestamp = timestamp;
-        pending.sampleRate = sampleRate;
-        pending.thingId = thingId;
-        pending.currentPower = currentPower;
-        pending.totalConsumption = totalConsumption;
-        pending.totalProduction = totalProduction;
-        m_pendingThingPowerSamples.append(pending);
-        return true;
-    }
-
-    QSqlQuery query = QSqlQuery(m_db);
-    query.prepare("INSERT INTO thingPower (timestamp, sampleRate, thingId, currentPower, totalConsumption, totalProduction) values (?, ?, ?, ?, ?, ?);");
+    QSqlQuery query = QSqlQuery(context->db);
+    query.prepare(thingPowerInsertQuery());
     query.addBindValue(timestamp.toMSecsSinceEpoch());
     query.addBindValue(sampleRate);
     query.addBindValue(thingId);
     query.addBindValue(currentPower);
     query.addBindValue(totalConsumption);
     query.addBindValue(totalProduction);
-    query.exec();
+    bindStats(query, thingPowerStatsFields, stats, sampleCount);
+    execWriteQuery(context, query, EnergyStatistics::OperationInsert);
     if (query.lastError().isValid()) {
         qCWarning(dcEnergyExperience()) << "Error logging thing power sample:" << query.lastError() << query.executedQuery();
         return false;
     }
-    emit thingPowerEntryAdded(sampleRate, ThingPowerLogEntry(timestamp, thingId, currentPower, totalConsumption, totalProduction));
+    context->result.thingPowerEntries.append(qMakePair(sampleRate, ThingPowerLogEntry(timestamp, thingId, currentPower, totalConsumption, totalProduction)));
     return true;
 }
 
-void EnergyLogger::trimPowerBalance(SampleRate sampleRate, const QDateTime &beforeTime)
+void EnergyLogger::trimPowerBalance(WriteContext *context, SampleRate sampleRate, const QDateTime &beforeTime) const
 {
-    if (m_dbMaintenanceRunning) {
-        return;
-    }
-
-    QSqlQuery query(m_db);
+    EnergyProfiler::Span span("trimPowerBalance", "db");
+    span.setArg("sampleRate", sampleRate);
+    QSqlQuery query(context->db);
     query.prepare("DELETE FROM powerBalance WHERE sampleRate = ? AND timestamp < ?;");
     query.addBindValue(sampleRate);
     query.addBindValue(beforeTime.toMSecsSinceEpoch());
-    query.exec();
+    execWriteQuery(context, query, EnergyStatistics::OperationTrim);
     if (query.numRowsAffected() > 0) {
         qCDebug(dcEnergyExperience()).nospace() << "Trimmed " << query.numRowsAffected() << " from power balance series: " << sampleRate << " (Older than: " << beforeTime.toString() << ")";
     }
 }
 
-void EnergyLogger::trimThingPower(const ThingId &thingId, SampleRate sampleRate, const QDateTime &beforeTime)
+void EnergyLogger::trimThingPower(WriteContext *context, const ThingId &thingId, SampleRate sampleRate, const QDateTime &beforeTime) const
 {
-    if (m_dbMaintenanceRunning) {
-        return;
-    }
-
-    QSqlQuery query(m_db);
+    EnergyProfiler::Span span("trimThingPower", "db");
+    span.setArg("sampleRate", sampleRate);
+    span.setArg("thingId", thingId.toString());
+    QSqlQuery query(context->db);
     query.prepare("DELETE FROM thingPower WHERE thingId = ? AND sampleRate = ? AND timestamp < ?;");
     query.addBindValue(thingId);
     query.addBindValue(sampleRate);
     query.addBindValue(beforeTime.toMSecsSinceEpoch());
-    query.exec();
+    execWriteQuery(context, query, EnergyStatistics::OperationTrim);
     if (query.numRowsAffected() > 0) {
         qCDebug(dcEnergyExperience()).nospace() << "Trimmed " << query.numRowsAffected() << " from thing power series for: " << thingId << sampleRate << " (Older than: " << beforeTime.toString() << ")";
     }
 }
 
-PowerBalanceLogEntry EnergyLogger::queryResultToBalanceLogEntry(const QSqlRecord &record) const
+bool EnergyLogger::execQuery(QSqlQuery &query, EnergyStatistics::Operation operation) const
+{
+    QElapsedTimer timer;
+    timer.start();
+    bool success = query.exec();
+    qint64 usecs = timer.nsecsElapsed() / 1000;
+    m_statistics.record(operation, usecs);
+    int threshold = m_slowOperationThreshold.loadAcquire();
+    if (threshold > 0 && usecs >= threshold * 1000) {
+        logSlowQuery(m_db, query, operation, usecs, &m_explainedStatements);
+    }
+    return success;
+}
+
+bool EnergyLogger::execWriteQuery(WriteContext *context, QSqlQuery &query, EnergyStatistics::Operation operation) const
+{
+    // The statistics are only touched on the main thread, the timings go back with the result
+    QElapsedTimer timer;
+    timer.start();
+    bool success = query.exec();
+    qint64 usecs = timer.nsecsElapsed() / 1000;
+    context->result.timings.append(qMakePair(operation, usecs));
+    int threshold = m_slowOperationThreshold.loadAcquire();
+    if (threshold > 0 && usecs >= threshold * 1000) {
+        logSlowQuery(context->db, query, operation, usecs, &context->explainedStatements);
+    }
+    return success;
+}
+
+void EnergyLogger::logSlowQuery(const QSqlDatabase &db, const QSqlQuery &query, EnergyStatistics::Operation operation, qint64 usecs, QSet<QString> *explainedStatements) const
+{
+    QVariantList bindValues;
+    QStringList parameters;
+    for (int i = 0; i < query.boundValues().count(); i++) {
+        bindValues.append(query.boundValue(i));
+        QString parameter = query.boundValue(i).toString();
+        parameters.append(parameter.length() > 40 ? parameter.left(37) + "..." : parameter);
+    }
+
+    // SQLite doesn't know how many rows a select will return until they are fetched
+    QString rows = query.isSelect() ? QString("-") : QString::number(query.numRowsAffected());
+    qCWarning(dcEnergyExperience()).nospace().noquote() << "Slow " << EnergyStatistics::operationName(operation) << " statement took "
+                                                        << usecs / 1000.0 << " ms: " << query.lastQuery() << " Parameters: [" << parameters.join(", ")
+                                                        << "] Rows affected: " << rows;
+
+    if (explainedStatements->contains(query.lastQuery())) {
+        return;
+    }
+    explainedStatements->insert(query.lastQuery());
+
+    QSqlQuery explainQuery(db);
+    explainQuery.prepare("EXPLAIN QUERY PLAN " + query.lastQuery());
+    foreach (const QVariant &bindValue, bindValues) {
+        explainQuery.addBindValue(bindValue);
+    }
+    if (!explainQuery.exec()) {
+        qCWarning(dcEnergyExperience()) << "Cannot explain slow statement:" << explainQuery.lastError().text();
+        return;
+    }
+    QStringList plan;
+    while (explainQuery.next()) {
+        plan.append(explainQuery.value("detail").toString());
+    }
+    qCWarning(dcEnergyExperience()).noquote() << "Query plan:" << plan.join(" | ");
+}
+
+void EnergyLogger::loadSlowLogConfig(QSettings &settings)
+{
+    settings.beginGroup("SlowLog");
+    m_slowOperationThreshold.storeRelease(settings.value("threshold", 500).toInt());
+    settings.endGroup();
+}
+
+PowerBalanceLogEntry EnergyLogger::queryResultToBalanceLogEntry(const QSqlRecord &record)
 {
     return PowerBalanceLogEntry(QDateTime::fromMSecsSinceEpoch(record.value("timestamp").toLongLong()),
                                 record.value("consumption").toDouble(),
@@ -1839,7 +3437,7 @@ PowerBalanceLogEntry EnergyLogger::queryResultToBalanceLogEntry(const QSqlRecord
 
 }
 
-ThingPowerLogEntry EnergyLogger::queryResultToThingPowerLogEntry(const QSqlRecord &record) const
+ThingPowerLogEntry EnergyLogger::queryResultToThingPowerLogEntry(const QSqlRecord &record)
 {
     return ThingPowerLogEntry(QDateTime::fromMSecsSinceEpoch(record.value("timestamp").toULongLong()),
                               record.value("thingId").toUuid(),
@@ -1847,3 +3445,79 @@ ThingPowerLogEntry EnergyLogger::queryResultToThingPowerLogEntry(const QSqlRecor
                               record.value("totalConsumption").toDouble(),
                               record.value("totalProduction").toDouble());
 }
+
+void EnergyLogger::ThingPowerScanMerge::addScan(const QString &thingId, QSqlQuery query)
+{
+    if (!query.next()) {
+        return;
+    }
+    Scan scan;
+    scan.thingId = thingId;
+    scan.query = query;
+    // Use the record, projected queries may not contain all value columns
+    scan.entry = queryResultToThingPowerLogEntry(query.record());
+    m_scans.append(scan);
+
+    m_heap.append(m_scans.count() - 1);
+    std::push_heap(m_heap.begin(), m_heap.end(), [this](int a, int b){ return scanLaterThan(a, b); });
+}
+
+bool EnergyLogger::ThingPowerScanMerge::atEnd() const
+{
+    return m_heap.isEmpty();
+}
+
+ThingPowerLogEntry EnergyLogger::ThingPowerScanMerge::takeNext()
+{
+    auto laterThan = [this](int a, int b){ return scanLaterThan(a, b); };
+    std::pop_heap(m_heap.begin(), m_heap.end(), laterThan);
+    Scan &scan = m_scans[m_heap.last()];
+    ThingPowerLogEntry entry = scan.entry;
+    if (scan.query.next()) {
+        scan.entry = queryResultToThingPowerLogEntry(scan.query.record());
+        std::push_heap(m_heap.begin(), m_heap.end(), laterThan);
+    } else {
+        m_heap.removeLast();
+    }
+    return entry;
+}
+
+bool EnergyLogger::ThingPowerScanMerge::scanLaterThan(int a, int b) const
+{
+    qint64 timestampA = m_scans.at(a).entry.timestamp().toMSecsSinceEpoch();
+    qint64 timestampB = m_scans.at(b).entry.timestamp().toMSecsSinceEpoch();
+    if (timestampA != timestampB) {
+        return timestampA > timestampB;
+    }
+    return m_scans.at(a).thingId > m_scans.at(b).thingId;
+}
+
+QString EnergyLogger::encodeCursor(qint64 timestamp, const ThingId &thingId)
+{
+    // Keyset cursor pointing at the last returned entry. Clients must treat this as opaque.
+    QByteArray cursor = QByteArray::number(timestamp);
+    if (!thingId.isNull()) {
+        cursor += ';' + thingId.toString().toUtf8();
+    }
+    return QString::fromLatin1(cursor.toBase64(QByteArray::Base64UrlEncoding | QByteArray::OmitTrailingEquals));
+}
+
+bool EnergyLogger::decodeCursor(const QString &cursor, qint64 *timestamp, ThingId *thingId)
+{
+    QList<QByteArray> parts = QByteArray::fromBase64(cursor.toLatin1(), QByteArray::Base64UrlEncoding).split(';');
+    if (parts.count() != (thingId ? 2 : 1)) {
+        return false;
+    }
+    bool ok = false;
+    *timestamp = parts.first().toLongLong(&ok);
+    if (!ok) {
+        return false;
+    }
+    if (thingId) {
+        *thingId = ThingId(QUuid(QString::fromUtf8(parts.at(1))));
+        if (thingId->isNull()) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -26,106 +26,285 @@
 #define ENERGYLOGGER_H
 
 #include "energylogs.h"
+#include "energylogstream.h"
+#include "energystatistics.h"
+#include "energywritequeue.h"
 
 #include <typeutils.h>
 
 #include <QObject>
 #include <QDateTime>
 #include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSettings>
 #include <QSqlResult>
-#include <QTimer>
+#include <QSqlRecord>
 #include <QMap>
 #include <QSet>
 #include <QThread>
+#include <QTimer>
+#include <QFileSystemWatcher>
+#include <QContiguousCache>
+#include <QSemaphore>
+#include <QAtomicInt>
+#include <QMutex>
+
+class EnergyClock;
 
 class EnergyLogger : public EnergyLogs
 {
     Q_OBJECT
+    // Drive the sampling and write samples directly, see tests/
+    friend class EnergyLoggerBenchmark;
+    friend class EnergyLoggerTest;
+
 public:
+    // Power statistics of the base samples aggregated into one tier sample. Stored along with the sample as
+    // <field>Min, <field>Max and <field>Peak15, the highest 15 minute average. Minute samples don't have them.
+    struct PowerStats {
+        double min = 0;
+        double max = 0;
+        double peak15 = 0;
+    };
+
+    // The PowerStats of one tier sample, keyed by the power value they were computed for (e.g. "consumption")
+    struct StatsEntry {
+        QDateTime timestamp;
+        int sampleCount = 0;
+        QMap<QString, PowerStats> stats;
+    };
+
+    // A persisted tier, sampled from the base series and keeping maxSamples samples
+    struct SampleConfig {
+        SampleRate baseSampleRate = SampleRate1Min;
+        uint maxSamples = 0;
+        bool operator==(const SampleConfig &other) const { return baseSampleRate == other.baseSampleRate && maxSamples == other.maxSamples; }
+    };
+
     explicit EnergyLogger(QObject *parent = nullptr);
+    // Samples along the given clock instead of the system time. The clock is not owned.
+    explicit EnergyLogger(EnergyClock *clock, QObject *parent = nullptr);
     ~EnergyLogger() override;
 
     void logPowerBalance(double consumption, double production, double acquisition, double storage, double totalConsumption, double totalProduction, double totalAcquisition, double totalReturn);
     void logThingPower(const ThingId &thingId, double currentPower, double totalConsumption, double totalProduction);
 
     PowerBalanceLogEntries powerBalanceLogs(SampleRate sampleRate, const QDateTime &from = QDateTime(), const QDateTime &to = QDateTime()) const override;
+    PowerBalanceLogEntries powerBalanceLogs(SampleRate sampleRate, const QDateTime &from, const QDateTime &to, const QueryOptions &options, QString *nextCursor = nullptr) const override;
     ThingPowerLogEntries thingPowerLogs(SampleRate sampleRate, const QList<ThingId> &thingIds, const QDateTime &from = QDateTime(), const QDateTime &to = QDateTime()) const override;
+    ThingPowerLogEntries thingPowerLogs(SampleRate sampleRate, const QList<ThingId> &thingIds, const QDateTime &from, const QDateTime &to, const QueryOptions &options, QString *nextCursor = nullptr) const override;
+    qint64 powerBalanceLogsRevision() const override;
+    qint64 thingPowerLogsRevision() const override;
+
+    // Rows have been deleted at these revisions other than by the retention trims. Queries with an older
+    // sinceRevision return all entries, the client needs to replace what it has synced so far.
+    qint64 powerBalanceLogsResyncRevision() const;
+    qint64 thingPowerLogsResyncRevision() const;
+    ThingEnergyDeltas energyBetween(const QList<ThingId> &thingIds, const QDateTime &from, const QDateTime &to) const override;
+    ThingEnergyDeltas topConsumers(const QDateTime &from, const QDateTime &to, int count) const override;
+    PowerBalanceEnergyDelta powerBalanceEnergyBetween(const QDateTime &from, const QDateTime &to) const override;
+
+    // The PowerStats of the tier samples of the power balance, or of the given thing. Minute samples don't have any.
+    QList<StatsEntry> powerStats(SampleRate sampleRate, const ThingId &thingId, const QDateTime &from = QDateTime(), const QDateTime &to = QDateTime()) const;
 
     PowerBalanceLogEntry latestLogEntry(SampleRate sampleRate);
     ThingPowerLogEntry latestLogEntry(SampleRate sampleRate, const ThingId &thingId);
 
+    // The newest values as logged by logPowerBalance() and logThingPower(), without touching the DB.
+    // If thingIds is empty, all things will be returned.
+    PowerBalanceLogEntry currentPowerBalanceEntry() const;
+    ThingPowerLogEntries currentThingPowerEntries(const QList<ThingId> &thingIds) const;
+
+    // Whether the given sub-minute sample rate is enabled, see SampleRate
+    bool hasLiveSampleRate(SampleRate sampleRate) const;
+
     void removeThingLogs(const ThingId &thingId);
     QList<ThingId> loggedThings() const;
 
+    // Operation timings and counters, the energy manager and JSON handler record theirs here too
+    EnergyStatistics *statistics() const;
+
+    // Bulk exports. The returned stream is not started yet. Only options.fields is used, streams are neither paged nor downsampled.
+    EnergyLogStream *createPowerBalanceLogStream(SampleRate sampleRate, const QDateTime &from, const QDateTime &to, const QueryOptions &options, int chunkSize, int windowSize, QObject *parent);
+    EnergyLogStream *createThingPowerLogStream(SampleRate sampleRate, const QList<ThingId> &thingIds, const QDateTime &from, const QDateTime &to, const QueryOptions &options, int chunkSize, int windowSize, QObject *parent);
+
+    // Schema and tier layout, shared with tools working on energy log DBs
+    static bool initSchema(QSqlDatabase &db);
+    static void loadSampleConfigs(QSettings &settings, int *maxMinuteSamples, QMap<SampleRate, SampleConfig> *configs, QMap<SampleRate, int> *liveConfigs);
+    static QDateTime nextSampleTimestamp(SampleRate sampleRate, const QDateTime &dateTime);
+    static QDateTime calculateSampleStart(const QDateTime &sampleEnd, SampleRate sampleRate, int sampleCount = 1);
+    // The sample boundary before sampleEnd as scheduled by nextSampleTimestamp(), i.e. in local time across DST changes
+    static QDateTime previousSampleTimestamp(SampleRate sampleRate, const QDateTime &sampleEnd);
+
+    static PowerBalanceLogEntry queryResultToBalanceLogEntry(const QSqlRecord &record);
+    static ThingPowerLogEntry queryResultToThingPowerLogEntry(const QSqlRecord &record);
+
+    // Merges per thing scans, each ordered by timestamp, into one sequence ordered by timestamp and thingId.
+    // Shared by thingPowerLogs() and the thing power log streams so both return the same order.
+    class ThingPowerScanMerge
+    {
+    public:
+        // Takes an executed forward only query, as built by thingPowerScanQuery(). ThingIds are compared as stored in the DB.
+        void addScan(const QString &thingId, QSqlQuery query);
+        bool atEnd() const;
+        ThingPowerLogEntry takeNext();
+
+    private:
+        struct Scan {
+            QString thingId;
+            QSqlQuery query;
+            ThingPowerLogEntry entry;
+        };
+        bool scanLaterThan(int a, int b) const;
+
+        QList<Scan> m_scans;
+        QVector<int> m_heap;
+    };
+
     // For internal use, the energymanager needs to cache some values to track things total values
     // This is really only here to have a single storage and not keep a separate cache file. Shouldn't be used for anything else
     // Note that the returned ThingPowerLogEntry will be incomplete. It won't have a timestamp nor a currentPower value!
     void cacheThingEntry(const ThingId &thingId, double totalEnergyConsumed, double totalEnergyProduced);
     ThingPowerLogEntry cachedThingEntry(const ThingId &thingId);
+    // The things with a cache entry, which includes all logged things
+    QList<ThingId> cachedThings() const;
 
 private slots:
+    void onClockWakeup();
+    void onClockJumped(qint64 msecs);
     void sample();
+    void onSettingsFileChanged(const QString &path);
 
 private:
     bool initDB();
-    void addConfig(SampleRate sampleRate, SampleRate baseSampleRate, int maxSamples);
+    static bool migrateDB(QSqlDatabase &db);
     QDateTime getOldestPowerBalanceSampleTimestamp(SampleRate sampleRate);
     QDateTime getNewestPowerBalanceSampleTimestamp(SampleRate sampleRate);
     QDateTime getOldestThingPowerSampleTimestamp(const ThingId &thingId, SampleRate sampleRate);
     QDateTime getNewestThingPowerSampleTimestamp(const ThingId &thingId, SampleRate sampleRate);
 
-    QDateTime nextSampleTimestamp(SampleRate sampleRate, const QDateTime &dateTime);
     void scheduleNextSample(SampleRate sampleRate);
-    QDateTime calculateSampleStart(const QDateTime &sampleEnd, SampleRate sampleRate, int sampleCount = 1);
+    // Arms the clock for the earliest upcoming sample boundary across all sample rates
+    void scheduleWakeup();
+
+    // The totals at timestamp, as used for the energy deltas. A null thingId reads the power balance.
+    ThingPowerLogEntry thingTotalsAt(const ThingId &thingId, const QDateTime &timestamp) const;
+    PowerBalanceLogEntry powerBalanceTotalsAt(const QDateTime &timestamp) const;
+    QSqlRecord totalsAt(const QString &table, const QString &columns, const ThingId &thingId, const QDateTime &timestamp) const;
+    // The subquery selecting the rowid of the sample holding the totals at timestamp, shared by totalsAt() and topConsumers().
+    // thingFilter is empty for the power balance, any of its bind values go before the ones appended here.
+    QString totalsAtRowQuery(const QString &table, const QString &thingFilter, const QDateTime &timestamp, QVariantList *bindValues) const;
+
+    // Time weighted averages of the live logs, with the totals of the newest live entry up to sampleEnd
+    PowerBalanceLogEntry averagePowerBalance(const QDateTime &sampleStart, const QDateTime &sampleEnd) const;
+    ThingPowerLogEntry averageThingPower(const ThingId &thingId, const QDateTime &sampleStart, const QDateTime &sampleEnd) const;
+
+    // Sub-minute sample rates, held in memory only
+    void sampleLiveSeries(const QDateTime &now);
+    PowerBalanceLogEntries livePowerBalanceLogs(SampleRate sampleRate, const QDateTime &from, const QDateTime &to, const QueryOptions &options, QString *nextCursor) const;
+    ThingPowerLogEntries liveThingPowerLogs(SampleRate sampleRate, const QList<ThingId> &thingIds, const QDateTime &from, const QDateTime &to, const QueryOptions &options, QString *nextCursor) const;
 
-    void rectifySamples(SampleRate sampleRate, EnergyLogger::SampleRate baseSampleRate);
+    // Executes the query, recording its duration in the statistics and the slow operation log
+    bool execQuery(QSqlQuery &query, EnergyStatistics::Operation operation) const;
+    void logSlowQuery(const QSqlDatabase &db, const QSqlQuery &query, EnergyStatistics::Operation operation, qint64 usecs, QSet<QString> *explainedStatements) const;
+    void loadSlowLogConfig(QSettings &settings);
 
-    bool samplePowerBalance(SampleRate sampleRate, SampleRate baseSampleRate, const QDateTime &sampleEnd);
-    bool insertPowerBalance(const QDateTime &timestamp, SampleRate sampleRate, double consumption, double production, double acquisition, double storage, double totalConsumption, double totalProduction, double totalAcquisition, double totalReturn);
-    bool sampleThingsPower(SampleRate sampleRate, SampleRate baseSampleRate, const QDateTime &sampleEnd);
-    bool sampleThingPower(const ThingId &thingId, SampleRate sampleRate, SampleRate baseSampleRate, const QDateTime &sampleEnd);
-    bool insertThingPower(const QDateTime &timestamp, SampleRate sampleRate, const ThingId &thingId, double currentPower, double totalConsumption, double totalProduction);
-    void trimPowerBalance(SampleRate sampleRate, const QDateTime &beforeTime);
-    void trimThingPower(const ThingId &thingId, SampleRate sampleRate, const QDateTime &beforeTime);
+    // The range scan of one thing on idx_thingPower, as run by thingPowerLogs() for each thing. Expects a valid or empty cursor.
+    static QString thingPowerScanQuery(SampleRate sampleRate, const ThingId &thingId, const QDateTime &from, const QDateTime &to, const QStringList &columns, const QueryOptions &options, QVariantList *bindValues);
 
-    PowerBalanceLogEntry queryResultToBalanceLogEntry(const QSqlRecord &record) const;
-    ThingPowerLogEntry queryResultToThingPowerLogEntry(const QSqlRecord &record) const;
+    static QString encodeCursor(qint64 timestamp, const ThingId &thingId = ThingId());
+    static bool decodeCursor(const QString &cursor, qint64 *timestamp, ThingId *thingId = nullptr);
 
 private:
-    struct PendingPowerBalanceSample {
+    // An immutable unit of work for the writer thread. Which members are used depends on the type.
+    struct WriteRecord {
+        enum Type {
+            TypePowerBalance, // Insert a sample: values are consumption, production, acquisition, storage and the 4 totals
+            TypeThingPower, // Insert a sample: values are currentPower, totalConsumption and totalProduction
+            TypeSampleTier, // Aggregate the tier sample ending at timestamp from its base series, for the balance and thingIds
+            TypeTrim, // Drop the samples of sampleRate older than timestamp, for the balance and thingIds
+            TypeRemoveThing,
+            TypeCacheThing, // values are totalEnergyConsumed and totalEnergyProduced
+            TypeMaintenance, // Gap filling up to timestamp, applying the tier configs and rectifying the tiers
+            TypeWriteProfile, // Writes the profile file, see EnergyProfiler. Not a DB write, but keeps the serialization off the main thread
+            TypeStop // The last record, the writer thread finishes once it is reached
+        };
+        Type type = TypePowerBalance;
         QDateTime timestamp;
         SampleRate sampleRate = SampleRateAny;
-        double consumption = 0;
-        double production = 0;
-        double acquisition = 0;
-        double storage = 0;
-        double totalConsumption = 0;
-        double totalProduction = 0;
-        double totalAcquisition = 0;
-        double totalReturn = 0;
+        SampleRate baseSampleRate = SampleRateAny;
+        ThingId thingId;
+        QList<ThingId> thingIds;
+        QVector<double> values;
+        QList<PowerStats> stats;
+        int sampleCount = 0;
+        // Minute samples fill a gap in front of them up to the retention, maintenance uses all of these
+        int maxMinuteSamples = 0;
+        QString reason;
+        QMap<SampleRate, SampleConfig> configs;
+        QHash<SampleRate, QDateTime> nextSamples;
     };
 
-    struct PendingThingPowerSample {
-        QDateTime timestamp;
-        SampleRate sampleRate = SampleRateAny;
-        ThingId thingId;
-        double currentPower = 0;
-        double totalConsumption = 0;
-        double totalProduction = 0;
+    // What the writer did, handed back to the main thread after each batch and each maintenance run
+    struct WriteResult {
+        int records = 0;
+        QList<QPair<SampleRate, PowerBalanceLogEntry>> powerBalanceEntries;
+        QList<QPair<SampleRate, ThingPowerLogEntry>> thingPowerEntries;
+        QList<QPair<EnergyStatistics::Operation, qint64>> timings;
+        // The tiers need rectifying, the writer found a gap in front of a sample
+        bool gapDetected = false;
+        QString maintenanceReason;
+        qint64 maintenanceDuration = 0;
+    };
+
+    // The writer's connection and state, only touched by the thread running the writes
+    struct WriteContext {
+        QSqlDatabase db;
+        bool batchOpen = false;
+        QSet<QString> explainedStatements;
+        WriteResult result;
     };
 
     void startDbMaintenance(const QString &reason, const QDateTime &fillMinuteSamplesUntil = QDateTime());
-    void flushPendingDbWrites();
 
-    struct SampleConfig {
-        SampleRate baseSampleRate;
-        uint maxSamples = 0;
-    };
+    // Main thread side of the writer. Records which don't fit into the queue wait in the backlog, in order.
+    void enqueueWrites(const QList<WriteRecord> &records);
+    bool flushWriteBacklog();
+    bool writesPending() const;
+    void onWritesDone(const WriteResult &result);
+
+    // Writer thread side. All writes go through here, batched into one transaction per wakeup.
+    void runWriter();
+    bool takeWrite(WriteRecord *record);
+    void postWriteResult(WriteContext *context);
+    void executeWrite(WriteContext *context, const WriteRecord &record) const;
+    void runMaintenance(WriteContext *context, const WriteRecord &record) const;
+    bool execWriteQuery(WriteContext *context, QSqlQuery &query, EnergyStatistics::Operation operation) const;
+    bool samplePowerBalance(WriteContext *context, SampleRate sampleRate, SampleRate baseSampleRate, const QDateTime &sampleEnd) const;
+    bool insertPowerBalance(WriteContext *context, const QDateTime &timestamp, SampleRate sampleRate, double consumption, double production, double acquisition, double storage, double totalConsumption, double totalProduction, double totalAcquisition, double totalReturn, const QList<PowerStats> &stats = QList<PowerStats>(), int sampleCount = 0) const;
+    bool sampleThingPower(WriteContext *context, const ThingId &thingId, SampleRate sampleRate, SampleRate baseSampleRate, const QDateTime &sampleEnd) const;
+    bool insertThingPower(WriteContext *context, const QDateTime &timestamp, SampleRate sampleRate, const ThingId &thingId, double currentPower, double totalConsumption, double totalProduction, const QList<PowerStats> &stats = QList<PowerStats>(), int sampleCount = 0) const;
+    void trimPowerBalance(WriteContext *context, SampleRate sampleRate, const QDateTime &beforeTime) const;
+    void trimThingPower(WriteContext *context, const ThingId &thingId, SampleRate sampleRate, const QDateTime &beforeTime) const;
+
+    void applyLiveConfigs(const QMap<SampleRate, int> &liveConfigs);
 
     PowerBalanceLogEntries m_balanceLiveLog;
     QHash<ThingId, ThingPowerLogEntries> m_thingsPowerLiveLogs;
 
-    QTimer m_sampleTimer;
+    // Sub-minute samples, ring buffers with the configured capacity per sample rate
+    QMap<SampleRate, int> m_liveConfigs;
+    QHash<SampleRate, QContiguousCache<PowerBalanceLogEntry>> m_balanceLiveSamples;
+    QHash<SampleRate, QHash<ThingId, QContiguousCache<ThingPowerLogEntry>>> m_thingsPowerLiveSamples;
+
+    EnergyClock *m_clock = nullptr;
+    mutable EnergyStatistics m_statistics;
+    QTimer m_profileWriteTimer;
+
+    // Statements and ticks taking longer than this are logged, 0 disables the slow operation log.
+    // The query plan is logged once per statement. Read by the writer thread as well.
+    QAtomicInt m_slowOperationThreshold = 500;
+    mutable QSet<QString> m_explainedStatements;
     QHash<SampleRate, QDateTime> m_nextSamples;
 
     QSqlDatabase m_db;
@@ -133,13 +312,23 @@ private:
 
     int m_maxMinuteSamples = 0;
     QMap<SampleRate, SampleConfig> m_configs;
+    QFileSystemWatcher m_settingsWatcher;
+    bool m_sampleConfigsChanged = false;
 
     bool m_dbMaintenanceRunning = false;
-    QThread *m_dbMaintenanceThread = nullptr;
-    QList<PendingPowerBalanceSample> m_pendingPowerBalanceSamples;
-    QList<PendingThingPowerSample> m_pendingThingPowerSamples;
-    QHash<ThingId, QPair<double, double>> m_pendingThingCacheEntries;
-    QSet<ThingId> m_pendingThingLogRemovals;
+
+    // Totals handed to cacheThingEntry(), so cachedThingEntry() doesn't depend on the writer having caught up
+    QHash<ThingId, QPair<double, double>> m_thingCacheEntries;
+
+    QThread *m_writerThread = nullptr;
+    EnergyWriteQueue<WriteRecord> m_writeQueue;
+    QSemaphore m_writeWakeups;
+    QList<WriteRecord> m_writeBacklog;
+    // The backlog left at shutdown, handed to the writer which takes it once the queue is empty
+    QMutex m_shutdownWritesMutex;
+    QList<WriteRecord> m_shutdownWrites;
+    quint64 m_writesSubmitted = 0;
+    quint64 m_writesCompleted = 0;
 };
 
 #endif // ENERGYLOGGER_H
@@ -0,0 +1,192 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-experience-plugin-energy.
+*
+* nymea-experience-plugin-energy is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-experience-plugin-energy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-experience-plugin-energy. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "energylogstream.h"
+#include "energylogger.h"
+
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QSqlRecord>
+#include <QMutexLocker>
+
+#include <QLoggingCategory>
+Q_DECLARE_LOGGING_CATEGORY(dcEnergyExperience)
+
+// A consumer which doesn't acknowledge any chunk for this long is considered gone and the stream is aborted
+static const int s_idleTimeout = 60000;
+
+EnergyLogStream::EnergyLogStream(Type type, const QString &dbFilePath, const QList<Scan> &scans, int chunkSize, int windowSize, QObject *parent):
+    QObject(parent),
+    m_id(QUuid::createUuid()),
+    m_type(type),
+    m_dbFilePath(dbFilePath),
+    m_scans(scans),
+    m_chunkSize(qMax(1, chunkSize)),
+    m_windowSize(qMax(1, windowSize))
+{
+
+}
+
+EnergyLogStream::~EnergyLogStream()
+{
+    if (m_thread) {
+        cancel();
+        m_thread->wait();
+        delete m_thread;
+    }
+}
+
+QUuid EnergyLogStream::id() const
+{
+    return m_id;
+}
+
+EnergyLogStream::Type EnergyLogStream::type() const
+{
+    return m_type;
+}
+
+void EnergyLogStream::start()
+{
+    if (m_thread) {
+        return;
+    }
+    m_idleDeadline.setRemainingTime(s_idleTimeout);
+    m_thread = QThread::create([this](){ run(); });
+    connect(m_thread, &QThread::finished, this, &EnergyLogStream::finished);
+    m_thread->start();
+}
+
+void EnergyLogStream::acknowledge(int sequence)
+{
+    QMutexLocker locker(&m_mutex);
+    m_idleDeadline.setRemainingTime(s_idleTimeout);
+    if (sequence > m_acknowledgedSequence) {
+        m_acknowledgedSequence = sequence;
+        m_windowCondition.wakeAll();
+    }
+}
+
+void EnergyLogStream::cancel()
+{
+    QMutexLocker locker(&m_mutex);
+    m_cancelled = true;
+    m_windowCondition.wakeAll();
+}
+
+void EnergyLogStream::run()
+{
+    bool failed = false;
+    const QString connectionName = QStringLiteral("energylogs_stream_%1").arg(m_id.toString(QUuid::WithoutBraces));
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), connectionName);
+        db.setConnectOptions(QStringLiteral("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=5000"));
+        db.setDatabaseName(m_dbFilePath);
+        if (!db.open()) {
+            qCWarning(dcEnergyExperience()) << "Cannot open energy log DB for log stream" << m_id << db.lastError();
+            failed = true;
+        } else {
+            QSqlQuery balanceQuery;
+            EnergyLogger::ThingPowerScanMerge merge;
+            foreach (const Scan &scan, m_scans) {
+                QSqlQuery query(db);
+                query.setForwardOnly(true);
+                query.prepare(scan.queryString);
+                foreach (const QVariant &bindValue, scan.bindValues) {
+                    query.addBindValue(bindValue);
+                }
+                if (!query.exec()) {
+                    qCWarning(dcEnergyExperience()) << "Error executing log stream query:" << query.lastError() << query.executedQuery();
+                    failed = true;
+                    break;
+                }
+                if (m_type == TypePowerBalance) {
+                    balanceQuery = query;
+                } else {
+                    merge.addScan(scan.thingId, query);
+                }
+            }
+
+            // Always read one row ahead to know whether the current chunk is the last one
+            bool hasBalanceRow = !failed && m_type == TypePowerBalance && balanceQuery.next();
+            for (int sequence = 0; !failed; sequence++) {
+                bool timedOut = false;
+                if (!waitForWindow(sequence, &timedOut)) {
+                    failed = timedOut;
+                    break;
+                }
+
+                PowerBalanceLogEntries powerBalanceEntries;
+                ThingPowerLogEntries thingPowerEntries;
+                if (m_type == TypePowerBalance) {
+                    for (int i = 0; hasBalanceRow && i < m_chunkSize; i++) {
+                        powerBalanceEntries.append(EnergyLogger::queryResultToBalanceLogEntry(balanceQuery.record()));
+                        hasBalanceRow = balanceQuery.next();
+                    }
+                } else {
+                    for (int i = 0; !merge.atEnd() && i < m_chunkSize; i++) {
+                        thingPowerEntries.append(merge.takeNext());
+                    }
+                }
+                const bool last = m_type == TypePowerBalance ? !hasBalanceRow : merge.atEnd();
+
+                // Emit from the main thread. The destructor waits for this thread, so this outlives the call.
+                QMetaObject::invokeMethod(this, [this, sequence, powerBalanceEntries, thingPowerEntries, last](){
+                    if (m_type == TypePowerBalance) {
+                        emit powerBalanceChunkAvailable(sequence, powerBalanceEntries, last);
+                    } else {
+                        emit thingPowerChunkAvailable(sequence, thingPowerEntries, last);
+                    }
+                }, Qt::QueuedConnection);
+
+                if (last) {
+                    break;
+                }
+            }
+        }
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+
+    if (failed) {
+        QMetaObject::invokeMethod(this, [this](){
+            emit aborted();
+        }, Qt::QueuedConnection);
+    }
+}
+
+bool EnergyLogStream::waitForWindow(int sequence, bool *timedOut)
+{
+    QMutexLocker locker(&m_mutex);
+    while (!m_cancelled && sequence > m_acknowledgedSequence + m_windowSize) {
+        // Measured from the last acknowledgement, not from when the window filled up
+        if (!m_windowCondition.wait(&m_mutex, m_idleDeadline) && m_idleDeadline.hasExpired()) {
+            qCWarning(dcEnergyExperience()) << "Log stream" << m_id << "timed out waiting for chunk" << m_acknowledgedSequence + 1 << "to be acknowledged";
+            *timedOut = true;
+            return false;
+        }
+    }
+    return !m_cancelled;
+}
@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-experience-plugin-energy.
+*
+* nymea-experience-plugin-energy is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-experience-plugin-energy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-experience-plugin-energy. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef ENERGYLOGSTREAM_H
+#define ENERGYLOGSTREAM_H
+
+#include "energylogs.h"
+
+#include <QObject>
+#include <QUuid>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThread>
+#include <QDeadlineTimer>
+
+// Runs a log query on a worker thread with its own DB connection and delivers the result in chunks.
+// At most windowSize chunks are delivered ahead of the last acknowledged one, the worker blocks
+// on the open cursors until the consumer catches up.
+class EnergyLogStream : public QObject
+{
+    Q_OBJECT
+    // Checks the query plans of the scans
+    friend class EnergyLoggerBenchmark;
+
+public:
+    enum Type {
+        TypePowerBalance,
+        TypeThingPower
+    };
+
+    // A single statement for the power balance. Thing power streams run one scan per thing, each ordered
+    // by timestamp, and merge them by timestamp and thingId like EnergyLogger::thingPowerLogs().
+    struct Scan {
+        QString thingId;
+        QString queryString;
+        QVariantList bindValues;
+    };
+
+    explicit EnergyLogStream(Type type, const QString &dbFilePath, const QList<Scan> &scans, int chunkSize, int windowSize, QObject *parent = nullptr);
+    ~EnergyLogStream() override;
+
+    QUuid id() const;
+    Type type() const;
+
+    void start();
+    void acknowledge(int sequence);
+    void cancel();
+
+signals:
+    void powerBalanceChunkAvailable(int sequence, const PowerBalanceLogEntries &entries, bool last);
+    void thingPowerChunkAvailable(int sequence, const ThingPowerLogEntries &entries, bool last);
+    // Emitted if the query fails or the consumer stopped acknowledging chunks
+    void aborted();
+    void finished();
+
+private:
+    void run();
+    bool waitForWindow(int sequence, bool *timedOut);
+
+    QUuid m_id;
+    Type m_type = TypePowerBalance;
+    QString m_dbFilePath;
+    QList<Scan> m_scans;
+    int m_chunkSize = 0;
+    int m_windowSize = 0;
+
+    QThread *m_thread = nullptr;
+
+    QMutex m_mutex;
+    QWaitCondition m_windowCondition;
+    int m_acknowledgedSequence = -1;
+    QDeadlineTimer m_idleDeadline;
+    bool m_cancelled = false;
+};
+
+#endif // ENERGYLOGSTREAM_H
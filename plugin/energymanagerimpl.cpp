@@ -24,6 +24,7 @@
 
 #include "energymanagerimpl.h"
 #include "energylogger.h"
+#include "energytrace.h"
 
 #include <nymeasettings.h>
 
@@ -32,10 +33,22 @@
 Q_DECLARE_LOGGING_CATEGORY(dcEnergyExperience)
 
 EnergyManagerImpl::EnergyManagerImpl(ThingManager *thingManager, QObject *parent):
+    EnergyManagerImpl(thingManager, nullptr, parent)
+{
+
+}
+
+EnergyManagerImpl::EnergyManagerImpl(ThingManager *thingManager, EnergyClock *clock, QObject *parent):
     EnergyManager(parent),
     m_thingManager(thingManager),
-    m_logger(new EnergyLogger(this))
+    m_logger(new EnergyLogger(clock, this))
 {
+    // A trace of the site's load for offline replay, see tools/energytracereplay
+    QString traceFile = qEnvironmentVariable("NYMEA_ENERGY_TRACE_FILE");
+    if (!traceFile.isEmpty()) {
+        m_traceWriter = new EnergyTraceWriter(traceFile);
+    }
+
     // Most of the time we get a bunch of state changes (currentPower, totals, for inverter, battery, rootmeter)
     // at the same time if they're implemented by the same plugin.
     // In order to decrease some load on the system, we'll wait for the event loop pass to finish until we actually
@@ -50,11 +63,8 @@ EnergyManagerImpl::EnergyManagerImpl(ThingManager *thingManager, QObject *parent
     qCDebug(dcEnergyExperience()) << "Loaded root meter" << rootMeterThingId;
 
     PowerBalanceLogEntry latestEntry = m_logger->latestLogEntry(EnergyLogs::SampleRateAny);
-    m_totalConsumption = latestEntry.totalConsumption();
-    m_totalProduction = latestEntry.totalProduction();
-    m_totalAcquisition = latestEntry.totalAcquisition();
-    m_totalReturn = latestEntry.totalReturn();
-    qCDebug(dcEnergyExperience()) << "Loaded power balance totals. Consumption:" << m_totalConsumption << "Production:" << m_totalProduction << "Acquisition:" << m_totalAcquisition << "Return:" << m_totalReturn;
+    m_balance.setTotals(latestEntry.totalConsumption(), latestEntry.totalProduction(), latestEntry.totalAcquisition(), latestEntry.totalReturn());
+    qCDebug(dcEnergyExperience()) << "Loaded power balance totals. Consumption:" << latestEntry.totalConsumption() << "Production:" << latestEntry.totalProduction() << "Acquisition:" << latestEntry.totalAcquisition() << "Return:" << latestEntry.totalReturn();
 
     foreach (Thing *thing, m_thingManager->configuredThings()) {
         watchThing(thing);
@@ -71,6 +81,11 @@ EnergyManagerImpl::EnergyManagerImpl(ThingManager *thingManager, QObject *parent
     }
 }
 
+EnergyManagerImpl::~EnergyManagerImpl()
+{
+    delete m_traceWriter;
+}
+
 Thing *EnergyManagerImpl::rootMeter() const
 {
     return m_rootMeter;
@@ -90,6 +105,10 @@ EnergyManager::EnergyError EnergyManagerImpl::setRootMeter(const ThingId &rootMe
         QSettings settings(NymeaSettings::settingsPath() + "/energy.conf", QSettings::IniFormat);
         settings.setValue("rootMeterThingId", rootMeter->id().toString());
 
+        if (m_traceWriter) {
+            m_traceWriter->rootMeterChanged(rootMeter->id());
+        }
+
         emit rootMeterChanged();
     }
     return EnergyErrorNoError;
@@ -97,42 +116,42 @@ EnergyManager::EnergyError EnergyManagerImpl::setRootMeter(const ThingId &rootMe
 
 double EnergyManagerImpl::currentPowerConsumption() const
 {
-    return m_currentPowerConsumption;
+    return m_balance.powerBalance().consumption;
 }
 
 double EnergyManagerImpl::currentPowerProduction() const
 {
-    return m_currentPowerProduction;
+    return m_balance.powerBalance().production;
 }
 
 double EnergyManagerImpl::currentPowerAcquisition() const
 {
-    return m_currentPowerAcquisition;
+    return m_balance.powerBalance().acquisition;
 }
 
 double EnergyManagerImpl::currentPowerStorage() const
 {
-    return m_currentPowerStorage;
+    return m_balance.powerBalance().storage;
 }
 
 double EnergyManagerImpl::totalConsumption() const
 {
-    return m_totalConsumption;
+    return m_balance.powerBalance().totalConsumption;
 }
 
 double EnergyManagerImpl::totalProduction() const
 {
-    return m_totalProduction;
+    return m_balance.powerBalance().totalProduction;
 }
 
 double EnergyManagerImpl::totalAcquisition() const
 {
-    return m_totalAcquisition;
+    return m_balance.powerBalance().totalAcquisition;
 }
 
 double EnergyManagerImpl::totalReturn() const
 {
-    return m_totalReturn;
+    return m_balance.powerBalance().totalReturn;
 }
 
 EnergyLogs *EnergyManagerImpl::logs() const
@@ -150,12 +169,32 @@ void EnergyManagerImpl::watchThing(Thing *thing)
 
     qCDebug(dcEnergyExperience()) << "Watching thing:" << thing->name();
 
+    if (m_traceWriter) {
+        m_traceWriter->thingAdded(thing->id(), thing->name(), thing->thingClass().interfaces());
+        // The initial state values, the replay has no other source for them
+        foreach (const StateType &stateType, thing->thingClass().stateTypes()) {
+            EnergyTrace::State state;
+            if (EnergyTrace::stateFromName(stateType.name(), &state)) {
+                m_traceWriter->stateChanged(thing->id(), state, thing->stateValue(stateType.id()).toDouble());
+            }
+        }
+        // The root meter may have been set before the thing was known to the trace
+        if (m_rootMeter == thing) {
+            m_traceWriter->rootMeterChanged(thing->id());
+        }
+        connect(thing, &Thing::stateValueChanged, this, [=](const StateTypeId &stateTypeId, const QVariant &value){
+            EnergyTrace::State state;
+            if (m_traceWriter && EnergyTrace::stateFromName(thing->thingClass().getStateType(stateTypeId).name(), &state)) {
+                m_traceWriter->stateChanged(thing->id(), state, value.toDouble());
+            }
+        });
+    }
+
     // Make sure we don't keep stale pointers in our caches when a thing goes away.
-    connect(thing, &QObject::destroyed, this, [this, thing](){
-        m_powerBalanceTotalEnergyConsumedCache.remove(thing);
-        m_powerBalanceTotalEnergyProducedCache.remove(thing);
-        m_thingsTotalEnergyConsumedCache.remove(thing);
-        m_thingsTotalEnergyProducedCache.remove(thing);
+    // The thing is gone already when destroyed is emitted, don't touch it in there
+    ThingId thingId = thing->id();
+    connect(thing, &QObject::destroyed, this, [this, thing, thingId](){
+        m_balance.removeThing(thingId);
 
         if (m_rootMeter == thing) {
             m_rootMeter = nullptr;
@@ -184,11 +223,7 @@ void EnergyManagerImpl::watchThing(Thing *thing)
         ThingPowerLogEntry entry = m_logger->latestLogEntry(EnergyLogs::SampleRateAny, {thing->id()});
         ThingPowerLogEntry stateEntry = m_logger->cachedThingEntry(thing->id());
 
-        m_powerBalanceTotalEnergyConsumedCache[thing] = stateEntry.totalConsumption();
-        m_powerBalanceTotalEnergyProducedCache[thing] = stateEntry.totalProduction();
-
-        m_thingsTotalEnergyConsumedCache[thing] = QPair<double, double>(stateEntry.totalConsumption(), entry.totalConsumption());
-        m_thingsTotalEnergyProducedCache[thing] = QPair<double, double>(stateEntry.totalProduction(), entry.totalProduction());
+        m_balance.addThing(thing->id(), stateEntry.totalConsumption(), stateEntry.totalProduction(), entry.totalConsumption(), entry.totalProduction());
         qCDebug(dcEnergyExperience()) << "Loaded thing power totals for" << thing->name() << "Consumption:" << entry.totalConsumption() << "Production:" << entry.totalProduction() << "Last thing state consumption:" << stateEntry.totalConsumption() << "production:" << stateEntry.totalProduction();
 
         updateThingPower(thing);
@@ -208,151 +243,67 @@ void EnergyManagerImpl::unwatchThing(const ThingId &thingId)
         emit rootMeterChanged();
     }
 
+    if (m_traceWriter) {
+        m_traceWriter->thingRemoved(thingId);
+    }
     m_logger->removeThingLogs(thingId);
 }
 
 void EnergyManagerImpl::updatePowerBalance()
 {
-    double currentPowerAcquisition = 0;
-    if (m_rootMeter) {
-        currentPowerAcquisition = m_rootMeter->stateValue("currentPower").toDouble();
+    EnergyStatistics::Timer timer(m_logger->statistics(), EnergyStatistics::OperationUpdatePowerBalance);
 
-        double oldAcquisition = m_powerBalanceTotalEnergyConsumedCache.value(m_rootMeter);
-        double newAcquisition = m_rootMeter->stateValue("totalEnergyConsumed").toDouble();
-        // For the very first cycle (oldAcquisition is 0) we'll sync up on the meter values without actually adding them to our balance.
-        if (oldAcquisition == 0) {
-            oldAcquisition = newAcquisition;
-        }
-        // If the root meter has been reset in the meantime (newConsumption < oldConsumption) we'll sync down, taking the whole diff from 0 to new value
-        if (newAcquisition < oldAcquisition) {
-            qCInfo(dcEnergyExperience()) << "Root meter seems to have been reset. Re-synching internal consumption counter.";
-            oldAcquisition = newAcquisition;
-        }
-        qCDebug(dcEnergyExperience()) << "Root meter total consumption: Previous value:" << oldAcquisition << "New value:" << newAcquisition << "Diff:" << (newAcquisition -oldAcquisition);
-        m_totalAcquisition += newAcquisition - oldAcquisition;
-        m_powerBalanceTotalEnergyConsumedCache[m_rootMeter] = newAcquisition;
-
-        double oldReturn = m_powerBalanceTotalEnergyProducedCache.value(m_rootMeter);
-        double newReturn = m_rootMeter->stateValue("totalEnergyProduced").toDouble();
-        // For the very first cycle (oldReturn is 0) we'll sync up on the meter values without actually adding them to our balance.
-        if (oldReturn == 0) {
-            oldReturn = newReturn;
-        }
-        if (newReturn < oldReturn) {
-            qCInfo(dcEnergyExperience()) << "Root meter seems to have been reset. Re-synching internal production counter.";
-            oldReturn = newReturn;
-        }
-        qCDebug(dcEnergyExperience()) << "Root meter total production: Previous value:" << oldReturn << "New value:" << newReturn << "Diff:" << (newReturn - oldReturn);
-        m_totalReturn += newReturn - oldReturn;
-        m_powerBalanceTotalEnergyProducedCache[m_rootMeter] = newReturn;
+    EnergyBalance::ThingValues rootMeterValues;
+    if (m_rootMeter) {
+        rootMeterValues = thingValues(m_rootMeter);
     }
-
-    double currentPowerProduction = 0;
+    QList<EnergyBalance::ThingValues> producers;
     foreach (Thing* thing, m_thingManager->configuredThings().filterByInterface("smartmeterproducer")) {
-        currentPowerProduction += thing->stateValue("currentPower").toDouble();
-        double oldProduction = m_powerBalanceTotalEnergyProducedCache.value(thing);
-        double newProduction = thing->stateValue("totalEnergyProduced").toDouble();
-        // For the very first cycle (oldProduction is 0) we'll sync up on the producer values without actually adding them to our balance.
-        if (oldProduction == 0) {
-            oldProduction = newProduction;
-        }
-        if (newProduction < oldProduction) {
-            oldProduction = newProduction;
-        }
-        qCDebug(dcEnergyExperience()) << "Producer" << thing->name() << "total production: Previous value:" << oldProduction << "New value:" << newProduction << "Diff:" << (newProduction - oldProduction);
-        m_totalProduction += newProduction - oldProduction;
-        m_powerBalanceTotalEnergyProducedCache[thing] = newProduction;
+        producers.append(thingValues(thing));
     }
-
-    double currentPowerStorage = 0;
-    double totalFromStorage = 0;
+    QList<EnergyBalance::ThingValues> storages;
     foreach (Thing *thing, m_thingManager->configuredThings().filterByInterface("energystorage")) {
-        currentPowerStorage += thing->stateValue("currentPower").toDouble();
-        double oldProduction = m_powerBalanceTotalEnergyProducedCache.value(thing);
-        double newProduction = thing->stateValue("totalEnergyProduced").toDouble();
-        // For the very first cycle (oldProdction is 0) we'll sync up on the meter values without actually adding them to our balance.
-        if (oldProduction == 0) {
-            oldProduction = newProduction;
-        }
-        if (newProduction < oldProduction) {
-            oldProduction = newProduction;
-        }
-        qCDebug(dcEnergyExperience()) << "Storage" << thing->name() << "total storage: Previous value:" << oldProduction << "New value:" << newProduction << "Diff:" << (newProduction - oldProduction);
-        totalFromStorage += newProduction - oldProduction;
-        m_powerBalanceTotalEnergyProducedCache[thing] = newProduction;
+        storages.append(thingValues(thing));
     }
 
-    double currentPowerConsumption = currentPowerAcquisition + qAbs(qMin(0.0, currentPowerProduction)) - currentPowerStorage;
-    m_totalConsumption = m_totalAcquisition + m_totalProduction + totalFromStorage - m_totalReturn;
-
-    qCDebug(dcEnergyExperience()).noquote().nospace() << "Power balance: " << "🔥: " << currentPowerConsumption << " W, 🌞: " << currentPowerProduction << " W, 💵: " << currentPowerAcquisition << " W, 🔋: " << currentPowerStorage << " W. Totals: 🔥: " << m_totalConsumption << " kWh, 🌞: " << m_totalProduction << " kWh, 💵↓: " << m_totalAcquisition << " kWh, 💵↑: " << m_totalReturn << " kWh";
-    if (currentPowerAcquisition != m_currentPowerAcquisition
-            || currentPowerConsumption != m_currentPowerConsumption
-            || currentPowerProduction != m_currentPowerProduction
-            || currentPowerStorage != m_currentPowerStorage) {
-        m_currentPowerAcquisition = currentPowerAcquisition;
-        m_currentPowerProduction = currentPowerProduction;
-        m_currentPowerConsumption = currentPowerConsumption;
-        m_currentPowerStorage = currentPowerStorage;
+    if (m_balance.updatePowerBalance(m_rootMeter ? &rootMeterValues : nullptr, producers, storages)) {
+        EnergyBalance::PowerBalance balance = m_balance.powerBalance();
         emit powerBalanceChanged();
-        m_logger->logPowerBalance(m_currentPowerConsumption, m_currentPowerProduction, m_currentPowerAcquisition, m_currentPowerStorage, m_totalConsumption, m_totalProduction, m_totalAcquisition, m_totalReturn);
+        m_logger->logPowerBalance(balance.consumption, balance.production, balance.acquisition, balance.storage, balance.totalConsumption, balance.totalProduction, balance.totalAcquisition, balance.totalReturn);
+        if (m_traceWriter) {
+            m_traceWriter->powerBalance(balance.consumption, balance.production, balance.acquisition, balance.storage, balance.totalConsumption, balance.totalProduction, balance.totalAcquisition, balance.totalReturn);
+        }
     }
 }
 
 void EnergyManagerImpl::updateThingPower(Thing *thing)
 {
-    // We'll be keeping our own counters, starting from 0 at the time they're added to nymea and increasing with the things counters.
-    // This way we'll have proper logs even if the thing counter is reset (some things may reset their counter on power loss, factory reset etc)
-    // and also won't start with huge values if the thing has been counting for a while and only added to nymea later on
-
-
-    // Consumption
-    double oldThingConsumptionState = m_thingsTotalEnergyConsumedCache.value(thing).first;
-    double oldThingConsumptionInternal = m_thingsTotalEnergyConsumedCache.value(thing).second;
-    double newThingConsumptionState = thing->stateValue("totalEnergyConsumed").toDouble();
-    // For the very first cycle (oldConsumption is 0) we'll sync up on the meter, without actually adding it to our diff
-    if (oldThingConsumptionState == 0 && newThingConsumptionState != 0) {
-        qCInfo(dcEnergyExperience()) << "Don't have a consumption counter for" << thing->name() << "Synching internal counters to initial value:" << newThingConsumptionState;
-        oldThingConsumptionState = newThingConsumptionState;
-    }
-    // If the thing's meter has been reset in the meantime (newConsumption < oldConsumption) we'll sync down, taking the whole diff from 0 to new value
-    if (newThingConsumptionState < oldThingConsumptionState) {
-        qCInfo(dcEnergyExperience()).nospace() << "Thing meter for " << thing->name() << " seems to have been reset. Old value: " << oldThingConsumptionState << " New value: " << newThingConsumptionState << ". Re-synching internal consumption counter.";
-        oldThingConsumptionState = newThingConsumptionState;
-    }
-    double consumptionDiff = newThingConsumptionState - oldThingConsumptionState;
-    double newThingConsumptionInternal = oldThingConsumptionInternal + consumptionDiff;
-    m_thingsTotalEnergyConsumedCache[thing] = QPair<double, double>(newThingConsumptionState, newThingConsumptionInternal);
-
-
-    // Production
-    double oldThingProductionState = m_thingsTotalEnergyProducedCache.value(thing).first;
-    double oldThingProductionInternal = m_thingsTotalEnergyProducedCache.value(thing).second;
-    double newThingProductionState = thing->stateValue("totalEnergyProduced").toDouble();
-    // For the very first cycle (oldProductino is 0) we'll sync up on the meter, without actually adding it to our diff
-    if (oldThingProductionState == 0 && newThingProductionState != 0) {
-        qCInfo(dcEnergyExperience()) << "Don't have a production counter for" << thing->name() << "Synching internal counter to initial value:" << newThingProductionState;
-        oldThingProductionState = newThingProductionState;
-    }
-    // If the thing's meter has been reset in the meantime (newProduction < oldProduction) we'll sync down, taking the whole diff from 0 to new value
-    if (newThingProductionState < oldThingProductionState) {
-        qCInfo(dcEnergyExperience()) << "Thing meter for" << thing->name() << "seems to have been reset. Re-synching internal production counter.";
-        oldThingProductionState = newThingProductionState;
-    }
-    double productionDiff = newThingProductionState - oldThingProductionState;
-    double newThingProductionInternal = oldThingProductionInternal + productionDiff;
-    m_thingsTotalEnergyProducedCache[thing] = QPair<double, double>(newThingProductionState, newThingProductionInternal);
-
+    EnergyBalance::ThingValues values = thingValues(thing);
+    QPair<double, double> totals = m_balance.updateThingTotals(values);
 
     // Write to log
-    qCDebug(dcEnergyExperience()) << "Logging thing" << thing->name() << "total consumption:" << newThingConsumptionInternal << "production:" << newThingProductionInternal;
-    m_logger->logThingPower(thing->id(), thing->state("currentPower").value().toDouble(), newThingConsumptionInternal, newThingProductionInternal);
+    qCDebug(dcEnergyExperience()) << "Logging thing" << thing->name() << "total consumption:" << totals.first << "production:" << totals.second;
+    m_logger->logThingPower(thing->id(), values.currentPower, totals.first, totals.second);
+    if (m_traceWriter) {
+        m_traceWriter->thingPower(thing->id(), values.currentPower, totals.first, totals.second);
+    }
 
     // Cache the thing state values in case nymea is restarted
-    m_logger->cacheThingEntry(thing->id(), newThingConsumptionState, newThingProductionState);
+    m_logger->cacheThingEntry(thing->id(), values.totalEnergyConsumed, values.totalEnergyProduced);
 
 }
 
+EnergyBalance::ThingValues EnergyManagerImpl::thingValues(Thing *thing)
+{
+    EnergyBalance::ThingValues values;
+    values.thingId = thing->id();
+    values.name = thing->name();
+    values.currentPower = thing->stateValue("currentPower").toDouble();
+    values.totalEnergyConsumed = thing->stateValue("totalEnergyConsumed").toDouble();
+    values.totalEnergyProduced = thing->stateValue("totalEnergyProduced").toDouble();
+    return values;
+}
+
 void EnergyManagerImpl::logDumpConsumers()
 {
     foreach (Thing *consumer, m_thingManager->configuredThings().filterByInterface("smartmeterconsumer")) {
@@ -32,14 +32,20 @@
 #include <integrations/thingmanager.h>
 
 #include "energymanager.h"
+#include "energybalance.h"
 
 class EnergyLogger;
+class EnergyClock;
+class EnergyTraceWriter;
 
 class EnergyManagerImpl : public EnergyManager
 {
     Q_OBJECT
 public:
     explicit EnergyManagerImpl(ThingManager *thingManager, QObject *parent = nullptr);
+    // Logs along the given clock instead of the system time, see EnergyLogger
+    explicit EnergyManagerImpl(ThingManager *thingManager, EnergyClock *clock, QObject *parent = nullptr);
+    ~EnergyManagerImpl() override;
 
     Thing *rootMeter() const override;
     EnergyError setRootMeter(const ThingId &rootMeterId) override;
@@ -62,6 +68,8 @@ private:
     void updatePowerBalance();
     void updateThingPower(Thing *thing);
 
+    static EnergyBalance::ThingValues thingValues(Thing *thing);
+
 private slots:
     void logDumpConsumers();
 
@@ -71,31 +79,12 @@ private:
     Thing *m_rootMeter = nullptr;
 
     QTimer m_balanceUpdateTimer;
-    double m_currentPowerConsumption = 0;
-    double m_currentPowerProduction = 0;
-    double m_currentPowerAcquisition = 0;
-    double m_currentPowerStorage = 0;
-    double m_totalConsumption = 0;
-    double m_totalProduction = 0;
-    double m_totalAcquisition = 0;
-    double m_totalReturn = 0;
+    EnergyBalance m_balance;
 
     EnergyLogger *m_logger = nullptr;
 
-    // Caching some values so we don't have to look them up on the DB all the time:
-    // We use different caches for power balance and thing logs because they are calculated independently
-    // and one must not update the others cache for the diffs to be correct
-
-    // For things totals we need to cache 2 values:
-    // The last thing state values we've processed
-    QHash<Thing *, double> m_powerBalanceTotalEnergyConsumedCache;
-    QHash<Thing *, double> m_powerBalanceTotalEnergyProducedCache;
-
-    // - The last thing state value we've read and processed
-    // - The last entry in our internal counters we've processed and logged
-    // QHash<Thing *, Pair<thingStateValue, internalValue>>
-    QHash<Thing *, QPair<double, double>> m_thingsTotalEnergyConsumedCache;
-    QHash<Thing *, QPair<double, double>> m_thingsTotalEnergyProducedCache;
+    // Records state changes and logger calls if NYMEA_ENERGY_TRACE_FILE is set, see EnergyTrace
+    EnergyTraceWriter *m_traceWriter = nullptr;
 };
 
 #endif // ENERGYMANAGERIMPL_H
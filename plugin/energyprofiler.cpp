@@ -0,0 +1,186 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-experience-plugin-energy.
+*
+* nymea-experience-plugin-energy is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-experience-plugin-energy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-experience-plugin-energy. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "energyprofiler.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QThread>
+
+#include <QLoggingCategory>
+Q_DECLARE_LOGGING_CATEGORY(dcEnergyExperience)
+
+EnergyProfiler::Span::Span(const char *name, const char *category):
+    m_name(name),
+    m_category(category)
+{
+    if (EnergyProfiler::instance()->isEnabled()) {
+        m_start = EnergyProfiler::instance()->now();
+    }
+}
+
+EnergyProfiler::Span::~Span()
+{
+    if (m_start < 0) {
+        return;
+    }
+    EnergyProfiler *profiler = EnergyProfiler::instance();
+    Event event;
+    event.name = m_name;
+    event.category = m_category;
+    event.start = m_start;
+    event.duration = profiler->now() - m_start;
+    event.threadId = static_cast<qint64>(reinterpret_cast<quintptr>(QThread::currentThreadId()));
+    event.args = m_args;
+    profiler->addEvent(event);
+}
+
+void EnergyProfiler::Span::setArg(const QString &key, const QVariant &value)
+{
+    if (m_start >= 0) {
+        m_args.insert(key, value);
+    }
+}
+
+EnergyProfiler *EnergyProfiler::instance()
+{
+    static EnergyProfiler profiler;
+    return &profiler;
+}
+
+EnergyProfiler::EnergyProfiler()
+{
+    // Timestamps are monotonic, starting at the wall clock time of the first use to relate them to the logs
+    m_clockStartUsecs = QDateTime::currentMSecsSinceEpoch() * 1000;
+    m_clock.start();
+}
+
+void EnergyProfiler::start(const QString &fileName, int maxEvents)
+{
+    QMutexLocker locker(&m_mutex);
+    m_fileName = fileName;
+    m_events.clear();
+    m_events.setCapacity(qMax(1, maxEvents));
+    m_changed = false;
+    m_enabled.storeRelease(1);
+    qCInfo(dcEnergyExperience()) << "Profiling energy logging to" << fileName << "keeping" << maxEvents << "spans";
+}
+
+void EnergyProfiler::stop()
+{
+    QMutexLocker locker(&m_mutex);
+    m_enabled.storeRelease(0);
+    m_events.clear();
+    m_changed = false;
+}
+
+bool EnergyProfiler::isEnabled() const
+{
+    return m_enabled.loadAcquire() != 0;
+}
+
+QString EnergyProfiler::fileName() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_fileName;
+}
+
+bool EnergyProfiler::hasChanges() const
+{
+    QMutexLocker locker(&m_mutex);
+    return isEnabled() && m_changed;
+}
+
+bool EnergyProfiler::writeFile()
+{
+    QContiguousCache<Event> events;
+    QString fileName;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (!isEnabled()) {
+            return false;
+        }
+        if (!m_changed) {
+            return true;
+        }
+        m_changed = false;
+        fileName = m_fileName;
+        // Implicitly shared, only copied once the next span is added
+        events = m_events;
+    }
+
+    QJsonArray traceEvents;
+    const qint64 pid = QCoreApplication::applicationPid();
+    for (int i = events.firstIndex(); i <= events.lastIndex(); i++) {
+        const Event &event = events.at(i);
+        QJsonObject traceEvent;
+        traceEvent.insert("name", QString::fromLatin1(event.name));
+        traceEvent.insert("cat", QString::fromLatin1(event.category));
+        traceEvent.insert("ph", "X");
+        traceEvent.insert("ts", m_clockStartUsecs + event.start);
+        traceEvent.insert("dur", event.duration);
+        traceEvent.insert("pid", pid);
+        traceEvent.insert("tid", event.threadId);
+        if (!event.args.isEmpty()) {
+            traceEvent.insert("args", QJsonObject::fromVariantMap(event.args));
+        }
+        traceEvents.append(traceEvent);
+    }
+
+    QJsonObject trace;
+    trace.insert("traceEvents", traceEvents);
+    trace.insert("displayTimeUnit", "ms");
+
+    QSaveFile file(fileName);
+    if (file.open(QFile::WriteOnly)) {
+        file.write(QJsonDocument(trace).toJson(QJsonDocument::Compact));
+        if (file.commit()) {
+            return true;
+        }
+    }
+    qCWarning(dcEnergyExperience()) << "Cannot write energy profile to" << fileName << file.errorString();
+    // Try again with the next write
+    QMutexLocker locker(&m_mutex);
+    m_changed = true;
+    return false;
+}
+
+qint64 EnergyProfiler::now() const
+{
+    return m_clock.nsecsElapsed() / 1000;
+}
+
+void EnergyProfiler::addEvent(const Event &event)
+{
+    QMutexLocker locker(&m_mutex);
+    if (isEnabled()) {
+        m_events.append(event);
+        m_changed = true;
+    }
+}
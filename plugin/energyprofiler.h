@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-experience-plugin-energy.
+*
+* nymea-experience-plugin-energy is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-experience-plugin-energy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-experience-plugin-energy. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#ifndef ENERGYPROFILER_H
+#define ENERGYPROFILER_H
+
+#include <QElapsedTimer>
+#include <QContiguousCache>
+#include <QVariantMap>
+#include <QAtomicInt>
+#include <QMutex>
+
+// Records spans of the sampling, maintenance and history queries and writes them as Chrome trace events,
+// to be opened in Perfetto or chrome://tracing. Only the newest maxEvents spans are kept.
+// Opt-in, see the [Profiling] group of energy.conf and NYMEA_ENERGY_PROFILE_FILE. Spans are cheap no-ops
+// while profiling is disabled. Thread safe.
+class EnergyProfiler
+{
+public:
+    // Records the time from its construction to its destruction. name and category must be string literals.
+    class Span
+    {
+    public:
+        Span(const char *name, const char *category);
+        ~Span();
+
+        void setArg(const QString &key, const QVariant &value);
+
+    private:
+        const char *m_name = nullptr;
+        const char *m_category = nullptr;
+        qint64 m_start = -1;
+        QVariantMap m_args;
+    };
+
+    static EnergyProfiler *instance();
+
+    void start(const QString &fileName, int maxEvents);
+    void stop();
+    bool isEnabled() const;
+    QString fileName() const;
+
+    // Replaces the file with the currently buffered spans, unless there are no new spans since the last write.
+    // Serializing is done outside the lock, so it can run on any thread while spans are recorded.
+    bool writeFile();
+    bool hasChanges() const;
+
+private:
+    struct Event {
+        const char *name = nullptr;
+        const char *category = nullptr;
+        qint64 start = 0;
+        qint64 duration = 0;
+        qint64 threadId = 0;
+        QVariantMap args;
+    };
+
+    EnergyProfiler();
+
+    qint64 now() const;
+    void addEvent(const Event &event);
+
+    QAtomicInt m_enabled;
+    QElapsedTimer m_clock;
+    qint64 m_clockStartUsecs = 0;
+
+    mutable QMutex m_mutex;
+    QContiguousCache<Event> m_events;
+    bool m_changed = false;
+    QString m_fileName;
+};
+
+#endif // ENERGYPROFILER_H
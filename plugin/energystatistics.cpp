@@ -0,0 +1,118 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-experience-plugin-energy.
+*
+* nymea-experience-plugin-energy is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-experience-plugin-energy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-experience-plugin-energy. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "energystatistics.h"
+
+static const QList<qint64> s_bucketBounds = {100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000};
+
+EnergyStatistics::Timer::Timer(EnergyStatistics *statistics, Operation operation):
+    m_statistics(statistics),
+    m_operation(operation)
+{
+    m_timer.start();
+}
+
+EnergyStatistics::Timer::~Timer()
+{
+    m_statistics->record(m_operation, m_timer.nsecsElapsed() / 1000);
+}
+
+EnergyStatistics::EnergyStatistics():
+    m_since(QDateTime::currentDateTime())
+{
+
+}
+
+void EnergyStatistics::record(Operation operation, qint64 usecs)
+{
+    OperationStatistics &statistics = m_operations[operation];
+    if (statistics.buckets.isEmpty()) {
+        statistics.buckets.fill(0, s_bucketBounds.count() + 1);
+    }
+    statistics.count++;
+    statistics.totalUsecs += usecs;
+    statistics.maxUsecs = qMax(statistics.maxUsecs, usecs);
+
+    int bucket = 0;
+    while (bucket < s_bucketBounds.count() && usecs > s_bucketBounds.at(bucket)) {
+        bucket++;
+    }
+    statistics.buckets[bucket]++;
+}
+
+void EnergyStatistics::countNotification(const QString &notification)
+{
+    m_notifications[notification]++;
+}
+
+void EnergyStatistics::reset()
+{
+    m_since = QDateTime::currentDateTime();
+    m_operations.clear();
+    m_notifications.clear();
+}
+
+QDateTime EnergyStatistics::since() const
+{
+    return m_since;
+}
+
+QHash<EnergyStatistics::Operation, EnergyStatistics::OperationStatistics> EnergyStatistics::operations() const
+{
+    return m_operations;
+}
+
+QHash<QString, quint64> EnergyStatistics::notifications() const
+{
+    return m_notifications;
+}
+
+QString EnergyStatistics::operationName(Operation operation)
+{
+    switch (operation) {
+    case OperationInsert:
+        return "insert";
+    case OperationRangeRead:
+        return "rangeRead";
+    case OperationLatestLookup:
+        return "latestLookup";
+    case OperationTrim:
+        return "trim";
+    case OperationDelete:
+        return "delete";
+    case OperationCacheWrite:
+        return "cacheWrite";
+    case OperationSampleTick:
+        return "sampleTick";
+    case OperationUpdatePowerBalance:
+        return "updatePowerBalance";
+    }
+    return QString();
+}
+
+QList<qint64> EnergyStatistics::bucketBounds()
+{
+    return s_bucketBounds;
+}
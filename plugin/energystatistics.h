@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-experience-plugin-energy.
+*
+* nymea-experience-plugin-energy is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-experience-plugin-energy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-experience-plugin-energy. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#ifndef ENERGYSTATISTICS_H
+#define ENERGYSTATISTICS_H
+
+#include <QHash>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QVector>
+
+// Counters and latency histograms of the energy logging, see Energy.GetStatistics.
+// Only recorded on the main thread, the writer thread hands its statement timings back with its results.
+// Includes the statements of the DB maintenance, the log streams are not covered.
+class EnergyStatistics
+{
+public:
+    enum Operation {
+        OperationInsert,
+        OperationRangeRead,
+        OperationLatestLookup,
+        OperationTrim,
+        OperationDelete,
+        OperationCacheWrite,
+        OperationSampleTick,
+        OperationUpdatePowerBalance
+    };
+
+    struct OperationStatistics {
+        quint64 count = 0;
+        qint64 totalUsecs = 0;
+        qint64 maxUsecs = 0;
+        QVector<quint64> buckets;
+    };
+
+    // Records the time from its construction to its destruction
+    class Timer
+    {
+    public:
+        Timer(EnergyStatistics *statistics, Operation operation);
+        ~Timer();
+
+    private:
+        EnergyStatistics *m_statistics = nullptr;
+        Operation m_operation = OperationInsert;
+        QElapsedTimer m_timer;
+    };
+
+    EnergyStatistics();
+
+    void record(Operation operation, qint64 usecs);
+    void countNotification(const QString &notification);
+    void reset();
+
+    QDateTime since() const;
+    QHash<Operation, OperationStatistics> operations() const;
+    QHash<QString, quint64> notifications() const;
+
+    static QString operationName(Operation operation);
+    // Upper bounds of the histogram buckets in µs. The last bucket holds everything above the last bound.
+    static QList<qint64> bucketBounds();
+
+private:
+    QDateTime m_since;
+    QHash<Operation, OperationStatistics> m_operations;
+    QHash<QString, quint64> m_notifications;
+};
+
+#endif // ENERGYSTATISTICS_H
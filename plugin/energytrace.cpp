@@ -0,0 +1,221 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-experience-plugin-energy.
+*
+* nymea-experience-plugin-energy is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-experience-plugin-energy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-experience-plugin-energy. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "energytrace.h"
+
+#include <QDateTime>
+
+#include <QLoggingCategory>
+Q_DECLARE_LOGGING_CATEGORY(dcEnergyExperience)
+
+bool EnergyTrace::stateFromName(const QString &stateName, State *state)
+{
+    static const QHash<QString, State> states = {
+        {"currentPower", StateCurrentPower},
+        {"totalEnergyConsumed", StateTotalEnergyConsumed},
+        {"totalEnergyProduced", StateTotalEnergyProduced}
+    };
+    if (!states.contains(stateName)) {
+        return false;
+    }
+    *state = states.value(stateName);
+    return true;
+}
+
+EnergyTraceWriter::EnergyTraceWriter(const QString &fileName):
+    m_file(fileName)
+{
+    if (!m_file.open(QFile::WriteOnly | QFile::Truncate)) {
+        qCWarning(dcEnergyExperience()) << "Cannot open energy trace file" << fileName << m_file.errorString();
+        return;
+    }
+    // Readable by both, Qt 5 and Qt 6 builds
+    m_stream.setDevice(&m_file);
+    m_stream.setVersion(QDataStream::Qt_5_12);
+    m_stream << EnergyTrace::magic << EnergyTrace::version;
+    qCInfo(dcEnergyExperience()) << "Recording energy trace to" << fileName;
+}
+
+EnergyTraceWriter::~EnergyTraceWriter()
+{
+    m_file.close();
+}
+
+bool EnergyTraceWriter::isOpen() const
+{
+    return m_file.isOpen();
+}
+
+void EnergyTraceWriter::thingAdded(const ThingId &thingId, const QString &name, const QStringList &interfaces)
+{
+    if (!isOpen() || m_thingIndexes.contains(thingId)) {
+        return;
+    }
+    quint16 index = m_nextThingIndex++;
+    m_thingIndexes.insert(thingId, index);
+    writeHeader(EnergyTrace::RecordTypeThingAdded);
+    m_stream << index << thingId << name << interfaces;
+}
+
+void EnergyTraceWriter::thingRemoved(const ThingId &thingId)
+{
+    if (!isOpen() || !m_thingIndexes.contains(thingId)) {
+        return;
+    }
+    writeHeader(EnergyTrace::RecordTypeThingRemoved);
+    m_stream << m_thingIndexes.take(thingId);
+}
+
+void EnergyTraceWriter::stateChanged(const ThingId &thingId, EnergyTrace::State state, double value)
+{
+    if (!isOpen() || !m_thingIndexes.contains(thingId)) {
+        return;
+    }
+    writeHeader(EnergyTrace::RecordTypeStateChanged);
+    m_stream << m_thingIndexes.value(thingId) << static_cast<quint8>(state) << value;
+}
+
+void EnergyTraceWriter::powerBalance(double consumption, double production, double acquisition, double storage, double totalConsumption, double totalProduction, double totalAcquisition, double totalReturn)
+{
+    if (!isOpen()) {
+        return;
+    }
+    writeHeader(EnergyTrace::RecordTypePowerBalance);
+    m_stream << consumption << production << acquisition << storage << totalConsumption << totalProduction << totalAcquisition << totalReturn;
+}
+
+void EnergyTraceWriter::thingPower(const ThingId &thingId, double currentPower, double totalConsumption, double totalProduction)
+{
+    if (!isOpen() || !m_thingIndexes.contains(thingId)) {
+        return;
+    }
+    writeHeader(EnergyTrace::RecordTypeThingPower);
+    m_stream << m_thingIndexes.value(thingId) << currentPower << totalConsumption << totalProduction;
+}
+
+void EnergyTraceWriter::rootMeterChanged(const ThingId &thingId)
+{
+    if (!isOpen() || !m_thingIndexes.contains(thingId)) {
+        return;
+    }
+    writeHeader(EnergyTrace::RecordTypeRootMeterChanged);
+    m_stream << m_thingIndexes.value(thingId);
+}
+
+void EnergyTraceWriter::writeHeader(EnergyTrace::RecordType type)
+{
+    m_stream << static_cast<quint8>(type) << QDateTime::currentMSecsSinceEpoch();
+}
+
+EnergyTraceReader::EnergyTraceReader(const QString &fileName):
+    m_file(fileName)
+{
+
+}
+
+bool EnergyTraceReader::open()
+{
+    if (!m_file.open(QFile::ReadOnly)) {
+        qCWarning(dcEnergyExperience()) << "Cannot open energy trace file" << m_file.fileName() << m_file.errorString();
+        return false;
+    }
+    m_stream.setDevice(&m_file);
+    m_stream.setVersion(QDataStream::Qt_5_12);
+
+    quint32 magic = 0;
+    quint16 version = 0;
+    m_stream >> magic >> version;
+    if (magic != EnergyTrace::magic || version < 1 || version > EnergyTrace::version) {
+        qCWarning(dcEnergyExperience()) << m_file.fileName() << "is not an energy trace of version" << EnergyTrace::version << "or older";
+        m_file.close();
+        return false;
+    }
+    return true;
+}
+
+bool EnergyTraceReader::atEnd() const
+{
+    return !m_file.isOpen() || m_stream.atEnd() || m_stream.status() != QDataStream::Ok;
+}
+
+bool EnergyTraceReader::readRecord(EnergyTrace::Record *record)
+{
+    if (atEnd()) {
+        return false;
+    }
+
+    quint8 type = 0;
+    m_stream >> type >> record->timestamp;
+    record->type = static_cast<EnergyTrace::RecordType>(type);
+    record->values.clear();
+
+    switch (record->type) {
+    case EnergyTrace::RecordTypeThingAdded:
+        m_stream >> record->thingIndex >> record->thingId >> record->name >> record->interfaces;
+        m_thingIds.insert(record->thingIndex, record->thingId);
+        break;
+    case EnergyTrace::RecordTypeThingRemoved:
+    case EnergyTrace::RecordTypeRootMeterChanged:
+        m_stream >> record->thingIndex;
+        record->thingId = m_thingIds.value(record->thingIndex);
+        break;
+    case EnergyTrace::RecordTypeStateChanged: {
+        quint8 state = 0;
+        double value = 0;
+        m_stream >> record->thingIndex >> state >> value;
+        record->thingId = m_thingIds.value(record->thingIndex);
+        record->state = static_cast<EnergyTrace::State>(state);
+        record->values.append(value);
+        break;
+    }
+    case EnergyTrace::RecordTypePowerBalance:
+        for (int i = 0; i < 8; i++) {
+            double value = 0;
+            m_stream >> value;
+            record->values.append(value);
+        }
+        break;
+    case EnergyTrace::RecordTypeThingPower:
+        m_stream >> record->thingIndex;
+        record->thingId = m_thingIds.value(record->thingIndex);
+        for (int i = 0; i < 3; i++) {
+            double value = 0;
+            m_stream >> value;
+            record->values.append(value);
+        }
+        break;
+    default:
+        qCWarning(dcEnergyExperience()) << "Unknown record type" << type << "in energy trace" << m_file.fileName();
+        m_stream.setStatus(QDataStream::ReadCorruptData);
+        return false;
+    }
+
+    return m_stream.status() == QDataStream::Ok;
+}
+
+ThingId EnergyTraceReader::thingId(quint16 thingIndex) const
+{
+    return m_thingIds.value(thingIndex);
+}
@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-experience-plugin-energy.
+*
+* nymea-experience-plugin-energy is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-experience-plugin-energy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-experience-plugin-energy. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#ifndef ENERGYTRACE_H
+#define ENERGYTRACE_H
+
+#include <typeutils.h>
+
+#include <QFile>
+#include <QDataStream>
+#include <QHash>
+#include <QStringList>
+
+// A compact binary trace of what the energy manager sees and logs: Thing state changes and the resulting
+// logger calls, in order. Recorded on live systems (see NYMEA_ENERGY_TRACE_FILE) and replayed with
+// tools/energytracereplay to reproduce the load of a specific site.
+//
+// Format: magic, version, then records of a type byte, the time in ms since epoch and the payload.
+// Things are announced once in a ThingAdded record and referred to by index afterwards.
+class EnergyTrace
+{
+public:
+    enum RecordType {
+        RecordTypeThingAdded = 0,   // index, thing id, name, interfaces
+        RecordTypeThingRemoved,     // index
+        RecordTypeStateChanged,     // index, state, value
+        RecordTypePowerBalance,     // consumption, production, acquisition, storage and the 4 totals
+        RecordTypeThingPower,       // index, current power, total consumption, total production
+        RecordTypeRootMeterChanged  // index, since version 2
+    };
+
+    // The states the energy manager reacts on
+    enum State {
+        StateCurrentPower = 0,
+        StateTotalEnergyConsumed,
+        StateTotalEnergyProduced
+    };
+
+    struct Record {
+        RecordType type = RecordTypeThingAdded;
+        qint64 timestamp = 0;
+        quint16 thingIndex = 0;
+        ThingId thingId;
+        QString name;
+        QStringList interfaces;
+        State state = StateCurrentPower;
+        QList<double> values;
+    };
+
+    static const quint32 magic = 0x4e455452; // "NETR"
+    static const quint16 version = 2;
+
+    static bool stateFromName(const QString &stateName, State *state);
+};
+
+class EnergyTraceWriter
+{
+public:
+    explicit EnergyTraceWriter(const QString &fileName);
+    ~EnergyTraceWriter();
+
+    bool isOpen() const;
+
+    void thingAdded(const ThingId &thingId, const QString &name, const QStringList &interfaces);
+    void thingRemoved(const ThingId &thingId);
+    void stateChanged(const ThingId &thingId, EnergyTrace::State state, double value);
+    void powerBalance(double consumption, double production, double acquisition, double storage, double totalConsumption, double totalProduction, double totalAcquisition, double totalReturn);
+    void thingPower(const ThingId &thingId, double currentPower, double totalConsumption, double totalProduction);
+    void rootMeterChanged(const ThingId &thingId);
+
+private:
+    void writeHeader(EnergyTrace::RecordType type);
+
+    QFile m_file;
+    QDataStream m_stream;
+    QHash<ThingId, quint16> m_thingIndexes;
+    quint16 m_nextThingIndex = 0;
+};
+
+class EnergyTraceReader
+{
+public:
+    explicit EnergyTraceReader(const QString &fileName);
+
+    // Fails on an unknown file format. Traces of older versions are read as well. A truncated last record, e.g. of a trace still being written, ends the trace.
+    bool open();
+    bool atEnd() const;
+    bool readRecord(EnergyTrace::Record *record);
+
+    // Known after the ThingAdded record of the index has been read
+    ThingId thingId(quint16 thingIndex) const;
+
+private:
+    QFile m_file;
+    QDataStream m_stream;
+    QHash<quint16, ThingId> m_thingIds;
+};
+
+#endif // ENERGYTRACE_H
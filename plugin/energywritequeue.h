@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-experience-plugin-energy.
+*
+* nymea-experience-plugin-energy is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-experience-plugin-energy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-experience-plugin-energy. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+
+#ifndef ENERGYWRITEQUEUE_H
+#define ENERGYWRITEQUEUE_H
+
+#include <QAtomicInteger>
+
+#include <vector>
+
+// Bounded lock-free queue between exactly one producer and one consumer thread. The producer only moves the
+// tail and the consumer only moves the head, each publishing its side with release semantics. Indexes run
+// freely and wrap around, the capacity is rounded up to a power of two.
+template<typename T>
+class EnergyWriteQueue
+{
+public:
+    explicit EnergyWriteQueue(int capacity)
+    {
+        quint32 size = 1;
+        while (size < static_cast<quint32>(capacity)) {
+            size <<= 1;
+        }
+        m_items.resize(size);
+        m_mask = size - 1;
+    }
+
+    // Producer side. Returns false if the queue is full.
+    bool push(const T &item)
+    {
+        const quint32 tail = m_tail.loadAcquire();
+        if (tail - m_head.loadAcquire() > m_mask) {
+            return false;
+        }
+        m_items[tail & m_mask] = item;
+        m_tail.storeRelease(tail + 1);
+        return true;
+    }
+
+    // Consumer side. Returns false if the queue is empty.
+    bool pop(T *item)
+    {
+        const quint32 head = m_head.loadAcquire();
+        if (head == m_tail.loadAcquire()) {
+            return false;
+        }
+        // Leave nothing behind in the slot, the producer may be done with the item long before it's overwritten
+        *item = m_items[head & m_mask];
+        m_items[head & m_mask] = T();
+        m_head.storeRelease(head + 1);
+        return true;
+    }
+
+    bool isEmpty() const
+    {
+        return m_head.loadAcquire() == m_tail.loadAcquire();
+    }
+
+    int capacity() const
+    {
+        return static_cast<int>(m_mask + 1);
+    }
+
+private:
+    std::vector<T> m_items;
+    quint32 m_mask = 0;
+    QAtomicInteger<quint32> m_head;
+    QAtomicInteger<quint32> m_tail;
+};
+
+#endif // ENERGYWRITEQUEUE_H
@@ -48,7 +48,17 @@ void ExperiencePluginEnergy::init()
     qCDebug(dcEnergyExperience()) << "Initializing energy experience";
 
     m_energyManager = new EnergyManagerImpl(thingManager(), this);
-    jsonRpcServer()->registerExperienceHandler(new EnergyJsonHandler(m_energyManager, this), 1, 0);
+    EnergyJsonHandler *jsonHandler = new EnergyJsonHandler(m_energyManager, this);
+    jsonRpcServer()->registerExperienceHandler(jsonHandler, 1, 0);
+
+    // The JsonRPCServer interface is not a QObject, the implementation behind it is. Look the signal up at runtime
+    // so this still loads on servers without it, the subscriptions of gone clients just stay around there.
+    QObject *server = dynamic_cast<QObject*>(jsonRpcServer());
+    if (server && server->metaObject()->indexOfSignal("clientDisconnected(QUuid)") >= 0) {
+        connect(server, SIGNAL(clientDisconnected(QUuid)), jsonHandler, SLOT(removeClient(QUuid)));
+    } else {
+        qCWarning(dcEnergyExperience()) << "The JSON-RPC server does not report disconnecting clients. Per-client state will not be cleaned up.";
+    }
 
     loadPlugins();
 }
@@ -14,12 +14,25 @@ LIBS += -L$$top_builddir/libnymea-energy -lnymea-energy
 
 HEADERS += experiencepluginenergy.h \
     energyjsonhandler.h \
+    energybalance.h \
+    energyclock.h \
     energylogger.h \
+    energylogstream.h \
+    energyprofiler.h \
+    energystatistics.h \
+    energytrace.h \
+    energywritequeue.h \
     energymanagerimpl.h
 
 SOURCES += experiencepluginenergy.cpp \
     energyjsonhandler.cpp \
+    energybalance.cpp \
+    energyclock.cpp \
     energylogger.cpp \
+    energylogstream.cpp \
+    energyprofiler.cpp \
+    energystatistics.cpp \
+    energytrace.cpp \
     energymanagerimpl.cpp
 
 target.path = $$[QT_INSTALL_LIBS]/nymea/experiences/
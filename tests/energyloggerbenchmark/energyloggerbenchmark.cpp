@@ -0,0 +1,418 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-experience-plugin-energy.
+*
+* nymea-experience-plugin-energy is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-experience-plugin-energy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-experience-plugin-energy. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "energylogger.h"
+#include "energyclock.h"
+
+#include <nymeasettings.h>
+
+#include <QtTest>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QtMath>
+
+Q_LOGGING_CATEGORY(dcEnergyExperience, "EnergyExperience")
+
+// Run with e.g. "./energyloggerbenchmark -iterations 20" or "-callgrind" for instruction counts.
+// The numbers are only comparable between runs on the same machine.
+class EnergyLoggerBenchmark: public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void init();
+    void cleanup();
+
+    void sampleTick_data();
+    void sampleTick();
+
+    void powerBalanceLogs_data();
+    void powerBalanceLogs();
+
+    void thingPowerLogs_data();
+    void thingPowerLogs();
+
+    void thingPowerQueryPlan();
+
+    void maintenanceAfterOutage_data();
+    void maintenanceAfterOutage();
+
+    void dbSizePerDay_data();
+    void dbSizePerDay();
+
+    void simulatedLogging_data();
+    void simulatedLogging();
+
+private:
+    void createLogger(EnergyClock *clock = nullptr);
+    QList<ThingId> createThings(int count);
+    void populate(const QList<ThingId> &thingIds, const QDateTime &from, const QDateTime &to);
+    qint64 dbSize();
+
+    EnergyLogger *m_logger = nullptr;
+    VirtualEnergyClock *m_clock = nullptr;
+};
+
+void EnergyLoggerBenchmark::initTestCase()
+{
+    // Keep the DB and energy.conf away from a real installation
+    QCoreApplication::setOrganizationName("nymea-test");
+    QLoggingCategory::setFilterRules("EnergyExperience.debug=false");
+}
+
+void EnergyLoggerBenchmark::init()
+{
+    QDir storage(NymeaSettings::storagePath());
+    foreach (const QString &file, QStringList({"energylogs.sqlite", "energylogs.sqlite-wal", "energylogs.sqlite-shm"})) {
+        storage.remove(file);
+    }
+}
+
+void EnergyLoggerBenchmark::cleanup()
+{
+    delete m_logger;
+    m_logger = nullptr;
+    delete m_clock;
+    m_clock = nullptr;
+    QSqlDatabase::removeDatabase("energylogs");
+}
+
+void EnergyLoggerBenchmark::sampleTick_data()
+{
+    QTest::addColumn<int>("things");
+
+    QTest::newRow("0 things") << 0;
+    QTest::newRow("10 things") << 10;
+    QTest::newRow("100 things") << 100;
+    QTest::newRow("250 things") << 250;
+}
+
+void EnergyLoggerBenchmark::sampleTick()
+{
+    QFETCH(int, things);
+
+    createLogger();
+    createThings(things);
+
+    // Pretend the sampling is behind by a month so every tick samples one minute, the following tick
+    // the next one, and so on. The coarser tiers stay scheduled in the future.
+    QDateTime start = QDateTime::currentDateTime().addDays(-30);
+    m_logger->m_nextSamples.insert(EnergyLogs::SampleRate1Min, m_logger->nextSampleTimestamp(EnergyLogs::SampleRate1Min, start));
+
+    // Only the main thread's share, the DB writes are left to the writer thread
+    QBENCHMARK {
+        m_logger->sample();
+    }
+
+    QTRY_VERIFY_WITH_TIMEOUT(!m_logger->writesPending(), 10 * 60 * 1000);
+    QCOMPARE(m_logger->m_dbMaintenanceRunning, false);
+}
+
+void EnergyLoggerBenchmark::powerBalanceLogs_data()
+{
+    QTest::addColumn<EnergyLogs::SampleRate>("sampleRate");
+    QTest::addColumn<int>("days");
+
+    QTest::newRow("1 min, 1 day") << EnergyLogs::SampleRate1Min << 1;
+    QTest::newRow("1 min, 7 days") << EnergyLogs::SampleRate1Min << 7;
+    QTest::newRow("15 mins, 7 days") << EnergyLogs::SampleRate15Mins << 7;
+    QTest::newRow("15 mins, 180 days") << EnergyLogs::SampleRate15Mins << 180;
+    QTest::newRow("1 hour, 365 days") << EnergyLogs::SampleRate1Hour << 365;
+    QTest::newRow("1 day, 365 days") << EnergyLogs::SampleRate1Day << 365;
+}
+
+void EnergyLoggerBenchmark::powerBalanceLogs()
+{
+    QFETCH(EnergyLogs::SampleRate, sampleRate);
+    QFETCH(int, days);
+
+    createLogger();
+    QDateTime now = QDateTime::currentDateTime();
+    populate(createThings(10), now.addDays(-365), now);
+
+    PowerBalanceLogEntries entries;
+    QBENCHMARK {
+        entries = m_logger->powerBalanceLogs(sampleRate, now.addDays(-days), now);
+    }
+    QVERIFY(!entries.isEmpty());
+}
+
+void EnergyLoggerBenchmark::thingPowerLogs_data()
+{
+    QTest::addColumn<EnergyLogs::SampleRate>("sampleRate");
+    QTest::addColumn<int>("days");
+    QTest::addColumn<int>("things");
+
+    QTest::newRow("1 min, 1 day, 1 thing") << EnergyLogs::SampleRate1Min << 1 << 1;
+    QTest::newRow("1 min, 1 day, 20 things") << EnergyLogs::SampleRate1Min << 1 << 20;
+    QTest::newRow("1 min, 7 days, 20 things") << EnergyLogs::SampleRate1Min << 7 << 20;
+    QTest::newRow("15 mins, 180 days, 1 thing") << EnergyLogs::SampleRate15Mins << 180 << 1;
+    QTest::newRow("15 mins, 180 days, 20 things") << EnergyLogs::SampleRate15Mins << 180 << 20;
+    QTest::newRow("1 day, 365 days, 20 things") << EnergyLogs::SampleRate1Day << 365 << 20;
+}
+
+void EnergyLoggerBenchmark::thingPowerLogs()
+{
+    QFETCH(EnergyLogs::SampleRate, sampleRate);
+    QFETCH(int, days);
+    QFETCH(int, things);
+
+    createLogger();
+    QDateTime now = QDateTime::currentDateTime();
+    QList<ThingId> thingIds = createThings(20);
+    populate(thingIds, now.addDays(-365), now);
+
+    ThingPowerLogEntries entries;
+    QBENCHMARK {
+        entries = m_logger->thingPowerLogs(sampleRate, thingIds.mid(0, things), now.addDays(-days), now);
+    }
+    QVERIFY(!entries.isEmpty());
+}
+
+void EnergyLoggerBenchmark::thingPowerQueryPlan()
+{
+    // thingPowerLogs() and the thing power streams scan each thing on its own. Every scan must be an
+    // index range scan which returns the rows in order, without sorting.
+    createLogger();
+    QDateTime now = QDateTime::currentDateTime();
+    QList<ThingId> thingIds = createThings(2);
+    populate(thingIds, now.addDays(-1), now);
+
+    QSqlQuery query(m_logger->m_db);
+    QVERIFY(query.exec("ANALYZE;"));
+    EnergyLogs::QueryOptions options;
+    options.limit = 1000;
+    QVariantList bindValues;
+    QString scanQuery = EnergyLogger::thingPowerScanQuery(EnergyLogs::SampleRate1Min, ThingId::createThingId(), now.addDays(-1), now,
+                                                          {"currentPower", "totalConsumption", "totalProduction"}, options, &bindValues);
+    query.prepare("EXPLAIN QUERY PLAN " + scanQuery);
+    foreach (const QVariant &bindValue, bindValues) {
+        query.addBindValue(bindValue);
+    }
+    QVERIFY2(query.exec(), qPrintable(query.lastError().text()));
+
+    QStringList plan;
+    while (query.next()) {
+        plan.append(query.value("detail").toString());
+    }
+    qInfo() << "Query plan:" << plan;
+    QCOMPARE(plan.count(), 1);
+    QVERIFY(plan.first().contains("USING INDEX idx_thingPower (thingId=? AND sampleRate=? AND timestamp>? AND timestamp<?)"));
+
+    // An empty thingIds list expands to the logged things
+    foreach (const QList<ThingId> &streamThingIds, QList<QList<ThingId>>() << thingIds << QList<ThingId>()) {
+        EnergyLogStream *stream = m_logger->createThingPowerLogStream(EnergyLogs::SampleRate1Min, streamThingIds, now.addDays(-1), now, EnergyLogs::QueryOptions(), 100, 2, this);
+        QVERIFY(stream);
+        QCOMPARE(stream->m_scans.count(), thingIds.count());
+        foreach (const EnergyLogStream::Scan &scan, stream->m_scans) {
+            query.prepare("EXPLAIN QUERY PLAN " + scan.queryString);
+            foreach (const QVariant &bindValue, scan.bindValues) {
+                query.addBindValue(bindValue);
+            }
+            QVERIFY2(query.exec(), qPrintable(query.lastError().text()));
+
+            QStringList streamPlan;
+            while (query.next()) {
+                streamPlan.append(query.value("detail").toString());
+            }
+            qInfo() << "Stream query plan:" << streamPlan;
+            QVERIFY2(streamPlan.filter("TEMP B-TREE").isEmpty(), qPrintable(streamPlan.join("; ")));
+            QCOMPARE(streamPlan.count(), 1);
+            QVERIFY(streamPlan.first().contains("USING INDEX idx_thingPower (thingId=? AND sampleRate=? AND timestamp>? AND timestamp<?)"));
+        }
+        delete stream;
+    }
+}
+
+void EnergyLoggerBenchmark::maintenanceAfterOutage_data()
+{
+    QTest::addColumn<int>("days");
+    QTest::addColumn<int>("things");
+
+    QTest::newRow("1 day, 10 things") << 1 << 10;
+    QTest::newRow("7 days, 10 things") << 7 << 10;
+    QTest::newRow("30 days, 10 things") << 30 << 10;
+    QTest::newRow("30 days, 100 things") << 30 << 100;
+}
+
+void EnergyLoggerBenchmark::maintenanceAfterOutage()
+{
+    QFETCH(int, days);
+    QFETCH(int, things);
+
+    // A week of logs which ends the given number of days ago
+    createLogger();
+    QDateTime outageStart = QDateTime::currentDateTime().addDays(-days);
+    populate(createThings(things), outageStart.addDays(-7), outageStart);
+
+    // The maintenance fills in the gap, that's what a restart after the outage would do
+    QBENCHMARK_ONCE {
+        m_logger->startDbMaintenance("benchmark", m_logger->calculateSampleStart(m_logger->m_nextSamples.value(EnergyLogs::SampleRate1Min), EnergyLogs::SampleRate1Min));
+        QTRY_VERIFY_WITH_TIMEOUT(!m_logger->m_dbMaintenanceRunning, 30 * 60 * 1000);
+    }
+    QVERIFY(m_logger->getNewestPowerBalanceSampleTimestamp(EnergyLogs::SampleRate1Min) > outageStart);
+}
+
+void EnergyLoggerBenchmark::dbSizePerDay_data()
+{
+    QTest::addColumn<int>("things");
+
+    QTest::newRow("0 things") << 0;
+    QTest::newRow("10 things") << 10;
+    QTest::newRow("100 things") << 100;
+}
+
+void EnergyLoggerBenchmark::dbSizePerDay()
+{
+    QFETCH(int, things);
+
+    createLogger();
+    QList<ThingId> thingIds = createThings(things);
+    QDateTime now = QDateTime::currentDateTime();
+    populate(thingIds, now.addDays(-7), now.addDays(-6));
+    qint64 before = dbSize();
+    populate(thingIds, now.addDays(-6), now);
+    qint64 bytesPerDay = (dbSize() - before) / 6;
+
+    qInfo() << "DB growth per day with" << things << "things:" << bytesPerDay << "bytes";
+    // The retention keeps the DB bounded, but a day of samples should stay well below 1 MiB per thing
+    QVERIFY2(bytesPerDay < (things + 1) * 1024 * 1024, qPrintable(QString("%1 bytes per day").arg(bytesPerDay)));
+}
+
+void EnergyLoggerBenchmark::simulatedLogging_data()
+{
+    QTest::addColumn<QDateTime>("start");
+    QTest::addColumn<int>("days");
+    QTest::addColumn<int>("things");
+
+    // Crossing the DST changes in March and October and the month and year ends
+    QTest::newRow("1 week, 10 things") << QDateTime(QDate(2024, 3, 28), QTime(12, 0)) << 7 << 10;
+    QTest::newRow("1 month, 10 things") << QDateTime(QDate(2024, 10, 15), QTime(0, 0)) << 31 << 10;
+    QTest::newRow("1 year, 1 thing") << QDateTime(QDate(2024, 6, 1), QTime(0, 0)) << 365 << 1;
+}
+
+void EnergyLoggerBenchmark::simulatedLogging()
+{
+    QFETCH(QDateTime, start);
+    QFETCH(int, days);
+    QFETCH(int, things);
+
+    // Runs the real sampling, tier rollovers and trimming along a virtual clock, waking up at each sample boundary
+    VirtualEnergyClock clock(start);
+    createLogger(&clock);
+    QList<ThingId> thingIds = createThings(things);
+
+    QDateTime end = start.addDays(days);
+    QBENCHMARK_ONCE {
+        int minute = 0;
+        while (clock.now() < end) {
+            double power = 800 + 400 * qSin(minute * M_PI / 720);
+            m_logger->logPowerBalance(power, 0, power, 0, minute * 0.01, 0, minute * 0.01, 0);
+            foreach (const ThingId &thingId, thingIds) {
+                m_logger->logThingPower(thingId, power / thingIds.count(), minute * 0.01 / thingIds.count(), 0);
+            }
+            clock.advance(60 * 1000);
+            minute++;
+
+            // Keep the writer thread from falling behind by more than a day
+            if (minute % 1440 == 0) {
+                QTRY_VERIFY_WITH_TIMEOUT(!m_logger->writesPending(), 60000);
+            }
+        }
+        QTRY_VERIFY_WITH_TIMEOUT(!m_logger->writesPending(), 60000);
+    }
+
+    QCOMPARE(m_logger->getNewestPowerBalanceSampleTimestamp(EnergyLogs::SampleRate1Min), m_logger->calculateSampleStart(m_logger->m_nextSamples.value(EnergyLogs::SampleRate1Min), EnergyLogs::SampleRate1Min));
+    QVERIFY(m_logger->getNewestPowerBalanceSampleTimestamp(EnergyLogs::SampleRate1Day).isValid());
+    QVERIFY(m_logger->getOldestPowerBalanceSampleTimestamp(EnergyLogs::SampleRate1Min) >= end.addSecs(-(qint64)m_logger->m_maxMinuteSamples * 60 - 60));
+}
+
+void EnergyLoggerBenchmark::createLogger(EnergyClock *clock)
+{
+    // Unless given a clock, time stands still so no sampling interferes with the benchmark
+    if (!clock) {
+        m_clock = new VirtualEnergyClock(QDateTime::currentDateTime());
+        clock = m_clock;
+    }
+    m_logger = new EnergyLogger(clock, this);
+    // Wait for the startup maintenance, the writer thread runs it before anything else
+    QTRY_VERIFY_WITH_TIMEOUT(!m_logger->m_dbMaintenanceRunning, 60000);
+}
+
+QList<ThingId> EnergyLoggerBenchmark::createThings(int count)
+{
+    QList<ThingId> thingIds;
+    for (int i = 0; i < count; i++) {
+        ThingId thingId = ThingId::createThingId();
+        m_logger->logThingPower(thingId, 100 + i, 1000 + i, 0);
+        thingIds.append(thingId);
+    }
+    return thingIds;
+}
+
+// Writes the samples all series would have if the logger had been running from from to to,
+// limited to the retention of each series. Power follows a daily curve, totals grow accordingly.
+void EnergyLoggerBenchmark::populate(const QList<ThingId> &thingIds, const QDateTime &from, const QDateTime &to)
+{
+    QMap<EnergyLogs::SampleRate, uint> retention;
+    retention.insert(EnergyLogs::SampleRate1Min, m_logger->m_maxMinuteSamples);
+    for (auto it = m_logger->m_configs.constBegin(); it != m_logger->m_configs.constEnd(); ++it) {
+        retention.insert(it.key(), it.value().maxSamples);
+    }
+
+    // Written directly, the writer thread's insert functions work on any connection
+    QDateTime now = QDateTime::currentDateTime();
+    EnergyLogger::WriteContext context;
+    context.db = m_logger->m_db;
+    context.db.transaction();
+    for (auto it = retention.constBegin(); it != retention.constEnd(); ++it) {
+        EnergyLogs::SampleRate sampleRate = it.key();
+        QDateTime start = qMax(from, m_logger->calculateSampleStart(now, sampleRate, it.value()));
+        for (QDateTime timestamp = m_logger->nextSampleTimestamp(sampleRate, start); timestamp <= to; timestamp = m_logger->nextSampleTimestamp(sampleRate, timestamp)) {
+            double hours = timestamp.toMSecsSinceEpoch() / 3600000.0;
+            double consumption = 800 + 400 * qSin(hours * M_PI / 12);
+            double production = qMax(0.0, 3000 * qSin((hours - 6) * M_PI / 12));
+            m_logger->insertPowerBalance(&context, timestamp, sampleRate, consumption, production, consumption - production, 0,
+                                         hours * 0.8, hours * 1.0, hours * 0.5, hours * 0.7);
+            for (int i = 0; i < thingIds.count(); i++) {
+                double power = consumption / qMax(1, thingIds.count()) * (1 + 0.1 * qSin(hours + i));
+                m_logger->insertThingPower(&context, timestamp, sampleRate, thingIds.at(i), power, hours * 0.8 / qMax(1, thingIds.count()), 0);
+            }
+            context.result = EnergyLogger::WriteResult();
+        }
+    }
+    context.db.commit();
+}
+
+qint64 EnergyLoggerBenchmark::dbSize()
+{
+    QSqlQuery query(m_logger->m_db);
+    query.exec("PRAGMA wal_checkpoint(TRUNCATE);");
+    return QFileInfo(m_logger->m_dbFilePath).size();
+}
+
+QTEST_MAIN(EnergyLoggerBenchmark)
+#include "energyloggerbenchmark.moc"
@@ -0,0 +1,29 @@
+TEMPLATE = app
+TARGET = energyloggerbenchmark
+
+include(../../config.pri)
+
+CONFIG += link_pkgconfig
+PKGCONFIG += nymea
+
+QT -= gui
+QT += testlib network sql
+
+INCLUDEPATH += $$top_srcdir/libnymea-energy $$top_srcdir/plugin
+LIBS += -L$$top_builddir/libnymea-energy -lnymea-energy
+QMAKE_RPATHDIR += $$top_builddir/libnymea-energy
+
+# The logger is built in, the benchmarks don't load the experience plugin
+HEADERS += $$top_srcdir/plugin/energyclock.h \
+    $$top_srcdir/plugin/energylogger.h \
+    $$top_srcdir/plugin/energylogstream.h \
+    $$top_srcdir/plugin/energyprofiler.h \
+    $$top_srcdir/plugin/energystatistics.h \
+    $$top_srcdir/plugin/energywritequeue.h
+
+SOURCES += energyloggerbenchmark.cpp \
+    $$top_srcdir/plugin/energyclock.cpp \
+    $$top_srcdir/plugin/energylogger.cpp \
+    $$top_srcdir/plugin/energylogstream.cpp \
+    $$top_srcdir/plugin/energyprofiler.cpp \
+    $$top_srcdir/plugin/energystatistics.cpp
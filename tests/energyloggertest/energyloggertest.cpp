@@ -0,0 +1,242 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-experience-plugin-energy.
+*
+* nymea-experience-plugin-energy is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-experience-plugin-energy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-experience-plugin-energy. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+
+#include "energylogger.h"
+#include "energyclock.h"
+
+#include <nymeasettings.h>
+
+#include <QtTest>
+#include <QSqlQuery>
+#include <QSqlError>
+
+Q_LOGGING_CATEGORY(dcEnergyExperience, "EnergyExperience")
+
+// Functional tests of the logger's queries, run by "make check"
+class EnergyLoggerTest: public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void init();
+    void cleanup();
+
+    void thingPowerLogsPaging_data();
+    void thingPowerLogsPaging();
+
+    void topConsumers_data();
+    void topConsumers();
+
+private:
+    void createLogger();
+
+    EnergyLogger *m_logger = nullptr;
+    VirtualEnergyClock *m_clock = nullptr;
+};
+
+void EnergyLoggerTest::initTestCase()
+{
+    // Keep the DB and energy.conf away from a real installation
+    QCoreApplication::setOrganizationName("nymea-test");
+    QLoggingCategory::setFilterRules("EnergyExperience.debug=false");
+}
+
+void EnergyLoggerTest::init()
+{
+    QDir storage(NymeaSettings::storagePath());
+    foreach (const QString &file, QStringList({"energylogs.sqlite", "energylogs.sqlite-wal", "energylogs.sqlite-shm"})) {
+        storage.remove(file);
+    }
+}
+
+void EnergyLoggerTest::cleanup()
+{
+    delete m_logger;
+    m_logger = nullptr;
+    delete m_clock;
+    m_clock = nullptr;
+    QSqlDatabase::removeDatabase("energylogs");
+}
+
+void EnergyLoggerTest::thingPowerLogsPaging_data()
+{
+    QTest::addColumn<int>("limit");
+    QTest::addColumn<bool>("allThings");
+
+    QTest::newRow("limit 1") << 1 << false;
+    QTest::newRow("limit 2") << 2 << false;
+    QTest::newRow("limit 3, all things") << 3 << true;
+    QTest::newRow("limit 4") << 4 << false;
+    QTest::newRow("limit 7, all things") << 7 << true;
+    QTest::newRow("limit above count") << 1000 << false;
+}
+
+void EnergyLoggerTest::thingPowerLogsPaging()
+{
+    QFETCH(int, limit);
+    QFETCH(bool, allThings);
+
+    createLogger();
+
+    // 4 things sharing most timestamps, each of them missing some, so pages end within and between runs of
+    // equal timestamps. Written directly, the writer thread's insert functions work on any connection.
+    QList<ThingId> thingIds;
+    for (int i = 0; i < 4; i++) {
+        thingIds.append(ThingId::createThingId());
+    }
+    QDateTime from = EnergyLogger::nextSampleTimestamp(EnergyLogs::SampleRate1Min, m_clock->now().addDays(-1));
+    QDateTime to = from.addSecs(29 * 60);
+    int written = 0;
+    EnergyLogger::WriteContext context;
+    context.db = m_logger->m_db;
+    context.db.transaction();
+    for (int minute = 0; minute < 30; minute++) {
+        for (int i = 0; i < thingIds.count(); i++) {
+            if ((minute + i) % 5 == 0) {
+                continue;
+            }
+            QVERIFY(m_logger->insertThingPower(&context, from.addSecs(minute * 60), EnergyLogs::SampleRate1Min, thingIds.at(i), minute * 10 + i, minute, 0));
+            written++;
+        }
+        context.result = EnergyLogger::WriteResult();
+    }
+    context.db.commit();
+
+    QList<ThingId> queriedThingIds = allThings ? QList<ThingId>() : thingIds;
+    ThingPowerLogEntries unpaged = m_logger->thingPowerLogs(EnergyLogs::SampleRate1Min, queriedThingIds, from, to);
+    QCOMPARE(unpaged.count(), written);
+
+    ThingPowerLogEntries paged;
+    EnergyLogs::QueryOptions options;
+    options.limit = limit;
+    int pages = 0;
+    do {
+        QString nextCursor;
+        ThingPowerLogEntries page = m_logger->thingPowerLogs(EnergyLogs::SampleRate1Min, queriedThingIds, from, to, options, &nextCursor);
+        QVERIFY(page.count() <= limit);
+        QVERIFY2(!page.isEmpty() || nextCursor.isEmpty(), "An empty page must not have a next cursor");
+        paged.append(page);
+        options.cursor = nextCursor;
+        QVERIFY2(++pages <= written + 1, "Paging doesn't terminate");
+    } while (!options.cursor.isEmpty());
+
+    QSet<QPair<qint64, QString>> seen;
+    foreach (const ThingPowerLogEntry &entry, paged) {
+        QPair<qint64, QString> key(entry.timestamp().toMSecsSinceEpoch(), entry.thingId().toString());
+        QVERIFY2(!seen.contains(key), qPrintable(QString("Duplicate entry for %1 at %2").arg(key.second).arg(entry.timestamp().toString())));
+        seen.insert(key);
+    }
+    QCOMPARE(paged.count(), unpaged.count());
+    for (int i = 0; i < unpaged.count(); i++) {
+        QCOMPARE(paged.at(i).timestamp(), unpaged.at(i).timestamp());
+        QCOMPARE(paged.at(i).thingId(), unpaged.at(i).thingId());
+        QCOMPARE(paged.at(i).currentPower(), unpaged.at(i).currentPower());
+    }
+}
+
+void EnergyLoggerTest::topConsumers_data()
+{
+    QTest::addColumn<int>("fromMinute");
+    QTest::addColumn<int>("toMinute");
+    QTest::addColumn<int>("count");
+
+    QTest::newRow("aligned") << 15 << 90 << 3;
+    QTest::newRow("unaligned") << 7 << 101 << 3;
+    QTest::newRow("from before the first sample") << -60 << 45 << 10;
+    QTest::newRow("to after the last sample") << 30 << 400 << 2;
+    QTest::newRow("empty period") << 50 << 50 << 10;
+}
+
+void EnergyLoggerTest::topConsumers()
+{
+    QFETCH(int, fromMinute);
+    QFETCH(int, toMinute);
+    QFETCH(int, count);
+
+    createLogger();
+
+    // Minute samples and 15 minute tier samples, so the totals at the bounds come from different sample rates.
+    // The last thing has never been sampled and two things consume at the same rate.
+    QList<ThingId> thingIds;
+    for (int i = 0; i < 6; i++) {
+        thingIds.append(ThingId::createThingId());
+    }
+    QDateTime start = EnergyLogger::nextSampleTimestamp(EnergyLogs::SampleRate15Mins, m_clock->now().addDays(-1));
+    EnergyLogger::WriteContext context;
+    context.db = m_logger->m_db;
+    context.db.transaction();
+    for (int i = 0; i < thingIds.count(); i++) {
+        QSqlQuery query(context.db);
+        query.prepare("INSERT INTO thingCache (thingId, totalEnergyConsumed, totalEnergyProduced) VALUES (?, 0, 0);");
+        query.addBindValue(thingIds.at(i));
+        QVERIFY2(query.exec(), qPrintable(query.lastError().text()));
+        if (i == thingIds.count() - 1) {
+            continue;
+        }
+        double rate = qMin(i, 3) + 1;
+        for (int minute = 0; minute <= 120; minute++) {
+            QVERIFY(m_logger->insertThingPower(&context, start.addSecs(minute * 60), EnergyLogs::SampleRate1Min, thingIds.at(i), 0, minute * rate, minute * rate / 10));
+            if (minute % 15 == 0) {
+                QVERIFY(m_logger->insertThingPower(&context, start.addSecs(minute * 60), EnergyLogs::SampleRate15Mins, thingIds.at(i), 0, minute * rate, minute * rate / 10));
+            }
+        }
+        context.result = EnergyLogger::WriteResult();
+    }
+    context.db.commit();
+
+    QDateTime from = start.addSecs(fromMinute * 60);
+    QDateTime to = start.addSecs(toMinute * 60);
+    ThingEnergyDeltas expected = m_logger->energyBetween(QList<ThingId>(), from, to);
+    QCOMPARE(expected.count(), thingIds.count());
+    std::sort(expected.begin(), expected.end(), [](const ThingEnergyDelta &a, const ThingEnergyDelta &b){
+        if (a.totalConsumption() != b.totalConsumption()) {
+            return a.totalConsumption() > b.totalConsumption();
+        }
+        return a.thingId().toString() < b.thingId().toString();
+    });
+    expected = expected.mid(0, count);
+
+    ThingEnergyDeltas ranked = m_logger->topConsumers(from, to, count);
+    QCOMPARE(ranked.count(), expected.count());
+    for (int i = 0; i < expected.count(); i++) {
+        QCOMPARE(ranked.at(i).thingId(), expected.at(i).thingId());
+        QCOMPARE(ranked.at(i).totalConsumption(), expected.at(i).totalConsumption());
+        QCOMPARE(ranked.at(i).totalProduction(), expected.at(i).totalProduction());
+    }
+}
+
+void EnergyLoggerTest::createLogger()
+{
+    // Time stands still, so no sampling interferes with the test
+    m_clock = new VirtualEnergyClock(QDateTime::currentDateTime());
+    m_logger = new EnergyLogger(m_clock, this);
+    // Wait for the startup maintenance, the writer thread runs it before anything else
+    QTRY_VERIFY_WITH_TIMEOUT(!m_logger->m_dbMaintenanceRunning, 60000);
+}
+
+QTEST_MAIN(EnergyLoggerTest)
+#include "energyloggertest.moc"
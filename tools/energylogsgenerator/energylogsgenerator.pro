@@ -0,0 +1,29 @@
+TEMPLATE = app
+TARGET = energylogsgenerator
+
+include(../../config.pri)
+
+CONFIG += console link_pkgconfig
+CONFIG -= app_bundle
+PKGCONFIG += nymea
+
+QT -= gui
+QT += network sql
+
+INCLUDEPATH += $$top_srcdir/libnymea-energy $$top_srcdir/plugin
+LIBS += -L$$top_builddir/libnymea-energy -lnymea-energy
+QMAKE_RPATHDIR += $$top_builddir/libnymea-energy
+
+# Uses the schema and tier layout of the logger
+HEADERS += $$top_srcdir/plugin/energyclock.h \
+    $$top_srcdir/plugin/energylogger.h \
+    $$top_srcdir/plugin/energylogstream.h \
+    $$top_srcdir/plugin/energyprofiler.h \
+    $$top_srcdir/plugin/energystatistics.h
+
+SOURCES += main.cpp \
+    $$top_srcdir/plugin/energyclock.cpp \
+    $$top_srcdir/plugin/energylogger.cpp \
+    $$top_srcdir/plugin/energylogstream.cpp \
+    $$top_srcdir/plugin/energyprofiler.cpp \
+    $$top_srcdir/plugin/energystatistics.cpp
@@ -0,0 +1,413 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-experience-plugin-energy.
+*
+* nymea-experience-plugin-energy is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-experience-plugin-energy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-experience-plugin-energy. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "energylogger.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <QTemporaryDir>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QFile>
+#include <QtMath>
+
+#include <QLoggingCategory>
+Q_LOGGING_CATEGORY(dcEnergyExperience, "EnergyExperience")
+
+// Generates a synthetic energy log DB with the same schema and tier layout the logger uses, e.g. to reproduce
+// performance issues of installations which have been logging for years.
+//
+// Each series (the power balance values and each thing) follows a curve made of a base load, a daily cycle, solar
+// production and a few seeded sines as noise. The energy is the closed form integral of that curve, so the samples
+// of all tiers and the totals are consistent with each other and the totals grow monotonically. During gaps the
+// power is 0 and the totals stand still, like the maintenance fills in gaps after a downtime.
+
+namespace {
+
+const qint64 msecsPerDay = 24 * 60 * 60 * 1000;
+const double msecsPerHour = 60 * 60 * 1000;
+
+struct Gap {
+    qint64 start;
+    qint64 end;
+};
+
+class Curve
+{
+public:
+    Curve() = default;
+    Curve(double basePower, double dailyAmplitude, double solarAmplitude, double noise, QRandomGenerator *random):
+        m_basePower(basePower),
+        m_dailyAmplitude(dailyAmplitude),
+        m_solarAmplitude(solarAmplitude)
+    {
+        // Periods from 5 minutes to 3 hours, the amplitudes add up to the noise share of the base load
+        for (int i = 0; i < 3; i++) {
+            Sine sine;
+            sine.amplitude = basePower * noise / 3;
+            sine.omega = 2 * M_PI / (random->bounded(5 * 60 * 1000, 3 * 60 * 60 * 1000));
+            sine.phase = random->bounded(2 * M_PI);
+            m_noise.append(sine);
+        }
+    }
+
+    // Energy in kWh from the epoch to the given time
+    double energy(qint64 msecs) const {
+        double t = msecs;
+        const double dailyOmega = 2 * M_PI / msecsPerDay;
+        // The daily cycle peaks in the evening
+        double wattMsecs = m_basePower * t - m_dailyAmplitude / dailyOmega * (qCos(dailyOmega * t - M_PI) - qCos(-M_PI));
+        wattMsecs += m_solarAmplitude / dailyOmega * solarIntegral(dailyOmega * t);
+        foreach (const Sine &sine, m_noise) {
+            wattMsecs -= sine.amplitude / sine.omega * (qCos(sine.omega * t + sine.phase) - qCos(sine.phase));
+        }
+        return wattMsecs / msecsPerHour / 1000;
+    }
+
+private:
+    struct Sine {
+        double amplitude = 0;
+        double omega = 0;
+        double phase = 0;
+    };
+
+    // Integral of max(0, sin(x - pi/2)), i.e. sun from 6:00 to 18:00 UTC
+    static double solarIntegral(double x) {
+        double shifted = x - M_PI / 2;
+        double periods = qFloor(shifted / (2 * M_PI));
+        double rest = shifted - periods * 2 * M_PI;
+        return periods * 2 + (rest < M_PI ? 1 - qCos(rest) : 2);
+    }
+
+    double m_basePower = 0;
+    double m_dailyAmplitude = 0;
+    double m_solarAmplitude = 0;
+    QList<Sine> m_noise;
+};
+
+// A series as logged: the energy counted outside of gaps gives the power, the totals stand still within gaps
+class Series
+{
+public:
+    Series() = default;
+    Series(const Curve &curve, const QList<Gap> &gaps): m_curve(curve), m_gaps(gaps) {}
+
+    double total(qint64 msecs) const {
+        foreach (const Gap &gap, m_gaps) {
+            if (msecs > gap.start && msecs < gap.end) {
+                return m_curve.energy(gap.start);
+            }
+        }
+        return m_curve.energy(msecs);
+    }
+
+    // Average power in W between from and to
+    double power(qint64 from, qint64 to) const {
+        return (loggedEnergy(to) - loggedEnergy(from)) * msecsPerHour * 1000 / (to - from);
+    }
+
+private:
+    double loggedEnergy(qint64 msecs) const {
+        double energy = m_curve.energy(msecs);
+        foreach (const Gap &gap, m_gaps) {
+            if (gap.start < msecs) {
+                energy -= m_curve.energy(qMin(msecs, gap.end)) - m_curve.energy(gap.start);
+            }
+        }
+        return energy;
+    }
+
+    Curve m_curve;
+    QList<Gap> m_gaps;
+};
+
+class Generator
+{
+public:
+    Generator(QSqlDatabase &db): m_db(db) {}
+
+    bool generate(const QMap<EnergyLogs::SampleRate, EnergyLogger::SampleConfig> &configs, int maxMinuteSamples, int thingCount,
+                  const QDateTime &from, const QDateTime &to, int gapCount, int maxGapHours, double noise, quint32 seed)
+    {
+        QRandomGenerator random(seed);
+
+        QList<Gap> gaps;
+        for (int i = 0; i < gapCount; i++) {
+            Gap gap;
+            gap.start = from.toMSecsSinceEpoch() + static_cast<qint64>(random.bounded(1.0) * from.msecsTo(to));
+            // QRandomGenerator::bounded() has no qint64 overload in Qt 5, the length is drawn in whole seconds
+            qint64 maxGapSecs = static_cast<qint64>(maxGapHours) * 60 * 60;
+            gap.end = gap.start + static_cast<qint64>(random.bounded(1.0) * maxGapSecs) * 1000;
+            gaps.append(gap);
+        }
+
+        m_consumption = Series(Curve(600, 300, 0, noise, &random), gaps);
+        m_production = Series(Curve(0, 0, 4000, noise, &random), gaps);
+        for (int i = 0; i < thingCount; i++) {
+            ThingId thingId = ThingId::createThingId();
+            m_thingIds.append(thingId);
+            // Every tenth thing is an inverter, the others consumers of different size
+            if (i % 10 == 9) {
+                m_thingsPower.insert(thingId, Series(Curve(0, 0, 500 + random.bounded(5000), noise, &random), gaps));
+                m_producers.insert(thingId);
+            } else {
+                double base = 5 + random.bounded(400);
+                m_thingsPower.insert(thingId, Series(Curve(base, base * random.bounded(1.0), 0, noise, &random), gaps));
+            }
+        }
+
+        m_powerBalanceQuery = QSqlQuery(m_db);
+        m_powerBalanceQuery.prepare("INSERT INTO powerBalance (timestamp, sampleRate, consumption, production, acquisition, storage, "
+                                    "totalConsumption, totalProduction, totalAcquisition, totalReturn, "
+                                    "consumptionMin, consumptionMax, consumptionPeak15, productionMin, productionMax, productionPeak15, "
+                                    "acquisitionMin, acquisitionMax, acquisitionPeak15, storageMin, storageMax, storagePeak15, "
+                                    "sampleCount, revision) "
+                                    "VALUES (?, ?, ?, ?, ?, 0, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);");
+        m_thingPowerQuery = QSqlQuery(m_db);
+        m_thingPowerQuery.prepare("INSERT INTO thingPower (timestamp, sampleRate, thingId, currentPower, totalConsumption, totalProduction, "
+                                  "currentPowerMin, currentPowerMax, currentPowerPeak15, sampleCount, revision) "
+                                  "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);");
+
+        QMap<EnergyLogs::SampleRate, uint> retention;
+        retention.insert(EnergyLogs::SampleRate1Min, maxMinuteSamples);
+        for (auto it = configs.constBegin(); it != configs.constEnd(); ++it) {
+            retention.insert(it.key(), it.value().maxSamples);
+        }
+
+        m_db.transaction();
+        for (auto it = retention.constBegin(); it != retention.constEnd(); ++it) {
+            EnergyLogs::SampleRate sampleRate = it.key();
+            QDateTime start = qMax(from, EnergyLogger::calculateSampleStart(to, sampleRate, it.value()));
+            for (QDateTime timestamp = EnergyLogger::nextSampleTimestamp(sampleRate, start); timestamp <= to; timestamp = EnergyLogger::nextSampleTimestamp(sampleRate, timestamp)) {
+                if (!insertSample(sampleRate, EnergyLogger::previousSampleTimestamp(sampleRate, timestamp), timestamp)) {
+                    m_db.rollback();
+                    return false;
+                }
+            }
+            qInfo() << "Generated" << sampleRate << "samples. Rows so far:" << m_powerBalanceRevision + m_thingPowerRevision;
+        }
+
+        // The energy manager continues the thing totals from the cache
+        QSqlQuery cacheQuery(m_db);
+        cacheQuery.prepare("INSERT INTO thingCache (thingId, totalEnergyConsumed, totalEnergyProduced) VALUES (?, ?, ?);");
+        foreach (const ThingId &thingId, m_thingIds) {
+            double total = m_thingsPower.value(thingId).total(to.toMSecsSinceEpoch());
+            cacheQuery.addBindValue(thingId);
+            cacheQuery.addBindValue(m_producers.contains(thingId) ? 0 : total);
+            cacheQuery.addBindValue(m_producers.contains(thingId) ? total : 0);
+            if (!cacheQuery.exec()) {
+                qWarning() << "Error writing thing cache:" << cacheQuery.lastError().text();
+                m_db.rollback();
+                return false;
+            }
+        }
+
+        // Tell the logger which tier layout the DB has been sampled with
+        QSqlQuery configQuery(m_db);
+        configQuery.prepare("INSERT INTO sampleConfigs (sampleRate, baseSampleRate, maxSamples) VALUES (?, ?, ?);");
+        for (auto it = retention.constBegin(); it != retention.constEnd(); ++it) {
+            configQuery.addBindValue(it.key());
+            configQuery.addBindValue(it.key() == EnergyLogs::SampleRate1Min ? EnergyLogs::SampleRateAny : configs.value(it.key()).baseSampleRate);
+            configQuery.addBindValue(it.value());
+            if (!configQuery.exec()) {
+                qWarning() << "Error writing tier layout:" << configQuery.lastError().text();
+                m_db.rollback();
+                return false;
+            }
+        }
+        return m_db.commit();
+    }
+
+    qint64 rowCount() const {
+        return m_powerBalanceRevision + m_thingPowerRevision;
+    }
+
+private:
+    bool insertSample(EnergyLogs::SampleRate sampleRate, const QDateTime &sampleStart, const QDateTime &sampleEnd)
+    {
+        qint64 from = sampleStart.toMSecsSinceEpoch();
+        qint64 to = sampleEnd.toMSecsSinceEpoch();
+        // Tier samples carry stats, which are flat in this data set
+        QVariant sampleCount = sampleRate == EnergyLogs::SampleRate1Min ? QVariant() : QVariant((to - from) / 60000);
+
+        double consumption = m_consumption.power(from, to);
+        double production = -m_production.power(from, to);
+        double acquisition = consumption + production;
+        double totalConsumption = m_consumption.total(to);
+        double totalProduction = m_production.total(to);
+
+        m_powerBalanceQuery.addBindValue(to);
+        m_powerBalanceQuery.addBindValue(sampleRate);
+        m_powerBalanceQuery.addBindValue(consumption);
+        m_powerBalanceQuery.addBindValue(production);
+        m_powerBalanceQuery.addBindValue(acquisition);
+        m_powerBalanceQuery.addBindValue(totalConsumption);
+        m_powerBalanceQuery.addBindValue(totalProduction);
+        // Roughly the self consumption of a PV installation
+        m_powerBalanceQuery.addBindValue(totalConsumption * 0.6);
+        m_powerBalanceQuery.addBindValue(totalProduction * 0.5);
+        foreach (double value, QList<double>({consumption, production, acquisition, 0})) {
+            for (int i = 0; i < 3; i++) {
+                m_powerBalanceQuery.addBindValue(sampleCount.isNull() ? QVariant() : QVariant(value));
+            }
+        }
+        m_powerBalanceQuery.addBindValue(sampleCount);
+        m_powerBalanceQuery.addBindValue(++m_powerBalanceRevision);
+        if (!m_powerBalanceQuery.exec()) {
+            qWarning() << "Error inserting power balance sample:" << m_powerBalanceQuery.lastError().text();
+            return false;
+        }
+
+        foreach (const ThingId &thingId, m_thingIds) {
+            const Series &series = m_thingsPower[thingId];
+            bool producer = m_producers.contains(thingId);
+            double currentPower = series.power(from, to) * (producer ? -1 : 1);
+            double total = series.total(to);
+            m_thingPowerQuery.addBindValue(to);
+            m_thingPowerQuery.addBindValue(sampleRate);
+            m_thingPowerQuery.addBindValue(thingId);
+            m_thingPowerQuery.addBindValue(currentPower);
+            m_thingPowerQuery.addBindValue(producer ? 0 : total);
+            m_thingPowerQuery.addBindValue(producer ? total : 0);
+            for (int i = 0; i < 3; i++) {
+                m_thingPowerQuery.addBindValue(sampleCount.isNull() ? QVariant() : QVariant(currentPower));
+            }
+            m_thingPowerQuery.addBindValue(sampleCount);
+            m_thingPowerQuery.addBindValue(++m_thingPowerRevision);
+            if (!m_thingPowerQuery.exec()) {
+                qWarning() << "Error inserting thing power sample:" << m_thingPowerQuery.lastError().text();
+                return false;
+            }
+        }
+
+        // Keep the transactions at a reasonable size
+        if (rowCount() - m_committedRows > 100000) {
+            m_db.commit();
+            m_db.transaction();
+            m_committedRows = rowCount();
+        }
+        return true;
+    }
+
+    QSqlDatabase &m_db;
+    QSqlQuery m_powerBalanceQuery;
+    QSqlQuery m_thingPowerQuery;
+    Series m_consumption;
+    Series m_production;
+    QList<ThingId> m_thingIds;
+    QHash<ThingId, Series> m_thingsPower;
+    QSet<ThingId> m_producers;
+    qint64 m_powerBalanceRevision = 0;
+    qint64 m_thingPowerRevision = 0;
+    qint64 m_committedRows = 0;
+};
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication application(argc, argv);
+    application.setApplicationName("energylogsgenerator");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Generates a synthetic nymea energy log database with all tiers, for testing and reproducing performance issues.");
+    parser.addHelpOption();
+    parser.addOption({{"o", "output"}, "The database file to write.", "file", "energylogs.sqlite"});
+    parser.addOption({{"f", "force"}, "Overwrite an existing database file."});
+    parser.addOption({{"t", "things"}, "The number of things to log.", "count", "10"});
+    parser.addOption({{"d", "days"}, "The number of days of history. Each tier is limited to its retention.", "days", "365"});
+    parser.addOption({{"c", "config"}, "An energy.conf to take the tier layout from. Defaults to the built-in layout.", "file"});
+    parser.addOption({"gaps", "The number of outages within the history.", "count", "0"});
+    parser.addOption({"gap-hours", "The maximum length of an outage.", "hours", "24"});
+    parser.addOption({"noise", "The noise share of the power values.", "fraction", "0.1"});
+    parser.addOption({"seed", "The seed for the random values, the same seed gives the same curves.", "seed", "1"});
+    parser.process(application);
+
+    bool ok = false;
+    int maxGapHours = parser.value("gap-hours").toInt(&ok);
+    if (!ok || maxGapHours <= 0) {
+        qCritical() << "Invalid --gap-hours" << parser.value("gap-hours") << "Expected a positive number of hours.";
+        return 1;
+    }
+
+    QString fileName = parser.value("output");
+    if (QFile::exists(fileName)) {
+        if (!parser.isSet("force")) {
+            qCritical() << "The file" << fileName << "exists already. Use --force to overwrite it.";
+            return 1;
+        }
+        foreach (const QString &suffix, QStringList({"", "-wal", "-shm"})) {
+            QFile::remove(fileName + suffix);
+        }
+    }
+
+    int maxMinuteSamples = 0;
+    QMap<EnergyLogs::SampleRate, EnergyLogger::SampleConfig> configs;
+    QMap<EnergyLogs::SampleRate, int> liveConfigs;
+    QTemporaryDir emptyConfigDir;
+    QSettings settings(parser.isSet("config") ? parser.value("config") : emptyConfigDir.filePath("energy.conf"), QSettings::IniFormat);
+    EnergyLogger::loadSampleConfigs(settings, &maxMinuteSamples, &configs, &liveConfigs);
+
+    QElapsedTimer timer;
+    timer.start();
+    bool success = false;
+    qint64 rowCount = 0;
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), "energylogsgenerator");
+        db.setDatabaseName(fileName);
+        if (!db.open()) {
+            qCritical() << "Cannot open" << fileName << db.lastError().text();
+            return 1;
+        }
+        if (!EnergyLogger::initSchema(db)) {
+            qCritical() << "Cannot create the energy log schema in" << fileName;
+            return 1;
+        }
+
+        // Nothing to lose if this crashes, the logger enables WAL when opening the DB
+        QSqlQuery pragmaQuery(db);
+        pragmaQuery.exec(QStringLiteral("PRAGMA journal_mode=MEMORY;"));
+        pragmaQuery.exec(QStringLiteral("PRAGMA synchronous=OFF;"));
+
+        QDateTime to = QDateTime::currentDateTime();
+        QDateTime from = to.addDays(-parser.value("days").toInt());
+        Generator generator(db);
+        success = generator.generate(configs, maxMinuteSamples, parser.value("things").toInt(), from, to,
+                                     parser.value("gaps").toInt(), maxGapHours,
+                                     parser.value("noise").toDouble(), parser.value("seed").toUInt());
+        rowCount = generator.rowCount();
+        db.close();
+    }
+    QSqlDatabase::removeDatabase("energylogsgenerator");
+
+    if (!success) {
+        qCritical() << "Generating the energy logs failed.";
+        return 1;
+    }
+    qInfo() << "Generated" << rowCount << "rows in" << fileName << "in" << timer.elapsed() << "ms";
+    return 0;
+}
@@ -0,0 +1,34 @@
+TEMPLATE = app
+TARGET = energytracereplay
+
+include(../../config.pri)
+
+CONFIG += console link_pkgconfig
+CONFIG -= app_bundle
+PKGCONFIG += nymea
+
+QT -= gui
+QT += network sql
+
+INCLUDEPATH += $$top_srcdir/libnymea-energy $$top_srcdir/plugin
+LIBS += -L$$top_builddir/libnymea-energy -lnymea-energy
+QMAKE_RPATHDIR += $$top_builddir/libnymea-energy
+
+# Replays through the energy balance into the logger, built in
+HEADERS += $$top_srcdir/plugin/energybalance.h \
+    $$top_srcdir/plugin/energyclock.h \
+    $$top_srcdir/plugin/energylogger.h \
+    $$top_srcdir/plugin/energylogstream.h \
+    $$top_srcdir/plugin/energyprofiler.h \
+    $$top_srcdir/plugin/energystatistics.h \
+    $$top_srcdir/plugin/energytrace.h \
+    $$top_srcdir/plugin/energywritequeue.h
+
+SOURCES += main.cpp \
+    $$top_srcdir/plugin/energybalance.cpp \
+    $$top_srcdir/plugin/energyclock.cpp \
+    $$top_srcdir/plugin/energylogger.cpp \
+    $$top_srcdir/plugin/energylogstream.cpp \
+    $$top_srcdir/plugin/energyprofiler.cpp \
+    $$top_srcdir/plugin/energystatistics.cpp \
+    $$top_srcdir/plugin/energytrace.cpp
@@ -0,0 +1,298 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+*
+* Copyright (C) 2013 - 2024, nymea GmbH
+* Copyright (C) 2024 - 2025, chargebyte austria GmbH
+*
+* This file is part of nymea-experience-plugin-energy.
+*
+* nymea-experience-plugin-energy is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* nymea-experience-plugin-energy is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with nymea-experience-plugin-energy. If not, see <https://www.gnu.org/licenses/>.
+*
+* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "energybalance.h"
+#include "energylogger.h"
+#include "energyclock.h"
+#include "energytrace.h"
+
+#include <nymeasettings.h>
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QDir>
+
+#include <QLoggingCategory>
+Q_LOGGING_CATEGORY(dcEnergyExperience, "EnergyExperience")
+
+// Replays an energy trace, as recorded with NYMEA_ENERGY_TRACE_FILE, into an energy logger running along a virtual
+// clock. The logger samples, rolls over tiers and trims as it would have on the site, but as fast as the machine
+// allows, so the cost of the site's load can be profiled (e.g. with perf or callgrind) on a developer machine.
+//
+// The recorded state changes are run through the same EnergyBalance arithmetic the energy manager uses, which
+// then drives the logger. The logger calls recorded on the site are only counted for comparison.
+
+namespace {
+
+QString formatDuration(qint64 nsecs)
+{
+    return QString("%1 ms").arg(nsecs / 1000000.0, 0, 'f', 1);
+}
+
+// The things of the site as far as the energy manager is concerned, see EnergyManagerImpl
+class ReplayManager
+{
+public:
+    explicit ReplayManager(EnergyLogger *logger): m_logger(logger) {
+        PowerBalanceLogEntry latestEntry = m_logger->latestLogEntry(EnergyLogs::SampleRateAny);
+        m_balance.setTotals(latestEntry.totalConsumption(), latestEntry.totalProduction(), latestEntry.totalAcquisition(), latestEntry.totalReturn());
+    }
+
+    void addThing(const ThingId &thingId, const QString &name, const QStringList &interfaces) {
+        TracedThing thing;
+        thing.values.thingId = thingId;
+        thing.values.name = name;
+        thing.interfaces = interfaces;
+        m_things.insert(thingId, thing);
+        m_thingIds.append(thingId);
+        if (m_rootMeterId.isNull() && interfaces.contains("energymeter")) {
+            m_rootMeterId = thingId;
+        }
+        if (isLogged(thing)) {
+            ThingPowerLogEntry entry = m_logger->latestLogEntry(EnergyLogs::SampleRateAny, {thingId});
+            ThingPowerLogEntry stateEntry = m_logger->cachedThingEntry(thingId);
+            m_balance.addThing(thingId, stateEntry.totalConsumption(), stateEntry.totalProduction(), entry.totalConsumption(), entry.totalProduction());
+        }
+    }
+
+    void removeThing(const ThingId &thingId) {
+        m_things.remove(thingId);
+        m_thingIds.removeAll(thingId);
+        m_balance.removeThing(thingId);
+        if (m_rootMeterId == thingId) {
+            m_rootMeterId = ThingId();
+        }
+        m_logger->removeThingLogs(thingId);
+    }
+
+    void setRootMeter(const ThingId &thingId) {
+        if (m_things.contains(thingId)) {
+            m_rootMeterId = thingId;
+        }
+    }
+
+    void changeState(const ThingId &thingId, EnergyTrace::State state, double value) {
+        if (!m_things.contains(thingId)) {
+            return;
+        }
+        TracedThing &thing = m_things[thingId];
+        switch (state) {
+        case EnergyTrace::StateCurrentPower:
+            thing.values.currentPower = value;
+            break;
+        case EnergyTrace::StateTotalEnergyConsumed:
+            thing.values.totalEnergyConsumed = value;
+            break;
+        case EnergyTrace::StateTotalEnergyProduced:
+            thing.values.totalEnergyProduced = value;
+            break;
+        }
+
+        // Like the energy manager, the balance is updated once per event loop pass, see flush()
+        if (state == EnergyTrace::StateCurrentPower && (thing.interfaces.contains("energymeter")
+                                                        || thing.interfaces.contains("smartmeterproducer")
+                                                        || thing.interfaces.contains("energystorage"))) {
+            m_powerBalancePending = true;
+        }
+        if (isLogged(thing)) {
+            QPair<double, double> totals = m_balance.updateThingTotals(thing.values);
+            m_logger->logThingPower(thingId, thing.values.currentPower, totals.first, totals.second);
+            m_logger->cacheThingEntry(thingId, thing.values.totalEnergyConsumed, thing.values.totalEnergyProduced);
+            m_thingPowerCalls++;
+        }
+    }
+
+    void flush() {
+        if (!m_powerBalancePending) {
+            return;
+        }
+        m_powerBalancePending = false;
+
+        QList<EnergyBalance::ThingValues> producers;
+        QList<EnergyBalance::ThingValues> storages;
+        foreach (const ThingId &thingId, m_thingIds) {
+            const TracedThing &thing = m_things[thingId];
+            if (thing.interfaces.contains("smartmeterproducer")) {
+                producers.append(thing.values);
+            }
+            if (thing.interfaces.contains("energystorage")) {
+                storages.append(thing.values);
+            }
+        }
+        const EnergyBalance::ThingValues *rootMeter = m_things.contains(m_rootMeterId) ? &m_things[m_rootMeterId].values : nullptr;
+        if (m_balance.updatePowerBalance(rootMeter, producers, storages)) {
+            EnergyBalance::PowerBalance balance = m_balance.powerBalance();
+            m_logger->logPowerBalance(balance.consumption, balance.production, balance.acquisition, balance.storage, balance.totalConsumption, balance.totalProduction, balance.totalAcquisition, balance.totalReturn);
+            m_powerBalanceCalls++;
+        }
+    }
+
+    qint64 powerBalanceCalls() const { return m_powerBalanceCalls; }
+    qint64 thingPowerCalls() const { return m_thingPowerCalls; }
+
+private:
+    struct TracedThing {
+        EnergyBalance::ThingValues values;
+        QStringList interfaces;
+    };
+
+    static bool isLogged(const TracedThing &thing) {
+        foreach (const QString &interface, QStringList({"energymeter", "smartmeterconsumer", "smartmeterproducer", "energystorage"})) {
+            if (thing.interfaces.contains(interface)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    EnergyLogger *m_logger = nullptr;
+    EnergyBalance m_balance;
+    QHash<ThingId, TracedThing> m_things;
+    // In the order they have been added, to sum up the balance in a stable order
+    QList<ThingId> m_thingIds;
+    ThingId m_rootMeterId;
+    bool m_powerBalancePending = false;
+    qint64 m_powerBalanceCalls = 0;
+    qint64 m_thingPowerCalls = 0;
+};
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication application(argc, argv);
+    application.setApplicationName("energytracereplay");
+    // Keep the DB away from a real installation
+    application.setOrganizationName("nymea-replay");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Replays a recorded energy trace into the energy logger at accelerated speed.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("trace", "The trace file, as recorded with NYMEA_ENERGY_TRACE_FILE.");
+    parser.addOption({"keep", "Continue on the DB of the previous replay instead of starting from an empty one."});
+    parser.addOption({{"v", "verbose"}, "Print the debug output of the logger."});
+    parser.process(application);
+
+    if (parser.positionalArguments().count() != 1) {
+        parser.showHelp(1);
+    }
+    if (!parser.isSet("verbose")) {
+        QLoggingCategory::setFilterRules("EnergyExperience.debug=false");
+    }
+
+    QDir storage(NymeaSettings::storagePath());
+    if (!parser.isSet("keep")) {
+        foreach (const QString &file, QStringList({"energylogs.sqlite", "energylogs.sqlite-wal", "energylogs.sqlite-shm"})) {
+            storage.remove(file);
+        }
+    }
+
+    EnergyTraceReader reader(parser.positionalArguments().first());
+    EnergyTrace::Record record;
+    if (!reader.open() || !reader.readRecord(&record)) {
+        qCritical() << "Cannot read the energy trace" << parser.positionalArguments().first();
+        return 1;
+    }
+
+    QDateTime start = QDateTime::fromMSecsSinceEpoch(record.timestamp);
+    VirtualEnergyClock clock(start);
+    EnergyLogger logger(&clock);
+    ReplayManager manager(&logger);
+
+    QHash<EnergyTrace::RecordType, qint64> recordCounts;
+    QHash<EnergyTrace::State, qint64> stateChangeCounts;
+    qint64 second = 0;
+    qint64 recordsInSecond = 0;
+    qint64 peakRecordsPerSecond = 0;
+    qint64 samplingNsecs = 0;
+    qint64 loggingNsecs = 0;
+    QElapsedTimer timer;
+    QElapsedTimer callTimer;
+    timer.start();
+
+    qint64 lastTimestamp = record.timestamp;
+    do {
+        // State changes recorded within the same millisecond are taken as one event loop pass
+        if (record.timestamp != lastTimestamp) {
+            callTimer.start();
+            manager.flush();
+            loggingNsecs += callTimer.nsecsElapsed();
+            lastTimestamp = record.timestamp;
+        }
+
+        callTimer.start();
+        clock.advanceTo(QDateTime::fromMSecsSinceEpoch(record.timestamp));
+        samplingNsecs += callTimer.nsecsElapsed();
+
+        recordCounts[record.type]++;
+        if (record.timestamp / 1000 != second) {
+            second = record.timestamp / 1000;
+            recordsInSecond = 0;
+        }
+        peakRecordsPerSecond = qMax(peakRecordsPerSecond, ++recordsInSecond);
+
+        callTimer.start();
+        switch (record.type) {
+        case EnergyTrace::RecordTypeThingAdded:
+            qInfo().nospace() << "Thing " << record.name << " (" << record.thingId.toString() << "): " << record.interfaces.join(", ");
+            manager.addThing(record.thingId, record.name, record.interfaces);
+            break;
+        case EnergyTrace::RecordTypeThingRemoved:
+            manager.removeThing(record.thingId);
+            break;
+        case EnergyTrace::RecordTypeRootMeterChanged:
+            manager.setRootMeter(record.thingId);
+            break;
+        case EnergyTrace::RecordTypeStateChanged:
+            stateChangeCounts[record.state]++;
+            manager.changeState(record.thingId, record.state, record.values.first());
+            break;
+        case EnergyTrace::RecordTypePowerBalance:
+        case EnergyTrace::RecordTypeThingPower:
+            // Recomputed from the state changes
+            break;
+        }
+        loggingNsecs += callTimer.nsecsElapsed();
+    } while (reader.readRecord(&record));
+    manager.flush();
+
+    qint64 traceMSecs = start.msecsTo(clock.now());
+    qint64 wallNsecs = timer.nsecsElapsed();
+    qInfo() << "Replayed" << traceMSecs / 1000 << "s of trace in" << qPrintable(formatDuration(wallNsecs))
+            << "(" << (wallNsecs > 0 ? traceMSecs * 1000000.0 / wallNsecs : 0) << "x real time)";
+    qInfo() << "Things:" << recordCounts.value(EnergyTrace::RecordTypeThingAdded) << "added," << recordCounts.value(EnergyTrace::RecordTypeThingRemoved) << "removed";
+    qInfo() << "State changes: currentPower" << stateChangeCounts.value(EnergyTrace::StateCurrentPower)
+            << "totalEnergyConsumed" << stateChangeCounts.value(EnergyTrace::StateTotalEnergyConsumed)
+            << "totalEnergyProduced" << stateChangeCounts.value(EnergyTrace::StateTotalEnergyProduced);
+    qInfo() << "Logger calls: power balance" << manager.powerBalanceCalls()
+            << "thing power" << manager.thingPowerCalls()
+            << "taking" << qPrintable(formatDuration(loggingNsecs));
+    qInfo() << "Recorded logger calls: power balance" << recordCounts.value(EnergyTrace::RecordTypePowerBalance)
+            << "thing power" << recordCounts.value(EnergyTrace::RecordTypeThingPower);
+    qInfo() << "Peak records per second:" << peakRecordsPerSecond;
+    qInfo() << "Sampling took" << qPrintable(formatDuration(samplingNsecs));
+    return 0;
+}